@@ -319,12 +319,115 @@ void mi_stats_print(void* out);
 /// Most detailed when using a debug build.
 void mi_stats_print_out(mi_output_fun* out, void* arg);
 
+/// Print suggested size classes for the recorded size histogram.
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// The histogram of requested sizes is only recorded when the
+/// \a mi_option_size_histogram option is enabled at startup, and
+/// only in builds with detailed statistics (`MI_STAT>1`, as in a debug build).
+/// The suggested table has the fewest size classes such that every recorded
+/// size wastes at most \a mi_option_size_class_waste percent of its block,
+/// and is printed in the form `MIMALLOC_SIZE_CLASSES=16,32,...` which can be
+/// used directly (or stored in a file) to set custom size classes at startup.
+/// This is done automatically at exit when \a mi_option_size_histogram is enabled.
+void mi_size_classes_print(mi_output_fun* out, void* arg);
+
+/// Print the heap profile of the sampled allocations.
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// Only available in builds with `MI_PROFILE=ON`. On average one allocation
+/// is sampled every \a mi_option_profile_interval bytes and its backtrace is recorded
+/// until it is freed. The profile lists the live (and total) sampled allocations per
+/// backtrace in the legacy `pprof` heap profile format (`heap_v2`), followed by
+/// the mapped libraries on Linux, such that it can be read directly by `pprof`.
+void mi_profile_dump(mi_output_fun* out, void* arg);
+
+/// Print the lifetimes and cross-thread frees of the sampled allocations.
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// Only available in builds with `MI_PROFILE=ON` and when \a mi_option_profile_lifetime
+/// is enabled. For each freed sample the lifetime is recorded in a histogram per size class
+/// (with power-of-4 buckets from 1us to 17s), and the free is counted in a matrix
+/// of allocating versus freeing threads (for up to 64 threads).
+/// This is done automatically at exit when \a mi_option_profile_lifetime is enabled.
+void mi_profile_lifetime_print(mi_output_fun* out, void* arg);
+
+/// Print the recent slow path events of all threads.
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// When \a mi_option_event_log is enabled, each thread records
+/// its slow path events (fresh and freed pages, segment allocation, abandonment and
+/// reclamation, segment cache hits and misses, and commits, decommits and resets) in a ring
+/// buffer of the last 256 events, with a cycle counter timestamp and the address
+/// and size involved. The rings of terminated threads are kept until they are reused.
+/// This does not allocate or take locks and can be called from a signal handler
+/// (if \a out can); it is also called when a heap corruption is detected.
+void mi_event_dump(mi_output_fun* out, void* arg);
+
 /// Reset statistics.
 void mi_stats_reset(void);
 
 /// Merge thread local statistics with the main statistics and reset.
 void mi_stats_merge(void);
 
+/// Get a snapshot of the statistics as plain numbers.
+/// @param snapshot The snapshot to fill in.
+/// @param version Pass \a MI_STATS_VERSION.
+/// @returns \a true if successful, and \a false if \a snapshot is \a NULL or the \a version is not supported.
+///
+/// The snapshot contains the main statistics together with those of the current thread
+/// (which are not reset). Like \a mi_stats_print, statistics of other threads are only included
+/// once they are merged (at thread exit or by calling \a mi_stats_merge on that thread).
+/// This does not allocate and can be called frequently, e.g. from a metrics scraper.
+/// The `malloc` and `normal_bins` statistics are only recorded when `detailed` is \a true
+/// (with `MI_STAT>1`, as in debug builds).
+bool mi_stats_get(mi_stats_snapshot_t* snapshot, size_t version);
+
+/// Print a statistics snapshot as JSON.
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// Prints the fields of \a mi_stats_get as a JSON object (and does not allocate).
+/// Only the \a normal_bins that were used are printed.
+void mi_stats_print_json(mi_output_fun* out, void* arg);
+
+/// Print a statistics snapshot in the OpenMetrics (Prometheus) text format.
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// Prints the statistics of \a mi_stats_get as metrics with stable names, prefixed with `mimalloc_`:
+/// gauges for current and peak values (like `mimalloc_committed_bytes` and `mimalloc_pages`),
+/// counters for monotonic counts (like `mimalloc_mmap_calls_total`), and per size class
+/// `mimalloc_bin_blocks{bin="..",block_size=".."}` with detailed statistics.
+/// The output ends with `# EOF` and can be served directly from a `/metrics` endpoint.
+/// This does not allocate and can be called from any thread.
+void mi_stats_print_openmetrics(mi_output_fun* out, void* arg);
+
+/// Print a fragmentation report of a heap.
+/// @param heap The heap (which must belong to the current thread).
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// For each size class this prints the number of pages, the bytes in use, the bytes in the
+/// `free`, `local_free`, and `xthread_free` lists, the reserved bytes that are not yet used,
+/// and a histogram of the pages by occupancy (`used/reserved` in steps of 10%).
+/// For each segment it prints the used, free and committed, and free and decommitted slices,
+/// together with a map of the slices. This takes time linear in the number of pages and
+/// free blocks and does not change the heap, so it can be used periodically in production.
+void mi_heap_fragmentation_report(mi_heap_t* heap, mi_output_fun* out, void* arg);
+
+/// Print a fragmentation report of all heaps of the current thread.
+/// @param out An output function or \a NULL for the default.
+/// @param arg Optional argument passed to \a out (if not \a NULL)
+///
+/// See \a mi_heap_fragmentation_report. Pages owned by other threads cannot be inspected
+/// safely while those threads run, so call this on each thread to cover the whole process.
+void mi_fragmentation_report(mi_output_fun* out, void* arg);
+
 /// Initialize mimalloc on a thread.
 /// Should not be used as on most systems (pthreads, windows) this is done
 /// automatically.
@@ -336,6 +439,9 @@ void mi_thread_init(void);
 /// be freed by other threads in the future) is properly handled.
 void mi_thread_done(void);
 
+/// Return the id of the current thread (as used by \a mi_heap_transfer).
+size_t mi_thread_id(void);
+
 /// Print out heap statistics for this thread.
 /// @param out An output function or \a NULL for the default.
 /// @param arg Optional argument passed to \a out (if not \a NULL)
@@ -368,6 +474,27 @@ typedef void (mi_deferred_free_fun)(bool force, unsigned long long heartbeat, vo
 /// At most one \a deferred_free function can be active.
 void   mi_register_deferred_free(mi_deferred_free_fun* deferred_free, void* arg);
 
+/// Free a block once no thread can reference it anymore (epoch based reclamation).
+/// @param p Pointer to a block that is no longer reachable from shared data (or \a NULL).
+///
+/// For lock-free data structures: readers access shared blocks inside
+/// \a mi_epoch_enter and \a mi_epoch_exit, and a block that is unlinked
+/// from the shared structure is passed to \a mi_free_deferred. The block is
+/// freed (as with \a mi_free) once all threads that were inside a critical
+/// section at that time have left it. Pending blocks are kept in per-thread
+/// bags and freed on the allocation heartbeat (see \a mi_register_deferred_free)
+/// or on \a mi_collect; when a thread exits, its pending blocks are freed
+/// later by other threads.
+void mi_free_deferred(void* p);
+
+/// Enter a critical section in which blocks passed to \a mi_free_deferred stay valid.
+/// Critical sections can be nested and should be short as a thread inside
+/// a critical section prevents all deferred frees after it entered.
+void mi_epoch_enter(void);
+
+/// Leave a critical section entered with \a mi_epoch_enter.
+void mi_epoch_exit(void);
+
 /// Type of output functions.
 /// @param msg Message to output.
 /// @param arg Argument that was passed at registration to hold extra state.
@@ -593,6 +720,44 @@ mi_heap_t* mi_heap_get_backing();
 /// Release outstanding resources in a specific heap.
 void mi_heap_collect(mi_heap_t* heap, bool force);
 
+/// Incrementally release outstanding resources in a specific heap.
+/// @param heap The heap to collect (owned by the current thread).
+/// @param max_pages The maximum number of pages to visit in this call (at least 1).
+/// @returns \a true if work remains (call again), or \a false if a full collection cycle completed.
+///
+/// Unlike \a mi_heap_collect, which visits all pages of a heap, this does a bounded
+/// amount of work per call and resumes from a cursor, so it can be called from an
+/// idle hook in latency sensitive event loops. Each call frees at most 32 blocks
+/// per page of budget that other threads freed into full pages, and then collects
+/// the thread free lists of at most \a max_pages pages, frees pages that became
+/// empty, and performs the expired delayed decommits of their segments. At the
+/// end of a cycle it frees expired retired pages and purges the segment cache.
+bool mi_heap_collect_step(mi_heap_t* heap, size_t max_pages);
+
+/// Hand the pages of a heap to a successor thread.
+/// @param heap A heap of the current thread (usually the backing heap of a thread that is about to exit).
+/// @param target_thread The id of the successor thread (see \a mi_thread_id), or 0 for any thread.
+/// @returns \a true if successful, or \a false if too many handoffs are pending.
+///
+/// All pages of \a heap are abandoned, and the segments that become abandoned
+/// (now, or later until the current thread exits) are not put on the global abandoned
+/// list but handed to \a target_thread. The target thread adopts all of them in one
+/// step into its backing heap, keeping the pages hot: either when it needs a fresh
+/// segment, or explicitly with \a mi_thread_adopt_abandoned_from. This is useful
+/// for thread pools that replace a worker thread with a new one. If the target thread
+/// exits, or does not adopt the segments within a second, they are put on the global
+/// abandoned list after all.
+bool mi_heap_transfer(mi_heap_t* heap, size_t target_thread);
+
+/// Adopt the pages handed off by another thread.
+/// @param thread_id The id of the thread that called \a mi_heap_transfer.
+/// @returns The number of adopted segments.
+///
+/// Adopts the segments that \a thread_id handed to the current thread (or to any thread)
+/// into the backing heap of the current thread. Usually called after the thread
+/// \a thread_id has exited (otherwise segments it abandons later are not adopted yet).
+size_t mi_thread_adopt_abandoned_from(size_t thread_id);
+
 /// Allocate in a specific heap.
 /// @see mi_malloc()
 void* mi_heap_malloc(mi_heap_t* heap, size_t size);
@@ -827,6 +992,12 @@ typedef enum mi_option_e {
   mi_option_allow_decommit,  ///< Enable decommitting memory (=on)
   mi_option_decommit_delay,  ///< Decommit page memory after N milli-seconds delay (25ms).
   mi_option_segment_decommit_delay, ///< Decommit large segment memory after N milli-seconds delay (500ms).
+  mi_option_size_histogram,  ///< Record a histogram of requested sizes and print suggested size classes at exit (needs `MI_STAT>1`).
+  mi_option_size_class_waste, ///< The target internal waste in percent for suggested size classes (10%).
+  mi_option_profile_interval, ///< The average bytes allocated between heap profile samples (512KiB, 0 to disable, needs `MI_PROFILE=ON`).
+  mi_option_profile_lifetime, ///< Record the lifetimes and freeing threads of the heap profile samples and print them at exit (needs `MI_PROFILE=ON`).
+  mi_option_event_log,       ///< Record slow path events in a per-thread ring buffer (disabled by default, see \a mi_event_dump).
+  mi_option_thread_data_cache, ///< Number of idle thread meta-data entries that stay resident (32 by default).
 
   _mi_option_last
 } mi_option_t;
@@ -874,6 +1045,7 @@ void* mi_reallocarray(void* p, size_t count, size_t size);
 /// Corresponds to [reallocarr](https://man.netbsd.org/reallocarr.3) in NetBSD.
 int   mi_reallocarr(void* p, size_t count, size_t size);
 
+/// Free a block of a known size (as with C++ sized delete).
 void mi_free_size(void* p, size_t size);
 void mi_free_size_aligned(void* p, size_t size, size_t alignment);
 void mi_free_aligned(void* p, size_t alignment);
@@ -975,6 +1147,25 @@ free lists, etc, as:
 > make
 ```
 This will name the shared library as `libmimalloc-secure.so`.
+
+On Linux (x64 and arm64) you can build with `-DMI_USDT=ON` to add USDT probes
+(provider `mimalloc`) on the allocator slow paths, like `malloc_generic`, `page_fresh`,
+`segment_alloc`, `segment_reclaim`, `segment_cache_pop`/`push`, `os_commit`, `os_reset`, and `thread_done`.
+These can be traced with `bpftrace` or `perf` (e.g. `bpftrace -l 'usdt:./libmimalloc.so:*'`)
+and are just a `nop` when not attached; see `include/mimalloc-usdt.h` for the arguments.
+
+With `-DMI_LATENCY=ON` the statistics also record the latency (in cycles) of the slow paths, like `malloc` and `free`
+when they miss the fast path, segment allocation and reclamation, deferred free callbacks, and OS calls, in log-bucketed
+histograms per thread. These are merged with the other statistics and printed as count, mean, p50, p99, p999 and max
+by `mi_stats_print_out` (or at exit with `MIMALLOC_SHOW_STATS=1`).
+
+On Unix you can build with `-DMI_TRACE=ON` to record allocation traces: run a program with
+`MIMALLOC_TRACE=<prefix>` (usually with the overriding library, e.g. `LD_PRELOAD=libmimalloc.so`) and every
+`malloc`, `free`, `realloc`, and aligned allocation is written, with its size and a timestamp, to a compact
+binary log per thread (`<prefix>.0`, `<prefix>.1`, ...). The trace can be replayed with the same number of
+threads with `mimalloc-replay <prefix>`, which reports the elapsed time, the RSS, and the mimalloc statistics.
+The format is described in `include/mimalloc-trace.h`.
+
 Use `ccmake`<sup>2</sup> instead of `cmake`
 to see and customize all the available build options.
 
@@ -1099,6 +1290,23 @@ or via environment variables.
    and allocate just a little to take up space in the huge OS page area (which cannot be reset).
 - `MIMALLOC_RESERVE_HUGE_OS_PAGES_AT=N`: where N is the numa node. This reserves the huge pages at a specific numa node. 
    (`N` is -1 by default to reserve huge pages evenly among the given number of numa nodes (or use the available ones as detected))
+- `MIMALLOC_SIZE_CLASSES=16,32,48,...`: use custom size classes instead of the default ones (with at most 52 classes; larger objects keep the default size classes).
+   The sizes (in bytes) must be ascending and are rounded up to a multiple of the word size (blocks are then only word aligned); the value can also be the name
+   of a file that contains the sizes. Use `MIMALLOC_SIZE_HISTOGRAM=1` with a debug build to record the requested
+   sizes of a program and print suggested size classes at exit (with at most `MIMALLOC_SIZE_CLASS_WASTE=N` percent
+   internal waste per size, 10% by default).
+- `MIMALLOC_PROFILE_INTERVAL=N`: sample on average every `N` allocated bytes (512KiB by default, 0 to disable) for the
+   heap profiler in builds with `-DMI_PROFILE=ON`. Use `mi_profile_dump` to print the live sampled allocations per
+   backtrace in the `pprof` heap profile format.
+- `MIMALLOC_PROFILE_LIFETIME=1`: also record the lifetime and the freeing thread of the sampled allocations (needs
+   `-DMI_PROFILE=ON`), and print a lifetime histogram per size class and a matrix of sampled frees per allocating and
+   freeing thread at exit (or use `mi_profile_lifetime_print`). This helps to find size classes where many blocks are
+   freed by another thread and which may benefit from a dedicated heap.
+- `MIMALLOC_EVENT_LOG=1`: record slow path events (like fresh pages, segment allocation, and commits)
+   in a per-thread ring buffer (disabled by default). Use `mi_event_dump` to print the last 256 events of each thread
+   with their cycle counter timestamps; the events are also printed when a heap corruption is detected.
+- `MIMALLOC_THREAD_DATA_CACHE=N`: keep the meta-data of at most N exited threads resident for reuse (32 by default).
+   The meta-data of further exited threads is reset (but still reused).
 
 Use caution when using `fork` in combination with either large or huge OS pages: on a fork, the OS uses copy-on-write
 for all pages in the original process including the huge OS pages. When any memory is now written in that area, the
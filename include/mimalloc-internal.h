@@ -9,6 +9,7 @@ terms of the MIT license. A copy of the license can be found in the file
 #define MIMALLOC_INTERNAL_H
 
 #include "mimalloc-types.h"
+#include "mimalloc-usdt.h"
 
 #if (MI_DEBUG>0)
 #define mi_trace_message(...)  _mi_trace_message(__VA_ARGS__)
@@ -56,6 +57,7 @@ void       _mi_verbose_message(const char* fmt, ...);
 void       _mi_trace_message(const char* fmt, ...);
 void       _mi_options_init(void);
 void       _mi_error_message(int err, const char* fmt, ...);
+bool       _mi_getenv(const char* name, char* result, size_t result_size);
 
 // random.c
 void       _mi_random_init(mi_random_ctx_t* ctx);
@@ -86,32 +88,46 @@ bool       _mi_os_reset(void* p, size_t size, mi_stats_t* stats);
 // bool       _mi_os_unreset(void* p, size_t size, bool* is_zero, mi_stats_t* stats);
 size_t     _mi_os_good_alloc_size(size_t size);
 bool       _mi_os_has_overcommit(void);
+bool       _mi_os_read_file(const char* fname, char* buf, size_t buf_size);
 
 // arena.c
-void*      _mi_arena_alloc_aligned(size_t size, size_t alignment, bool* commit, bool* large, bool* is_pinned, bool* is_zero, size_t* memid, mi_os_tld_t* tld);
-void*      _mi_arena_alloc(size_t size, bool* commit, bool* large, bool* is_pinned, bool* is_zero, size_t* memid, mi_os_tld_t* tld);
+void*      _mi_arena_alloc_aligned(size_t size, size_t alignment, bool* commit, bool* large, bool* is_pinned, bool* is_zero, mi_arena_id_t req_arena_id, size_t* memid, mi_os_tld_t* tld);
+void*      _mi_arena_alloc(size_t size, bool* commit, bool* large, bool* is_pinned, bool* is_zero, mi_arena_id_t req_arena_id, size_t* memid, mi_os_tld_t* tld);
 void       _mi_arena_free(void* p, size_t size, size_t memid, bool is_committed, mi_os_tld_t* tld);
+mi_arena_id_t _mi_arena_id_none(void);
+bool       _mi_arena_memid_is_suitable(size_t memid, mi_arena_id_t req_arena_id);
+void*      _mi_arena_area(mi_arena_id_t arena_id, size_t* size, size_t* field_count);
+size_t     _mi_arena_copy_inuse(mi_arena_id_t arena_id, size_t* fields, size_t field_count);
+bool       _mi_arena_restore_inuse(mi_arena_id_t arena_id, const size_t* fields, size_t field_count);
+size_t     _mi_arena_memid_of(mi_arena_id_t arena_id, const void* p);
 
 // "segment-cache.c"
 void*      _mi_segment_cache_pop(size_t size, mi_commit_mask_t* commit_mask, mi_commit_mask_t* decommit_mask, bool* large, bool* is_pinned, bool* is_zero, size_t* memid, mi_os_tld_t* tld);
 bool       _mi_segment_cache_push(void* start, size_t size, size_t memid, const mi_commit_mask_t* commit_mask, const mi_commit_mask_t* decommit_mask, bool is_large, bool is_pinned, mi_os_tld_t* tld);
 void       _mi_segment_cache_collect(bool force, mi_os_tld_t* tld);
-void       _mi_segment_map_allocated_at(const mi_segment_t* segment);
+void       _mi_segment_map_allocated_at(const mi_segment_t* segment, size_t segment_size);
 void       _mi_segment_map_freed_at(const mi_segment_t* segment);
 
 // "segment.c"
-mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_wsize, mi_segments_tld_t* tld, mi_os_tld_t* os_tld);
+mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t page_size, mi_segments_tld_t* tld, mi_os_tld_t* os_tld);
 void       _mi_segment_page_free(mi_page_t* page, bool force, mi_segments_tld_t* tld);
 void       _mi_segment_page_abandon(mi_page_t* page, mi_segments_tld_t* tld);
 bool       _mi_segment_try_reclaim_abandoned( mi_heap_t* heap, bool try_all, mi_segments_tld_t* tld);
 void       _mi_segment_thread_collect(mi_segments_tld_t* tld);
+void       _mi_segment_page_collect_decommit(mi_page_t* page, mi_segments_tld_t* tld);
 void       _mi_segment_huge_page_free(mi_segment_t* segment, mi_page_t* page, mi_block_t* block);
 
 uint8_t*   _mi_segment_page_start(const mi_segment_t* segment, const mi_page_t* page, size_t* page_size); // page start for any page
 void       _mi_abandoned_reclaim_all(mi_heap_t* heap, mi_segments_tld_t* tld);
 void       _mi_abandoned_await_readers(void);
 void       _mi_abandoned_collect(mi_heap_t* heap, bool force, mi_segments_tld_t* tld);
-
+bool       _mi_segment_handoff_open(mi_threadid_t to, mi_segments_tld_t* tld);
+void       _mi_segment_handoff_close(mi_segments_tld_t* tld);
+size_t     _mi_segment_handoff_adopt(mi_heap_t* heap, mi_threadid_t from, mi_segments_tld_t* tld);
+bool       _mi_segment_snapshot_adopt(mi_segment_t* segment, size_t memid, size_t max_size, mi_heap_t* heap, bool validate, mi_segments_tld_t* tld);
+typedef bool (mi_segment_span_visit_fun)(void* start, size_t size, void* arg);
+bool       _mi_segment_snapshot_visit_spans(mi_segment_t* segment, mi_segment_span_visit_fun* visit, void* arg);
+size_t     _mi_segment_fragmentation_print(const mi_segment_t* segment, mi_output_fun* out, void* arg);
 
 
 // "page.c"
@@ -122,6 +138,7 @@ void       _mi_page_unfull(mi_page_t* page);
 void       _mi_page_free(mi_page_t* page, mi_page_queue_t* pq, bool force);   // free the page
 void       _mi_page_abandon(mi_page_t* page, mi_page_queue_t* pq);            // abandon the page, to be picked up by another thread...
 void       _mi_heap_delayed_free(mi_heap_t* heap);
+bool       _mi_heap_delayed_free_partial(mi_heap_t* heap, size_t max_blocks);
 void       _mi_heap_collect_retired(mi_heap_t* heap, bool force);
 
 void       _mi_page_use_delayed_free(mi_page_t* page, mi_delayed_t delay, bool override_never);
@@ -133,6 +150,9 @@ void       _mi_page_reclaim(mi_heap_t* heap, mi_page_t* page);   // callback fro
 
 size_t     _mi_bin_size(uint8_t bin);           // for stats
 uint8_t    _mi_bin(size_t size);                // for stats
+void       _mi_size_classes_init(void);         // load custom size classes (on process init)
+void       _mi_heap_init_size_classes(mi_heap_t* heap);
+size_t     _mi_size_classes_max(void);          // maximal number of custom size classes
 
 // "heap.c"
 void       _mi_heap_destroy_pages(mi_heap_t* heap);
@@ -141,10 +161,40 @@ void       _mi_heap_set_default_direct(mi_heap_t* heap);
 
 // "stats.c"
 void       _mi_stats_done(mi_stats_t* stats);
+void       _mi_size_histogram_init(void);
+#if (MI_STAT>1)
+extern bool _mi_size_histogram_enabled;
+void       _mi_size_histogram_increase(size_t size);
+#endif
+
+// "profile.c"
+void       _mi_profile_sample(mi_heap_t* heap, mi_page_t* page, const void* block, size_t size);
+void       _mi_profile_free(mi_page_t* page, const void* block, bool local);
+void       _mi_profile_free_range(const void* start, size_t size);
+
+// "event.c"
+void       _mi_event_record(mi_event_kind_t kind, const void* addr, size_t size);
+void       _mi_event_thread_done(void);
+
+// "epoch.c"
+void       _mi_epoch_collect(bool force);
+void       _mi_epoch_thread_done(void);
+
+// "trace.c"
+extern bool _mi_trace_enabled;
+void       _mi_trace_init(void);
+void       _mi_trace_thread_done(void);
+void       _mi_trace_process_done(void);
+void       _mi_trace_malloc(const void* p, size_t size);
+void       _mi_trace_free(const void* p);
+void       _mi_trace_enter(void);
+void       _mi_trace_realloc(const void* p, const void* newp, size_t newsize);
+void       _mi_trace_aligned(const void* p, size_t size, size_t alignment);
 
 mi_msecs_t  _mi_clock_now(void);
 mi_msecs_t  _mi_clock_end(mi_msecs_t start);
 mi_msecs_t  _mi_clock_start(void);
+mi_usecs_t  _mi_clock_usecs(void);
 
 // "alloc.c"
 void*       _mi_page_malloc(mi_heap_t* heap, mi_page_t* page, size_t size) mi_attr_noexcept;  // called from `_mi_malloc_generic`
@@ -598,6 +648,14 @@ static inline void mi_page_set_has_aligned(mi_page_t* page, bool has_aligned) {
   page->flags.x.has_aligned = has_aligned;
 }
 
+static inline bool mi_page_has_sampled(const mi_page_t* page) {
+  return page->flags.x.has_sampled;
+}
+
+static inline void mi_page_set_has_sampled(mi_page_t* page, bool has_sampled) {
+  page->flags.x.has_sampled = has_sampled;
+}
+
 
 /* -------------------------------------------------------------------
 Encoding/Decoding the free list next pointers
@@ -891,6 +949,30 @@ static inline mi_threadid_t _mi_thread_id(void) mi_attr_noexcept {
 #endif
 
 
+// -------------------------------------------------------------------
+// A cheap cycle counter for timestamps and latencies
+// (falls back to micro-seconds on other platforms)
+// -------------------------------------------------------------------
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+static inline uint64_t _mi_cycles(void) {
+  #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc();
+  #elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+  #elif defined(__GNUC__) && defined(__aarch64__)
+  uint64_t t;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+  #else
+  return (uint64_t)_mi_clock_usecs();
+  #endif
+}
+
+
 // -----------------------------------------------------------------------
 // Count bits: trailing or leading zeros (with MI_INTPTR_BITS on all zero)
 // -----------------------------------------------------------------------
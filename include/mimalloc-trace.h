@@ -0,0 +1,46 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MIMALLOC_TRACE_H
+#define MIMALLOC_TRACE_H
+
+// --------------------------------------------------------------------------------------------
+// The binary format of allocation traces (see `src/trace.c` and `test/replay.c`).
+//
+// In a build with `MI_TRACE=ON`, setting `MIMALLOC_TRACE=<prefix>` records every
+// malloc, free, realloc, and aligned allocation. Each thread writes its own file
+// `<prefix>.<n>` (where `n` is 0 for the first thread that allocates, 1 for the next, etc.)
+// that consists of a header followed by entries in the order of the calls in that thread.
+// All fields are in native byte order.
+// --------------------------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#define MI_TRACE_MAGIC    "mitrace1"
+
+typedef enum mi_trace_op_e {
+  MI_TRACE_MALLOC  = 1,   // `ptr = malloc(size)` (including `calloc`, `strdup` etc.)
+  MI_TRACE_FREE    = 2,   // `free(ptr)` (with size 0)
+  MI_TRACE_REALLOC = 3,   // `ptr = realloc(arg,size)`
+  MI_TRACE_ALIGNED = 4    // `ptr = aligned_alloc(arg,size)`
+} mi_trace_op_t;
+
+typedef struct mi_trace_header_s {
+  char     magic[8];      // `MI_TRACE_MAGIC`
+  uint64_t thread;        // the `n` in the file name
+  uint64_t thread_id;     // the thread id of the recording thread
+  uint64_t reserved;
+} mi_trace_header_t;
+
+typedef struct mi_trace_entry_s {
+  uint64_t time;          // cycle counter (used to order the entries across threads)
+  uint64_t ptr;           // the allocated or freed pointer
+  uint64_t arg;           // the old pointer of a realloc, or the alignment of an aligned allocation
+  uint64_t size_op;       // `size << 8 | op`
+} mi_trace_entry_t;
+
+#endif
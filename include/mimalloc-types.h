@@ -129,6 +129,14 @@ typedef int32_t  mi_ssize_t;
 
 // Main tuning parameters for segment and page sizes
 // Sizes for 64-bit (usually divide by two for 32-bit)
+// The slice and segment shift can be set together at build time (see `MI_SEGMENT_PROFILE` in cmake),
+// for example 14/23 (16KiB slices in 8MiB segments) for a small footprint, or 18/30 (256KiB slices
+// in 1GiB segments) for large heaps.
+#if defined(MI_SEGMENT_SLICE_SHIFT) != defined(MI_SEGMENT_SHIFT)
+#error "mimalloc internal: MI_SEGMENT_SLICE_SHIFT and MI_SEGMENT_SHIFT must be defined together"
+#endif
+
+#ifndef MI_SEGMENT_SLICE_SHIFT
 #define MI_SEGMENT_SLICE_SHIFT            (13 + MI_INTPTR_SHIFT)         // 64KiB  (32KiB on 32-bit)
 
 #if MI_INTPTR_SIZE > 4
@@ -136,6 +144,17 @@ typedef int32_t  mi_ssize_t;
 #else
 #define MI_SEGMENT_SHIFT                  ( 7 + MI_SEGMENT_SLICE_SHIFT)  // 4MiB on 32-bit
 #endif
+#endif
+
+#if (MI_SEGMENT_SLICE_SHIFT < 14 && MI_INTPTR_SIZE > 4) || (MI_SEGMENT_SLICE_SHIFT > 18)
+#error "mimalloc internal: the slice size must be between 16KiB and 256KiB"
+#endif
+#if (MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT < 7) || (MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT > 12)
+#error "mimalloc internal: a segment must have between 128 and 4096 slices"
+#endif
+#if (MI_SEGMENT_SHIFT > 30) || (MI_SEGMENT_SHIFT > 24 && MI_INTPTR_SIZE <= 4)
+#error "mimalloc internal: the segment size must be at most 1GiB (and at most 16MiB on 32-bit)"
+#endif
 
 #define MI_SMALL_PAGE_SHIFT               (MI_SEGMENT_SLICE_SHIFT)       // 64KiB
 #define MI_MEDIUM_PAGE_SHIFT              ( 3 + MI_SMALL_PAGE_SHIFT)     // 512KiB
@@ -157,10 +176,19 @@ typedef int32_t  mi_ssize_t;
 #define MI_LARGE_OBJ_SIZE_MAX             (MI_SEGMENT_SIZE/2)      // 32MiB on 64-bit
 #define MI_LARGE_OBJ_WSIZE_MAX            (MI_LARGE_OBJ_SIZE_MAX/MI_INTPTR_SIZE)
 
+// Large objects up to MI_LARGE_BIN_OBJ_SIZE_MAX still have a size class and share a page
+// with a few other blocks; larger ones get a page of their own in the huge queue.
+#if (MI_SEGMENT_SIZE/32 > 262144*MI_INTPTR_SIZE)
+#define MI_LARGE_BIN_OBJ_SIZE_MAX         (262144*MI_INTPTR_SIZE)  // the largest size class (with large segments)
+#else
+#define MI_LARGE_BIN_OBJ_SIZE_MAX         (MI_SEGMENT_SIZE/32)     // 2MiB on 64-bit
+#endif
+#define MI_LARGE_BIN_OBJ_WSIZE_MAX        (MI_LARGE_BIN_OBJ_SIZE_MAX/MI_INTPTR_SIZE)
+
 // Maximum number of size classes. (spaced exponentially in 12.5% increments)
 #define MI_BIN_HUGE  (73U)
 
-#if (MI_MEDIUM_OBJ_WSIZE_MAX >= 655360)
+#if (MI_LARGE_BIN_OBJ_WSIZE_MAX > 262144)
 #error "mimalloc internal: define more bins"
 #endif
 #if (MI_ALIGNMENT_MAX > MI_SEGMENT_SIZE/2)
@@ -170,8 +198,13 @@ typedef int32_t  mi_ssize_t;
 #error "mimalloc internal: the max aligned boundary must be an integral multiple of the segment slice size"
 #endif
 
-// Maximum slice offset (15)
+// Maximum slice offset (15): blocks of a medium page and aligned blocks in a large page
+// must be found from the slice they start in.
+#if (MI_ALIGNMENT_MAX > MI_MEDIUM_PAGE_SIZE)
 #define MI_MAX_SLICE_OFFSET               ((MI_ALIGNMENT_MAX / MI_SEGMENT_SLICE_SIZE) - 1)
+#else
+#define MI_MAX_SLICE_OFFSET               ((MI_MEDIUM_PAGE_SIZE / MI_SEGMENT_SLICE_SIZE) - 1)
+#endif
 
 // Used as a special value to encode block sizes in 32 bits.
 #define MI_HUGE_BLOCK_SIZE                ((uint32_t)(2*MI_GiB))
@@ -208,23 +241,25 @@ typedef enum mi_delayed_e {
 } mi_delayed_t;
 
 
-// The `in_full` and `has_aligned` page flags are put in a union to efficiently
-// test if both are false (`full_aligned == 0`) in the `mi_free` routine.
+// The `in_full`, `has_aligned`, and `has_sampled` page flags are put in a union to efficiently
+// test if all are false (`full_aligned == 0`) in the `mi_free` routine.
 #if !MI_TSAN
 typedef union mi_page_flags_s {
   uint8_t full_aligned;
   struct {
     uint8_t in_full : 1;
     uint8_t has_aligned : 1;
+    uint8_t has_sampled : 1;   // contains blocks sampled by the heap profiler (see `profile.c`)
   } x;
 } mi_page_flags_t;
 #else
 // under thread sanitizer, use a byte for each flag to suppress warning, issue #130
 typedef union mi_page_flags_s {
-  uint16_t full_aligned;
+  uint32_t full_aligned;
   struct {
     uint8_t in_full;
     uint8_t has_aligned;
+    uint8_t has_sampled;
   } x;
 } mi_page_flags_t;
 #endif
@@ -276,7 +311,7 @@ typedef struct mi_page_s {
   // layout like this to optimize access in `mi_malloc` and `mi_free`
   uint16_t              capacity;          // number of blocks committed, must be the first field, see `segment.c:page_clear`
   uint16_t              reserved;          // number of blocks reserved in memory
-  mi_page_flags_t       flags;             // `in_full` and `has_aligned` flags (8 bits)
+  mi_page_flags_t       flags;             // `in_full`, `has_aligned`, and `has_sampled` flags (8 bits)
   uint8_t               is_zero : 1;         // `true` if the blocks in the free list are zero initialized
   uint8_t               retire_expire : 7;   // expiration count for retired blocks
 
@@ -295,7 +330,9 @@ typedef struct mi_page_s {
   struct mi_page_s* prev;                  // previous page owned by this thread with the same `block_size`
 
   // 64-bit 9 words, 32-bit 12 words, (+2 for secure)
-  #if MI_INTPTR_SIZE==8
+  #if MI_PROFILE
+  _Atomic(size_t)   sampled;               // number of live blocks sampled by the heap profiler (see `profile.c`)
+  #elif MI_INTPTR_SIZE==8
   uintptr_t padding[1];
   #endif
 } mi_page_t;
@@ -342,6 +379,7 @@ typedef struct mi_commit_mask_s {
 
 typedef mi_page_t  mi_slice_t;
 typedef int64_t    mi_msecs_t;
+typedef int64_t    mi_usecs_t;
 
 
 // Segments are large allocated memory blocks (8mb on 64 bit) from
@@ -400,6 +438,8 @@ typedef struct mi_page_queue_s {
   mi_page_t* first;
   mi_page_t* last;
   size_t     block_size;
+  uint32_t   page_slices;   // slices of the next fresh page (or 0 if no fresh page was allocated yet) (see `mi_page_fresh_size`)
+  uint32_t   fresh_beat;    // heartbeat of the thread when the last fresh page was allocated
 } mi_page_queue_t;
 
 #define MI_BIN_FULL  (MI_BIN_HUGE+1)
@@ -435,12 +475,16 @@ struct mi_heap_s {
   mi_page_queue_t       pages[MI_BIN_FULL + 1];              // queue of pages for each size class (or "bin")
   _Atomic(mi_block_t*)  thread_delayed_free;
   mi_threadid_t         thread_id;                           // thread this heap belongs too
+  mi_arena_id_t         arena_id;                            // arena id if the heap belongs to a specific arena (or 0)
   uintptr_t             cookie;                              // random cookie to verify pointers (see `_mi_ptr_cookie`)
   uintptr_t             keys[2];                             // two random keys used to encode the `thread_delayed_free` list
   mi_random_ctx_t       random;                              // random number context used for secure allocation
   size_t                page_count;                          // total number of pages in the `pages` queues.
   size_t                page_retired_min;                    // smallest retired index (retired pages are fully free, but still in the page queues)
   size_t                page_retired_max;                    // largest retired index into the `pages` array.
+  size_t                collect_bin;                         // cursor of `mi_heap_collect_step`: the page queue
+  mi_page_t*            collect_page;                        // and the next page in that queue (or NULL for its first page)
+  ptrdiff_t             sample_countdown;                    // bytes to allocate until the next heap profile sample (see `profile.c`)
   mi_heap_t*            next;                                // list of heaps per thread
   bool                  no_reclaim;                          // `true` if this heap should not reclaim abandoned pages
 };
@@ -505,6 +549,37 @@ typedef struct mi_stat_counter_s {
   int64_t count;
 } mi_stat_counter_t;
 
+// Latency histograms of the slow paths (with `MI_LATENCY=1`)
+#ifndef MI_LATENCY
+#define MI_LATENCY 0
+#endif
+
+// Log-bucketed (HDR-style) histogram of cycle counts: 8 sub-buckets per power of 2 (at most 12.5% error)
+#define MI_LATENCY_SUB_BITS   (3)
+#define MI_LATENCY_MAX_BITS   (40)     // larger counts are in the last bucket
+#define MI_LATENCY_BUCKETS    ((MI_LATENCY_MAX_BITS - MI_LATENCY_SUB_BITS + 2) << MI_LATENCY_SUB_BITS)
+
+typedef enum mi_latency_kind_e {
+  MI_LATENCY_MALLOC_GENERIC,    // `_mi_malloc_generic`
+  MI_LATENCY_FREE_GENERIC,      // `mi_free_generic`
+  MI_LATENCY_DEFERRED_FREE,     // the registered deferred free callback
+  MI_LATENCY_SEGMENT_ALLOC,     // `mi_segment_alloc`
+  MI_LATENCY_SEGMENT_RECLAIM,   // `mi_segment_try_reclaim`
+  MI_LATENCY_OS_ALLOC,          // allocate OS memory
+  MI_LATENCY_OS_FREE,           // free OS memory
+  MI_LATENCY_OS_COMMIT,
+  MI_LATENCY_OS_DECOMMIT,
+  MI_LATENCY_OS_RESET,
+  MI_LATENCY_COUNT
+} mi_latency_kind_t;
+
+typedef struct mi_stat_latency_s {
+  int64_t count;
+  int64_t total;
+  int64_t max;
+  int64_t buckets[MI_LATENCY_BUCKETS];
+} mi_stat_latency_t;
+
 typedef struct mi_stats_s {
   mi_stat_count_t segments;
   mi_stat_count_t pages;
@@ -531,12 +606,16 @@ typedef struct mi_stats_s {
 #if MI_STAT>1
   mi_stat_count_t normal_bins[MI_BIN_HUGE+1];
 #endif
+#if MI_LATENCY
+  mi_stat_latency_t latency[MI_LATENCY_COUNT];
+#endif
 } mi_stats_t;
 
 
 void _mi_stat_increase(mi_stat_count_t* stat, size_t amount);
 void _mi_stat_decrease(mi_stat_count_t* stat, size_t amount);
 void _mi_stat_counter_increase(mi_stat_counter_t* stat, size_t amount);
+void _mi_stat_latency_add(mi_stat_latency_t* stat, uint64_t cycles);
 
 #if (MI_STAT)
 #define mi_stat_increase(stat,amount)         _mi_stat_increase( &(stat), amount)
@@ -548,10 +627,40 @@ void _mi_stat_counter_increase(mi_stat_counter_t* stat, size_t amount);
 #define mi_stat_counter_increase(stat,amount) (void)0
 #endif
 
+#if MI_LATENCY
+#define mi_latency_start()                  _mi_cycles()
+#define mi_latency_stop(stats,kind,start)   _mi_stat_latency_add( &(stats)->latency[kind], _mi_cycles() - (start))
+#else
+#define mi_latency_start()                  ((uint64_t)0)
+#define mi_latency_stop(stats,kind,start)   ((void)(start))
+#endif
+
 #define mi_heap_stat_counter_increase(heap,stat,amount)  mi_stat_counter_increase( (heap)->tld->stats.stat, amount)
 #define mi_heap_stat_increase(heap,stat,amount)  mi_stat_increase( (heap)->tld->stats.stat, amount)
 #define mi_heap_stat_decrease(heap,stat,amount)  mi_stat_decrease( (heap)->tld->stats.stat, amount)
 
+// ------------------------------------------------------
+// Event log (see `event.c`)
+// ------------------------------------------------------
+
+// Slow path events recorded in the per-thread event rings
+typedef enum mi_event_kind_e {
+  MI_EVENT_NONE,
+  MI_EVENT_PAGE_FRESH,      // a fresh page (size is the block size)
+  MI_EVENT_PAGE_FREE,       // a page is freed (retired) back to its segment
+  MI_EVENT_SEGMENT_ALLOC,   // a fresh segment from the cache or OS
+  MI_EVENT_SEGMENT_FREE,    // a segment is returned to the cache or OS
+  MI_EVENT_SEGMENT_ABANDON, // a segment is abandoned by its thread
+  MI_EVENT_SEGMENT_RECLAIM, // an abandoned segment is reclaimed
+  MI_EVENT_CACHE_HIT,       // a segment is popped from the segment cache
+  MI_EVENT_CACHE_MISS,      // no segment was available in the segment cache
+  MI_EVENT_COMMIT,          // OS memory is committed
+  MI_EVENT_DECOMMIT,        // OS memory is decommitted
+  MI_EVENT_RESET,           // OS memory is reset
+  MI_EVENT_THREAD_DONE,     // the thread terminates
+  MI_EVENT_KIND_COUNT
+} mi_event_kind_t;
+
 // ------------------------------------------------------
 // Thread Local data
 // ------------------------------------------------------
@@ -564,7 +673,8 @@ typedef struct mi_span_queue_s {
   size_t      slice_count;
 } mi_span_queue_t;
 
-#define MI_SEGMENT_BIN_MAX (35)     // 35 == mi_segment_bin(MI_SLICES_PER_SEGMENT)
+#define MI_SEGMENT_BIN_MAX (4*(MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT) - 5)  // == mi_slice_bin(MI_SLICES_PER_SEGMENT) (35 for 1024 slices)
+#define MI_SEGMENT_BIN_FIELDS ((MI_SEGMENT_BIN_MAX + MI_INTPTR_BITS) / MI_INTPTR_BITS)  // fields in the bitmap of non-empty span queues
 
 // OS thread local data
 typedef struct mi_os_tld_s {
@@ -576,12 +686,14 @@ typedef struct mi_os_tld_s {
 // Segments thread local data
 typedef struct mi_segments_tld_s {
   mi_span_queue_t     spans[MI_SEGMENT_BIN_MAX+1];  // free slice spans inside segments
+  uintptr_t           spans_nonempty[MI_SEGMENT_BIN_FIELDS];  // bit `i` is set if `spans[i]` is not empty
   size_t              count;        // current number of segments;
   size_t              peak_count;   // peak number of segments
   size_t              current_size; // current size of all segments
   size_t              peak_size;    // peak size of all segments
   mi_stats_t*         stats;        // points to tld stats
   mi_os_tld_t*        os;           // points to os stats
+  struct mi_handoff_s* handoff;     // if not NULL, abandoned segments are handed off through this slot (see `mi_heap_transfer`)
 } mi_segments_tld_t;
 
 // Thread local data
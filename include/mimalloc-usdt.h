@@ -0,0 +1,112 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MIMALLOC_USDT_H
+#define MIMALLOC_USDT_H
+
+// --------------------------------------------------------------------------------------------
+// USDT (user-level statically defined tracing) probes on the allocator slow paths.
+// Enabled by building with `MI_USDT=ON`; otherwise the probes expand to nothing.
+//
+// We emit the same ELF notes as `<sys/sdt.h>` (provider `mimalloc`) so the probes are
+// found by `bpftrace`, `perf`, `systemtap` etc, but we do not depend on that header.
+// A probe is a single `nop` and the arguments are described in a `.note.stapsdt` section.
+// Each probe has a semaphore that a tracer increments when attaching; we use it to only
+// measure durations when someone is listening (`mi_usdt_start` / `mi_usdt_elapsed`).
+//
+// probes (all arguments are 64-bit, durations in micro-seconds):
+//   malloc_generic(heap, size, bin, usecs)           slow path of `malloc`
+//   page_fresh(heap, block_size, page, usecs)         allocate a fresh page from a segment
+//   segment_alloc(required, segment, usecs)           allocate a fresh segment
+//   segment_reclaim(heap, block_size, segment, usecs) try to reclaim an abandoned segment
+//   segment_cache_pop(size, start)                    `start` is NULL on a miss
+//   segment_cache_push(start, size, pushed)
+//   os_commit(addr, size, commit, usecs)              commit (`commit=1`) or decommit
+//   os_reset(addr, size, usecs)
+//   thread_done(heap, thread_id)
+// --------------------------------------------------------------------------------------------
+
+#if defined(MI_USDT) && (MI_USDT!=0) && defined(__GNUC__) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#include <stdint.h>
+
+#define MI_USDT_PROBES(X) \
+  X(malloc_generic) X(page_fresh) X(segment_alloc) X(segment_reclaim) \
+  X(segment_cache_pop) X(segment_cache_push) X(os_commit) X(os_reset) X(thread_done)
+
+// semaphores (defined in `init.c`)
+#define MI_USDT_SEMAPHORE(name)   mimalloc_##name##_semaphore
+#define MI_USDT_SEMAPHORE_DECL(name)  extern volatile unsigned short MI_USDT_SEMAPHORE(name);
+#ifdef __cplusplus
+extern "C" {
+#endif
+MI_USDT_PROBES(MI_USDT_SEMAPHORE_DECL)
+#ifdef __cplusplus
+}
+#endif
+
+#if defined(__x86_64__)
+#define MI_USDT_ARG(x)  "nor"((uint64_t)(x))
+#else
+#define MI_USDT_ARG(x)  "r"((uint64_t)(x))
+#endif
+
+#define _mi_usdt_str(x)   #x
+#define _mi_usdt_xstr(x)  _mi_usdt_str(x)
+
+#define _mi_usdt_note(name,args) \
+  "990: nop\n" \
+  ".pushsection .note.stapsdt,\"\",\"note\"\n" \
+  ".balign 4\n" \
+  ".4byte 992f-991f, 994f-993f, 3\n" \
+  "991: .asciz \"stapsdt\"\n" \
+  "992: .balign 4\n" \
+  "993: .8byte 990b\n" \
+  ".8byte _.stapsdt.base\n" \
+  ".8byte " _mi_usdt_xstr(MI_USDT_SEMAPHORE(name)) "\n" \
+  ".asciz \"mimalloc\"\n" \
+  ".asciz \"" #name "\"\n" \
+  ".asciz \"" args "\"\n" \
+  "994: .balign 4\n" \
+  ".popsection\n" \
+  ".ifndef _.stapsdt.base\n" \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n" \
+  ".hidden _.stapsdt.base\n" \
+  "_.stapsdt.base: .space 1\n" \
+  ".size _.stapsdt.base, 1\n" \
+  ".popsection\n" \
+  ".endif\n"
+
+#define mi_usdt_probe1(name,a0) \
+  __asm__ __volatile__ (_mi_usdt_note(name,"8@%0") :: MI_USDT_ARG(a0))
+#define mi_usdt_probe2(name,a0,a1) \
+  __asm__ __volatile__ (_mi_usdt_note(name,"8@%0 8@%1") :: MI_USDT_ARG(a0), MI_USDT_ARG(a1))
+#define mi_usdt_probe3(name,a0,a1,a2) \
+  __asm__ __volatile__ (_mi_usdt_note(name,"8@%0 8@%1 8@%2") :: MI_USDT_ARG(a0), MI_USDT_ARG(a1), MI_USDT_ARG(a2))
+#define mi_usdt_probe4(name,a0,a1,a2,a3) \
+  __asm__ __volatile__ (_mi_usdt_note(name,"8@%0 8@%1 8@%2 8@%3") :: MI_USDT_ARG(a0), MI_USDT_ARG(a1), MI_USDT_ARG(a2), MI_USDT_ARG(a3))
+
+#define mi_usdt_enabled(name)     mi_unlikely(MI_USDT_SEMAPHORE(name) != 0)
+#define mi_usdt_start(name)       (mi_usdt_enabled(name) ? _mi_clock_usecs() : 0)
+#define mi_usdt_elapsed(start)    ((start) == 0 ? 0 : _mi_clock_usecs() - (start))
+
+#else
+
+// the arguments are not evaluated (but still count as used)
+#define mi_usdt_probe1(name,a0)               do { (void)sizeof(a0); } while(0)
+#define mi_usdt_probe2(name,a0,a1)            do { (void)sizeof(a0); (void)sizeof(a1); } while(0)
+#define mi_usdt_probe3(name,a0,a1,a2)         do { (void)sizeof(a0); (void)sizeof(a1); (void)sizeof(a2); } while(0)
+#define mi_usdt_probe4(name,a0,a1,a2,a3)      do { (void)sizeof(a0); (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); } while(0)
+
+#define mi_usdt_enabled(name)     (false)
+#define mi_usdt_start(name)       (0)
+#define mi_usdt_elapsed(start)    ((void)(start), 0)
+
+#endif
+
+#endif
@@ -95,6 +95,7 @@ terms of the MIT license. A copy of the license can be found in the file
 
 #include <stddef.h>     // size_t
 #include <stdbool.h>    // bool
+#include <stdint.h>     // int64_t
 
 #ifdef __cplusplus
 extern "C" {
@@ -139,6 +140,10 @@ mi_decl_nodiscard mi_decl_export size_t mi_good_size(size_t size)     mi_attr_no
 typedef void (mi_cdecl mi_deferred_free_fun)(bool force, unsigned long long heartbeat, void* arg);
 mi_decl_export void mi_register_deferred_free(mi_deferred_free_fun* deferred_free, void* arg) mi_attr_noexcept;
 
+mi_decl_export void mi_free_deferred(void* p) mi_attr_noexcept;
+mi_decl_export void mi_epoch_enter(void) mi_attr_noexcept;
+mi_decl_export void mi_epoch_exit(void) mi_attr_noexcept;
+
 typedef void (mi_cdecl mi_output_fun)(const char* msg, void* arg);
 mi_decl_export void mi_register_output(mi_output_fun* out, void* arg) mi_attr_noexcept;
 
@@ -151,16 +156,82 @@ mi_decl_export void mi_stats_reset(void)      mi_attr_noexcept;
 mi_decl_export void mi_stats_merge(void)      mi_attr_noexcept;
 mi_decl_export void mi_stats_print(void* out) mi_attr_noexcept;  // backward compatibility: `out` is ignored and should be NULL
 mi_decl_export void mi_stats_print_out(mi_output_fun* out, void* arg) mi_attr_noexcept;
+mi_decl_export void mi_size_classes_print(mi_output_fun* out, void* arg) mi_attr_noexcept;
+mi_decl_export void mi_profile_dump(mi_output_fun* out, void* arg) mi_attr_noexcept;
+mi_decl_export void mi_profile_lifetime_print(mi_output_fun* out, void* arg) mi_attr_noexcept;
+mi_decl_export void mi_event_dump(mi_output_fun* out, void* arg) mi_attr_noexcept;
 
 mi_decl_export void mi_process_init(void)     mi_attr_noexcept;
 mi_decl_export void mi_thread_init(void)      mi_attr_noexcept;
 mi_decl_export void mi_thread_done(void)      mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export size_t mi_thread_id(void) mi_attr_noexcept;
 mi_decl_export void mi_thread_stats_print_out(mi_output_fun* out, void* arg) mi_attr_noexcept;
 
 mi_decl_export void mi_process_info(size_t* elapsed_msecs, size_t* user_msecs, size_t* system_msecs, 
                                     size_t* current_rss, size_t* peak_rss, 
                                     size_t* current_commit, size_t* peak_commit, size_t* page_faults) mi_attr_noexcept;
 
+// -------------------------------------------------------------------------------------
+// Statistics snapshot: all statistics as plain numbers (without allocation).
+// Pass `MI_STATS_VERSION` as the version; fields are only ever added at the end.
+// -------------------------------------------------------------------------------------
+#define MI_STATS_VERSION  (1)
+#define MI_STATS_BINS     (74)     // number of size class bins (including the huge bin)
+
+typedef struct mi_stats_count_s {
+  int64_t allocated;
+  int64_t freed;
+  int64_t peak;
+  int64_t current;
+} mi_stats_count_t;
+
+typedef struct mi_stats_counter_s {
+  int64_t total;
+  int64_t count;
+} mi_stats_counter_t;
+
+typedef struct mi_stats_snapshot_s {
+  size_t version;                 // the version of this snapshot (`MI_STATS_VERSION`)
+  size_t size;                    // `sizeof(mi_stats_snapshot_t)` of the library
+  bool   detailed;                // are `malloc` and `normal_bins` recorded? (only with `MI_STAT>1`, as in debug builds)
+  mi_stats_count_t   segments;
+  mi_stats_count_t   pages;
+  mi_stats_count_t   reserved;
+  mi_stats_count_t   committed;
+  mi_stats_count_t   reset;
+  mi_stats_count_t   page_committed;
+  mi_stats_count_t   segments_abandoned;
+  mi_stats_count_t   pages_abandoned;
+  mi_stats_count_t   threads;
+  mi_stats_count_t   normal;
+  mi_stats_count_t   huge;
+  mi_stats_count_t   large;
+  mi_stats_count_t   malloc;
+  mi_stats_count_t   segments_cache;
+  mi_stats_counter_t pages_extended;
+  mi_stats_counter_t mmap_calls;
+  mi_stats_counter_t commit_calls;
+  mi_stats_counter_t page_no_retire;
+  mi_stats_counter_t searches;
+  mi_stats_counter_t normal_count;
+  mi_stats_counter_t huge_count;
+  mi_stats_counter_t large_count;
+  mi_stats_count_t   normal_bins[MI_STATS_BINS];       // blocks per size class
+  size_t             normal_bin_sizes[MI_STATS_BINS];  // block size of each size class (or 0 if unused)
+  size_t elapsed_msecs;
+  size_t user_msecs;
+  size_t system_msecs;
+  size_t current_rss;
+  size_t peak_rss;
+  size_t current_commit;
+  size_t peak_commit;
+  size_t page_faults;
+} mi_stats_snapshot_t;
+
+mi_decl_export bool mi_stats_get(mi_stats_snapshot_t* snapshot, size_t version) mi_attr_noexcept;
+mi_decl_export void mi_stats_print_json(mi_output_fun* out, void* arg) mi_attr_noexcept;
+mi_decl_export void mi_stats_print_openmetrics(mi_output_fun* out, void* arg) mi_attr_noexcept;
+
 // -------------------------------------------------------------------------------------
 // Aligned allocation
 // Note that `alignment` always follows `size` for consistency with unaligned
@@ -192,6 +263,9 @@ mi_decl_export mi_heap_t* mi_heap_set_default(mi_heap_t* heap);
 mi_decl_export mi_heap_t* mi_heap_get_default(void);
 mi_decl_export mi_heap_t* mi_heap_get_backing(void);
 mi_decl_export void       mi_heap_collect(mi_heap_t* heap, bool force) mi_attr_noexcept;
+mi_decl_export bool       mi_heap_collect_step(mi_heap_t* heap, size_t max_pages) mi_attr_noexcept;
+mi_decl_export bool       mi_heap_transfer(mi_heap_t* heap, size_t target_thread) mi_attr_noexcept;
+mi_decl_export size_t     mi_thread_adopt_abandoned_from(size_t thread_id) mi_attr_noexcept;
 
 mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_malloc(mi_heap_t* heap, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size(2);
 mi_decl_nodiscard mi_decl_export mi_decl_restrict void* mi_heap_zalloc(mi_heap_t* heap, size_t size) mi_attr_noexcept mi_attr_malloc mi_attr_alloc_size(2);
@@ -263,6 +337,9 @@ typedef bool (mi_cdecl mi_block_visit_fun)(const mi_heap_t* heap, const mi_heap_
 
 mi_decl_export bool mi_heap_visit_blocks(const mi_heap_t* heap, bool visit_all_blocks, mi_block_visit_fun* visitor, void* arg);
 
+mi_decl_export void mi_heap_fragmentation_report(mi_heap_t* heap, mi_output_fun* out, void* arg) mi_attr_noexcept;
+mi_decl_export void mi_fragmentation_report(mi_output_fun* out, void* arg) mi_attr_noexcept;
+
 // Experimental
 mi_decl_nodiscard mi_decl_export bool mi_is_in_heap_region(const void* p) mi_attr_noexcept;
 mi_decl_nodiscard mi_decl_export bool mi_is_redirected(void) mi_attr_noexcept;
@@ -275,6 +352,17 @@ mi_decl_export bool mi_manage_os_memory(void* start, size_t size, bool is_commit
 
 mi_decl_export void mi_debug_show_arenas(void) mi_attr_noexcept;
 
+// Experimental: heaps associated with specific memory arena's
+typedef int mi_arena_id_t;
+mi_decl_export bool mi_manage_os_memory_ex(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept;
+mi_decl_export int  mi_reserve_os_memory_ex(size_t size, bool commit, bool allow_large, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_new_in_arena(mi_arena_id_t arena_id);
+
+// Experimental: heaps in a file backed arena that can be saved and restored at the same address
+mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_new_snapshot(const char* fname, void* addr, size_t size) mi_attr_noexcept;
+mi_decl_export int  mi_heap_snapshot_save(mi_heap_t* heap, void* root) mi_attr_noexcept;
+mi_decl_nodiscard mi_decl_export mi_heap_t* mi_heap_snapshot_restore(const char* fname, bool validate, void** root) mi_attr_noexcept;
+
 // deprecated
 mi_decl_export int  mi_reserve_huge_os_pages(size_t pages, double max_secs, size_t* pages_reserved) mi_attr_noexcept;
 
@@ -331,6 +419,12 @@ typedef enum mi_option_e {
   mi_option_allow_decommit,
   mi_option_segment_decommit_delay,  
   mi_option_decommit_extend_delay,
+  mi_option_size_histogram,           // record a histogram of requested sizes and suggest size classes at exit
+  mi_option_size_class_waste,         // target internal waste (in percent) of the suggested size classes
+  mi_option_profile_interval,         // average bytes allocated between heap profile samples (0 to disable; needs MI_PROFILE)
+  mi_option_profile_lifetime,         // record lifetimes and freeing threads of heap profile samples and print them at exit
+  mi_option_event_log,                // record slow path events in a per-thread ring buffer (see `mi_event_dump`)
+  mi_option_thread_data_cache,        // number of idle thread meta-data entries that stay resident (further ones are reset)
   _mi_option_last
 } mi_option_t;
 
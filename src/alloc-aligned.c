@@ -45,7 +45,7 @@ static mi_decl_noinline void* mi_heap_malloc_zero_aligned_at_fallback(mi_heap_t*
 }
 
 // Primitive aligned allocation
-static void* mi_heap_malloc_zero_aligned_at(mi_heap_t* const heap, const size_t size, const size_t alignment, const size_t offset, const bool zero) mi_attr_noexcept
+static void* mi_heap_malloc_zero_aligned_atx(mi_heap_t* const heap, const size_t size, const size_t alignment, const size_t offset, const bool zero) mi_attr_noexcept
 {
   // note: we don't require `size > offset`, we just guarantee that the address at offset is aligned regardless of the allocated size.
   mi_assert(alignment > 0);
@@ -90,6 +90,20 @@ static void* mi_heap_malloc_zero_aligned_at(mi_heap_t* const heap, const size_t
   return mi_heap_malloc_zero_aligned_at_fallback(heap, size, alignment, offset, zero);
 }
 
+static void* mi_heap_malloc_zero_aligned_at(mi_heap_t* const heap, const size_t size, const size_t alignment, const size_t offset, const bool zero) mi_attr_noexcept
+{
+  #if MI_TRACE
+  if (mi_unlikely(_mi_trace_enabled)) {
+    // record a single aligned allocation instead of the (over-)allocation it performs
+    _mi_trace_enter();
+    void* p = mi_heap_malloc_zero_aligned_atx(heap, size, alignment, offset, zero);
+    _mi_trace_aligned(p, size, alignment);
+    return p;
+  }
+  #endif
+  return mi_heap_malloc_zero_aligned_atx(heap, size, alignment, offset, zero);
+}
+
 
 // ------------------------------------------------------
 // Optimized mi_heap_malloc_aligned / mi_malloc_aligned
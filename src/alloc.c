@@ -45,16 +45,30 @@ extern inline void* _mi_page_malloc(mi_heap_t* heap, mi_page_t* page, size_t siz
 
 #if (MI_STAT>0)
   const size_t bsize = mi_page_usable_block_size(page);
-  if (bsize <= MI_MEDIUM_OBJ_SIZE_MAX) {
+  if (bsize <= MI_LARGE_BIN_OBJ_SIZE_MAX) {
     mi_heap_stat_increase(heap, normal, bsize);
     mi_heap_stat_counter_increase(heap, normal_count, 1);
 #if (MI_STAT>1)
     const size_t bin = _mi_bin(bsize);
     mi_heap_stat_increase(heap, normal_bins[bin], 1);
+    if (mi_unlikely(_mi_size_histogram_enabled)) {
+      _mi_size_histogram_increase(size - MI_PADDING_SIZE);
+    }
 #endif
   }
 #endif
 
+#if MI_PROFILE
+  heap->sample_countdown -= (ptrdiff_t)size;
+  if (mi_unlikely(heap->sample_countdown < 0)) {
+    _mi_profile_sample(heap, page, block, size);
+  }
+#endif
+
+#if MI_TRACE
+  if (mi_unlikely(_mi_trace_enabled)) { _mi_trace_malloc(block, size - MI_PADDING_SIZE); }
+#endif
+
 #if (MI_PADDING > 0) && defined(MI_ENCODE_FREELIST)
   mi_padding_t* const padding = (mi_padding_t*)((uint8_t*)block + mi_page_usable_block_size(page));
   ptrdiff_t delta = ((uint8_t*)padding - (uint8_t*)block - (size - MI_PADDING_SIZE));
@@ -306,7 +320,7 @@ static void mi_stat_free(const mi_page_t* page, const mi_block_t* block) {
   const size_t usize = mi_page_usable_size_of(page, block);
   mi_heap_stat_decrease(heap, malloc, usize);
   #endif  
-  if (bsize <= MI_MEDIUM_OBJ_SIZE_MAX) {
+  if (bsize <= MI_LARGE_BIN_OBJ_SIZE_MAX) {
     mi_heap_stat_decrease(heap, normal, bsize);
     #if (MI_STAT > 1)
     mi_heap_stat_decrease(heap, normal_bins[_mi_bin(bsize)], 1);
@@ -442,10 +456,20 @@ mi_block_t* _mi_page_ptr_unalign(const mi_segment_t* segment, const mi_page_t* p
 
 
 static void mi_decl_noinline mi_free_generic(const mi_segment_t* segment, bool local, void* p) mi_attr_noexcept {
+  const uint64_t cycles = mi_latency_start();
   mi_page_t* const page = _mi_segment_page_of(segment, p);
   mi_block_t* const block = (mi_page_has_aligned(page) ? _mi_page_ptr_unalign(segment, page, p) : (mi_block_t*)p);
+  #if MI_LATENCY
+  // do not initialize the thread for a (cross-thread) free; the page may be freed below so get the stats now
+  mi_heap_t* const heap = (local ? mi_page_heap(page) : NULL);
+  mi_stats_t* const stats = (heap != NULL ? &heap->tld->stats : &_mi_stats_main);
+  #endif
+  #if MI_PROFILE
+  if (mi_unlikely(mi_page_has_sampled(page))) { _mi_profile_free(page, block, local); }
+  #endif
   mi_stat_free(page, block);
   _mi_free_block(page, local, block);
+  mi_latency_stop(stats, MI_LATENCY_FREE_GENERIC, cycles);
 }
 
 // Get the segment data belonging to a pointer
@@ -487,6 +511,9 @@ void mi_free(void* p) mi_attr_noexcept
 {
   mi_segment_t* const segment = mi_checked_ptr_segment(p,"mi_free");
   if (mi_unlikely(segment == NULL)) return; 
+  #if MI_TRACE
+  if (mi_unlikely(_mi_trace_enabled)) { _mi_trace_free(p); }
+  #endif
 
   mi_threadid_t tid = _mi_thread_id();
   mi_page_t* const page = _mi_segment_page_of(segment, p);
@@ -584,16 +611,49 @@ void* _mi_externs[] = {
 // Allocation extensions
 // ------------------------------------------------------
 
+// Free a block of a known `size` (as with C++ sized delete). Unlike `mi_free`, pages with
+// aligned blocks stay on the fast path: `p` may be an interior pointer of an aligned block,
+// so it is adjusted to the start of its block in that case.
 void mi_free_size(void* p, size_t size) mi_attr_noexcept {
+  mi_segment_t* const segment = mi_checked_ptr_segment(p,"mi_free_size");
+  if (mi_unlikely(segment == NULL)) return;
+  #if MI_TRACE
+  if (mi_unlikely(_mi_trace_enabled)) { _mi_trace_free(p); }
+  #endif
   MI_UNUSED_RELEASE(size);
-  mi_assert(p == NULL || size <= _mi_usable_size(p,"mi_free_size"));
-  mi_free(p);
+  mi_assert(size <= _mi_usable_size(p,"mi_free_size"));
+
+  mi_threadid_t tid = _mi_thread_id();
+  mi_page_t* const page = _mi_segment_page_of(segment, p);
+
+  if (mi_likely(tid == mi_atomic_load_relaxed(&segment->thread_id) &&
+                (page->flags.full_aligned == 0 || (!mi_page_is_in_full(page) && !mi_page_has_sampled(page))))) {
+    // local, not full, and no sampled blocks (but possibly aligned blocks)
+    mi_block_t* block = (mi_likely(page->flags.full_aligned == 0) ? (mi_block_t*)p : _mi_page_ptr_unalign(segment, page, p));
+    if (mi_unlikely(mi_check_is_double_free(page,block))) return;
+    mi_check_padding(page, block);
+    mi_stat_free(page, block);
+    #if (MI_DEBUG!=0)
+    memset(block, MI_DEBUG_FREED, mi_page_block_size(page));
+    #endif
+    mi_block_set_next(page, block, page->local_free);
+    page->local_free = block;
+    if (mi_unlikely(--page->used == 0)) {
+      _mi_page_retire(page);
+    }
+  }
+  else {
+    // non-local, a full page, or a page with sampled blocks
+    mi_free_generic(segment, tid == segment->thread_id, p);
+  }
 }
 
 void mi_free_size_aligned(void* p, size_t size, size_t alignment) mi_attr_noexcept {
+  MI_UNUSED_RELEASE(size);
   MI_UNUSED_RELEASE(alignment);
   mi_assert(((uintptr_t)p % alignment) == 0);
-  mi_free_size(p,size);
+  mi_assert(p == NULL || size <= _mi_usable_size(p,"mi_free_size_aligned"));
+  mi_free(p);
 }
 
 void mi_free_aligned(void* p, size_t alignment) mi_attr_noexcept {
@@ -637,7 +697,7 @@ void* mi_expand(void* p, size_t newsize) mi_attr_noexcept {
   #endif
 }
 
-void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero) mi_attr_noexcept {
+static void* mi_heap_realloc_zerox(mi_heap_t* heap, void* p, size_t newsize, bool zero) mi_attr_noexcept {
   const size_t size = _mi_usable_size(p,"mi_realloc"); // also works if p == NULL
   if (mi_unlikely(newsize <= size && newsize >= (size / 2))) {
     // todo: adjust potential padding to reflect the new size?
@@ -658,6 +718,19 @@ void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero)
   return newp;
 }
 
+void* _mi_heap_realloc_zero(mi_heap_t* heap, void* p, size_t newsize, bool zero) mi_attr_noexcept {
+  #if MI_TRACE
+  if (mi_unlikely(_mi_trace_enabled)) {
+    // record a single realloc instead of the allocation and free it performs
+    _mi_trace_enter();
+    void* newp = mi_heap_realloc_zerox(heap, p, newsize, zero);
+    _mi_trace_realloc(p, newp, newsize);
+    return newp;
+  }
+  #endif
+  return mi_heap_realloc_zerox(heap, p, newsize, zero);
+}
+
 void* mi_heap_realloc(mi_heap_t* heap, void* p, size_t newsize) mi_attr_noexcept {
   return _mi_heap_realloc_zero(heap, p, newsize, false);  
 }
@@ -59,6 +59,8 @@ typedef struct mi_arena_s {
   size_t   block_count;                   // size of the area in arena blocks (of `MI_ARENA_BLOCK_SIZE`)
   size_t   field_count;                   // number of bitmap fields (where `field_count * MI_BITMAP_FIELD_BITS >= block_count`)
   int      numa_node;                     // associated NUMA node
+  mi_arena_id_t id;                       // arena id; 0 for non-specific
+  bool     exclusive;                     // only allow allocations if specifically for this arena
   bool     is_zero_init;                  // is the arena zero initialized?
   bool     allow_decommit;                // is decommit allowed? if true, is_large should be false and blocks_committed != NULL
   bool     is_large;                      // large- or huge OS pages (always committed)
@@ -74,24 +76,55 @@ static mi_decl_cache_align _Atomic(mi_arena_t*) mi_arenas[MI_MAX_ARENAS];
 static mi_decl_cache_align _Atomic(size_t)      mi_arena_count; // = 0
 
 
+/* -----------------------------------------------------------
+  Arena id's
+  0 is used for non-arena's (like OS memory)
+  id = arena_index + 1
+----------------------------------------------------------- */
+
+static size_t mi_arena_id_index(mi_arena_id_t id) {
+  return (size_t)(id <= 0 ? MI_MAX_ARENAS : id - 1);
+}
+
+static mi_arena_id_t mi_arena_id_create(size_t arena_index) {
+  mi_assert_internal(arena_index < MI_MAX_ARENAS);
+  return (int)arena_index + 1;
+}
+
+mi_arena_id_t _mi_arena_id_none(void) {
+  return 0;
+}
+
+static bool mi_arena_id_is_suitable(mi_arena_id_t arena_id, bool arena_is_exclusive, mi_arena_id_t req_arena_id) {
+  return ((!arena_is_exclusive && req_arena_id == _mi_arena_id_none()) ||
+          (arena_id == req_arena_id));
+}
+
+
 /* -----------------------------------------------------------
   Arena allocations get a memory id where the lower 8 bits are
-  the arena index +1, and the upper bits the block index.
+  the arena id, bit 8 the exclusive flag, and the upper bits the block index.
 ----------------------------------------------------------- */
 
 // Use `0` as a special id for direct OS allocated memory.
 #define MI_MEMID_OS   0
 
-static size_t mi_arena_id_create(size_t arena_index, mi_bitmap_index_t bitmap_index) {
-  mi_assert_internal(arena_index < 0xFE);
-  mi_assert_internal(((bitmap_index << 8) >> 8) == bitmap_index); // no overflow?
-  return ((bitmap_index << 8) | ((arena_index+1) & 0xFF));
+static size_t mi_arena_memid_create(mi_arena_id_t id, bool exclusive, mi_bitmap_index_t bitmap_index) {
+  mi_assert_internal(((bitmap_index << 9) >> 9) == bitmap_index); // no overflow?
+  mi_assert_internal(id > 0 && id <= 0xFF);
+  return ((bitmap_index << 9) | (exclusive ? 0x100 : 0) | (id & 0xFF));
 }
 
-static void mi_arena_id_indices(size_t memid, size_t* arena_index, mi_bitmap_index_t* bitmap_index) {
+static bool mi_arena_memid_indices(size_t memid, size_t* arena_index, mi_bitmap_index_t* bitmap_index) {
   mi_assert_internal(memid != MI_MEMID_OS);
-  *arena_index = (memid & 0xFF) - 1;
-  *bitmap_index = (memid >> 8);
+  *arena_index = mi_arena_id_index((mi_arena_id_t)(memid & 0xFF));
+  *bitmap_index = (memid >> 9);
+  return ((memid & 0x100) != 0);
+}
+
+bool _mi_arena_memid_is_suitable(size_t memid, mi_arena_id_t request_arena_id) {
+  if (memid == MI_MEMID_OS) return (request_arena_id == _mi_arena_id_none());
+  return mi_arena_id_is_suitable((mi_arena_id_t)(memid & 0xFF), (memid & 0x100) != 0, request_arena_id);
 }
 
 static size_t mi_block_count_of_size(size_t size) {
@@ -116,7 +149,7 @@ static bool mi_arena_alloc(mi_arena_t* arena, size_t blocks, mi_bitmap_index_t*
   Arena Allocation
 ----------------------------------------------------------- */
 
-static mi_decl_noinline void* mi_arena_alloc_from(mi_arena_t* arena, size_t arena_index, size_t needed_bcount,
+static mi_decl_noinline void* mi_arena_alloc_from(mi_arena_t* arena, size_t needed_bcount,
                                                   bool* commit, bool* large, bool* is_pinned, bool* is_zero, size_t* memid, mi_os_tld_t* tld)
 {
   mi_bitmap_index_t bitmap_index;
@@ -124,7 +157,7 @@ static mi_decl_noinline void* mi_arena_alloc_from(mi_arena_t* arena, size_t aren
 
   // claimed it! set the dirty bits (todo: no need for an atomic op here?)
   void* p    = arena->start + (mi_bitmap_index_bit(bitmap_index)*MI_ARENA_BLOCK_SIZE);
-  *memid     = mi_arena_id_create(arena_index, bitmap_index);
+  *memid     = mi_arena_memid_create(arena->id, arena->exclusive, bitmap_index);
   *is_zero   = _mi_bitmap_claim_across(arena->blocks_dirty, arena->field_count, needed_bcount, bitmap_index, NULL);
   *large     = arena->is_large;
   *is_pinned = (arena->is_large || !arena->allow_decommit);
@@ -149,7 +182,8 @@ static mi_decl_noinline void* mi_arena_alloc_from(mi_arena_t* arena, size_t aren
   return p;
 }
 
-static mi_decl_noinline void* mi_arena_allocate(int numa_node, size_t size, size_t alignment, bool* commit, bool* large, bool* is_pinned, bool* is_zero, size_t* memid, mi_os_tld_t* tld)
+static mi_decl_noinline void* mi_arena_allocate(int numa_node, size_t size, size_t alignment, bool* commit, bool* large, bool* is_pinned, bool* is_zero, 
+                                                mi_arena_id_t req_arena_id, size_t* memid, mi_os_tld_t* tld)
 {  
   MI_UNUSED_RELEASE(alignment);
   mi_assert_internal(alignment <= MI_SEGMENT_ALIGN);
@@ -158,14 +192,26 @@ static mi_decl_noinline void* mi_arena_allocate(int numa_node, size_t size, size
   if (mi_likely(max_arena == 0)) return NULL;
   mi_assert_internal(size <= bcount*MI_ARENA_BLOCK_SIZE);
 
+  // try only the specific arena if so requested
+  size_t arena_index = mi_arena_id_index(req_arena_id);
+  if (arena_index < max_arena) {
+    mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[arena_index]);
+    if (arena == NULL || (!*large && arena->is_large)) return NULL;
+    void* p = mi_arena_alloc_from(arena, bcount, commit, large, is_pinned, is_zero, memid, tld);
+    mi_assert_internal((uintptr_t)p % alignment == 0);
+    return p;
+  }
+  if (req_arena_id != _mi_arena_id_none()) return NULL;
+
   // try numa affine allocation
   for (size_t i = 0; i < max_arena; i++) {
     mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[i]);
     if (arena==NULL) break; // end reached
     if ((arena->numa_node<0 || arena->numa_node==numa_node) && // numa local?
-      (*large || !arena->is_large)) // large OS pages allowed, or arena is not large OS pages
+      (*large || !arena->is_large) && // large OS pages allowed, or arena is not large OS pages
+      !arena->exclusive)              // only allocate from exclusive arenas if specifically requested
     {
-      void* p = mi_arena_alloc_from(arena, i, bcount, commit, large, is_pinned, is_zero, memid, tld);
+      void* p = mi_arena_alloc_from(arena, bcount, commit, large, is_pinned, is_zero, memid, tld);
       mi_assert_internal((uintptr_t)p % alignment == 0);
       if (p != NULL) {
         return p;
@@ -178,9 +224,10 @@ static mi_decl_noinline void* mi_arena_allocate(int numa_node, size_t size, size
     mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[i]);
     if (arena==NULL) break; // end reached
     if ((arena->numa_node>=0 && arena->numa_node!=numa_node) && // not numa local!
-      (*large || !arena->is_large)) // large OS pages allowed, or arena is not large OS pages
+      (*large || !arena->is_large) && // large OS pages allowed, or arena is not large OS pages
+      !arena->exclusive)              // only allocate from exclusive arenas if specifically requested
     {
-      void* p = mi_arena_alloc_from(arena, i, bcount, commit, large, is_pinned, is_zero, memid, tld);
+      void* p = mi_arena_alloc_from(arena, bcount, commit, large, is_pinned, is_zero, memid, tld);
       mi_assert_internal((uintptr_t)p % alignment == 0);
       if (p != NULL) {
         return p;
@@ -192,7 +239,7 @@ static mi_decl_noinline void* mi_arena_allocate(int numa_node, size_t size, size
 
 
 void* _mi_arena_alloc_aligned(size_t size, size_t alignment, bool* commit, bool* large, bool* is_pinned, bool* is_zero,
-                              size_t* memid, mi_os_tld_t* tld)
+                              mi_arena_id_t req_arena_id, size_t* memid, mi_os_tld_t* tld)
 {
   mi_assert_internal(commit != NULL && is_pinned != NULL && is_zero != NULL && memid != NULL && tld != NULL);
   mi_assert_internal(size > 0);
@@ -206,10 +253,16 @@ void* _mi_arena_alloc_aligned(size_t size, size_t alignment, bool* commit, bool*
 
   // try to allocate in an arena if the alignment is small enough and the object is not too small (as for heap meta data)
   if (size >= MI_ARENA_MIN_OBJ_SIZE && alignment <= MI_SEGMENT_ALIGN) {
-    void* p = mi_arena_allocate(numa_node, size, alignment, commit, large, is_pinned, is_zero, memid, tld);
+    void* p = mi_arena_allocate(numa_node, size, alignment, commit, large, is_pinned, is_zero, req_arena_id, memid, tld);
     if (p != NULL) return p;
   }
 
+  // never fall back to the OS if a specific arena was requested
+  if (req_arena_id != _mi_arena_id_none()) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
   // finally, fall back to the OS
   if (mi_option_is_enabled(mi_option_limit_os_alloc)) {
     errno = ENOMEM;
@@ -222,9 +275,9 @@ void* _mi_arena_alloc_aligned(size_t size, size_t alignment, bool* commit, bool*
   return p;
 }
 
-void* _mi_arena_alloc(size_t size, bool* commit, bool* large, bool* is_pinned, bool* is_zero, size_t* memid, mi_os_tld_t* tld)
+void* _mi_arena_alloc(size_t size, bool* commit, bool* large, bool* is_pinned, bool* is_zero, mi_arena_id_t req_arena_id, size_t* memid, mi_os_tld_t* tld)
 {
-  return _mi_arena_alloc_aligned(size, MI_ARENA_BLOCK_SIZE, commit, large, is_pinned, is_zero, memid, tld);
+  return _mi_arena_alloc_aligned(size, MI_ARENA_BLOCK_SIZE, commit, large, is_pinned, is_zero, req_arena_id, memid, tld);
 }
 
 /* -----------------------------------------------------------
@@ -244,7 +297,7 @@ void _mi_arena_free(void* p, size_t size, size_t memid, bool all_committed, mi_o
     // allocated in an arena
     size_t arena_idx;
     size_t bitmap_idx;
-    mi_arena_id_indices(memid, &arena_idx, &bitmap_idx);
+    mi_arena_memid_indices(memid, &arena_idx, &bitmap_idx);
     mi_assert_internal(arena_idx < MI_MAX_ARENAS);
     mi_arena_t* arena = mi_atomic_load_ptr_relaxed(mi_arena_t,&mi_arenas[arena_idx]);
     mi_assert_internal(arena != NULL);
@@ -277,26 +330,82 @@ void _mi_arena_free(void* p, size_t size, size_t memid, bool all_committed, mi_o
   }
 }
 
+/* -----------------------------------------------------------
+  Arena snapshots: used to save and restore the in-use blocks
+  of an arena that is backed by a file (see `snapshot.c`).
+----------------------------------------------------------- */
+
+static mi_arena_t* mi_arena_from_id(mi_arena_id_t arena_id) {
+  const size_t arena_index = mi_arena_id_index(arena_id);
+  if (arena_index >= mi_atomic_load_relaxed(&mi_arena_count)) return NULL;
+  return mi_atomic_load_ptr_relaxed(mi_arena_t, &mi_arenas[arena_index]);
+}
+
+// Return the start of the arena area, its size in bytes, and the number of in-use bitmap fields.
+void* _mi_arena_area(mi_arena_id_t arena_id, size_t* size, size_t* field_count) {
+  mi_arena_t* arena = mi_arena_from_id(arena_id);
+  if (arena == NULL) return NULL;
+  if (size != NULL) *size = arena->block_count * MI_ARENA_BLOCK_SIZE;
+  if (field_count != NULL) *field_count = arena->field_count;
+  return mi_atomic_load_ptr_relaxed(uint8_t, &arena->start);
+}
+
+// Copy the in-use bitmap of an arena into `fields`; returns the number of fields copied.
+size_t _mi_arena_copy_inuse(mi_arena_id_t arena_id, size_t* fields, size_t field_count) {
+  mi_arena_t* arena = mi_arena_from_id(arena_id);
+  if (arena == NULL) return 0;
+  const size_t count = (field_count < arena->field_count ? field_count : arena->field_count);
+  for (size_t i = 0; i < count; i++) {
+    fields[i] = mi_atomic_load_relaxed(&arena->blocks_inuse[i]);
+  }
+  return count;
+}
+
+// Claim the blocks given by a previously saved in-use bitmap; the arena should not be in use yet.
+bool _mi_arena_restore_inuse(mi_arena_id_t arena_id, const size_t* fields, size_t field_count) {
+  mi_arena_t* arena = mi_arena_from_id(arena_id);
+  if (arena == NULL || field_count != arena->field_count) return false;
+  for (size_t i = 0; i < field_count; i++) {
+    mi_atomic_or_acq_rel(&arena->blocks_inuse[i], fields[i]);
+  }
+  return true;
+}
+
+// The memory id of a block in an arena at address `p`
+size_t _mi_arena_memid_of(mi_arena_id_t arena_id, const void* p) {
+  mi_arena_t* arena = mi_arena_from_id(arena_id);
+  if (arena == NULL) return MI_MEMID_OS;
+  const uint8_t* start = mi_atomic_load_ptr_relaxed(uint8_t, &arena->start);
+  mi_assert_internal((const uint8_t*)p >= start && (const uint8_t*)p < start + arena->block_count*MI_ARENA_BLOCK_SIZE);
+  const size_t bitmap_index = ((const uint8_t*)p - start) / MI_ARENA_BLOCK_SIZE;
+  return mi_arena_memid_create(arena->id, arena->exclusive, bitmap_index);
+}
+
+
 /* -----------------------------------------------------------
   Add an arena.
 ----------------------------------------------------------- */
 
-static bool mi_arena_add(mi_arena_t* arena) {
+static bool mi_arena_add(mi_arena_t* arena, mi_arena_id_t* arena_id) {
   mi_assert_internal(arena != NULL);
   mi_assert_internal((uintptr_t)mi_atomic_load_ptr_relaxed(uint8_t,&arena->start) % MI_SEGMENT_ALIGN == 0);
   mi_assert_internal(arena->block_count > 0);
+  if (arena_id != NULL) *arena_id = -1;
 
   size_t i = mi_atomic_increment_acq_rel(&mi_arena_count);
   if (i >= MI_MAX_ARENAS) {
     mi_atomic_decrement_acq_rel(&mi_arena_count);
     return false;
   }
+  arena->id = mi_arena_id_create(i);
   mi_atomic_store_ptr_release(mi_arena_t,&mi_arenas[i], arena);
+  if (arena_id != NULL) *arena_id = arena->id;
   return true;
 }
 
-bool mi_manage_os_memory(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node) mi_attr_noexcept
+bool mi_manage_os_memory_ex(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept
 {
+  if (arena_id != NULL) *arena_id = _mi_arena_id_none();
   if (size < MI_ARENA_BLOCK_SIZE) return false;
 
   if (is_large) {
@@ -314,6 +423,8 @@ bool mi_manage_os_memory(void* start, size_t size, bool is_committed, bool is_la
   arena->block_count = bcount;
   arena->field_count = fields;
   arena->start = (uint8_t*)start;
+  arena->id           = _mi_arena_id_none();
+  arena->exclusive    = exclusive;
   arena->numa_node    = numa_node; // TODO: or get the current numa node if -1? (now it allows anyone to allocate on -1)
   arena->is_large     = is_large;
   arena->is_zero_init = is_zero;
@@ -322,6 +433,10 @@ bool mi_manage_os_memory(void* start, size_t size, bool is_committed, bool is_la
   arena->blocks_dirty = &arena->blocks_inuse[fields]; // just after inuse bitmap
   arena->blocks_committed = (!arena->allow_decommit ? NULL : &arena->blocks_inuse[2*fields]); // just after dirty bitmap
   // the bitmaps are already zero initialized due to os_alloc
+  // mark all blocks as dirty if the memory is not known to be zero
+  if (!is_zero) {
+    memset((void*)arena->blocks_dirty, 0xFF, fields*sizeof(mi_bitmap_field_t)); // cast to void* to avoid atomic warning
+  }
   // initialize committed bitmap?
   if (arena->blocks_committed != NULL && is_committed) {
     memset((void*)arena->blocks_committed, 0xFF, fields*sizeof(mi_bitmap_field_t)); // cast to void* to avoid atomic warning
@@ -335,18 +450,26 @@ bool mi_manage_os_memory(void* start, size_t size, bool is_committed, bool is_la
     _mi_bitmap_claim(arena->blocks_inuse, fields, post, postidx, NULL);
   }
 
-  mi_arena_add(arena);
+  if (!mi_arena_add(arena, arena_id)) {
+    _mi_os_free(arena, asize, &_mi_stats_main);
+    return false;
+  }
   return true;
 }
 
+bool mi_manage_os_memory(void* start, size_t size, bool is_committed, bool is_large, bool is_zero, int numa_node) mi_attr_noexcept {
+  return mi_manage_os_memory_ex(start, size, is_committed, is_large, is_zero, numa_node, false, NULL);
+}
+
 // Reserve a range of regular OS memory
-int mi_reserve_os_memory(size_t size, bool commit, bool allow_large) mi_attr_noexcept 
+int mi_reserve_os_memory_ex(size_t size, bool commit, bool allow_large, bool exclusive, mi_arena_id_t* arena_id) mi_attr_noexcept 
 {
+  if (arena_id != NULL) *arena_id = _mi_arena_id_none();
   size = _mi_align_up(size, MI_ARENA_BLOCK_SIZE); // at least one block
   bool large = allow_large;
   void* start = _mi_os_alloc_aligned(size, MI_SEGMENT_ALIGN, commit, &large, &_mi_stats_main);
   if (start==NULL) return ENOMEM;
-  if (!mi_manage_os_memory(start, size, (large || commit), large, true, -1)) {
+  if (!mi_manage_os_memory_ex(start, size, (large || commit), large, true, -1, exclusive, arena_id)) {
     _mi_os_free_ex(start, size, commit, &_mi_stats_main);
     _mi_verbose_message("failed to reserve %zu k memory\n", _mi_divide_up(size,1024));
     return ENOMEM;
@@ -355,6 +478,10 @@ int mi_reserve_os_memory(size_t size, bool commit, bool allow_large) mi_attr_noe
   return 0;
 }
 
+int mi_reserve_os_memory(size_t size, bool commit, bool allow_large) mi_attr_noexcept {
+  return mi_reserve_os_memory_ex(size, commit, allow_large, false, NULL);
+}
+
 static size_t mi_debug_show_bitmap(const char* prefix, mi_bitmap_field_t* fields, size_t field_count ) {
   size_t inuse_count = 0;
   for (size_t i = 0; i < field_count; i++) {
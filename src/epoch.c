@@ -0,0 +1,248 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+Epoch based deferred free for lock-free data structures.
+
+Readers access shared blocks between `mi_epoch_enter` and `mi_epoch_exit`.
+A block that is unlinked from a shared structure is passed to
+`mi_free_deferred` and only freed (through the normal `mi_free`) once
+every thread that was inside a critical section at that time has left it.
+
+There is a global epoch; a thread entering a critical section announces the
+global epoch it observed. The global epoch advances from `e` to `e+1` only if
+all threads that are in a critical section have announced `e`. A block retired
+while the global epoch was `e` can be freed once the global epoch is at least
+`e+2`, as any thread that could still reference it has left its critical section.
+
+Each thread keeps its retired blocks in "limbo" bags (allocated in the thread's
+heap) tagged with the epoch at retirement, newest first. The global epoch is
+advanced, and expired bags are freed, when a bag fills up and on the heartbeat
+of the thread in `_mi_deferred_free` (i.e. in the generic allocation path and
+on `mi_collect`). When a thread terminates, its pending bags are put on a
+global orphan list that is collected by the other threads.
+
+The per-thread records are linked in a global list and never freed; when a
+thread terminates its record is released and reused by the next new thread.
+-----------------------------------------------------------------------------*/
+#include "mimalloc.h"
+#include "mimalloc-internal.h"
+#include "mimalloc-atomic.h"
+
+#define MI_EPOCH_BAG_SIZE   (62)   // blocks per limbo bag (such that a bag is 512 bytes on 64-bit)
+
+// A limbo bag of retired blocks
+typedef struct mi_epoch_bag_s {
+  struct mi_epoch_bag_s* next;       // older bags
+  size_t                 epoch;      // global epoch when the last block was retired
+  size_t                 count;
+  void*                  blocks[MI_EPOCH_BAG_SIZE];
+} mi_epoch_bag_t;
+
+// The epoch record of a thread
+typedef struct mi_epoch_thread_s {
+  struct mi_epoch_thread_s* next;    // list of all records
+  _Atomic(uintptr_t)        owner;   // owning thread id (or 0 if the record is free)
+  _Atomic(size_t)           epoch;   // announced global epoch while in a critical section (or 0 if not)
+  size_t                    nesting; // nesting depth of critical sections
+  mi_epoch_bag_t*           bags;    // limbo bags, newest first; only the first one is being filled
+} mi_epoch_thread_t;
+
+static _Atomic(mi_epoch_thread_t*) mi_epoch_threads;        // all records (never freed)
+static _Atomic(size_t)             mi_epoch_global = MI_ATOMIC_VAR_INIT(1);   // never 0
+static _Atomic(mi_epoch_bag_t*)    mi_epoch_orphans;        // bags of terminated threads
+
+static mi_decl_thread mi_epoch_thread_t* mi_epoch_thread;   // the record of this thread (or NULL if not yet claimed)
+
+
+/* -----------------------------------------------------------
+  Thread records
+----------------------------------------------------------- */
+
+// Claim a free record or allocate a fresh one
+static mi_epoch_thread_t* mi_epoch_thread_claim(void) {
+  const mi_threadid_t tid = _mi_thread_id();
+  for (mi_epoch_thread_t* t = mi_atomic_load_ptr_acquire(mi_epoch_thread_t, &mi_epoch_threads); t != NULL; t = t->next) {
+    uintptr_t expected = 0;
+    if (mi_atomic_load_relaxed(&t->owner) == 0 && mi_atomic_cas_strong_acq_rel(&t->owner, &expected, (uintptr_t)tid)) {
+      mi_assert_internal(t->nesting == 0 && t->bags == NULL);
+      return t;
+    }
+  }
+  mi_epoch_thread_t* t = (mi_epoch_thread_t*)_mi_os_alloc(sizeof(mi_epoch_thread_t), &_mi_stats_main);
+  if (t == NULL) {
+    _mi_error_message(ENOMEM, "unable to allocate epoch thread data (%zu bytes)\n", sizeof(mi_epoch_thread_t));
+    return NULL;
+  }
+  mi_atomic_store_relaxed(&t->owner, (uintptr_t)tid);
+  mi_epoch_thread_t* next = mi_atomic_load_ptr_relaxed(mi_epoch_thread_t, &mi_epoch_threads);
+  do {
+    t->next = next;
+  } while (!mi_atomic_cas_ptr_weak_release(mi_epoch_thread_t, &mi_epoch_threads, &next, t));
+  return t;
+}
+
+static mi_epoch_thread_t* mi_epoch_thread_get(void) {
+  mi_epoch_thread_t* t = mi_epoch_thread;
+  if (mi_unlikely(t == NULL)) {
+    t = mi_epoch_thread_claim();
+    mi_epoch_thread = t;
+  }
+  return t;
+}
+
+
+/* -----------------------------------------------------------
+  Critical sections
+----------------------------------------------------------- */
+
+void mi_epoch_enter(void) mi_attr_noexcept {
+  mi_epoch_thread_t* t = mi_epoch_thread_get();
+  if (t == NULL) return;
+  if (t->nesting++ > 0) return;
+  // announce the global epoch; the sequentially consistent fence ensures that either an
+  // advancing thread sees our announcement, or we observe the advanced epoch.
+  mi_atomic_store_release(&t->epoch, mi_atomic_load_acquire(&mi_epoch_global));
+  mi_atomic(thread_fence)(mi_memory_order(seq_cst));
+}
+
+void mi_epoch_exit(void) mi_attr_noexcept {
+  mi_epoch_thread_t* t = mi_epoch_thread;
+  mi_assert(t != NULL && t->nesting > 0);
+  if (t == NULL || t->nesting == 0) return;
+  if (--t->nesting > 0) return;
+  mi_atomic_store_release(&t->epoch, (size_t)0);
+}
+
+// Try to advance the global epoch; returns the current global epoch
+static size_t mi_epoch_try_advance(void) {
+  mi_atomic(thread_fence)(mi_memory_order(seq_cst));
+  size_t epoch = mi_atomic_load_acquire(&mi_epoch_global);
+  for (mi_epoch_thread_t* t = mi_atomic_load_ptr_acquire(mi_epoch_thread_t, &mi_epoch_threads); t != NULL; t = t->next) {
+    const size_t e = mi_atomic_load_acquire(&t->epoch);
+    if (e != 0 && e != epoch) return epoch;   // a thread is still in an earlier epoch
+  }
+  size_t next = (epoch + 1 == 0 ? 1 : epoch + 1);
+  if (mi_atomic_cas_strong_acq_rel(&mi_epoch_global, &epoch, next)) return next;
+  return epoch;  // someone else advanced (and `epoch` is updated)
+}
+
+static bool mi_epoch_expired(size_t bag_epoch, size_t global_epoch) {
+  return (global_epoch - bag_epoch >= 2);  // (also correct on wrap around)
+}
+
+
+/* -----------------------------------------------------------
+  Retire and free
+----------------------------------------------------------- */
+
+static void mi_epoch_bags_free(mi_epoch_bag_t* bag) {
+  while (bag != NULL) {
+    mi_epoch_bag_t* next = bag->next;
+    for (size_t i = 0; i < bag->count; i++) {
+      mi_free(bag->blocks[i]);
+    }
+    mi_free(bag);
+    bag = next;
+  }
+}
+
+// Free the expired bags of this thread (the bags are ordered by epoch, newest first)
+static void mi_epoch_thread_collect(mi_epoch_thread_t* t, size_t global_epoch) {
+  mi_epoch_bag_t** link = &t->bags;
+  while (*link != NULL && !mi_epoch_expired((*link)->epoch, global_epoch)) {
+    link = &(*link)->next;
+  }
+  mi_epoch_bag_t* expired = *link;
+  *link = NULL;
+  mi_epoch_bags_free(expired);
+}
+
+static void mi_epoch_orphans_push(mi_epoch_bag_t* first) {
+  if (first == NULL) return;
+  mi_epoch_bag_t* last = first;
+  while (last->next != NULL) { last = last->next; }
+  mi_epoch_bag_t* next = mi_atomic_load_ptr_relaxed(mi_epoch_bag_t, &mi_epoch_orphans);
+  do {
+    last->next = next;
+  } while (!mi_atomic_cas_ptr_weak_release(mi_epoch_bag_t, &mi_epoch_orphans, &next, first));
+}
+
+// Free the expired bags of terminated threads
+static void mi_epoch_orphans_collect(size_t global_epoch) {
+  if (mi_atomic_load_ptr_relaxed(mi_epoch_bag_t, &mi_epoch_orphans) == NULL) return;
+  mi_epoch_bag_t* bag = mi_atomic_exchange_ptr_acq_rel(mi_epoch_bag_t, &mi_epoch_orphans, NULL);
+  mi_epoch_bag_t* keep = NULL;
+  while (bag != NULL) {
+    mi_epoch_bag_t* next = bag->next;
+    if (mi_epoch_expired(bag->epoch, global_epoch)) {
+      bag->next = NULL;
+      mi_epoch_bags_free(bag);
+    }
+    else {
+      bag->next = keep;
+      keep = bag;
+    }
+    bag = next;
+  }
+  mi_epoch_orphans_push(keep);
+}
+
+void mi_free_deferred(void* p) mi_attr_noexcept {
+  if (p == NULL) return;
+  mi_epoch_thread_t* t = mi_epoch_thread_get();
+  if (t == NULL) return;  // out of memory: leak the block as it cannot be freed safely
+  // the block is already unlinked so any thread that enters from now on cannot reach it
+  mi_atomic(thread_fence)(mi_memory_order(seq_cst));
+  const size_t epoch = mi_atomic_load_acquire(&mi_epoch_global);
+  mi_epoch_bag_t* bag = t->bags;
+  if (bag == NULL || bag->count >= MI_EPOCH_BAG_SIZE) {
+    // start a new bag; try to advance and free expired bags first (which may reuse their memory)
+    if (bag != NULL) {
+      const size_t global_epoch = mi_epoch_try_advance();
+      mi_epoch_thread_collect(t, global_epoch);
+      mi_epoch_orphans_collect(global_epoch);
+    }
+    bag = mi_malloc_tp(mi_epoch_bag_t);
+    if (bag == NULL) {
+      _mi_error_message(ENOMEM, "unable to allocate a deferred free bag (%zu bytes)\n", sizeof(mi_epoch_bag_t));
+      return;
+    }
+    bag->count = 0;
+    bag->next = t->bags;
+    t->bags = bag;
+  }
+  bag->blocks[bag->count++] = p;
+  bag->epoch = epoch;  // the epoch of the last retired block
+}
+
+// Called on the heartbeat of a thread (from `_mi_deferred_free`)
+void _mi_epoch_collect(bool force) {
+  mi_epoch_thread_t* t = mi_epoch_thread;
+  const bool has_bags = (t != NULL && t->bags != NULL);
+  if (!has_bags && mi_atomic_load_ptr_relaxed(mi_epoch_bag_t, &mi_epoch_orphans) == NULL) return;
+  size_t global_epoch = mi_epoch_try_advance();
+  if (force && (t == NULL || t->nesting == 0)) {
+    global_epoch = mi_epoch_try_advance();  // a second time to also expire the most recent bags if possible
+  }
+  if (has_bags) { mi_epoch_thread_collect(t, global_epoch); }
+  mi_epoch_orphans_collect(global_epoch);
+}
+
+// Called when a thread terminates: leave any critical section and orphan the pending bags
+void _mi_epoch_thread_done(void) {
+  mi_epoch_thread_t* t = mi_epoch_thread;
+  if (t == NULL) return;
+  mi_epoch_thread = NULL;
+  t->nesting = 0;
+  mi_atomic_store_release(&t->epoch, (size_t)0);
+  const size_t global_epoch = mi_epoch_try_advance();
+  mi_epoch_thread_collect(t, global_epoch);
+  mi_epoch_orphans_push(t->bags);
+  t->bags = NULL;
+  mi_atomic_store_release(&t->owner, (uintptr_t)0);
+}
@@ -0,0 +1,156 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+A flight recorder of slow path events (enabled with the `event_log` option).
+
+Each thread records compact events (page fresh/free, segment alloc/free/
+abandon/reclaim, segment cache hit/miss, and commit/decommit/reset) with a
+cycle counter timestamp in its own ring buffer that holds the last
+`MI_EVENT_RING_SIZE` events. Events are only recorded on slow paths, never
+in the `_mi_page_malloc` or `mi_free` fast paths.
+
+A ring is only written by its owning thread so recording needs no locks.
+The rings are linked in a global list and never freed; when a thread
+terminates its ring is released (but keeps its events) and is reused by the
+next new thread. `mi_event_dump` prints all rings without taking locks or
+allocating such that it can also be called in a signal handler after a crash;
+it is also called when a heap corruption is detected (with `EFAULT`) before
+aborting. Events that are written concurrently with a dump may be torn.
+-----------------------------------------------------------------------------*/
+#include "mimalloc.h"
+#include "mimalloc-internal.h"
+#include "mimalloc-atomic.h"
+
+#define MI_EVENT_RING_SHIFT  (8)
+#define MI_EVENT_RING_SIZE   ((size_t)1 << MI_EVENT_RING_SHIFT)   // events per thread
+#define MI_EVENT_SIZE_SHIFT  (8)                                  // `info` is `size << 8 | kind`
+
+// A compact event (24 bytes)
+typedef struct mi_event_s {
+  uint64_t   tsc;       // cycle counter timestamp
+  uintptr_t  addr;      // page, segment or OS memory address
+  uint64_t   info;      // size (or block size) shifted by `MI_EVENT_SIZE_SHIFT`, and the `mi_event_kind_t`
+} mi_event_t;
+
+// The event ring of a thread
+typedef struct mi_event_ring_s {
+  struct mi_event_ring_s* next;               // list of all rings
+  _Atomic(uintptr_t)      owner;              // owning thread id (or 0 if the ring is free)
+  mi_threadid_t           thread_id;          // last owning thread (kept for a dump after the thread terminates)
+  _Atomic(size_t)         count;              // total events recorded by the owner
+  mi_event_t              events[MI_EVENT_RING_SIZE];
+} mi_event_ring_t;
+
+static _Atomic(mi_event_ring_t*) mi_event_rings;  // all rings (never freed)
+static uint64_t          mi_event_start_tsc;      // cycle counter and time at the first ring for estimating the cycle frequency
+static mi_usecs_t        mi_event_start_usecs;
+
+#define MI_EVENT_RING_DONE  ((mi_event_ring_t*)1)   // sentinel after the thread terminated
+
+static mi_decl_thread mi_event_ring_t* mi_event_ring;   // the ring of this thread (or NULL if not yet claimed)
+static mi_decl_thread bool mi_event_recurse;            // claiming a ring allocates OS memory which may record events itself
+
+static const char* mi_event_names[MI_EVENT_KIND_COUNT] = {
+  "none", "page-fresh", "page-free", "segment-alloc", "segment-free", "segment-abandon", "segment-reclaim",
+  "cache-hit", "cache-miss", "commit", "decommit", "reset", "thread-done"
+};
+
+
+/* -----------------------------------------------------------
+  Recording
+----------------------------------------------------------- */
+
+// Claim a free ring or allocate a fresh one
+static mi_event_ring_t* mi_event_ring_claim(void) {
+  const mi_threadid_t tid = _mi_thread_id();
+  for (mi_event_ring_t* ring = mi_atomic_load_ptr_acquire(mi_event_ring_t, &mi_event_rings); ring != NULL; ring = ring->next) {
+    uintptr_t expected = 0;
+    if (mi_atomic_load_relaxed(&ring->owner) == 0 && mi_atomic_cas_strong_acq_rel(&ring->owner, &expected, (uintptr_t)tid)) {
+      ring->thread_id = tid;
+      mi_atomic_store_release(&ring->count, (size_t)0);
+      return ring;
+    }
+  }
+  mi_event_ring_t* ring = (mi_event_ring_t*)_mi_os_alloc(sizeof(mi_event_ring_t), &_mi_stats_main);
+  if (ring == NULL) return NULL;
+  mi_atomic_store_relaxed(&ring->owner, (uintptr_t)tid);
+  ring->thread_id = tid;
+  if (mi_event_start_tsc == 0) {  // a race here is benign
+    mi_event_start_usecs = _mi_clock_usecs();
+    mi_event_start_tsc = _mi_cycles();
+  }
+  mi_event_ring_t* next = mi_atomic_load_ptr_relaxed(mi_event_ring_t, &mi_event_rings);
+  do {
+    ring->next = next;
+  } while (!mi_atomic_cas_ptr_weak_release(mi_event_ring_t, &mi_event_rings, &next, ring));
+  return ring;
+}
+
+void _mi_event_record(mi_event_kind_t kind, const void* addr, size_t size) {
+  mi_event_ring_t* ring = mi_event_ring;
+  if (mi_unlikely(ring == NULL)) {
+    if (mi_event_recurse || !mi_option_is_enabled(mi_option_event_log)) return;
+    mi_event_recurse = true;
+    ring = mi_event_ring_claim();
+    mi_event_recurse = false;
+    if (ring == NULL) return;
+    mi_event_ring = ring;
+  }
+  else if (ring == MI_EVENT_RING_DONE) {
+    return;
+  }
+  const size_t count = mi_atomic_load_relaxed(&ring->count);
+  mi_event_t* ev = &ring->events[count & (MI_EVENT_RING_SIZE - 1)];
+  ev->tsc  = _mi_cycles();
+  ev->addr = (uintptr_t)addr;
+  ev->info = ((uint64_t)size << MI_EVENT_SIZE_SHIFT) | (uint64_t)kind;
+  mi_atomic_store_release(&ring->count, count + 1);
+}
+
+// Called when a thread terminates: release the ring (but keep the events for a later dump)
+void _mi_event_thread_done(void) {
+  mi_event_ring_t* ring = mi_event_ring;
+  if (ring == NULL || ring == MI_EVENT_RING_DONE) return;
+  _mi_event_record(MI_EVENT_THREAD_DONE, NULL, 0);
+  mi_event_ring = MI_EVENT_RING_DONE;
+  mi_atomic_store_release(&ring->owner, (uintptr_t)0);
+}
+
+
+/* -----------------------------------------------------------
+  Dump
+----------------------------------------------------------- */
+
+static void mi_event_ring_print(const mi_event_ring_t* ring, uint64_t now, mi_output_fun* out, void* arg) {
+  const size_t count = mi_atomic_load_acquire(&((mi_event_ring_t*)ring)->count);
+  const size_t n = (count < MI_EVENT_RING_SIZE ? count : MI_EVENT_RING_SIZE);
+  const bool active = (mi_atomic_load_relaxed(&((mi_event_ring_t*)ring)->owner) != 0);
+  _mi_fprintf(out, arg, "thread 0x%zx%s: %zu events (last %zu)\n", (size_t)ring->thread_id, (active ? "" : " (done)"), count, n);
+  for (size_t i = count - n; i < count; i++) {
+    const mi_event_t* ev = &ring->events[i & (MI_EVENT_RING_SIZE - 1)];
+    const size_t kind = (size_t)(ev->info & ((1 << MI_EVENT_SIZE_SHIFT) - 1));
+    const size_t size = (size_t)(ev->info >> MI_EVENT_SIZE_SHIFT);
+    const char* name = (kind < MI_EVENT_KIND_COUNT ? mi_event_names[kind] : "unknown");
+    const long long rel = (long long)(ev->tsc - now);   // usually negative
+    _mi_fprintf(out, arg, "  %14lld  %-16s %p  %zu\n", rel, name, (void*)ev->addr, size);
+  }
+}
+
+void mi_event_dump(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  const uint64_t now = _mi_cycles();
+  const uint64_t start = mi_event_start_tsc;
+  _mi_fprintf(out, arg, "slow path events (timestamps in cycles relative to now");
+  const mi_usecs_t usecs = _mi_clock_usecs() - mi_event_start_usecs;
+  if (start != 0 && now > start && usecs > 1000) {
+    _mi_fprintf(out, arg, ", about %zu cycles per micro-second", (size_t)((now - start) / (uint64_t)usecs));
+  }
+  _mi_fprintf(out, arg, "):\n");
+  for (mi_event_ring_t* ring = mi_atomic_load_ptr_acquire(mi_event_ring_t, &mi_event_rings); ring != NULL; ring = ring->next) {
+    mi_event_ring_print(ring, now, out, arg);
+  }
+}
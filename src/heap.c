@@ -182,6 +182,54 @@ void mi_collect(bool force) mi_attr_noexcept {
 }
 
 
+/* -----------------------------------------------------------
+  Incremental collection: collect a bounded number of pages
+  per call, resuming from a cursor in the heap.
+----------------------------------------------------------- */
+
+#define MI_COLLECT_STEP_BLOCKS  (32)    // delayed frees per page of the budget
+
+bool mi_heap_collect_step(mi_heap_t* heap, size_t max_pages) mi_attr_noexcept {
+  if (heap==NULL || !mi_heap_is_initialized(heap)) return false;
+  mi_assert(heap->thread_id == _mi_thread_id());
+  if (max_pages == 0) max_pages = 1;
+
+  // free delayed blocks of other threads first (so their pages may become free)
+  if (!_mi_heap_delayed_free_partial(heap, max_pages * MI_COLLECT_STEP_BLOCKS)) return true;
+
+  // visit the pages from the cursor; the cursor page is advanced when it is removed from
+  // its queue (see `mi_page_queue_remove`), but as pages may be added or moved between steps,
+  // a page may be visited twice or skipped in a cycle (and is then visited in the next cycle)
+  mi_collect_t collect = MI_NORMAL;
+  size_t visited = 0;
+  while (heap->collect_bin <= MI_BIN_FULL) {
+    mi_page_queue_t* pq = &heap->pages[heap->collect_bin];
+    mi_page_t* page = (heap->collect_page != NULL ? heap->collect_page : pq->first);
+    if (page == NULL) {
+      heap->collect_bin++;
+      continue;
+    }
+    if (visited >= max_pages) {
+      heap->collect_page = page;
+      return true;
+    }
+    // advance the cursor first as the page may be freed or moved
+    heap->collect_page = page->next;
+    if (page->next == NULL) { heap->collect_bin++; }
+    visited++;
+    _mi_segment_page_collect_decommit(page, &heap->tld->segments);
+    mi_heap_page_collect(heap, pq, page, &collect, NULL);
+  }
+
+  // all pages are visited: free expired retired pages and decommit expired segments in the cache
+  _mi_heap_collect_retired(heap, false);
+  _mi_segment_cache_collect(false, &heap->tld->os);
+  heap->collect_bin = 0;
+  heap->collect_page = NULL;
+  return false;
+}
+
+
 /* -----------------------------------------------------------
   Heap new
 ----------------------------------------------------------- */
@@ -200,13 +248,15 @@ mi_heap_t* mi_heap_get_backing(void) {
   return bheap;
 }
 
-mi_heap_t* mi_heap_new(void) {
+mi_decl_nodiscard mi_heap_t* mi_heap_new_in_arena(mi_arena_id_t arena_id) {
   mi_heap_t* bheap = mi_heap_get_backing();
   mi_heap_t* heap = mi_heap_malloc_tp(bheap, mi_heap_t);  // todo: OS allocate in secure mode?
   if (heap==NULL) return NULL;
   _mi_memcpy_aligned(heap, &_mi_heap_empty, sizeof(mi_heap_t));
+  _mi_heap_init_size_classes(heap);
   heap->tld = bheap->tld;
   heap->thread_id = _mi_thread_id();
+  heap->arena_id = arena_id;
   _mi_random_split(&bheap->random, &heap->random);
   heap->cookie  = _mi_heap_random_next(heap) | 1;
   heap->keys[0] = _mi_heap_random_next(heap);
@@ -218,6 +268,10 @@ mi_heap_t* mi_heap_new(void) {
   return heap;
 }
 
+mi_decl_nodiscard mi_heap_t* mi_heap_new(void) {
+  return mi_heap_new_in_arena(_mi_arena_id_none());
+}
+
 uintptr_t _mi_heap_random_next(mi_heap_t* heap) {
   return _mi_random_next(&heap->random);
 }
@@ -232,8 +286,11 @@ static void mi_heap_reset_pages(mi_heap_t* heap) {
   memset(&heap->pages_free_medium, 0, sizeof(heap->pages_free_medium));
 #endif
   _mi_memcpy_aligned(&heap->pages, &_mi_heap_empty.pages, sizeof(heap->pages));
+  _mi_heap_init_size_classes(heap);
   heap->thread_delayed_free = NULL;
   heap->page_count = 0;
+  heap->collect_bin = 0;
+  heap->collect_page = NULL;
 }
 
 // called from `mi_heap_destroy` and `mi_heap_delete` to free the internal heap resources.
@@ -283,7 +340,7 @@ static bool _mi_heap_page_destroy(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_
 
   // stats
   const size_t bsize = mi_page_block_size(page);
-  if (bsize > MI_MEDIUM_OBJ_SIZE_MAX) {
+  if (bsize > MI_LARGE_BIN_OBJ_SIZE_MAX) {
     if (bsize <= MI_LARGE_OBJ_SIZE_MAX) {
       mi_heap_stat_decrease(heap, large, bsize);
     }
@@ -294,7 +351,7 @@ static bool _mi_heap_page_destroy(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_
 #if (MI_STAT)
   _mi_page_free_collect(page, false);  // update used count
   const size_t inuse = page->used;
-  if (bsize <= MI_LARGE_OBJ_SIZE_MAX) {
+  if (bsize <= MI_LARGE_BIN_OBJ_SIZE_MAX) {
     mi_heap_stat_decrease(heap, normal, bsize * inuse);
 #if (MI_STAT>1)
     mi_heap_stat_decrease(heap, normal_bins[_mi_bin(bsize)], inuse);
@@ -409,6 +466,31 @@ mi_heap_t* mi_heap_set_default(mi_heap_t* heap) {
 }
 
 
+/* -----------------------------------------------------------
+  Heap transfer: hand the pages of a heap to a successor thread
+----------------------------------------------------------- */
+
+// Abandon all pages of `heap` and hand the segments that become abandoned (now, or later
+// until this thread is done) to thread `target_thread` (or any thread if 0) instead of
+// the global abandoned list. The target adopts them in one step when it needs a fresh
+// segment, or explicitly with `mi_thread_adopt_abandoned_from`. 
+bool mi_heap_transfer(mi_heap_t* heap, size_t target_thread) mi_attr_noexcept {
+  if (heap==NULL || !mi_heap_is_initialized(heap)) return false;
+  if (heap->thread_id != _mi_thread_id()) return false;
+  if (!_mi_segment_handoff_open(target_thread, &heap->tld->segments)) return false;
+  _mi_heap_collect_abandon(heap);
+  mi_assert_internal(heap->page_count==0);
+  return true;
+}
+
+// Adopt the segments handed off by thread `thread_id` (to this thread or to any thread) into the backing heap.
+size_t mi_thread_adopt_abandoned_from(size_t thread_id) mi_attr_noexcept {
+  if (thread_id == 0) return 0;
+  mi_heap_t* heap = mi_heap_get_backing();
+  return _mi_segment_handoff_adopt(heap, thread_id, &heap->tld->segments);
+}
+
+
 
 
 /* -----------------------------------------------------------
@@ -492,8 +574,8 @@ static bool mi_heap_area_visit_blocks(const mi_heap_area_ex_t* xarea, mi_block_v
   }
 
   // create a bitmap of free blocks.
-  #define MI_MAX_BLOCKS   (MI_SMALL_PAGE_SIZE / sizeof(void*))
-  uintptr_t free_map[MI_MAX_BLOCKS / sizeof(uintptr_t)];
+  #define MI_MAX_BLOCKS   (MI_ZU(1) << 16)  // `page->reserved` is 16-bit
+  uintptr_t free_map[MI_MAX_BLOCKS / MI_INTPTR_BITS];
   memset(free_map, 0, sizeof(free_map));
 
   size_t free_count = 0;
@@ -504,8 +586,8 @@ static bool mi_heap_area_visit_blocks(const mi_heap_area_ex_t* xarea, mi_block_v
     mi_assert_internal(offset % bsize == 0);
     size_t blockidx = offset / bsize;  // Todo: avoid division?
     mi_assert_internal( blockidx < MI_MAX_BLOCKS);
-    size_t bitidx = (blockidx / sizeof(uintptr_t));
-    size_t bit = blockidx - (bitidx * sizeof(uintptr_t));
+    size_t bitidx = (blockidx / MI_INTPTR_BITS);
+    size_t bit = blockidx - (bitidx * MI_INTPTR_BITS);
     free_map[bitidx] |= ((uintptr_t)1 << bit);
   }
   mi_assert_internal(page->capacity == (free_count + page->used));
@@ -513,11 +595,11 @@ static bool mi_heap_area_visit_blocks(const mi_heap_area_ex_t* xarea, mi_block_v
   // walk through all blocks skipping the free ones
   size_t used_count = 0;
   for (size_t i = 0; i < page->capacity; i++) {
-    size_t bitidx = (i / sizeof(uintptr_t));
-    size_t bit = i - (bitidx * sizeof(uintptr_t));
+    size_t bitidx = (i / MI_INTPTR_BITS);
+    size_t bit = i - (bitidx * MI_INTPTR_BITS);
     uintptr_t m = free_map[bitidx];
     if (bit == 0 && m == UINTPTR_MAX) {
-      i += (sizeof(uintptr_t) - 1); // skip a run of free blocks
+      i += (MI_INTPTR_BITS - 1); // skip a run of free blocks
     }
     else if ((m & ((uintptr_t)1 << bit)) == 0) {
       used_count++;
@@ -578,3 +660,140 @@ bool mi_heap_visit_blocks(const mi_heap_t* heap, bool visit_blocks, mi_block_vis
   mi_visit_blocks_args_t args = { visit_blocks, visitor, arg };
   return mi_heap_visit_areas(heap, &mi_heap_area_visitor, &args);
 }
+
+
+/* -----------------------------------------------------------
+  Fragmentation report
+
+  For each size class we report the distribution of the page occupancy
+  (`used/reserved`) and the bytes in the various free lists; and for each
+  segment a map of used, free and committed slices. This takes time linear
+  in the number of pages and free blocks and does not change the heap.
+----------------------------------------------------------- */
+
+#define MI_FRAG_OCCUPANCY   (10)      // occupancy histogram buckets (per 10%)
+#define MI_FRAG_SEGMENTS    (1024)    // maximal number of segments in the report
+
+typedef struct mi_frag_bin_s {
+  size_t pages;
+  size_t block_size;
+  size_t used;            // bytes in blocks in use (not counting blocks freed by other threads)
+  size_t free;            // bytes in the `free` list
+  size_t local_free;      // bytes in the `local_free` list
+  size_t thread_free;     // bytes in the `xthread_free` list (freed by other threads)
+  size_t unused;          // bytes reserved but not yet part of any free list (`reserved - capacity`)
+  size_t occupancy[MI_FRAG_OCCUPANCY];
+} mi_frag_bin_t;
+
+typedef struct mi_frag_s {
+  mi_frag_bin_t       bins[MI_BIN_HUGE+1];
+  const mi_segment_t* segments[MI_FRAG_SEGMENTS];
+  size_t              segment_count;
+  size_t              segment_overflow;
+} mi_frag_t;
+
+static size_t mi_frag_list_count(const mi_page_t* page, const mi_block_t* block) {
+  size_t count = 0;
+  for (; block != NULL; block = mi_block_next(page, block)) { count++; }
+  return count;
+}
+
+static bool mi_heap_fragmentation_page(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_t* page, void* arg1, void* arg2) {
+  MI_UNUSED(heap); MI_UNUSED(pq); MI_UNUSED(arg2);
+  mi_frag_t* frag = (mi_frag_t*)arg1;
+  const size_t bsize = mi_page_block_size(page);
+  const size_t thread_free = mi_frag_list_count(page, mi_page_thread_free(page));
+  const size_t used = (page->used > thread_free ? page->used - thread_free : 0);
+  mi_frag_bin_t* bin = &frag->bins[_mi_bin(bsize)];
+  bin->pages++;
+  bin->block_size = (bin->block_size == 0 || bin->block_size == bsize ? bsize : 0); // 0 for mixed (huge) sizes
+  bin->used += used * bsize;
+  bin->free += mi_frag_list_count(page, page->free) * bsize;
+  bin->local_free += mi_frag_list_count(page, page->local_free) * bsize;
+  bin->thread_free += thread_free * bsize;
+  bin->unused += (size_t)(page->reserved - page->capacity) * bsize;
+  const size_t occ = (page->reserved == 0 ? 0 : (used * MI_FRAG_OCCUPANCY) / page->reserved);
+  bin->occupancy[occ >= MI_FRAG_OCCUPANCY ? MI_FRAG_OCCUPANCY - 1 : occ]++;
+
+  // remember the segment (pages of a segment are often visited consecutively)
+  const mi_segment_t* segment = _mi_page_segment(page);
+  for (size_t i = frag->segment_count; i > 0; i--) {
+    if (frag->segments[i-1] == segment) return true;
+  }
+  if (frag->segment_count < MI_FRAG_SEGMENTS) {
+    frag->segments[frag->segment_count++] = segment;
+  }
+  else {
+    frag->segment_overflow++;
+  }
+  return true;
+}
+
+static void mi_frag_print(const mi_frag_t* frag, mi_output_fun* out, void* arg) {
+  _mi_fprintf(out, arg, "%4s %10s %6s %12s %12s %12s %12s %12s  %s\n",
+              "bin", "block size", "pages", "used", "free", "local free", "thread free", "unused", "pages per occupancy (used/reserved): 0-10%, 10-20%, ..., 90-100%");
+  mi_frag_bin_t total;
+  memset(&total, 0, sizeof(total));
+  for (size_t i = 0; i <= MI_BIN_HUGE; i++) {
+    const mi_frag_bin_t* bin = &frag->bins[i];
+    if (bin->pages == 0) continue;
+    _mi_fprintf(out, arg, "%4zu %10zu %6zu %12zu %12zu %12zu %12zu %12zu ",
+                i, bin->block_size, bin->pages, bin->used, bin->free, bin->local_free, bin->thread_free, bin->unused);
+    for (size_t j = 0; j < MI_FRAG_OCCUPANCY; j++) {
+      _mi_fprintf(out, arg, " %zu", bin->occupancy[j]);
+    }
+    _mi_fprintf(out, arg, "\n");
+    total.pages += bin->pages;
+    total.used += bin->used;
+    total.free += bin->free;
+    total.local_free += bin->local_free;
+    total.thread_free += bin->thread_free;
+    total.unused += bin->unused;
+  }
+  _mi_fprintf(out, arg, "%4s %10s %6zu %12zu %12zu %12zu %12zu %12zu\n\n",
+              "all", "", total.pages, total.used, total.free, total.local_free, total.thread_free, total.unused);
+
+  _mi_fprintf(out, arg, "segment maps: one character per 8 slices of %zu KiB: '#' all used, '+' partly used, 'o' free and committed,\n"
+                        "  ':' free and partly committed, '.' free and decommitted\n", (size_t)(MI_SEGMENT_SLICE_SIZE / MI_KiB));
+  size_t free_committed = 0;
+  for (size_t i = 0; i < frag->segment_count; i++) {
+    free_committed += _mi_segment_fragmentation_print(frag->segments[i], out, arg);
+  }
+  if (frag->segment_overflow > 0) {
+    _mi_fprintf(out, arg, "(pages in %zu more segments are not shown)\n", frag->segment_overflow);
+  }
+  _mi_fprintf(out, arg, "segments: %zu, free and committed: %zu bytes\n", frag->segment_count, free_committed);
+}
+
+static void mi_fragmentation_report_ex(mi_heap_t* heap, bool all_heaps, mi_output_fun* out, void* arg) {
+  mi_frag_t* frag = (mi_frag_t*)_mi_os_alloc(sizeof(mi_frag_t), &_mi_stats_main);  // zero initialized
+  if (frag == NULL) return;
+  if (all_heaps) {
+    for (mi_heap_t* h = heap->tld->heaps; h != NULL; h = h->next) {
+      mi_heap_visit_pages(h, &mi_heap_fragmentation_page, frag, NULL);
+    }
+  }
+  else {
+    mi_heap_visit_pages(heap, &mi_heap_fragmentation_page, frag, NULL);
+  }
+  mi_frag_print(frag, out, arg);
+  _mi_os_free(frag, sizeof(mi_frag_t), &_mi_stats_main);
+}
+
+// Report the fragmentation of a heap (which must belong to the current thread)
+void mi_heap_fragmentation_report(mi_heap_t* heap, mi_output_fun* out, void* arg) mi_attr_noexcept {
+  if (heap == NULL || !mi_heap_is_initialized(heap)) return;
+  mi_assert(heap->thread_id == _mi_thread_id());
+  _mi_fprintf(out, arg, "fragmentation of heap %p:\n", heap);
+  mi_fragmentation_report_ex(heap, false, out, arg);
+}
+
+// Report the fragmentation of all heaps of the current thread.
+// The pages of other threads cannot be inspected safely while they are in use;
+// call this on each thread (or let threads terminate) to cover the whole process.
+void mi_fragmentation_report(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  mi_heap_t* heap = mi_heap_get_default();
+  if (!mi_heap_is_initialized(heap)) return;
+  _mi_fprintf(out, arg, "fragmentation of all heaps in thread 0x%zx:\n", _mi_thread_id());
+  mi_fragmentation_report_ex(heap, true, out, arg);
+}
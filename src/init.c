@@ -10,6 +10,12 @@ terms of the MIT license. A copy of the license can be found in the file
 #include <string.h>  // memcpy, memset
 #include <stdlib.h>  // atexit
 
+#ifdef MI_USDT_PROBES
+// USDT semaphores; incremented by a tracer when it attaches to a probe (see `mimalloc-usdt.h`)
+#define MI_USDT_SEMAPHORE_DEF(name)  volatile unsigned short MI_USDT_SEMAPHORE(name) __attribute__((used,section(".probes"))) = 0;
+MI_USDT_PROBES(MI_USDT_SEMAPHORE_DEF)
+#endif
+
 // Empty page used to initialize the small free pages array
 const mi_page_t _mi_page_empty = {
   0, false, false, false, false,
@@ -28,7 +34,9 @@ const mi_page_t _mi_page_empty = {
   MI_ATOMIC_VAR_INIT(0), // xthread_free
   MI_ATOMIC_VAR_INIT(0), // xheap
   NULL, NULL
-  #if MI_INTPTR_SIZE==8
+  #if MI_PROFILE
+  , MI_ATOMIC_VAR_INIT(0) // sampled
+  #elif MI_INTPTR_SIZE==8
   , { 0 }  // padding
   #endif
 };
@@ -45,7 +53,7 @@ const mi_page_t _mi_page_empty = {
 
 
 // Empty page queues for every bin
-#define QNULL(sz)  { NULL, NULL, (sz)*sizeof(uintptr_t) }
+#define QNULL(sz)  { NULL, NULL, (sz)*sizeof(uintptr_t), 0, 0 }
 #define MI_PAGE_QUEUES_EMPTY \
   { QNULL(1), \
     QNULL(     1), QNULL(     2), QNULL(     3), QNULL(     4), QNULL(     5), QNULL(     6), QNULL(     7), QNULL(     8), /* 8 */ \
@@ -57,8 +65,8 @@ const mi_page_t _mi_page_empty = {
     QNULL( 10240), QNULL( 12288), QNULL( 14336), QNULL( 16384), QNULL( 20480), QNULL( 24576), QNULL( 28672), QNULL( 32768), /* 56 */ \
     QNULL( 40960), QNULL( 49152), QNULL( 57344), QNULL( 65536), QNULL( 81920), QNULL( 98304), QNULL(114688), QNULL(131072), /* 64 */ \
     QNULL(163840), QNULL(196608), QNULL(229376), QNULL(262144), QNULL(327680), QNULL(393216), QNULL(458752), QNULL(524288), /* 72 */ \
-    QNULL(MI_MEDIUM_OBJ_WSIZE_MAX + 1  /* 655360, Huge queue */), \
-    QNULL(MI_MEDIUM_OBJ_WSIZE_MAX + 2) /* Full queue */ }
+    QNULL(MI_LARGE_BIN_OBJ_WSIZE_MAX + 1) /* Huge queue */, \
+    QNULL(MI_LARGE_BIN_OBJ_WSIZE_MAX + 2) /* Full queue */ }
 
 #define MI_STAT_COUNT_NULL()  {0,0,0,0}
 
@@ -69,6 +77,12 @@ const mi_page_t _mi_page_empty = {
 #define MI_STAT_COUNT_END_NULL()
 #endif
 
+#if MI_LATENCY
+#define MI_STAT_LATENCY_END_NULL()  , { { 0, 0, 0, { 0 } } }
+#else
+#define MI_STAT_LATENCY_END_NULL()
+#endif
+
 #define MI_STATS_NULL  \
   MI_STAT_COUNT_NULL(), MI_STAT_COUNT_NULL(), \
   MI_STAT_COUNT_NULL(), MI_STAT_COUNT_NULL(), \
@@ -79,18 +93,36 @@ const mi_page_t _mi_page_empty = {
   MI_STAT_COUNT_NULL(), MI_STAT_COUNT_NULL(), \
   { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },     \
   { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } \
-  MI_STAT_COUNT_END_NULL()
+  MI_STAT_COUNT_END_NULL() \
+  MI_STAT_LATENCY_END_NULL()
 
 
-// Empty slice span queues for every bin
+// Empty slice span queues for every bin (up to `MI_SEGMENT_BIN_MAX`)
 #define SQNULL(sz)  { NULL, NULL, sz }
-#define MI_SEGMENT_SPAN_QUEUES_EMPTY \
-  { SQNULL(1), \
+#define MI_SEGMENT_SPAN_QUEUES_128 \
+    SQNULL(1), \
     SQNULL(     1), SQNULL(     2), SQNULL(     3), SQNULL(     4), SQNULL(     5), SQNULL(     6), SQNULL(     7), SQNULL(    10), /*  8 */ \
     SQNULL(    12), SQNULL(    14), SQNULL(    16), SQNULL(    20), SQNULL(    24), SQNULL(    28), SQNULL(    32), SQNULL(    40), /* 16 */ \
-    SQNULL(    48), SQNULL(    56), SQNULL(    64), SQNULL(    80), SQNULL(    96), SQNULL(   112), SQNULL(   128), SQNULL(   160), /* 24 */ \
-    SQNULL(   192), SQNULL(   224), SQNULL(   256), SQNULL(   320), SQNULL(   384), SQNULL(   448), SQNULL(   512), SQNULL(   640), /* 32 */ \
-    SQNULL(   768), SQNULL(   896), SQNULL(  1024) /* 35 */ }
+    SQNULL(    48), SQNULL(    56), SQNULL(    64), SQNULL(    80), SQNULL(    96), SQNULL(   112), SQNULL(   128)                  /* 23 */
+#define MI_SEGMENT_SPAN_QUEUES_256   MI_SEGMENT_SPAN_QUEUES_128,  SQNULL(   160), SQNULL(   192), SQNULL(   224), SQNULL(   256)  /* 27 */
+#define MI_SEGMENT_SPAN_QUEUES_512   MI_SEGMENT_SPAN_QUEUES_256,  SQNULL(   320), SQNULL(   384), SQNULL(   448), SQNULL(   512)  /* 31 */
+#define MI_SEGMENT_SPAN_QUEUES_1024  MI_SEGMENT_SPAN_QUEUES_512,  SQNULL(   640), SQNULL(   768), SQNULL(   896), SQNULL(  1024)  /* 35 */
+#define MI_SEGMENT_SPAN_QUEUES_2048  MI_SEGMENT_SPAN_QUEUES_1024, SQNULL(  1280), SQNULL(  1536), SQNULL(  1792), SQNULL(  2048)  /* 39 */
+#define MI_SEGMENT_SPAN_QUEUES_4096  MI_SEGMENT_SPAN_QUEUES_2048, SQNULL(  2560), SQNULL(  3072), SQNULL(  3584), SQNULL(  4096)  /* 43 */
+
+#if (MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT == 7)
+#define MI_SEGMENT_SPAN_QUEUES_EMPTY  { MI_SEGMENT_SPAN_QUEUES_128 }
+#elif (MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT == 8)
+#define MI_SEGMENT_SPAN_QUEUES_EMPTY  { MI_SEGMENT_SPAN_QUEUES_256 }
+#elif (MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT == 9)
+#define MI_SEGMENT_SPAN_QUEUES_EMPTY  { MI_SEGMENT_SPAN_QUEUES_512 }
+#elif (MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT == 10)
+#define MI_SEGMENT_SPAN_QUEUES_EMPTY  { MI_SEGMENT_SPAN_QUEUES_1024 }
+#elif (MI_SEGMENT_SHIFT - MI_SEGMENT_SLICE_SHIFT == 11)
+#define MI_SEGMENT_SPAN_QUEUES_EMPTY  { MI_SEGMENT_SPAN_QUEUES_2048 }
+#else
+#define MI_SEGMENT_SPAN_QUEUES_EMPTY  { MI_SEGMENT_SPAN_QUEUES_4096 }
+#endif
 
 
 // --------------------------------------------------------
@@ -108,11 +140,14 @@ mi_decl_cache_align const mi_heap_t _mi_heap_empty = {
   MI_PAGE_QUEUES_EMPTY,
   MI_ATOMIC_VAR_INIT(NULL),
   0,                // tid
+  0,                // arena id
   0,                // cookie
   { 0, 0 },         // keys
   { {0}, {0}, 0 },
   0,                // page count
   MI_BIN_FULL, 0,   // page retired min/max
+  0, NULL,          // collect step cursor
+  0,                // sample countdown
   NULL,             // next
   false
 };
@@ -124,7 +159,7 @@ mi_decl_cache_align static const mi_tld_t tld_empty = {
   0,
   false,
   NULL, NULL,
-  { MI_SEGMENT_SPAN_QUEUES_EMPTY, 0, 0, 0, 0, tld_empty_stats, tld_empty_os }, // segments
+  { MI_SEGMENT_SPAN_QUEUES_EMPTY, { 0 }, 0, 0, 0, 0, tld_empty_stats, tld_empty_os, NULL }, // segments
   { 0, tld_empty_stats }, // os
   { MI_STATS_NULL }       // stats
 };
@@ -137,7 +172,7 @@ extern mi_heap_t _mi_heap_main;
 static mi_tld_t tld_main = {
   0, false,
   &_mi_heap_main, & _mi_heap_main,
-  { MI_SEGMENT_SPAN_QUEUES_EMPTY, 0, 0, 0, 0, &tld_main.stats, &tld_main.os }, // segments
+  { MI_SEGMENT_SPAN_QUEUES_EMPTY, { 0 }, 0, 0, 0, 0, &tld_main.stats, &tld_main.os, NULL }, // segments
   { 0, &tld_main.stats },  // os
   { MI_STATS_NULL }       // stats
 };
@@ -148,11 +183,14 @@ mi_heap_t _mi_heap_main = {
   MI_PAGE_QUEUES_EMPTY,
   MI_ATOMIC_VAR_INIT(NULL),
   0,                // thread id
+  0,                // arena id
   0,                // initial cookie
   { 0, 0 },         // the key of the main heap can be fixed (unlike page keys that need to be secure!)
   { {0x846ca68b}, {0}, 0 },  // random
   0,                // page count
   MI_BIN_FULL, 0,   // page retired min/max
+  0, NULL,          // collect step cursor
+  0,                // sample countdown
   NULL,             // next heap
   false             // can reclaim
 };
@@ -186,67 +224,162 @@ mi_heap_t* _mi_heap_main_get(void) {
 typedef struct mi_thread_data_s {
   mi_heap_t  heap;  // must come first due to cast in `_mi_heap_done`
   mi_tld_t   tld;
+  size_t     index; // index+1 in the thread data pool, or 0 if allocated directly from the OS
 } mi_thread_data_t;
 
 
-// Thread meta-data is allocated directly from the OS. For
-// some programs that do not use thread pools and allocate and
-// destroy many OS threads, this may causes too much overhead 
-// per thread so we maintain a small cache of recently freed metadata.
+// Thread meta-data is allocated from the OS in slabs of `MI_TD_SLAB_COUNT` entries.
+// Programs that do not use thread pools may create and destroy many OS threads
+// (like a thread per connection) and we do not want to allocate and free the
+// meta-data from the OS for each of them. Freed entries are kept in a lock-free
+// stack. If more than `mi_option_thread_data_cache` entries are idle, further
+// freed entries are reset (`_mi_os_reset`) so they no longer use physical memory.
+// Slabs are never freed as entries are popped concurrently from the free stack.
+// Only if the slab table is full (or the OS is out of memory) do we allocate
+// (and free) the meta-data of a thread directly from the OS.
+
+#define MI_TD_SLAB_COUNT  (16)       // entries per slab
+#define MI_TD_SLABS_MAX   (1024)     // at most 16k pooled thread data entries
+
+// The slab header is on its own OS page as the entries may be reset.
+typedef struct mi_td_slab_s {
+  _Atomic(uintptr_t) next[MI_TD_SLAB_COUNT];      // free stack links (index+1, or 0)
+  bool               is_reset[MI_TD_SLAB_COUNT];  // is the entry reset while on the free stack?
+} mi_td_slab_t;
+
+static _Atomic(mi_td_slab_t*) td_slabs[MI_TD_SLABS_MAX];
+static _Atomic(size_t)        td_slab_count;   // claimed slots in `td_slabs`
+static _Atomic(uintptr_t)     td_free;         // the free stack: a tag in the high bits and the top index+1 in the low bits
+static _Atomic(size_t)        td_free_count;   // entries on the free stack (approximately)
+
+#define MI_TD_TAG_SHIFT   (MI_INTPTR_BITS/2)
+#define MI_TD_INDEX_MASK  (((uintptr_t)1 << MI_TD_TAG_SHIFT) - 1)
+
+// entries are OS page aligned so they can be reset individually
+static size_t mi_td_entry_size(void) {
+  return _mi_align_up(sizeof(mi_thread_data_t), _mi_os_page_size());
+}
+
+static size_t mi_td_slab_size(void) {
+  return _mi_os_page_size() + (MI_TD_SLAB_COUNT * mi_td_entry_size());
+}
+
+static mi_td_slab_t* mi_td_slab_of(size_t idx) {
+  return mi_atomic_load_ptr_acquire(mi_td_slab_t, &td_slabs[idx / MI_TD_SLAB_COUNT]);
+}
+
+static mi_thread_data_t* mi_td_entry(mi_td_slab_t* slab, size_t idx) {
+  return (mi_thread_data_t*)((uint8_t*)slab + _mi_os_page_size() + ((idx % MI_TD_SLAB_COUNT) * mi_td_entry_size()));
+}
+
+static void mi_td_push(size_t idx) {
+  mi_td_slab_t* slab = mi_td_slab_of(idx);
+  uintptr_t head = mi_atomic_load_relaxed(&td_free);
+  uintptr_t next;
+  do {
+    mi_atomic_store_relaxed(&slab->next[idx % MI_TD_SLAB_COUNT], head & MI_TD_INDEX_MASK);
+    next = (((head >> MI_TD_TAG_SHIFT) + 1) << MI_TD_TAG_SHIFT) | (idx + 1);
+  } while (!mi_atomic_cas_weak_release(&td_free, &head, next));
+  mi_atomic_increment_relaxed(&td_free_count);
+}
+
+// returns the index+1 of a popped entry, or 0 if the free stack is empty
+static size_t mi_td_pop(void) {
+  uintptr_t head = mi_atomic_load_acquire(&td_free);
+  uintptr_t next;
+  size_t idx1;
+  do {
+    idx1 = (size_t)(head & MI_TD_INDEX_MASK);
+    if (idx1 == 0) return 0;
+    // the slab header is never freed so this read is safe even if the entry was popped concurrently (the tag protects against ABA)
+    const uintptr_t link = mi_atomic_load_relaxed(&mi_td_slab_of(idx1 - 1)->next[(idx1 - 1) % MI_TD_SLAB_COUNT]);
+    next = (((head >> MI_TD_TAG_SHIFT) + 1) << MI_TD_TAG_SHIFT) | link;
+  } while (!mi_atomic_cas_weak_acq_rel(&td_free, &head, next));
+  mi_atomic_decrement_relaxed(&td_free_count);
+  return idx1;
+}
 
-#define TD_CACHE_SIZE (8)
-static _Atomic(mi_thread_data_t*) td_cache[TD_CACHE_SIZE];
+// allocate a fresh slab, push all but the first entry, and return the index+1 of the first entry (or 0 on failure)
+static size_t mi_td_slab_alloc(void) {
+  if (mi_atomic_load_relaxed(&td_slab_count) >= MI_TD_SLABS_MAX) return 0;
+  const size_t slot = mi_atomic_increment_acq_rel(&td_slab_count);
+  if (slot >= MI_TD_SLABS_MAX) return 0;
+  mi_td_slab_t* slab = (mi_td_slab_t*)_mi_os_alloc(mi_td_slab_size(), &_mi_stats_main);
+  if (slab == NULL) return 0;  // the slot stays empty
+  mi_atomic_store_ptr_release(mi_td_slab_t, &td_slabs[slot], slab);
+  const size_t first = slot * MI_TD_SLAB_COUNT;
+  for (size_t i = MI_TD_SLAB_COUNT - 1; i > 0; i--) {
+    mi_td_push(first + i);
+  }
+  return first + 1;
+}
 
 static mi_thread_data_t* mi_thread_data_alloc(void) {
-  // try to find thread metadata in the cache
-  mi_thread_data_t* td;
-  for (int i = 0; i < TD_CACHE_SIZE; i++) {
-    td = mi_atomic_load_ptr_relaxed(mi_thread_data_t, &td_cache[i]);
-    if (td != NULL) {
-      td = mi_atomic_exchange_ptr_acq_rel(mi_thread_data_t, &td_cache[i], NULL); 
-      if (td != NULL) {
-        return td;
-      }
+  // try to pop thread metadata from the pool, or grow it with a new slab
+  size_t idx1 = mi_td_pop();
+  if (idx1 == 0) idx1 = mi_td_slab_alloc();
+  if (idx1 != 0) {
+    mi_td_slab_t* slab = mi_td_slab_of(idx1 - 1);
+    mi_thread_data_t* td = mi_td_entry(slab, idx1 - 1);
+    if (slab->is_reset[(idx1 - 1) % MI_TD_SLAB_COUNT]) {
+      slab->is_reset[(idx1 - 1) % MI_TD_SLAB_COUNT] = false;
+      _mi_stat_decrease(&_mi_stats_main.reset, mi_td_entry_size());  // the memory is simply reused
     }
+    td->index = idx1;
+    return td;
   }
   // if that fails, allocate directly from the OS
-  td = (mi_thread_data_t*)_mi_os_alloc(sizeof(mi_thread_data_t), &_mi_stats_main);
+  mi_thread_data_t* td = (mi_thread_data_t*)_mi_os_alloc(sizeof(mi_thread_data_t), &_mi_stats_main);
   if (td == NULL) {
     // if this fails, try once more. (issue #257)
     td = (mi_thread_data_t*)_mi_os_alloc(sizeof(mi_thread_data_t), &_mi_stats_main);
     if (td == NULL) {
       // really out of memory
       _mi_error_message(ENOMEM, "unable to allocate thread local heap metadata (%zu bytes)\n", sizeof(mi_thread_data_t));
+      return NULL;
     }
   }
+  td->index = 0;
   return td;
 }
 
+// reset an idle entry that is not on the free stack
+static void mi_td_reset(size_t idx) {
+  mi_td_slab_t* slab = mi_td_slab_of(idx);
+  if (slab->is_reset[idx % MI_TD_SLAB_COUNT]) return;
+  slab->is_reset[idx % MI_TD_SLAB_COUNT] = true;
+  _mi_os_reset(mi_td_entry(slab, idx), mi_td_entry_size(), &_mi_stats_main);
+}
+
 static void mi_thread_data_free( mi_thread_data_t* tdfree ) {
-  // try to add the thread metadata to the cache
-  for (int i = 0; i < TD_CACHE_SIZE; i++) {
-    mi_thread_data_t* td = mi_atomic_load_ptr_relaxed(mi_thread_data_t, &td_cache[i]);
-    if (td == NULL) {
-      mi_thread_data_t* expected = NULL;
-      if (mi_atomic_cas_ptr_weak_acq_rel(mi_thread_data_t, &td_cache[i], &expected, tdfree)) {
-        return;
-      }
-    }
+  const size_t idx1 = tdfree->index;
+  if (idx1 == 0) {
+    // not from the pool, free it directly
+    _mi_os_free(tdfree, sizeof(mi_thread_data_t), &_mi_stats_main);
+    return;
+  }
+  // release the physical memory if there are enough idle entries already
+  const long bound = mi_option_get(mi_option_thread_data_cache);
+  if (bound >= 0 && mi_atomic_load_relaxed(&td_free_count) >= (size_t)bound) {
+    mi_td_reset(idx1 - 1);
   }
-  // if that fails, just free it directly
-  _mi_os_free(tdfree, sizeof(mi_thread_data_t), &_mi_stats_main);
+  mi_td_push(idx1 - 1);
 }
 
 static void mi_thread_data_collect(void) {
-  // free all thread metadata from the cache
-  for (int i = 0; i < TD_CACHE_SIZE; i++) {
-    mi_thread_data_t* td = mi_atomic_load_ptr_relaxed(mi_thread_data_t, &td_cache[i]);
-    if (td != NULL) {
-      td = mi_atomic_exchange_ptr_acq_rel(mi_thread_data_t, &td_cache[i], NULL);
-      if (td != NULL) {
-        _mi_os_free( td, sizeof(mi_thread_data_t), &_mi_stats_main );
-      }
-    }
+  // reset all idle thread metadata in the pool
+  size_t idle = 0;
+  size_t idx1;
+  while ((idx1 = mi_td_pop()) != 0) {
+    mi_td_reset(idx1 - 1);
+    // chain the popped entries through their (unused) link so we can push them back
+    mi_atomic_store_relaxed(&mi_td_slab_of(idx1 - 1)->next[(idx1 - 1) % MI_TD_SLAB_COUNT], idle);
+    idle = idx1;
+  }
+  while (idle != 0) {
+    const size_t next = mi_atomic_load_relaxed(&mi_td_slab_of(idle - 1)->next[(idle - 1) % MI_TD_SLAB_COUNT]);
+    mi_td_push(idle - 1);
+    idle = next;
   }
 }
 
@@ -270,6 +403,7 @@ static bool _mi_heap_init(void) {
     mi_heap_t* heap = &td->heap;
     _mi_memcpy_aligned(tld, &tld_empty, sizeof(*tld));
     _mi_memcpy_aligned(heap, &_mi_heap_empty, sizeof(*heap));
+    _mi_heap_init_size_classes(heap);
     heap->thread_id = _mi_thread_id();
     _mi_random_init(&heap->random);
     heap->cookie  = _mi_heap_random_next(heap) | 1;
@@ -312,8 +446,12 @@ static bool _mi_heap_done(mi_heap_t* heap) {
 
   // collect if not the main thread
   if (heap != &_mi_heap_main) {
+    _mi_segment_handoff_adopt(heap, 0, &heap->tld->segments);  // adopt segments handed to us so they are abandoned as usual
     _mi_heap_collect_abandon(heap);
   }
+
+  // segments handed off by this thread can now be released once adopted
+  _mi_segment_handoff_close(&heap->tld->segments);
   
   // merge stats
   _mi_stats_done(&heap->tld->stats);  
@@ -430,6 +568,10 @@ void mi_thread_init(void) mi_attr_noexcept
   //_mi_verbose_message("thread init: 0x%zx\n", _mi_thread_id());
 }
 
+size_t mi_thread_id(void) mi_attr_noexcept {
+  return _mi_thread_id();
+}
+
 void mi_thread_done(void) mi_attr_noexcept {
   _mi_thread_done(mi_get_default_heap());
 }
@@ -440,9 +582,19 @@ static void _mi_thread_done(mi_heap_t* heap) {
 
   // check thread-id as on Windows shutdown with FLS the main (exit) thread may call this on thread-local heaps...
   if (heap->thread_id != _mi_thread_id()) return;
+  mi_usdt_probe2(thread_done, heap, heap->thread_id);
+
+  // leave any epoch and hand pending deferred frees to other threads
+  _mi_epoch_thread_done();
   
   // abandon the thread local heap
   if (_mi_heap_done(heap)) return;  // returns true if already ran
+
+  // release the event ring of this thread
+  _mi_event_thread_done();
+
+  // write the allocation trace of this thread
+  _mi_trace_thread_done();
 }
 
 void _mi_heap_set_default_direct(mi_heap_t* heap)  {
@@ -573,6 +725,9 @@ void mi_process_init(void) mi_attr_noexcept {
   mi_detect_cpu_features();
   _mi_os_init();
   mi_heap_main_init();
+  _mi_size_classes_init();
+  _mi_size_histogram_init();
+  _mi_trace_init();
   #if (MI_DEBUG)
   _mi_verbose_message("debug level : %d\n", MI_DEBUG);
   #endif
@@ -614,6 +769,9 @@ static void mi_process_done(void) {
   if (process_done) return;
   process_done = true;
 
+  // write the allocation traces before we free anything
+  _mi_trace_process_done();
+
   #if defined(_WIN32) && !defined(MI_SHARED_LIB)
   FlsFree(mi_fls_key);  // call thread-done on all threads (except the main thread) to prevent dangling callback pointer if statically linked with a DLL; Issue #208
   #endif
@@ -630,6 +788,12 @@ static void mi_process_done(void) {
   if (mi_option_is_enabled(mi_option_show_stats) || mi_option_is_enabled(mi_option_verbose)) {
     mi_stats_print(NULL);
   }
+  if (mi_option_is_enabled(mi_option_size_histogram)) {
+    mi_size_classes_print(NULL, NULL);
+  }
+  if (mi_option_is_enabled(mi_option_profile_lifetime)) {
+    mi_profile_lifetime_print(NULL, NULL);
+  }
   mi_allocator_done();  
   _mi_verbose_message("process done: 0x%zx\n", _mi_heap_main.thread_id);
   os_preloading = true; // don't call the C runtime anymore
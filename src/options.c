@@ -94,7 +94,13 @@ static mi_option_desc_t options[_mi_option_last] =
   { 8,    UNINIT, MI_OPTION(max_segment_reclaim)},// max. number of segment reclaims from the abandoned segments per try.  
   { 1,    UNINIT, MI_OPTION(allow_decommit) },    // decommit slices when no longer used (after decommit_delay milli-seconds)
   { 500,  UNINIT, MI_OPTION(segment_decommit_delay) }, // decommit delay in milli-seconds for freed segments
-  { 2,    UNINIT, MI_OPTION(decommit_extend_delay) }
+  { 2,    UNINIT, MI_OPTION(decommit_extend_delay) },
+  { 0,    UNINIT, MI_OPTION(size_histogram) },    // record a histogram of the requested sizes and suggest size classes at exit (needs MI_STAT>1)
+  { 10,   UNINIT, MI_OPTION(size_class_waste) },  // target internal waste (in percent) for suggested size classes
+  { 512*1024, UNINIT, MI_OPTION(profile_interval) }, // average bytes between heap profile samples (needs MI_PROFILE=1)
+  { 0,    UNINIT, MI_OPTION(profile_lifetime) },  // record lifetimes and cross-thread frees of the heap profile samples and print them at exit
+  { 0,    UNINIT, MI_OPTION(event_log) },         // record slow path events in a per-thread ring buffer
+  { 32,   UNINIT, MI_OPTION(thread_data_cache) }  // idle thread meta-data entries kept before resetting them
 };
 
 static void mi_option_init(mi_option_desc_t* desc);
@@ -408,6 +414,7 @@ static void mi_error_default(int err) {
   MI_UNUSED(err);
 #if (MI_DEBUG>0) 
   if (err==EFAULT) {
+    mi_event_dump(NULL, NULL);
     #ifdef _MSC_VER
     __debugbreak();
     #endif
@@ -416,6 +423,7 @@ static void mi_error_default(int err) {
 #endif
 #if (MI_SECURE>0)
   if (err==EFAULT) {  // abort on serious errors in secure mode (corrupted meta-data)
+    mi_event_dump(NULL, NULL);
     abort();
   }
 #endif
@@ -557,6 +565,11 @@ static bool mi_getenv(const char* name, char* result, size_t result_size) {
 #endif  // !MI_USE_ENVIRON
 #endif  // !MI_NO_GETENV
 
+// Read an environment variable that is not an option (like `MIMALLOC_SIZE_CLASSES`)
+bool _mi_getenv(const char* name, char* result, size_t result_size) {
+  return mi_getenv(name, result, result_size);
+}
+
 static void mi_option_init(mi_option_desc_t* desc) {  
   // Read option value from the environment
   char s[64+1];
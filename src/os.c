@@ -353,6 +353,7 @@ static void* mi_os_get_aligned_hint(size_t try_alignment, size_t size) {
 static bool mi_os_mem_free(void* addr, size_t size, bool was_committed, mi_stats_t* stats)
 {
   if (addr == NULL || size == 0) return true; // || _mi_os_is_huge_reserved(addr)
+  const uint64_t cycles = mi_latency_start();
   bool err = false;
 #if defined(_WIN32)
   DWORD errcode = 0;
@@ -383,6 +384,7 @@ static bool mi_os_mem_free(void* addr, size_t size, bool was_committed, mi_stats
 #endif
   if (was_committed) { _mi_stat_decrease(&stats->committed, size); }
   _mi_stat_decrease(&stats->reserved, size);
+  mi_latency_stop(stats, MI_LATENCY_OS_FREE, cycles);
   return !err;  
 }
 
@@ -707,6 +709,7 @@ static void* mi_os_mem_alloc(size_t size, size_t try_alignment, bool commit, boo
   if (size == 0) return NULL;
   if (!commit) allow_large = false;
   if (try_alignment == 0) try_alignment = 1; // avoid 0 to ensure there will be no divide by zero when aligning
+  const uint64_t cycles = mi_latency_start();
 
   void* p = NULL;
   /*
@@ -736,6 +739,7 @@ static void* mi_os_mem_alloc(size_t size, size_t try_alignment, bool commit, boo
     _mi_stat_increase(&stats->reserved, size);
     if (commit) { _mi_stat_increase(&stats->committed, size); }
   }
+  mi_latency_stop(stats, MI_LATENCY_OS_ALLOC, cycles);
   return p;
 }
 
@@ -889,6 +893,8 @@ static bool mi_os_commitx(void* addr, size_t size, bool commit, bool conservativ
   size_t csize;
   void* start = mi_os_page_align_areax(conservative, addr, size, &csize);
   if (csize == 0) return true;  // || _mi_os_is_huge_reserved(addr))
+  const mi_usecs_t tstart = mi_usdt_start(os_commit);
+  const uint64_t cycles = mi_latency_start();
   int err = 0;
   if (commit) {
     _mi_stat_increase(&stats->committed, size);  // use size for precise commit vs. decommit
@@ -949,6 +955,9 @@ static bool mi_os_commitx(void* addr, size_t size, bool commit, bool conservativ
     _mi_warning_message("%s error: start: %p, csize: 0x%zx, err: %i\n", commit ? "commit" : "decommit", start, csize, err);
     mi_mprotect_hint(err);
   }
+  mi_latency_stop(stats, (commit ? MI_LATENCY_OS_COMMIT : MI_LATENCY_OS_DECOMMIT), cycles);
+  mi_usdt_probe4(os_commit, start, csize, commit, mi_usdt_elapsed(tstart));
+  _mi_event_record((commit ? MI_EVENT_COMMIT : MI_EVENT_DECOMMIT), start, csize);
   mi_assert_internal(err == 0);
   return (err == 0);
 }
@@ -1034,7 +1043,13 @@ static bool mi_os_resetx(void* addr, size_t size, bool reset, mi_stats_t* stats)
 bool _mi_os_reset(void* addr, size_t size, mi_stats_t* tld_stats) {
   MI_UNUSED(tld_stats);
   mi_stats_t* stats = &_mi_stats_main;
-  return mi_os_resetx(addr, size, true, stats);
+  const mi_usecs_t start = mi_usdt_start(os_reset);
+  const uint64_t cycles = mi_latency_start();
+  const bool ok = mi_os_resetx(addr, size, true, stats);
+  mi_latency_stop(stats, MI_LATENCY_OS_RESET, cycles);
+  mi_usdt_probe3(os_reset, addr, size, mi_usdt_elapsed(start));
+  _mi_event_record(MI_EVENT_RESET, addr, size);
+  return ok;
 }
 
 /*
@@ -1441,3 +1456,44 @@ int _mi_os_numa_node_get(mi_os_tld_t* tld) {
   if (numa_node >= numa_count) { numa_node = numa_node % numa_count; }
   return (int)numa_node;
 }
+
+
+/* ----------------------------------------------------------------------------
+  Read a (small) text file without using the C runtime
+  (as this can be called before the C runtime is initialized).
+-----------------------------------------------------------------------------*/
+#if defined(_WIN32)
+bool _mi_os_read_file(const char* fname, char* buf, size_t buf_size) {
+  if (fname == NULL || buf == NULL || buf_size == 0) return false;
+  HANDLE h = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (h == INVALID_HANDLE_VALUE) return false;
+  DWORD n = 0;
+  const BOOL ok = ReadFile(h, buf, (DWORD)(buf_size - 1), &n, NULL);
+  CloseHandle(h);
+  if (!ok) return false;
+  buf[n] = 0;
+  return true;
+}
+#elif defined(__wasi__)
+bool _mi_os_read_file(const char* fname, char* buf, size_t buf_size) {
+  MI_UNUSED(fname); MI_UNUSED(buf); MI_UNUSED(buf_size);
+  return false;
+}
+#else
+#include <fcntl.h>
+bool _mi_os_read_file(const char* fname, char* buf, size_t buf_size) {
+  if (fname == NULL || buf == NULL || buf_size == 0) return false;
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0) return false;
+  size_t len = 0;
+  while (len < buf_size - 1) {
+    const ssize_t n = read(fd, buf + len, buf_size - 1 - len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    len += (size_t)n;
+  }
+  close(fd);
+  buf[len] = 0;
+  return true;
+}
+#endif
@@ -34,21 +34,30 @@ terms of the MIT license. A copy of the license can be found in the file
 
 
 static inline bool mi_page_queue_is_huge(const mi_page_queue_t* pq) {
-  return (pq->block_size == (MI_MEDIUM_OBJ_SIZE_MAX+sizeof(uintptr_t)));
+  return (pq->block_size == (MI_LARGE_BIN_OBJ_SIZE_MAX+sizeof(uintptr_t)));
 }
 
 static inline bool mi_page_queue_is_full(const mi_page_queue_t* pq) {
-  return (pq->block_size == (MI_MEDIUM_OBJ_SIZE_MAX+(2*sizeof(uintptr_t))));
+  return (pq->block_size == (MI_LARGE_BIN_OBJ_SIZE_MAX+(2*sizeof(uintptr_t))));
 }
 
 static inline bool mi_page_queue_is_special(const mi_page_queue_t* pq) {
-  return (pq->block_size > MI_MEDIUM_OBJ_SIZE_MAX);
+  return (pq->block_size > MI_LARGE_BIN_OBJ_SIZE_MAX);
 }
 
 /* -----------------------------------------------------------
   Bins
 ----------------------------------------------------------- */
 
+// A custom size class table (see `_mi_size_classes_init`) replaces
+// the default bins up to `MI_MEDIUM_OBJ_SIZE_MAX`: `mi_bins_of_wsize` maps
+// a word size to its bin (and is only allocated when custom size classes are used),
+// and `mi_bins_size` holds the block size of each bin.
+// Larger sizes still use the default large bins.
+static bool     mi_bins_custom;
+static uint8_t* mi_bins_of_wsize;  // MI_MEDIUM_OBJ_WSIZE_MAX+1 entries
+static size_t  mi_bins_size[MI_BIN_HUGE];
+
 // Return the bin for a given field size.
 // Returns MI_BIN_HUGE if the size is too large.
 // We use `wsize` for the size in "machine word sizes",
@@ -56,7 +65,10 @@ static inline bool mi_page_queue_is_special(const mi_page_queue_t* pq) {
 static inline uint8_t mi_bin(size_t size) {
   size_t wsize = _mi_wsize_from_size(size);
   uint8_t bin;
-  if (wsize <= 1) {
+  if (mi_unlikely(mi_bins_custom) && wsize <= MI_MEDIUM_OBJ_WSIZE_MAX) {
+    bin = mi_bins_of_wsize[wsize];
+  }
+  else if (wsize <= 1) {
     bin = 1;
   }
   #if defined(MI_ALIGN4W)
@@ -72,7 +84,7 @@ static inline uint8_t mi_bin(size_t size) {
     bin = (uint8_t)wsize;
   }
   #endif
-  else if (wsize > MI_MEDIUM_OBJ_WSIZE_MAX) {
+  else if (wsize > MI_LARGE_BIN_OBJ_WSIZE_MAX) {
     bin = MI_BIN_HUGE;
   }
   else {
@@ -103,17 +115,17 @@ uint8_t _mi_bin(size_t size) {
 }
 
 size_t _mi_bin_size(uint8_t bin) {
+  if (mi_unlikely(mi_bins_custom) && bin < MI_BIN_HUGE) return mi_bins_size[bin];
   return _mi_heap_empty.pages[bin].block_size;
 }
 
 // Good size for allocation
 size_t mi_good_size(size_t size) mi_attr_noexcept {
-  if (size <= MI_MEDIUM_OBJ_SIZE_MAX) {
-    return _mi_bin_size(mi_bin(size));
-  }
-  else {
-    return _mi_align_up(size,_mi_os_page_size());
+  if (size <= MI_LARGE_BIN_OBJ_SIZE_MAX) {
+    const uint8_t bin = mi_bin(size);
+    if (bin < MI_BIN_HUGE) return _mi_bin_size(bin);
   }
+  return _mi_align_up(size,_mi_os_page_size());
 }
 
 #if (MI_DEBUG>1)
@@ -186,7 +198,8 @@ static inline void mi_heap_queue_first_update(mi_heap_t* heap, const mi_page_que
     while( bin == mi_bin(prev->block_size) && prev > &heap->pages[0]) {
       prev--;
     }
-    start = 1 + _mi_wsize_from_size(prev->block_size);
+    // (with custom size classes the first bin can be larger than one word)
+    start = (bin == mi_bin(prev->block_size) ? 0 : 1 + _mi_wsize_from_size(prev->block_size));
     if (start > idx) start = idx;
   }
 
@@ -203,12 +216,21 @@ static bool mi_page_queue_is_empty(mi_page_queue_t* queue) {
 }
 */
 
+// Advance the cursor of `mi_heap_collect_step` if it is at a page that is unlinked from its queue
+static inline void mi_heap_collect_cursor_unlink(mi_heap_t* heap, const mi_page_t* page) {
+  if (mi_unlikely(heap->collect_page == page)) {
+    heap->collect_page = page->next;
+    if (page->next == NULL) { heap->collect_bin++; }
+  }
+}
+
 static void mi_page_queue_remove(mi_page_queue_t* queue, mi_page_t* page) {
   mi_assert_internal(page != NULL);
   mi_assert_expensive(mi_page_queue_contains(queue, page));
-  mi_assert_internal(page->xblock_size == queue->block_size || (page->xblock_size > MI_MEDIUM_OBJ_SIZE_MAX && mi_page_queue_is_huge(queue))  || (mi_page_is_in_full(page) && mi_page_queue_is_full(queue)));
+  mi_assert_internal(page->xblock_size == queue->block_size || (page->xblock_size > MI_LARGE_BIN_OBJ_SIZE_MAX && mi_page_queue_is_huge(queue))  || (mi_page_is_in_full(page) && mi_page_queue_is_full(queue)));
   mi_heap_t* heap = mi_page_heap(page);
 
+  mi_heap_collect_cursor_unlink(heap, page);
   if (page->prev != NULL) page->prev->next = page->next;
   if (page->next != NULL) page->next->prev = page->prev;
   if (page == queue->last)  queue->last = page->prev;
@@ -232,7 +254,7 @@ static void mi_page_queue_push(mi_heap_t* heap, mi_page_queue_t* queue, mi_page_
 
   mi_assert_internal(_mi_page_segment(page)->kind != MI_SEGMENT_HUGE);
   mi_assert_internal(page->xblock_size == queue->block_size ||
-                      (page->xblock_size > MI_MEDIUM_OBJ_SIZE_MAX) ||
+                      (page->xblock_size > MI_LARGE_BIN_OBJ_SIZE_MAX && mi_page_queue_is_huge(queue)) ||
                         (mi_page_is_in_full(page) && mi_page_queue_is_full(queue)));
 
   mi_page_set_in_full(page, mi_page_queue_is_full(queue));
@@ -254,6 +276,29 @@ static void mi_page_queue_push(mi_heap_t* heap, mi_page_queue_t* queue, mi_page_
 }
 
 
+// Push a page at the end of a queue, behind the page that is allocated from
+static void mi_page_queue_push_back(mi_heap_t* heap, mi_page_queue_t* queue, mi_page_t* page) {
+  mi_assert_internal(mi_page_heap(page) == heap);
+  mi_assert_internal(!mi_page_queue_contains(queue, page));
+  mi_assert_internal(_mi_page_segment(page)->kind != MI_SEGMENT_HUGE);
+  mi_assert_internal(page->xblock_size == queue->block_size);
+
+  mi_page_set_in_full(page, false);
+  page->prev = queue->last;
+  page->next = NULL;
+  if (queue->last != NULL) {
+    mi_assert_internal(queue->last->next == NULL);
+    queue->last->next = page;
+    queue->last = page;
+  }
+  else {
+    queue->first = queue->last = page;
+    mi_heap_queue_first_update(heap, queue);
+  }
+  heap->page_count++;
+}
+
+
 static void mi_page_queue_enqueue_from(mi_page_queue_t* to, mi_page_queue_t* from, mi_page_t* page) {
   mi_assert_internal(page != NULL);
   mi_assert_expensive(mi_page_queue_contains(from, page));
@@ -266,6 +311,7 @@ static void mi_page_queue_enqueue_from(mi_page_queue_t* to, mi_page_queue_t* fro
                      (page->xblock_size > MI_LARGE_OBJ_SIZE_MAX && mi_page_queue_is_full(to)));
 
   mi_heap_t* heap = mi_page_heap(page);
+  mi_heap_collect_cursor_unlink(heap, page);
   if (page->prev != NULL) page->prev->next = page->next;
   if (page->next != NULL) page->next->prev = page->prev;
   if (page == from->last)  from->last = page->prev;
@@ -323,9 +369,161 @@ size_t _mi_page_queue_append(mi_heap_t* heap, mi_page_queue_t* pq, mi_page_queue
     // append to end
     mi_assert_internal(pq->last!=NULL);
     mi_assert_internal(append->first!=NULL);
-    pq->last->next = append->first;
-    append->first->prev = pq->last;
+    mi_page_t* page = append->first;
+    pq->last->next = page;
+    page->prev = pq->last;
     pq->last = append->last;
+    // only the first page of a queue may be without free blocks (see `mi_find_free_page`),
+    // so the first appended page moves to the full queue if it has none
+    if (!mi_page_queue_is_special(pq)) {
+      _mi_page_free_collect(page, false);
+      if (!mi_page_immediate_available(page) && page->capacity == page->reserved) {
+        mi_page_queue_enqueue_from(&heap->pages[MI_BIN_FULL], pq, page);
+      }
+    }
   }
   return count;
 }
+
+
+/* -----------------------------------------------------------
+  Custom size classes
+
+  The `MIMALLOC_SIZE_CLASSES` environment variable can give a table of
+  block sizes (in bytes, ascending, separated by commas or white space)
+  to use instead of the default bins; it can also be the name of a file
+  that contains the table (where `#` starts a comment line).
+  A size table as suggested by `mi_size_classes_print` can be used directly.
+  Sizes are rounded up to a whole number of words, and `MI_SMALL_SIZE_MAX`
+  and `MI_MEDIUM_OBJ_SIZE_MAX` are always added so the direct small page
+  array and the full medium object range stay covered. The custom classes
+  use the bins below the default large bins, which stay in use for the
+  sizes beyond `MI_MEDIUM_OBJ_SIZE_MAX`.
+----------------------------------------------------------- */
+
+// The maximal number of custom size classes: the last default bin up to `MI_MEDIUM_OBJ_SIZE_MAX`
+size_t _mi_size_classes_max(void) {
+  size_t bin = 1;
+  while (_mi_heap_empty.pages[bin+1].block_size <= MI_MEDIUM_OBJ_SIZE_MAX) { bin++; }
+  return bin;
+}
+
+// Set the block sizes of the page queues of a (fresh) heap to the custom size classes
+void _mi_heap_init_size_classes(mi_heap_t* heap) {
+  if (mi_likely(!mi_bins_custom)) return;
+  for (size_t bin = 0; bin < MI_BIN_HUGE; bin++) {
+    mi_assert_internal(heap->pages[bin].first == NULL);
+    heap->pages[bin].block_size = mi_bins_size[bin];
+  }
+}
+
+static bool mi_size_classes_push(size_t* sizes, size_t* count, size_t size) {
+  if (*count > 0 && sizes[*count - 1] >= size) return true;  // already covered
+  if (*count >= _mi_size_classes_max()) {
+    _mi_warning_message("too many size classes (at most %zu can be used)\n", _mi_size_classes_max());
+    return false;
+  }
+  sizes[*count] = size;
+  *count += 1;
+  return true;
+}
+
+// Parse a size class table; returns the number of size classes or 0 on error.
+static size_t mi_size_classes_parse(const char* s, size_t* sizes) {
+  size_t count = 0;
+  size_t last = 0;
+  while (*s != 0) {
+    if (*s == '#') {
+      while (*s != 0 && *s != '\n') { s++; }
+    }
+    else if (*s == ',' || *s == ';' || *s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') {
+      s++;
+    }
+    else if (strncmp(s, "MIMALLOC_SIZE_CLASSES=", 22) == 0) {
+      s += 22;  // as printed by `mi_size_classes_print`
+    }
+    else if (*s >= '0' && *s <= '9') {
+      size_t size = 0;
+      while (*s >= '0' && *s <= '9') {
+        if (size <= MI_MEDIUM_OBJ_SIZE_MAX) { size = 10*size + (size_t)(*s - '0'); }
+        s++;
+      }
+      if (size == 0 || size > MI_MEDIUM_OBJ_SIZE_MAX) {
+        _mi_warning_message("invalid size class %zu (must be between 1 and %zu)\n", size, (size_t)MI_MEDIUM_OBJ_SIZE_MAX);
+        return 0;
+      }
+      // blocks are a whole number of words
+      const size_t asize = _mi_align_up(size, MI_INTPTR_SIZE);
+      if (asize != size) {
+        _mi_verbose_message("size class %zu is rounded up to %zu for alignment\n", size, asize);
+      }
+      if (size <= last) {
+        _mi_warning_message("size classes must be ascending (%zu follows %zu)\n", size, last);
+        return 0;
+      }
+      last = size;
+      if (asize > MI_SMALL_SIZE_MAX && !mi_size_classes_push(sizes, &count, MI_SMALL_SIZE_MAX)) return 0;
+      if (!mi_size_classes_push(sizes, &count, asize)) return 0;
+    }
+    else {
+      _mi_warning_message("invalid character '%c' in the size classes\n", *s);
+      return 0;
+    }
+  }
+  if (count == 0) return 0;
+  if (!mi_size_classes_push(sizes, &count, MI_SMALL_SIZE_MAX)) return 0;
+  if (!mi_size_classes_push(sizes, &count, MI_MEDIUM_OBJ_SIZE_MAX)) return 0;
+  return count;
+}
+
+static bool mi_size_classes_install(const size_t* sizes, size_t count) {
+  mi_assert_internal(count > 0 && count <= _mi_size_classes_max() && sizes[count-1] == MI_MEDIUM_OBJ_SIZE_MAX);
+  mi_bins_of_wsize = (uint8_t*)_mi_os_alloc(MI_MEDIUM_OBJ_WSIZE_MAX+1, &_mi_stats_main);
+  if (mi_bins_of_wsize == NULL) return false;
+  // bin 0 is never used, the bins beyond `count` up to the large bins stay empty,
+  // and the large bins keep their default size
+  mi_bins_size[0] = sizes[0];
+  for (size_t bin = 1; bin < MI_BIN_HUGE; bin++) {
+    mi_bins_size[bin] = (bin <= count ? sizes[bin-1] : _mi_heap_empty.pages[bin].block_size);
+  }
+  size_t bin = 1;
+  for (size_t wsize = 0; wsize <= MI_MEDIUM_OBJ_WSIZE_MAX; wsize++) {
+    while (_mi_wsize_from_size(mi_bins_size[bin]) < wsize) { bin++; }
+    mi_assert_internal(bin <= count);
+    mi_bins_of_wsize[wsize] = (uint8_t)bin;
+  }
+  mi_bins_custom = true;
+  return true;
+}
+
+// Called once on process initialization, before any heap is used.
+void _mi_size_classes_init(void) {
+  char buf[1024];
+  if (!_mi_getenv("mimalloc_size_classes", buf, sizeof(buf)) || buf[0] == 0) return;
+  mi_heap_t* heap = _mi_heap_main_get();
+  if (heap->page_count > 0) {
+    _mi_warning_message("custom size classes can only be set before the first allocation\n");
+    return;
+  }
+  const char* table = buf;
+  char text[1024];
+  if (!(buf[0] >= '0' && buf[0] <= '9')) {
+    if (!_mi_os_read_file(buf, text, sizeof(text))) {
+      _mi_warning_message("unable to read the size classes from \"%s\"\n", buf);
+      return;
+    }
+    table = text;
+  }
+  size_t sizes[MI_BIN_HUGE];
+  const size_t count = mi_size_classes_parse(table, sizes);
+  if (count == 0) {
+    _mi_warning_message("invalid size classes; using the default size classes instead\n");
+    return;
+  }
+  if (!mi_size_classes_install(sizes, count)) {
+    _mi_warning_message("unable to allocate the size classes; using the default size classes instead\n");
+    return;
+  }
+  _mi_heap_init_size_classes(heap);
+  _mi_verbose_message("using %zu custom size classes\n", count);
+}
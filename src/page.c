@@ -38,6 +38,7 @@ static inline mi_block_t* mi_page_block_at(const mi_page_t* page, void* page_sta
 
 static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t size, mi_tld_t* tld);
 static void mi_page_extend_free(mi_heap_t* heap, mi_page_t* page, mi_tld_t* tld);
+static void mi_page_to_full(mi_page_t* page, mi_page_queue_t* pq);
 
 #if (MI_DEBUG>=3)
 static size_t mi_page_list_count(mi_page_t* page, mi_block_t* head) {
@@ -115,7 +116,7 @@ bool _mi_page_is_valid(mi_page_t* page) {
     if (segment->kind != MI_SEGMENT_HUGE) {
       mi_page_queue_t* pq = mi_page_queue_of(page);
       mi_assert_internal(mi_page_queue_contains(pq, page));
-      mi_assert_internal(pq->block_size==mi_page_block_size(page) || mi_page_block_size(page) > MI_MEDIUM_OBJ_SIZE_MAX || mi_page_is_in_full(page));
+      mi_assert_internal(pq->block_size==mi_page_block_size(page) || (mi_page_block_size(page) > MI_LARGE_BIN_OBJ_SIZE_MAX && mi_page_queue_is_huge(pq)) || mi_page_is_in_full(page));
       mi_assert_internal(mi_heap_contains_queue(mi_page_heap(page),pq));
     }
   }
@@ -236,20 +237,81 @@ void _mi_page_reclaim(mi_heap_t* heap, mi_page_t* page) {
   mi_assert_internal(mi_page_thread_free_flag(page) != MI_NEVER_DELAYED_FREE);
   mi_assert_internal(_mi_page_segment(page)->kind != MI_SEGMENT_HUGE);
   mi_assert_internal(!page->is_reset);
-  // TODO: push on full queue immediately if it is full?
   mi_page_queue_t* pq = mi_page_queue(heap, mi_page_block_size(page));
-  mi_page_queue_push(heap, pq, page);
+  if (mi_page_queue_is_special(pq)) {
+    mi_page_queue_push(heap, pq, page);
+  }
+  else {
+    // only the first page of a queue may be without free blocks (see `mi_find_free_page`),
+    // so a reclaimed page goes to the end of the queue, or to the full queue if it has none
+    _mi_page_free_collect(page, false);
+    mi_page_queue_push_back(heap, pq, page);
+    if (pq->first != page && !mi_page_immediate_available(page) && page->capacity == page->reserved) {
+      mi_page_to_full(page, pq);
+    }
+  }
   mi_assert_expensive(_mi_page_is_valid(page));
 }
 
+/* -----------------------------------------------------------
+  Adaptive page sizes.
+  A size class that needs fresh pages in quick succession gets
+  larger pages (doubling up to `MI_MEDIUM_PAGE_SIZE`, or
+  `MI_PAGE_LARGE_MAX_BLOCKS` blocks for large size classes) so it
+  takes the slow path less often, while a size class that rarely
+  needs a fresh page gets smaller pages (halving down to one slice,
+  or `MI_PAGE_MIN_BLOCKS` blocks) to reserve less memory for just a
+  few blocks. The demand is measured in heartbeats of the thread
+  (i.e. calls to the generic allocation path) between fresh pages.
+----------------------------------------------------------- */
+
+#define MI_PAGE_HOT_BEATS     (128)        // double the page size if the previous fresh page is at most this many heartbeats ago
+#define MI_PAGE_COLD_BEATS    (16*1024)    // halve the page size if the previous fresh page is at least this many heartbeats ago
+#define MI_PAGE_MIN_BLOCKS    (4)          // minimal number of blocks in a page
+#define MI_PAGE_LARGE_MAX_BLOCKS (8)       // maximal number of blocks in a page of a large size class
+
+// Return the size of the next fresh page for the queue `pq` (or 0 for the huge queue)
+static size_t mi_page_fresh_size(mi_heap_t* heap, mi_page_queue_t* pq) {
+  const size_t bsize = pq->block_size;
+  if (bsize > MI_LARGE_BIN_OBJ_SIZE_MAX) return 0;
+  const size_t min_slices = _mi_divide_up(MI_PAGE_MIN_BLOCKS*bsize, MI_SEGMENT_SLICE_SIZE);
+  size_t max_slices = MI_MEDIUM_PAGE_SIZE / MI_SEGMENT_SLICE_SIZE;
+  if (bsize > MI_MEDIUM_OBJ_SIZE_MAX) {
+    max_slices = _mi_divide_up(MI_PAGE_LARGE_MAX_BLOCKS*bsize, MI_SEGMENT_SLICE_SIZE);
+  }
+  else if (max_slices * MI_SEGMENT_SLICE_SIZE / bsize > UINT16_MAX) {
+    max_slices = (UINT16_MAX * bsize) / MI_SEGMENT_SLICE_SIZE;  // `page->reserved` is 16-bit
+  }
+  mi_assert_internal(min_slices >= 1 && min_slices <= max_slices);
+  const uint32_t beat = (uint32_t)heap->tld->heartbeat;
+  size_t slices = pq->page_slices;
+  if (slices == 0) {
+    slices = min_slices;
+  }
+  else {
+    const uint32_t elapsed = beat - pq->fresh_beat;
+    if (elapsed <= MI_PAGE_HOT_BEATS) { slices *= 2; }
+    else if (elapsed >= MI_PAGE_COLD_BEATS) { slices /= 2; }
+  }
+  if (slices < min_slices) slices = min_slices;
+  if (slices > max_slices) slices = max_slices;
+  pq->page_slices = (uint32_t)slices;
+  pq->fresh_beat = beat;
+  return (slices * MI_SEGMENT_SLICE_SIZE);
+}
+
 // allocate a fresh page from a segment
 static mi_page_t* mi_page_fresh_alloc(mi_heap_t* heap, mi_page_queue_t* pq, size_t block_size) {
   mi_assert_internal(pq==NULL||mi_heap_contains_queue(heap, pq));
-  mi_page_t* page = _mi_segment_page_alloc(heap, block_size, &heap->tld->segments, &heap->tld->os);
+  const mi_usecs_t start = mi_usdt_start(page_fresh);
+  const size_t page_size = (pq == NULL ? 0 : mi_page_fresh_size(heap, pq));
+  mi_page_t* page = _mi_segment_page_alloc(heap, block_size, page_size, &heap->tld->segments, &heap->tld->os);
+  mi_usdt_probe4(page_fresh, heap, block_size, page, mi_usdt_elapsed(start));
   if (page == NULL) {
     // this may be out-of-memory, or an abandoned page was reclaimed (and in our queue)
     return NULL;
   }
+  _mi_event_record(MI_EVENT_PAGE_FRESH, page, block_size);
   mi_assert_internal(pq==NULL || _mi_page_segment(page)->kind != MI_SEGMENT_HUGE);
   mi_page_init(heap, page, block_size, heap->tld);
   mi_heap_stat_increase(heap, pages, 1);
@@ -293,6 +355,29 @@ void _mi_heap_delayed_free(mi_heap_t* heap) {
   }
 }
 
+// Free at most `max_blocks` delayed blocks; returns `true` if the delayed free list is empty.
+// Blocks are popped one at a time; since only the owning thread pops (and other
+// threads only push) there is no A-B-A problem.
+bool _mi_heap_delayed_free_partial(mi_heap_t* heap, size_t max_blocks) {
+  for (size_t count = 0; count < max_blocks; count++) {
+    mi_block_t* block = mi_atomic_load_ptr_acquire(mi_block_t, &heap->thread_delayed_free);
+    mi_block_t* next;
+    do {
+      if (block == NULL) return true;
+      next = mi_block_nextx(heap, block, heap->keys);
+    } while (!mi_atomic_cas_ptr_weak_acq_rel(mi_block_t, &heap->thread_delayed_free, &block, next));
+    if (!_mi_free_delayed_block(block)) {
+      // another thread has not yet reset the delayed_freeing flag; reinsert and try again in a later call
+      mi_block_t* dfree = mi_atomic_load_ptr_relaxed(mi_block_t, &heap->thread_delayed_free);
+      do {
+        mi_block_set_nextx(heap, block, dfree, heap->keys);
+      } while (!mi_atomic_cas_ptr_weak_release(mi_block_t, &heap->thread_delayed_free, &dfree, block));
+      return false;
+    }
+  }
+  return (mi_atomic_load_ptr_relaxed(mi_block_t, &heap->thread_delayed_free) == NULL);
+}
+
 /* -----------------------------------------------------------
   Unfull, abandon, free and retire
 ----------------------------------------------------------- */
@@ -375,12 +460,13 @@ void _mi_page_free(mi_page_t* page, mi_page_queue_t* pq, bool force) {
   mi_page_queue_remove(pq, page);
 
   // and free it
+  _mi_event_record(MI_EVENT_PAGE_FREE, page, mi_page_block_size(page));
   mi_page_set_heap(page,NULL);
   _mi_segment_page_free(page, force, segments_tld);
 }
 
 // Retire parameters
-#define MI_MAX_RETIRE_SIZE    MI_MEDIUM_OBJ_SIZE_MAX  
+#define MI_MAX_RETIRE_SIZE    MI_LARGE_BIN_OBJ_SIZE_MAX
 #define MI_RETIRE_CYCLES      (8)
 
 // Retire a page with no more used blocks
@@ -403,7 +489,7 @@ void _mi_page_retire(mi_page_t* page) mi_attr_noexcept {
   // how to check this efficiently though...
   // for now, we don't retire if it is the only page left of this size class.
   mi_page_queue_t* pq = mi_page_queue_of(page);
-  if (mi_likely(page->xblock_size <= MI_MAX_RETIRE_SIZE && !mi_page_is_in_full(page))) {
+  if (mi_likely(page->xblock_size <= MI_MAX_RETIRE_SIZE && !mi_page_queue_is_special(pq))) {
     if (pq->last==page && pq->first==page) { // the only page in the queue?
       mi_stat_counter_increase(_mi_stats_main.page_no_retire,1);
       page->retire_expire = 1 + (page->xblock_size <= MI_SMALL_OBJ_SIZE_MAX ? MI_RETIRE_CYCLES : MI_RETIRE_CYCLES/4);      
@@ -661,10 +747,11 @@ static void mi_page_init(mi_heap_t* heap, mi_page_t* page, size_t block_size, mi
 -------------------------------------------------------------*/
 
 // Find a page with free blocks of `page->block_size`.
-static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* pq, bool first_try)
+// (`visited` is the number of pages the caller already visited for this search)
+static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* pq, size_t visited, bool first_try)
 {
   // search through the pages in "next fit" order
-  size_t count = 0;
+  size_t count = visited;
   mi_page_t* page = pq->first;
   while (page != NULL)
   {
@@ -689,6 +776,7 @@ static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* p
     // 3. If the page is completely full, move it to the `mi_pages_full`
     // queue so we don't visit long-lived pages too often.
     mi_assert_internal(!mi_page_is_in_full(page) && !mi_page_immediate_available(page));
+    mi_assert_internal(visited == 0 && count == 1);  // only the first page may be without free blocks
     mi_page_to_full(page, pq);
 
     page = next;
@@ -701,7 +789,7 @@ static mi_page_t* mi_page_queue_find_free_ex(mi_heap_t* heap, mi_page_queue_t* p
     page = mi_page_fresh(heap, pq);
     if (page == NULL && first_try) {
       // out-of-memory _or_ an abandoned page with free blocks was reclaimed, try once again
-      page = mi_page_queue_find_free_ex(heap, pq, false);      
+      page = mi_page_queue_find_free_ex(heap, pq, 0, false);      
     }
   }
   else {
@@ -734,8 +822,25 @@ static inline mi_page_t* mi_find_free_page(mi_heap_t* heap, size_t size) {
       page->retire_expire = 0;
       return page; // fast path
     }
+
+    // the first page is already collected: extend it, or move it to the full queue
+    // so the search starts at the next page. Only the first page of a queue is
+    // allocated from, and every other page has free blocks: fresh pages, unfull pages
+    // (through the delayed free notification), and reclaimed or absorbed pages (which
+    // go to the full queue otherwise, see `_mi_page_reclaim` and `_mi_page_queue_append`).
+    // So the page queue itself is the index of pages with free blocks, and the search
+    // below succeeds at the next page.
+    if (page->capacity < page->reserved) {
+      mi_page_extend_free(heap, page, heap->tld);
+      mi_assert_internal(mi_page_immediate_available(page));
+      mi_heap_stat_counter_increase(heap, searches, 1);
+      page->retire_expire = 0;
+      return page;
+    }
+    mi_page_to_full(page, pq);
+    return mi_page_queue_find_free_ex(heap, pq, 1, true);
   }
-  return mi_page_queue_find_free_ex(heap, pq, true);
+  return mi_page_queue_find_free_ex(heap, pq, 0, true);
 }
 
 
@@ -751,9 +856,12 @@ static _Atomic(void*) deferred_arg; // = NULL
 
 void _mi_deferred_free(mi_heap_t* heap, bool force) {
   heap->tld->heartbeat++;
+  _mi_epoch_collect(force);
   if (deferred_free != NULL && !heap->tld->recurse) {
     heap->tld->recurse = true;
+    const uint64_t cycles = mi_latency_start();
     deferred_free(force, heap->tld->heartbeat, mi_atomic_load_ptr_relaxed(void,&deferred_arg));
+    mi_latency_stop(&heap->tld->stats, MI_LATENCY_DEFERRED_FREE, cycles);
     heap->tld->recurse = false;
   }
 }
@@ -768,7 +876,7 @@ void mi_register_deferred_free(mi_deferred_free_fun* fn, void* arg) mi_attr_noex
   General allocation
 ----------------------------------------------------------- */
 
-// Large and huge page allocation.
+// Large and huge page allocation for objects without a size class (see `MI_LARGE_BIN_OBJ_SIZE_MAX`).
 // Huge pages are allocated directly without being in a queue.
 // Because huge pages contain just one block, and the segment contains
 // just that page, we always treat them as abandoned and any thread
@@ -794,7 +902,10 @@ static mi_page_t* mi_large_huge_page_alloc(mi_heap_t* heap, size_t size) {
     }
     
     const size_t bsize = mi_page_usable_block_size(page);  // note: not `mi_page_block_size` to account for padding
-    if (bsize <= MI_LARGE_OBJ_SIZE_MAX) {
+    if (bsize <= MI_LARGE_BIN_OBJ_SIZE_MAX) {
+      // with custom size classes: counted as a normal block in `_mi_page_malloc`
+    }
+    else if (bsize <= MI_LARGE_OBJ_SIZE_MAX) {
       mi_heap_stat_increase(heap, large, bsize);
       mi_heap_stat_counter_increase(heap, large_count, 1);
     }
@@ -817,6 +928,10 @@ static mi_page_t* mi_find_page(mi_heap_t* heap, size_t size) mi_attr_noexcept {
       _mi_error_message(EOVERFLOW, "allocation request is too large (%zu bytes)\n", req_size);
       return NULL;
     }
+    else if (req_size <= (MI_LARGE_BIN_OBJ_SIZE_MAX - MI_PADDING_SIZE)) {
+      // large size class: pages with a few blocks each
+      return mi_find_free_page(heap, size);
+    }
     else {
       return mi_large_huge_page_alloc(heap,size);
     }
@@ -841,6 +956,8 @@ void* _mi_malloc_generic(mi_heap_t* heap, size_t size) mi_attr_noexcept
     if (mi_unlikely(!mi_heap_is_initialized(heap))) { return NULL; }
   }
   mi_assert_internal(mi_heap_is_initialized(heap));
+  const mi_usecs_t start = mi_usdt_start(malloc_generic);
+  const uint64_t cycles = mi_latency_start();
 
   // call potential deferred free routines
   _mi_deferred_free(heap, false);
@@ -858,6 +975,8 @@ void* _mi_malloc_generic(mi_heap_t* heap, size_t size) mi_attr_noexcept
   if (mi_unlikely(page == NULL)) { // out of memory
     const size_t req_size = size - MI_PADDING_SIZE;  // correct for padding_size in case of an overflow on `size`  
     _mi_error_message(ENOMEM, "unable to allocate memory (%zu bytes)\n", req_size);
+    mi_latency_stop(&heap->tld->stats, MI_LATENCY_MALLOC_GENERIC, cycles);
+    mi_usdt_probe4(malloc_generic, heap, size, MI_BIN_FULL, mi_usdt_elapsed(start));
     return NULL;
   }
 
@@ -865,5 +984,8 @@ void* _mi_malloc_generic(mi_heap_t* heap, size_t size) mi_attr_noexcept
   mi_assert_internal(mi_page_block_size(page) >= size);
 
   // and try again, this time succeeding! (i.e. this should never recurse)
-  return _mi_page_malloc(heap, page, size);
+  void* p = _mi_page_malloc(heap, page, size);
+  mi_latency_stop(&heap->tld->stats, MI_LATENCY_MALLOC_GENERIC, cycles);
+  mi_usdt_probe4(malloc_generic, heap, size, _mi_bin(mi_page_block_size(page)), mi_usdt_elapsed(start));
+  return p;
 }
@@ -0,0 +1,550 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+A sampling heap profiler (enabled with `MI_PROFILE=1`).
+
+Each heap counts down the bytes it allocates (in `_mi_page_malloc`), and when
+the countdown drops below zero the allocated block is sampled: we capture a
+backtrace, record the block in a side table together with the "bucket" of that
+backtrace, and set the `has_sampled` flag of its page. The flag makes `mi_free`
+take the generic path for that page where we remove the block again.
+Each page counts its live sampled blocks and the owning thread clears the flag
+once the count drops to zero. A free of an unsampled block on such a page only
+consults a lock-free counting filter of the sampled block addresses, and
+takes the lock on the side table only if the block may have been sampled.
+The distance between samples is exponentially distributed with a mean of
+`profile_interval` bytes (as in tcmalloc and gperftools), so each sample
+stands for `profile_interval` bytes on average.
+
+`mi_profile_dump` prints the sampled blocks per backtrace in the legacy
+pprof heap profile format (`heap_v2`) which `pprof` reads directly.
+
+With `profile_lifetime` enabled we also record the allocation time, the
+allocating thread, and the size class of each sample. When a sampled block is
+freed we add its lifetime to a histogram per size class, and count the free in
+a matrix of allocating versus freeing threads. `mi_profile_lifetime_print`
+prints both (and it is printed at exit as well).
+-----------------------------------------------------------------------------*/
+#include "mimalloc.h"
+#include "mimalloc-internal.h"
+#include "mimalloc-atomic.h"
+
+#include <stdio.h>   // snprintf
+#include <string.h>  // memcmp, memcpy
+
+#if MI_PROFILE
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>  // backtrace
+#define MI_PROFILE_BACKTRACE
+#endif
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define MI_PROFILE_MAX_DEPTH    (32)                    // maximal frames in a backtrace
+#define MI_PROFILE_SKIP_FRAMES  (2)                     // skip the profiler itself in a backtrace
+#define MI_PROFILE_BUCKETS      (4096)                  // hash table size for the backtrace buckets (power of 2)
+#define MI_PROFILE_CHUNK_SIZE   (64*MI_KiB)             // buckets are allocated in chunks from the OS
+#define MI_PROFILE_MIN_SAMPLES  (4096)                  // initial capacity of the sampled block table (power of 2)
+#define MI_PROFILE_RECHECK      ((ptrdiff_t)64*MI_MiB)  // bytes between checking the `profile_interval` option when not sampling
+#define MI_PROFILE_LIFETIMES    (14)                    // lifetime histogram buckets: below 1us, 4us, 16us, ..., 4^12us (~17s), and above
+#define MI_PROFILE_MAX_THREADS  (64)                    // threads in the transfer matrix (the last one counts all further threads)
+#define MI_PROFILE_FILTER       (4096)                  // entries in the counting filter of sampled blocks (power of 2)
+
+// All allocations with the same backtrace share a bucket
+typedef struct mi_profile_bucket_s {
+  struct mi_profile_bucket_s* next;   // next bucket in the hash chain
+  uintptr_t hash;
+  size_t    alloc_count;              // total sampled blocks
+  size_t    alloc_size;               // total requested bytes of the sampled blocks
+  size_t    live_count;               // currently live sampled blocks
+  size_t    live_size;                // currently live requested bytes
+  size_t    depth;
+  void*     frames[MI_PROFILE_MAX_DEPTH];
+} mi_profile_bucket_t;
+
+// A live sampled block
+typedef struct mi_profile_sample_s {
+  const void*          block;         // the sampled block (or NULL if the entry is unused)
+  size_t               size;          // requested size
+  mi_profile_bucket_t* bucket;        // backtrace of the allocation
+  mi_usecs_t           time;          // allocation time (or 0 if lifetimes are not recorded)
+  uint16_t             thread;        // index of the allocating thread in the transfer matrix
+  uint8_t              bin;           // size class of the block
+} mi_profile_sample_t;
+
+// Lifetimes and transfers of the freed samples (with `profile_lifetime` enabled)
+typedef struct mi_profile_lifetime_s {
+  size_t        lifetimes[MI_BIN_HUGE+1][MI_PROFILE_LIFETIMES];   // lifetime histogram per size class
+  size_t        cross_frees[MI_BIN_HUGE+1];                        // frees by another thread than the allocating one
+  size_t        transfers[MI_PROFILE_MAX_THREADS][MI_PROFILE_MAX_THREADS];  // frees per allocating (row) and freeing (column) thread
+  mi_threadid_t thread_ids[MI_PROFILE_MAX_THREADS];
+  size_t        thread_count;
+} mi_profile_lifetime_t;
+
+// All state is protected by `mi_profile_lock`
+static _Atomic(uintptr_t)   mi_profile_lock;
+static mi_profile_bucket_t* mi_profile_buckets[MI_PROFILE_BUCKETS];
+static size_t               mi_profile_bucket_count;
+static uint8_t*             mi_profile_chunk;             // current chunk for new buckets
+static size_t               mi_profile_chunk_available;   // bytes available in the current chunk
+static mi_profile_sample_t* mi_profile_samples;           // open addressing hash table of live sampled blocks
+static size_t               mi_profile_samples_capacity;  // always a power of 2 (or 0)
+static size_t               mi_profile_samples_count;
+static mi_profile_lifetime_t mi_profile_lifetime;
+
+// Sampled blocks hashed into a counting filter; updated with the lock held but read without it
+static _Atomic(size_t)      mi_profile_filter[MI_PROFILE_FILTER];
+
+static mi_decl_thread size_t mi_profile_thread;           // index of this thread in the transfer matrix plus one (or 0 if not yet assigned)
+
+static mi_decl_thread bool  mi_profile_recurse;           // sampling already on this thread? (a backtrace may allocate)
+
+static void mi_profile_lock_acquire(void) {
+  uintptr_t expected = 0;
+  while (!mi_atomic_cas_weak_acq_rel(&mi_profile_lock, &expected, 1)) {
+    expected = 0;
+    mi_atomic_yield();
+  }
+}
+
+static void mi_profile_lock_release(void) {
+  mi_atomic_store_release(&mi_profile_lock, 0);
+}
+
+
+/* -----------------------------------------------------------
+  Sampling intervals and backtraces
+----------------------------------------------------------- */
+
+// Return `-ln(u)*interval` for a uniform `u` in (0,1] which gives exponentially distributed intervals.
+// We use a random 26-bit number `r` for `u = r/2^26` and approximate `log2(r)` (within 0.01).
+static ptrdiff_t mi_profile_next_interval(mi_heap_t* heap, size_t interval) {
+  const uintptr_t r = (_mi_heap_random_next(heap) & (((uintptr_t)1 << 26) - 1)) + 1;
+  const size_t e = mi_bsr(r);
+  const double f = ((double)r / (double)((uintptr_t)1 << e)) - 1.0;   // in [0,1)
+  const double log2r = (double)e + f + (0.34 * f * (1.0 - f));
+  const double x = (26.0 - log2r) * 0.6931471805599453 * (double)interval;
+  if (x < 1.0) return 1;
+  if (x > (double)(PTRDIFF_MAX/2)) return (PTRDIFF_MAX/2);
+  return (ptrdiff_t)x;
+}
+
+// Capture the backtrace of the current allocation (skipping the profiler frames)
+static mi_decl_noinline size_t mi_profile_backtrace(void** frames) {
+  #if defined(_WIN32)
+  return CaptureStackBackTrace(MI_PROFILE_SKIP_FRAMES, MI_PROFILE_MAX_DEPTH, frames, NULL);
+  #elif defined(MI_PROFILE_BACKTRACE)
+  void* buf[MI_PROFILE_MAX_DEPTH + MI_PROFILE_SKIP_FRAMES];
+  const int n = backtrace(buf, MI_PROFILE_MAX_DEPTH + MI_PROFILE_SKIP_FRAMES);
+  if (n <= MI_PROFILE_SKIP_FRAMES) return 0;
+  const size_t depth = (size_t)n - MI_PROFILE_SKIP_FRAMES;
+  memcpy(frames, buf + MI_PROFILE_SKIP_FRAMES, depth * sizeof(void*));
+  return depth;
+  #else
+  MI_UNUSED(frames);
+  return 0;
+  #endif
+}
+
+// Find or create the bucket for a backtrace
+static mi_profile_bucket_t* mi_profile_bucket_get(void* const* frames, size_t depth) {
+  uintptr_t hash = depth;
+  for (size_t i = 0; i < depth; i++) {
+    hash = _mi_random_shuffle(hash ^ (uintptr_t)frames[i]);
+  }
+  const size_t idx = hash & (MI_PROFILE_BUCKETS - 1);
+  for (mi_profile_bucket_t* bucket = mi_profile_buckets[idx]; bucket != NULL; bucket = bucket->next) {
+    if (bucket->hash == hash && bucket->depth == depth && memcmp(bucket->frames, frames, depth * sizeof(void*)) == 0) {
+      return bucket;
+    }
+  }
+  if (mi_profile_chunk_available < sizeof(mi_profile_bucket_t)) {
+    mi_profile_chunk = (uint8_t*)_mi_os_alloc(MI_PROFILE_CHUNK_SIZE, &_mi_stats_main);  // zero initialized
+    if (mi_profile_chunk == NULL) {
+      mi_profile_chunk_available = 0;
+      return NULL;
+    }
+    mi_profile_chunk_available = MI_PROFILE_CHUNK_SIZE;
+  }
+  mi_profile_bucket_t* bucket = (mi_profile_bucket_t*)mi_profile_chunk;
+  mi_profile_chunk += sizeof(mi_profile_bucket_t);
+  mi_profile_chunk_available -= sizeof(mi_profile_bucket_t);
+  bucket->hash = hash;
+  bucket->depth = depth;
+  memcpy(bucket->frames, frames, depth * sizeof(void*));
+  bucket->next = mi_profile_buckets[idx];
+  mi_profile_buckets[idx] = bucket;
+  mi_profile_bucket_count++;
+  return bucket;
+}
+
+
+/* -----------------------------------------------------------
+  The table of live sampled blocks
+----------------------------------------------------------- */
+
+static size_t mi_profile_sample_index(const void* block, size_t capacity) {
+  return (_mi_random_shuffle((uintptr_t)block) & (capacity - 1));
+}
+
+static _Atomic(size_t)* mi_profile_filter_at(const void* block) {
+  return &mi_profile_filter[mi_profile_sample_index(block, MI_PROFILE_FILTER)];
+}
+
+// Can a block be sampled? (without false negatives, and without taking the lock)
+static bool mi_profile_filter_contains(const void* block) {
+  return (mi_atomic_load_relaxed(mi_profile_filter_at(block)) != 0);
+}
+
+static bool mi_profile_samples_grow(void) {
+  const size_t capacity = (mi_profile_samples_capacity == 0 ? MI_PROFILE_MIN_SAMPLES : 2*mi_profile_samples_capacity);
+  mi_profile_sample_t* samples = (mi_profile_sample_t*)_mi_os_alloc(capacity * sizeof(mi_profile_sample_t), &_mi_stats_main);
+  if (samples == NULL) return false;
+  for (size_t i = 0; i < mi_profile_samples_capacity; i++) {
+    const mi_profile_sample_t* sample = &mi_profile_samples[i];
+    if (sample->block == NULL) continue;
+    size_t j = mi_profile_sample_index(sample->block, capacity);
+    while (samples[j].block != NULL) { j = (j + 1) & (capacity - 1); }
+    samples[j] = *sample;
+  }
+  if (mi_profile_samples != NULL) {
+    _mi_os_free(mi_profile_samples, mi_profile_samples_capacity * sizeof(mi_profile_sample_t), &_mi_stats_main);
+  }
+  mi_profile_samples = samples;
+  mi_profile_samples_capacity = capacity;
+  return true;
+}
+
+// Return the index of a sampled block, or the capacity if not found
+static size_t mi_profile_sample_find(const void* block) {
+  if (mi_profile_samples_count == 0) return mi_profile_samples_capacity;
+  const size_t mask = mi_profile_samples_capacity - 1;
+  for (size_t i = mi_profile_sample_index(block, mi_profile_samples_capacity); mi_profile_samples[i].block != NULL; i = (i + 1) & mask) {
+    if (mi_profile_samples[i].block == block) return i;
+  }
+  return mi_profile_samples_capacity;
+}
+
+// Remove a sampled block; we use backward shift deletion to keep the probe sequences intact
+static void mi_profile_sample_remove_at(size_t i) {
+  mi_profile_sample_t* const samples = mi_profile_samples;
+  mi_profile_bucket_t* const bucket = samples[i].bucket;
+  bucket->live_count--;
+  bucket->live_size -= samples[i].size;
+  mi_atomic_decrement_relaxed(mi_profile_filter_at(samples[i].block));
+  const size_t mask = mi_profile_samples_capacity - 1;
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & mask;
+    if (samples[j].block == NULL) break;
+    const size_t k = mi_profile_sample_index(samples[j].block, mi_profile_samples_capacity);
+    // the entry at `j` can stay if its home `k` is cyclically in `(i,j]`
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+    samples[i] = samples[j];
+    i = j;
+  }
+  samples[i].block = NULL;
+  samples[i].bucket = NULL;
+  samples[i].size = 0;
+  mi_profile_samples_count--;
+}
+
+
+/* -----------------------------------------------------------
+  Lifetimes and transfers
+----------------------------------------------------------- */
+
+// Get the index of the current thread in the transfer matrix (with the lock held)
+static uint16_t mi_profile_thread_index(void) {
+  if (mi_profile_thread == 0) {
+    mi_profile_lifetime_t* const lt = &mi_profile_lifetime;
+    if (lt->thread_count < MI_PROFILE_MAX_THREADS) {
+      lt->thread_ids[lt->thread_count] = _mi_thread_id();
+      lt->thread_count++;
+    }
+    mi_profile_thread = lt->thread_count;  // the last index is shared once all are taken
+  }
+  return (uint16_t)(mi_profile_thread - 1);
+}
+
+// Record the lifetime and transfer of a freed sample (with the lock held)
+static void mi_profile_lifetime_record(const mi_profile_sample_t* sample) {
+  if (sample->time == 0) return;
+  mi_profile_lifetime_t* const lt = &mi_profile_lifetime;
+  const mi_usecs_t t = _mi_clock_usecs() - sample->time;
+  // bucket `i` counts lifetimes in `[4^(i-1), 4^i)` micro-seconds
+  size_t i = (t <= 0 ? 0 : 1 + mi_bsr((uintptr_t)t)/2);
+  if (i >= MI_PROFILE_LIFETIMES) { i = MI_PROFILE_LIFETIMES - 1; }
+  lt->lifetimes[sample->bin][i]++;
+  const uint16_t thread = mi_profile_thread_index();
+  if (thread != sample->thread || thread == MI_PROFILE_MAX_THREADS - 1) {
+    // (we cannot tell threads apart that share the last index so we count them as cross-thread)
+    lt->cross_frees[sample->bin]++;
+  }
+  lt->transfers[sample->thread][thread]++;
+}
+
+
+/* -----------------------------------------------------------
+  Sample and free
+----------------------------------------------------------- */
+
+// Called from `_mi_page_malloc` when the sample countdown of the heap drops below zero
+void _mi_profile_sample(mi_heap_t* heap, mi_page_t* page, const void* block, size_t size) {
+  // a fresh heap starts with a zero countdown and only needs to draw its first interval
+  const bool fresh = (heap->sample_countdown + (ptrdiff_t)size == 0);
+  const long interval = mi_option_get_clamp(mi_option_profile_interval, 0, LONG_MAX);
+  if (interval == 0) {
+    heap->sample_countdown = MI_PROFILE_RECHECK;
+    return;
+  }
+  heap->sample_countdown = mi_profile_next_interval(heap, (size_t)interval);
+  if (fresh || mi_profile_recurse) return;
+
+  mi_profile_recurse = true;
+  const bool record_lifetime = mi_option_is_enabled(mi_option_profile_lifetime);
+  void* frames[MI_PROFILE_MAX_DEPTH];
+  const size_t depth = mi_profile_backtrace(frames);
+  mi_profile_lock_acquire();
+  if (mi_profile_samples_count < mi_profile_samples_capacity/2 || mi_profile_samples_grow()) {
+    mi_profile_bucket_t* const bucket = mi_profile_bucket_get(frames, depth);
+    if (bucket != NULL) {
+      // a block can still be in the table if its page was not cleared (e.g. after `mi_heap_destroy`)
+      const size_t old = mi_profile_sample_find(block);
+      if (old < mi_profile_samples_capacity) {
+        mi_profile_sample_remove_at(old);
+        if (mi_atomic_load_relaxed(&page->sampled) > 0) { mi_atomic_decrement_relaxed(&page->sampled); }
+      }
+      size_t i = mi_profile_sample_index(block, mi_profile_samples_capacity);
+      while (mi_profile_samples[i].block != NULL) { i = (i + 1) & (mi_profile_samples_capacity - 1); }
+      mi_profile_sample_t* const sample = &mi_profile_samples[i];
+      sample->block = block;
+      sample->size = size - MI_PADDING_SIZE;
+      sample->bucket = bucket;
+      sample->bin = _mi_bin(mi_page_block_size(page));
+      if (record_lifetime) {
+        sample->time = _mi_clock_usecs();
+        sample->thread = mi_profile_thread_index();
+      }
+      else {
+        sample->time = 0;
+        sample->thread = 0;
+      }
+      mi_profile_samples_count++;
+      bucket->alloc_count++;
+      bucket->alloc_size += sample->size;
+      bucket->live_count++;
+      bucket->live_size += sample->size;
+      mi_atomic_increment_relaxed(mi_profile_filter_at(block));
+      mi_atomic_increment_relaxed(&page->sampled);
+      mi_page_set_has_sampled(page, true);
+    }
+  }
+  mi_profile_lock_release();
+  mi_profile_recurse = false;
+}
+
+// Called from `mi_free` for blocks in pages with the `has_sampled` flag
+void _mi_profile_free(mi_page_t* page, const void* block, bool local) {
+  if (mi_profile_filter_contains(block)) {
+    mi_profile_lock_acquire();
+    const size_t i = mi_profile_sample_find(block);
+    if (i < mi_profile_samples_capacity) {
+      mi_profile_lifetime_record(&mi_profile_samples[i]);
+      mi_profile_sample_remove_at(i);
+      mi_atomic_decrement_relaxed(&page->sampled);
+    }
+    mi_profile_lock_release();
+  }
+  // only the owning thread samples blocks and changes the page flags
+  if (local && mi_atomic_load_relaxed(&page->sampled) == 0) {
+    mi_page_set_has_sampled(page, false);
+  }
+}
+
+// Called when a page with the `has_sampled` flag is freed to remove any remaining sampled blocks
+// (which happens when the blocks were not freed individually, as in `mi_heap_destroy`)
+void _mi_profile_free_range(const void* start, size_t size) {
+  mi_profile_lock_acquire();
+  size_t i = 0;
+  while (mi_profile_samples_count > 0 && i < mi_profile_samples_capacity) {
+    const uint8_t* block = (const uint8_t*)mi_profile_samples[i].block;
+    if (block != NULL && block >= (const uint8_t*)start && block < (const uint8_t*)start + size) {
+      mi_profile_sample_remove_at(i);  // and check the same index again
+    }
+    else {
+      i++;
+    }
+  }
+  mi_profile_lock_release();
+}
+
+
+/* -----------------------------------------------------------
+  Print the profile
+----------------------------------------------------------- */
+
+typedef struct mi_profile_entry_s {
+  const mi_profile_bucket_t* bucket;
+  size_t alloc_count;
+  size_t alloc_size;
+  size_t live_count;
+  size_t live_size;
+} mi_profile_entry_t;
+
+// pprof needs the memory map to symbolize the backtraces
+static void mi_profile_print_maps(mi_output_fun* out, void* arg) {
+  #if defined(__linux__)
+  _mi_fprintf(out, arg, "\nMAPPED_LIBRARIES:\n");
+  const int fd = open("/proc/self/maps", O_RDONLY);
+  if (fd < 0) return;
+  char buf[512 + 1];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf) - 1)) > 0) {
+    buf[n] = 0;
+    _mi_fputs(out, arg, NULL, buf);
+  }
+  close(fd);
+  #else
+  MI_UNUSED(out); MI_UNUSED(arg);
+  #endif
+}
+
+void mi_profile_dump(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  // copy the counts while holding the lock so we do not hold it while printing
+  // (buckets are never freed and their backtrace does not change)
+  mi_profile_lock_acquire();
+  const size_t count = mi_profile_bucket_count;
+  const size_t entries_size = count * sizeof(mi_profile_entry_t);
+  mi_profile_entry_t* entries = NULL;
+  if (count > 0) {
+    entries = (mi_profile_entry_t*)_mi_os_alloc(entries_size, &_mi_stats_main);
+    if (entries != NULL) {
+      size_t n = 0;
+      for (size_t i = 0; i < MI_PROFILE_BUCKETS; i++) {
+        for (const mi_profile_bucket_t* bucket = mi_profile_buckets[i]; bucket != NULL; bucket = bucket->next) {
+          mi_assert_internal(n < count);
+          mi_profile_entry_t* entry = &entries[n++];
+          entry->bucket = bucket;
+          entry->alloc_count = bucket->alloc_count;
+          entry->alloc_size = bucket->alloc_size;
+          entry->live_count = bucket->live_count;
+          entry->live_size = bucket->live_size;
+        }
+      }
+    }
+  }
+  mi_profile_lock_release();
+  if (count > 0 && entries == NULL) return;
+
+  mi_profile_entry_t total = { NULL, 0, 0, 0, 0 };
+  for (size_t i = 0; i < count; i++) {
+    total.alloc_count += entries[i].alloc_count;
+    total.alloc_size += entries[i].alloc_size;
+    total.live_count += entries[i].live_count;
+    total.live_size += entries[i].live_size;
+  }
+  const long interval = mi_option_get_clamp(mi_option_profile_interval, 0, LONG_MAX);
+  _mi_fprintf(out, arg, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%ld\n",
+              total.live_count, total.live_size, total.alloc_count, total.alloc_size, interval);
+  for (size_t i = 0; i < count; i++) {
+    const mi_profile_entry_t* entry = &entries[i];
+    _mi_fprintf(out, arg, "%zu: %zu [%zu: %zu] @", entry->live_count, entry->live_size, entry->alloc_count, entry->alloc_size);
+    for (size_t j = 0; j < entry->bucket->depth; j++) {
+      _mi_fprintf(out, arg, " 0x%zx", (size_t)(uintptr_t)entry->bucket->frames[j]);
+    }
+    _mi_fprintf(out, arg, "\n");
+  }
+  if (entries != NULL) {
+    _mi_os_free(entries, entries_size, &_mi_stats_main);
+  }
+  mi_profile_print_maps(out, arg);
+}
+
+static const char* mi_profile_lifetime_labels[MI_PROFILE_LIFETIMES] = {
+  "<1us", "<4us", "<16us", "<64us", "<256us", "<1ms", "<4ms", "<16ms", "<66ms", "<262ms", "<1s", "<4s", "<17s", ">=17s"
+};
+
+void mi_profile_lifetime_print(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  // copy the counts so we do not hold the lock while printing
+  mi_profile_lifetime_t* lt = (mi_profile_lifetime_t*)_mi_os_alloc(sizeof(mi_profile_lifetime_t), &_mi_stats_main);
+  if (lt == NULL) return;
+  mi_profile_lock_acquire();
+  memcpy(lt, &mi_profile_lifetime, sizeof(mi_profile_lifetime_t));
+  mi_profile_lock_release();
+
+  size_t total = 0;
+  size_t total_cross = 0;
+  for (size_t bin = 0; bin <= MI_BIN_HUGE; bin++) {
+    for (size_t i = 0; i < MI_PROFILE_LIFETIMES; i++) { total += lt->lifetimes[bin][i]; }
+    total_cross += lt->cross_frees[bin];
+  }
+  _mi_fprintf(out, arg, "sampled frees: %zu, cross-thread: %zu\n", total, total_cross);
+  if (total == 0) {
+    if (!mi_option_is_enabled(mi_option_profile_lifetime)) {
+      _mi_fprintf(out, arg, "# lifetimes are not recorded (enable with MIMALLOC_PROFILE_LIFETIME=1)\n");
+    }
+    _mi_os_free(lt, sizeof(mi_profile_lifetime_t), &_mi_stats_main);
+    return;
+  }
+
+  // lifetime histogram per size class
+  _mi_fprintf(out, arg, "\nlifetimes of sampled blocks:\n%4s %10s %8s %8s", "bin", "block size", "freed", "cross");
+  for (size_t i = 0; i < MI_PROFILE_LIFETIMES; i++) { _mi_fprintf(out, arg, " %7s", mi_profile_lifetime_labels[i]); }
+  _mi_fprintf(out, arg, "\n");
+  for (size_t bin = 0; bin <= MI_BIN_HUGE; bin++) {
+    size_t freed = 0;
+    for (size_t i = 0; i < MI_PROFILE_LIFETIMES; i++) { freed += lt->lifetimes[bin][i]; }
+    if (freed == 0) continue;
+    if (bin < MI_BIN_HUGE) {
+      _mi_fprintf(out, arg, "%4zu %10zu %8zu %8zu", bin, _mi_bin_size((uint8_t)bin), freed, lt->cross_frees[bin]);
+    }
+    else {
+      _mi_fprintf(out, arg, "%4s %10s %8zu %8zu", "huge", "", freed, lt->cross_frees[bin]);
+    }
+    for (size_t i = 0; i < MI_PROFILE_LIFETIMES; i++) { _mi_fprintf(out, arg, " %7zu", lt->lifetimes[bin][i]); }
+    _mi_fprintf(out, arg, "\n");
+  }
+
+  // transfer matrix between threads
+  const size_t n = lt->thread_count;
+  _mi_fprintf(out, arg, "\nsampled frees per allocating thread (rows) and freeing thread (columns):\n");
+  for (size_t t = 0; t < n; t++) {
+    _mi_fprintf(out, arg, "t%-3zu: thread 0x%zx%s\n", t, lt->thread_ids[t], (t == MI_PROFILE_MAX_THREADS - 1 ? " (and all further threads)" : ""));
+  }
+  _mi_fprintf(out, arg, "%5s", "");
+  for (size_t t = 0; t < n; t++) {
+    char label[32];
+    snprintf(label, sizeof(label), "t%zu", t);
+    _mi_fprintf(out, arg, " %9s", label);
+  }
+  _mi_fprintf(out, arg, "\n");
+  for (size_t a = 0; a < n; a++) {
+    _mi_fprintf(out, arg, "t%-3zu:", a);
+    for (size_t f = 0; f < n; f++) { _mi_fprintf(out, arg, " %9zu", lt->transfers[a][f]); }
+    _mi_fprintf(out, arg, "\n");
+  }
+  _mi_os_free(lt, sizeof(mi_profile_lifetime_t), &_mi_stats_main);
+}
+
+#else
+
+void mi_profile_dump(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  _mi_fprintf(out, arg, "# heap profiling is not available (build with MI_PROFILE=ON)\n");
+}
+
+void mi_profile_lifetime_print(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  mi_profile_dump(out, arg);
+}
+
+#endif
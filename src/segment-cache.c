@@ -69,7 +69,11 @@ mi_decl_noinline void* _mi_segment_cache_pop(size_t size, mi_commit_mask_t* comm
     if (claimed) *large = false;
   }
 
-  if (!claimed) return NULL;
+  if (!claimed) {
+    mi_usdt_probe2(segment_cache_pop, size, NULL);
+    _mi_event_record(MI_EVENT_CACHE_MISS, NULL, size);
+    return NULL;
+  }
 
   // found a slot
   mi_cache_slot_t* slot = &cache[mi_bitmap_index_bit(bitidx)];
@@ -85,6 +89,8 @@ mi_decl_noinline void* _mi_segment_cache_pop(size_t size, mi_commit_mask_t* comm
   // mark the slot as free again
   mi_assert_internal(_mi_bitmap_is_claimed(cache_inuse, MI_CACHE_FIELDS, 1, bitidx));
   _mi_bitmap_unclaim(cache_inuse, MI_CACHE_FIELDS, 1, bitidx);
+  mi_usdt_probe2(segment_cache_pop, size, p);
+  _mi_event_record(MI_EVENT_CACHE_HIT, p, size);
   return p;
 #endif
 }
@@ -178,7 +184,10 @@ mi_decl_noinline bool _mi_segment_cache_push(void* start, size_t size, size_t me
   // find an available slot
   mi_bitmap_index_t bitidx;
   bool claimed = _mi_bitmap_try_find_from_claim(cache_inuse, MI_CACHE_FIELDS, start_field, 1, &bitidx);
-  if (!claimed) return false;
+  if (!claimed) {
+    mi_usdt_probe3(segment_cache_push, start, size, false);
+    return false;
+  }
 
   mi_assert_internal(_mi_bitmap_is_claimed(cache_available, MI_CACHE_FIELDS, 1, bitidx));
   mi_assert_internal(_mi_bitmap_is_claimed(cache_available_large, MI_CACHE_FIELDS, 1, bitidx));
@@ -210,6 +219,7 @@ mi_decl_noinline bool _mi_segment_cache_push(void* start, size_t size, size_t me
 
   // make it available
   _mi_bitmap_unclaim((is_large ? cache_available_large : cache_available), MI_CACHE_FIELDS, 1, bitidx);
+  mi_usdt_probe3(segment_cache_push, start, size, true);
   return true;
 #endif
 }
@@ -219,108 +229,133 @@ mi_decl_noinline bool _mi_segment_cache_push(void* start, size_t size, size_t me
   The following functions are to reliably find the segment or
   block that encompasses any pointer p (or NULL if it is not
   in any of our segments).
-  We maintain a bitmap of all memory with 1 bit per MI_SEGMENT_SIZE (64MiB)
-  set to 1 if it contains the segment meta data.
+  We maintain a two-level radix map of all memory with 1 bit per
+  MI_SEGMENT_SIZE (64MiB) set to 1 if it contains the segment meta data.
+  The top level is static and small (32KiB on 64-bit), while the leaves
+  (64KiB, covering 32TiB each) are allocated on demand. This covers the
+  full 57-bit address space of 5-level paging.
 ----------------------------------------------------------- */
 
-
 #if (MI_INTPTR_SIZE==8)
-#define MI_MAX_ADDRESS    ((size_t)20 << 40)  // 20TB
+#define MI_SEGMENT_MAP_ADDRESS_BITS  (57)
 #else
-#define MI_MAX_ADDRESS    ((size_t)2 << 30)   // 2Gb
+#define MI_SEGMENT_MAP_ADDRESS_BITS  (MI_INTPTR_SIZE*8)
 #endif
 
-#define MI_SEGMENT_MAP_BITS  (MI_MAX_ADDRESS / MI_SEGMENT_SIZE)
-#define MI_SEGMENT_MAP_SIZE  (MI_SEGMENT_MAP_BITS / 8)
-#define MI_SEGMENT_MAP_WSIZE (MI_SEGMENT_MAP_SIZE / MI_INTPTR_SIZE)
-
-static _Atomic(uintptr_t) mi_segment_map[MI_SEGMENT_MAP_WSIZE + 1];  // 2KiB per TB with 64MiB segments
+#define MI_SEGMENT_MAP_INDEX_BITS    (MI_SEGMENT_MAP_ADDRESS_BITS - MI_SEGMENT_SHIFT)   // bits of a segment index
+#if (MI_SEGMENT_MAP_INDEX_BITS > 19)
+#define MI_SEGMENT_MAP_LEAF_SHIFT    (19)                                               // 64KiB leaves
+#else
+#define MI_SEGMENT_MAP_LEAF_SHIFT    (MI_SEGMENT_MAP_INDEX_BITS)
+#endif
+#define MI_SEGMENT_MAP_LEAF_BITS     (MI_ZU(1) << MI_SEGMENT_MAP_LEAF_SHIFT)
+#define MI_SEGMENT_MAP_LEAF_WSIZE    (MI_SEGMENT_MAP_LEAF_BITS / MI_INTPTR_BITS)
+#define MI_SEGMENT_MAP_LEAF_SIZE     (MI_SEGMENT_MAP_LEAF_WSIZE * MI_INTPTR_SIZE)                        // 64KiB
+#define MI_SEGMENT_MAP_TOP_COUNT     (MI_ZU(1) << (MI_SEGMENT_MAP_INDEX_BITS - MI_SEGMENT_MAP_LEAF_SHIFT))
+
+typedef struct mi_segment_map_leaf_s {
+  _Atomic(uintptr_t) bits[MI_SEGMENT_MAP_LEAF_WSIZE];
+} mi_segment_map_leaf_t;
+
+static _Atomic(mi_segment_map_leaf_t*) mi_segment_map[MI_SEGMENT_MAP_TOP_COUNT];  // 4096 entries on 64-bit (with 64MiB segments)
+
+// the largest span (in MI_SEGMENT_SIZE units) of any segment we mapped; bounds the search for interior pointers
+static _Atomic(size_t) mi_segment_map_max_span; // = 0
+
+static size_t mi_segment_map_index_of(const void* p, bool* valid) {
+  const uintptr_t segindex = (uintptr_t)p >> MI_SEGMENT_SHIFT;
+  #if (MI_SEGMENT_MAP_ADDRESS_BITS < MI_INTPTR_SIZE*8)
+  *valid = (segindex < (MI_SEGMENT_MAP_TOP_COUNT * MI_SEGMENT_MAP_LEAF_BITS));
+  #else
+  *valid = true;
+  #endif
+  return segindex;
+}
 
-static size_t mi_segment_map_index_of(const mi_segment_t* segment, size_t* bitidx) {
-  mi_assert_internal(_mi_ptr_segment(segment) == segment); // is it aligned on MI_SEGMENT_SIZE?
-  if ((uintptr_t)segment >= MI_MAX_ADDRESS) {
-    *bitidx = 0;
-    return MI_SEGMENT_MAP_WSIZE;
-  }
-  else {
-    const uintptr_t segindex = ((uintptr_t)segment) / MI_SEGMENT_SIZE;
-    *bitidx = segindex % MI_INTPTR_BITS;
-    const size_t mapindex = segindex / MI_INTPTR_BITS;
-    mi_assert_internal(mapindex < MI_SEGMENT_MAP_WSIZE);
-    return mapindex;
+static mi_segment_map_leaf_t* mi_segment_map_leaf_at(size_t segindex, bool create) {
+  const size_t top = segindex >> MI_SEGMENT_MAP_LEAF_SHIFT;
+  mi_assert_internal(top < MI_SEGMENT_MAP_TOP_COUNT);
+  mi_segment_map_leaf_t* leaf = mi_atomic_load_ptr_acquire(mi_segment_map_leaf_t, &mi_segment_map[top]);
+  if (mi_likely(leaf != NULL) || !create) return leaf;
+  // allocate a fresh (zero initialized) leaf; the OS commits it lazily on first touch
+  mi_segment_map_leaf_t* expected = NULL;
+  leaf = (mi_segment_map_leaf_t*)_mi_os_alloc(MI_SEGMENT_MAP_LEAF_SIZE, &_mi_stats_main);
+  if (leaf == NULL) return NULL;
+  if (!mi_atomic_cas_ptr_strong_release(mi_segment_map_leaf_t, &mi_segment_map[top], &expected, leaf)) {
+    // another thread was first
+    _mi_os_free(leaf, MI_SEGMENT_MAP_LEAF_SIZE, &_mi_stats_main);
+    leaf = expected;
   }
+  return leaf;
+}
+
+static _Atomic(uintptr_t)* mi_segment_map_word_at(size_t segindex, bool create) {
+  mi_segment_map_leaf_t* leaf = mi_segment_map_leaf_at(segindex, create);
+  if (leaf == NULL) return NULL;
+  return &leaf->bits[(segindex % MI_SEGMENT_MAP_LEAF_BITS) / MI_INTPTR_BITS];
 }
 
-void _mi_segment_map_allocated_at(const mi_segment_t* segment) {
-  size_t bitidx;
-  size_t index = mi_segment_map_index_of(segment, &bitidx);
-  mi_assert_internal(index <= MI_SEGMENT_MAP_WSIZE);
-  if (index==MI_SEGMENT_MAP_WSIZE) return;
-  uintptr_t mask = mi_atomic_load_relaxed(&mi_segment_map[index]);
-  uintptr_t newmask;
-  do {
-    newmask = (mask | ((uintptr_t)1 << bitidx));
-  } while (!mi_atomic_cas_weak_release(&mi_segment_map[index], &mask, newmask));
+void _mi_segment_map_allocated_at(const mi_segment_t* segment, size_t segment_size) {
+  mi_assert_internal(_mi_ptr_segment(segment) == segment); // is it aligned on MI_SEGMENT_SIZE?
+  bool valid;
+  const size_t segindex = mi_segment_map_index_of(segment, &valid);
+  if (!valid) return;
+  _Atomic(uintptr_t)* word = mi_segment_map_word_at(segindex, true);
+  if (word == NULL) {
+    _mi_error_message(ENOMEM, "unable to allocate the segment map for %p\n", segment);
+    return;
+  }
+  const size_t span = _mi_divide_up(segment_size, MI_SEGMENT_SIZE);
+  size_t max_span = mi_atomic_load_relaxed(&mi_segment_map_max_span);
+  while (span > max_span && !mi_atomic_cas_weak_release(&mi_segment_map_max_span, &max_span, span)) { /* nothing */ };
+  mi_atomic_or_acq_rel(word, (uintptr_t)1 << (segindex % MI_INTPTR_BITS));
 }
 
 void _mi_segment_map_freed_at(const mi_segment_t* segment) {
-  size_t bitidx;
-  size_t index = mi_segment_map_index_of(segment, &bitidx);
-  mi_assert_internal(index <= MI_SEGMENT_MAP_WSIZE);
-  if (index == MI_SEGMENT_MAP_WSIZE) return;
-  uintptr_t mask = mi_atomic_load_relaxed(&mi_segment_map[index]);
-  uintptr_t newmask;
-  do {
-    newmask = (mask & ~((uintptr_t)1 << bitidx));
-  } while (!mi_atomic_cas_weak_release(&mi_segment_map[index], &mask, newmask));
+  mi_assert_internal(_mi_ptr_segment(segment) == segment);
+  bool valid;
+  const size_t segindex = mi_segment_map_index_of(segment, &valid);
+  if (!valid) return;
+  _Atomic(uintptr_t)* word = mi_segment_map_word_at(segindex, false);
+  mi_assert_internal(word != NULL);
+  if (word == NULL) return;
+  mi_atomic_and_acq_rel(word, ~((uintptr_t)1 << (segindex % MI_INTPTR_BITS)));
 }
 
 // Determine the segment belonging to a pointer or NULL if it is not in a valid segment.
 static mi_segment_t* _mi_segment_of(const void* p) {
   mi_segment_t* segment = _mi_ptr_segment(p);
   if (segment == NULL) return NULL; 
-  size_t bitidx;
-  size_t index = mi_segment_map_index_of(segment, &bitidx);
+  bool valid;
+  size_t segindex = mi_segment_map_index_of(segment, &valid);
+  if (!valid) return NULL;
   // fast path: for any pointer to valid small/medium/large object or first MI_SEGMENT_SIZE in huge
-  const uintptr_t mask = mi_atomic_load_relaxed(&mi_segment_map[index]);
+  _Atomic(uintptr_t)* word = mi_segment_map_word_at(segindex, false);
+  size_t bitidx = segindex % MI_INTPTR_BITS;
+  uintptr_t mask = (word == NULL ? 0 : mi_atomic_load_relaxed(word));
   if (mi_likely((mask & ((uintptr_t)1 << bitidx)) != 0)) {
     return segment; // yes, allocated by us
   }
-  if (index==MI_SEGMENT_MAP_WSIZE) return NULL;
 
-  // TODO: maintain max/min allocated range for efficiency for more efficient rejection of invalid pointers?
-
-  // search downwards for the first segment in case it is an interior pointer
-  // could be slow but searches in MI_INTPTR_SIZE * MI_SEGMENT_SIZE (512MiB) steps trough
-  // valid huge objects
-  // note: we could maintain a lowest index to speed up the path for invalid pointers?
-  size_t lobitidx;
-  size_t loindex;
+  // search downwards for the start of a huge segment in case it is an interior pointer;
+  // we never need to look further back than the largest segment span we mapped.
+  const size_t max_span = mi_atomic_load_relaxed(&mi_segment_map_max_span);
+  if (max_span <= 1) return NULL;
+  const size_t minindex = (segindex >= max_span - 1 ? segindex - (max_span - 1) : 0);
   uintptr_t lobits = mask & (((uintptr_t)1 << bitidx) - 1);
-  if (lobits != 0) {
-    loindex = index;
-    lobitidx = mi_bsr(lobits);    // lobits != 0
-  }
-  else if (index == 0) {
-    return NULL;
-  }
-  else {
-    mi_assert_internal(index > 0);
-    uintptr_t lomask = mask;
-    loindex = index;
-    do {
-      loindex--;  
-      lomask = mi_atomic_load_relaxed(&mi_segment_map[loindex]);      
-    } while (lomask != 0 && loindex > 0);
-    if (lomask == 0) return NULL;
-    lobitidx = mi_bsr(lomask);    // lomask != 0
+  while (lobits == 0) {
+    // go to the previous word
+    const size_t wordstart = segindex - bitidx;
+    if (wordstart <= minindex) return NULL;
+    segindex = wordstart - 1;
+    bitidx = MI_INTPTR_BITS - 1;
+    word = mi_segment_map_word_at(segindex, false);
+    lobits = (word == NULL ? 0 : mi_atomic_load_relaxed(word));
   }
-  mi_assert_internal(loindex < MI_SEGMENT_MAP_WSIZE);
-  // take difference as the addresses could be larger than the MAX_ADDRESS space.
-  size_t diff = (((index - loindex) * (8*MI_INTPTR_SIZE)) + bitidx - lobitidx) * MI_SEGMENT_SIZE;
-  segment = (mi_segment_t*)((uint8_t*)segment - diff);
+  const size_t loindex = segindex - bitidx + mi_bsr(lobits);
+  if (loindex < minindex) return NULL;
+  segment = (mi_segment_t*)(loindex << MI_SEGMENT_SHIFT);
 
-  if (segment == NULL) return NULL;
   mi_assert_internal((void*)segment < p);
   bool cookie_ok = (_mi_ptr_cookie(segment) == segment->cookie);
   mi_assert_internal(cookie_ok);
@@ -204,14 +204,37 @@ static inline size_t mi_slice_index(const mi_slice_t* slice) {
    Slice span queues
 ----------------------------------------------------------- */
 
-static void mi_span_queue_push(mi_span_queue_t* sq, mi_slice_t* slice) {
+// The bitmap of non-empty span queues is kept in sync with the queues so
+// finding the smallest non-empty queue of at least some bin is a bit scan.
+static void mi_span_queue_set_nonempty(mi_span_queue_t* sq, mi_segments_tld_t* tld, bool nonempty) {
+  const size_t bin = (size_t)(sq - tld->spans);
+  mi_assert_internal(bin <= MI_SEGMENT_BIN_MAX);
+  const uintptr_t mask = ((uintptr_t)1 << (bin % MI_INTPTR_BITS));
+  if (nonempty) { tld->spans_nonempty[bin / MI_INTPTR_BITS] |= mask; }
+           else { tld->spans_nonempty[bin / MI_INTPTR_BITS] &= ~mask; }
+}
+
+// Return the first non-empty span queue at `bin` or above (or NULL if there is none)
+static mi_span_queue_t* mi_span_queue_find_nonempty(size_t bin, mi_segments_tld_t* tld) {
+  size_t field = bin / MI_INTPTR_BITS;
+  uintptr_t bits = tld->spans_nonempty[field] & ((uintptr_t)(-1) << (bin % MI_INTPTR_BITS));
+  while (bits == 0) {
+    if (++field >= MI_SEGMENT_BIN_FIELDS) return NULL;
+    bits = tld->spans_nonempty[field];
+  }
+  const size_t found = (field * MI_INTPTR_BITS) + mi_ctz(bits);
+  mi_assert_internal(found <= MI_SEGMENT_BIN_MAX && tld->spans[found].first != NULL);
+  return &tld->spans[found];
+}
+
+static void mi_span_queue_push(mi_span_queue_t* sq, mi_slice_t* slice, mi_segments_tld_t* tld) {
   // todo: or push to the end?
   mi_assert_internal(slice->prev == NULL && slice->next==NULL);
   slice->prev = NULL; // paranoia
   slice->next = sq->first;
   sq->first = slice;
   if (slice->next != NULL) slice->next->prev = slice;
-                     else sq->last = slice;
+                     else { sq->last = slice; mi_span_queue_set_nonempty(sq, tld, true); }
   slice->xblock_size = 0; // free
 }
 
@@ -222,7 +245,7 @@ static mi_span_queue_t* mi_span_queue_for(size_t slice_count, mi_segments_tld_t*
   return sq;
 }
 
-static void mi_span_queue_delete(mi_span_queue_t* sq, mi_slice_t* slice) {
+static void mi_span_queue_delete(mi_span_queue_t* sq, mi_slice_t* slice, mi_segments_tld_t* tld) {
   mi_assert_internal(slice->xblock_size==0 && slice->slice_count>0 && slice->slice_offset==0);
   // should work too if the queue does not contain slice (which can happen during reclaim)
   if (slice->prev != NULL) slice->prev->next = slice->next;
@@ -232,6 +255,7 @@ static void mi_span_queue_delete(mi_span_queue_t* sq, mi_slice_t* slice) {
   slice->prev = NULL;
   slice->next = NULL;
   slice->xblock_size = 1; // no more free
+  if (sq->first == NULL) mi_span_queue_set_nonempty(sq, tld, false);
 }
 
 
@@ -369,6 +393,7 @@ static void mi_segments_track_size(long segment_size, mi_segments_tld_t* tld) {
 }
 
 static void mi_segment_os_free(mi_segment_t* segment, mi_segments_tld_t* tld) {
+  _mi_event_record(MI_EVENT_SEGMENT_FREE, segment, mi_segment_size(segment));
   segment->thread_id = 0;
   _mi_segment_map_freed_at(segment);
   mi_segments_track_size(-((long)mi_segment_size(segment)),tld);
@@ -386,7 +411,8 @@ static void mi_segment_os_free(mi_segment_t* segment, mi_segments_tld_t* tld) {
   
   // _mi_os_free(segment, mi_segment_size(segment), /*segment->memid,*/ tld->stats);
   const size_t size = mi_segment_size(segment);
-  if (size != MI_SEGMENT_SIZE || !_mi_segment_cache_push(segment, size, segment->memid, &segment->commit_mask, &segment->decommit_mask, segment->mem_is_large, segment->mem_is_pinned, tld->os)) {
+  if (size != MI_SEGMENT_SIZE || !_mi_arena_memid_is_suitable(segment->memid, _mi_arena_id_none()) ||  // never cache segments from exclusive arena's
+      !_mi_segment_cache_push(segment, size, segment->memid, &segment->commit_mask, &segment->decommit_mask, segment->mem_is_large, segment->mem_is_pinned, tld->os)) {
     const size_t csize = _mi_commit_mask_committed_size(&segment->commit_mask, size);
     if (csize > 0 && !segment->mem_is_pinned) _mi_stat_decrease(&_mi_stats_main.committed, csize);
     _mi_abandoned_await_readers();  // wait until safe to free
@@ -400,6 +426,13 @@ void _mi_segment_thread_collect(mi_segments_tld_t* tld) {
   // nothing to do
 }
 
+// Perform the expired delayed decommits in the segment of a page (see `mi_heap_collect_step`)
+void _mi_segment_page_collect_decommit(mi_page_t* page, mi_segments_tld_t* tld) {
+  mi_segment_t* segment = _mi_page_segment(page);
+  if (segment->kind == MI_SEGMENT_HUGE) return;
+  mi_segment_delayed_decommit(segment, false /* force? */, tld->stats);
+}
+
 
 /* -----------------------------------------------------------
    Span management
@@ -598,7 +631,7 @@ static void mi_segment_span_free(mi_segment_t* segment, size_t slice_index, size
   mi_segment_perhaps_decommit(segment,mi_slice_start(slice),slice_count*MI_SEGMENT_SLICE_SIZE,tld->stats);
   
   // and push it on the free page queue (if it was not a huge page)
-  if (sq != NULL) mi_span_queue_push( sq, slice );
+  if (sq != NULL) mi_span_queue_push( sq, slice, tld );
              else slice->xblock_size = 0; // mark huge page as free anyways
 }
 
@@ -616,7 +649,7 @@ static void mi_segment_span_remove_from_queue(mi_slice_t* slice, mi_segments_tld
   mi_assert_internal(slice->slice_count > 0 && slice->slice_offset==0 && slice->xblock_size==0);
   mi_assert_internal(_mi_ptr_segment(slice)->kind != MI_SEGMENT_HUGE);
   mi_span_queue_t* sq = mi_span_queue_for(slice->slice_count, tld);
-  mi_span_queue_delete(sq, slice);
+  mi_span_queue_delete(sq, slice, tld);
 }
 
 // note: can be called on abandoned segments
@@ -721,16 +754,29 @@ static mi_page_t* mi_segment_span_allocate(mi_segment_t* segment, size_t slice_i
   return page;
 }
 
-static mi_page_t* mi_segments_page_find_and_allocate(size_t slice_count, mi_segments_tld_t* tld) {
+// A page with several large blocks needs a back pointer in every slice (not just the
+// first MI_MAX_SLICE_OFFSET) so each of its blocks can find the page (see `_mi_segment_page_of`)
+static void mi_segment_page_set_back_offsets(mi_page_t* page) {
+  mi_slice_t* slice = mi_page_to_slice(page);
+  mi_assert_internal(slice->slice_offset == 0 && slice->slice_count > 0);
+  for (size_t i = MI_MAX_SLICE_OFFSET + 1; i < slice->slice_count; i++) {
+    mi_slice_t* s = slice + i;
+    s->slice_offset = (uint32_t)(sizeof(mi_slice_t)*i);
+    s->slice_count = 0;
+    s->xblock_size = 1;
+  }
+}
+
+static mi_page_t* mi_segments_page_find_and_allocate(size_t slice_count, mi_arena_id_t req_arena_id, mi_segments_tld_t* tld) {
   mi_assert_internal(slice_count*MI_SEGMENT_SLICE_SIZE <= MI_LARGE_OBJ_SIZE_MAX);
-  // search from best fit up
-  mi_span_queue_t* sq = mi_span_queue_for(slice_count, tld);
+  // search from best fit up (skipping empty queues)
+  mi_span_queue_t* sq = mi_span_queue_find_nonempty(mi_slice_bin(slice_count), tld);
   if (slice_count == 0) slice_count = 1;
-  while (sq <= &tld->spans[MI_SEGMENT_BIN_MAX]) {
+  while (sq != NULL) {
     for (mi_slice_t* slice = sq->first; slice != NULL; slice = slice->next) {
-      if (slice->slice_count >= slice_count) {
+      if (slice->slice_count >= slice_count && _mi_arena_memid_is_suitable(_mi_ptr_segment(slice)->memid, req_arena_id)) {
         // found one
-        mi_span_queue_delete(sq, slice);
+        mi_span_queue_delete(sq, slice, tld);
         mi_segment_t* segment = _mi_ptr_segment(slice);
         if (slice->slice_count > slice_count) {
           mi_segment_slice_split(segment, slice, slice_count, tld);
@@ -742,10 +788,11 @@ static mi_page_t* mi_segments_page_find_and_allocate(size_t slice_count, mi_segm
           mi_segment_span_free_coalesce(slice, tld);
           return NULL;
         }
+        _mi_stat_increase(&tld->stats->pages, 1);  // decreased in `mi_segment_page_clear`
         return page;        
       }
     }
-    sq++;
+    sq = (sq < &tld->spans[MI_SEGMENT_BIN_MAX] ? mi_span_queue_find_nonempty((size_t)(sq - tld->spans) + 1, tld) : NULL);
   }
   // could not find a page..
   return NULL;
@@ -757,7 +804,7 @@ static mi_page_t* mi_segments_page_find_and_allocate(size_t slice_count, mi_segm
 ----------------------------------------------------------- */
 
 // Allocate a segment from the OS aligned to `MI_SEGMENT_SIZE` .
-static mi_segment_t* mi_segment_init(mi_segment_t* segment, size_t required, mi_segments_tld_t* tld, mi_os_tld_t* os_tld, mi_page_t** huge_page)
+static mi_segment_t* mi_segment_init(mi_segment_t* segment, size_t required, mi_arena_id_t req_arena_id, mi_segments_tld_t* tld, mi_os_tld_t* os_tld, mi_page_t** huge_page)
 {
   mi_assert_internal((required==0 && huge_page==NULL) || (required>0 && huge_page != NULL));
   mi_assert_internal((segment==NULL) || (segment!=NULL && required==0));
@@ -793,9 +840,11 @@ static mi_segment_t* mi_segment_init(mi_segment_t* segment, size_t required, mi_
     bool mem_large = (!eager_delay && (MI_SECURE==0)); // only allow large OS pages once we are no longer lazy    
     bool is_pinned = false;
     size_t memid = 0;
-    segment = (mi_segment_t*)_mi_segment_cache_pop(segment_size, &commit_mask, &decommit_mask, &mem_large, &is_pinned, &is_zero, &memid, os_tld);
+    if (req_arena_id == _mi_arena_id_none()) {  // the cache only contains segments that are not from a specific arena
+      segment = (mi_segment_t*)_mi_segment_cache_pop(segment_size, &commit_mask, &decommit_mask, &mem_large, &is_pinned, &is_zero, &memid, os_tld);
+    }
     if (segment==NULL) {
-      segment = (mi_segment_t*)_mi_arena_alloc_aligned(segment_size, MI_SEGMENT_SIZE, &commit, &mem_large, &is_pinned, &is_zero, &memid, os_tld);
+      segment = (mi_segment_t*)_mi_arena_alloc_aligned(segment_size, MI_SEGMENT_SIZE, &commit, &mem_large, &is_pinned, &is_zero, req_arena_id, &memid, os_tld);
       if (segment == NULL) return NULL;  // failed to allocate
       if (commit) {
         mi_commit_mask_create_full(&commit_mask);
@@ -822,7 +871,7 @@ static mi_segment_t* mi_segment_init(mi_segment_t* segment, size_t required, mi_
     segment->mem_is_large = mem_large;
     segment->mem_is_committed = mi_commit_mask_is_full(&commit_mask);
     mi_segments_track_size((long)(segment_size), tld);
-    _mi_segment_map_allocated_at(segment);
+    _mi_segment_map_allocated_at(segment, segment_size);
   }
 
   // zero the segment info? -- not always needed as it is zero initialized from the OS 
@@ -899,6 +948,7 @@ static mi_segment_t* mi_segment_init(mi_segment_t* segment, size_t required, mi_
     mi_assert_internal(mi_commit_mask_is_full(&segment->commit_mask));
     *huge_page = mi_segment_span_allocate(segment, info_slices, segment_slices - info_slices - guard_slices, tld);
     mi_assert_internal(*huge_page != NULL); // cannot fail as we commit in advance 
+    _mi_stat_increase(&tld->stats->pages, 1);
   }
 
   mi_assert_expensive(mi_segment_is_valid(segment,tld));
@@ -907,8 +957,14 @@ static mi_segment_t* mi_segment_init(mi_segment_t* segment, size_t required, mi_
 
 
 // Allocate a segment from the OS aligned to `MI_SEGMENT_SIZE` .
-static mi_segment_t* mi_segment_alloc(size_t required, mi_segments_tld_t* tld, mi_os_tld_t* os_tld, mi_page_t** huge_page) {
-  return mi_segment_init(NULL, required, tld, os_tld, huge_page);
+static mi_segment_t* mi_segment_alloc(size_t required, mi_arena_id_t req_arena_id, mi_segments_tld_t* tld, mi_os_tld_t* os_tld, mi_page_t** huge_page) {
+  const mi_usecs_t start = mi_usdt_start(segment_alloc);
+  const uint64_t cycles = mi_latency_start();
+  mi_segment_t* segment = mi_segment_init(NULL, required, req_arena_id, tld, os_tld, huge_page);
+  mi_latency_stop(tld->stats, MI_LATENCY_SEGMENT_ALLOC, cycles);
+  mi_usdt_probe3(segment_alloc, required, segment, mi_usdt_elapsed(start));
+  if (segment != NULL) { _mi_event_record(MI_EVENT_SEGMENT_ALLOC, segment, mi_segment_size(segment)); }
+  return segment;
 }
 
 
@@ -959,6 +1015,15 @@ static mi_slice_t* mi_segment_page_clear(mi_page_t* page, mi_segments_tld_t* tld
   _mi_stat_decrease(&tld->stats->page_committed, inuse);
   _mi_stat_decrease(&tld->stats->pages, 1);
 
+  #if MI_PROFILE
+  // remove sampled blocks that were never freed individually (as in `mi_heap_destroy`)
+  if (mi_page_has_sampled(page)) {
+    size_t psize;
+    const uint8_t* start = _mi_page_start(segment, page, &psize);
+    _mi_profile_free_range(start, psize);
+  }
+  #endif
+
   // reset the page memory to reduce memory pressure?
   if (!segment->mem_is_pinned && !page->is_reset && mi_option_is_enabled(mi_option_page_reset)) {
     size_t psize;
@@ -1177,6 +1242,173 @@ static mi_segment_t* mi_abandoned_pop(void) {
   return segment;
 }
 
+/* -----------------------------------------------------------
+   Handoff
+
+A thread can hand its abandoned segments to a successor
+thread (`mi_heap_transfer`) instead of the global abandoned
+list. The segments are pushed on a per-thread handoff list
+and the successor adopts all of them in one step, either
+explicitly (`mi_thread_adopt_abandoned_from`) or when it
+first needs a fresh segment. Since adopters always take the
+whole list at once (using an exchange) there is no A-B-A
+problem and no need for a reader count.
+
+An adopter first claims the slot with a CAS on the state it
+observed when checking the `from` and `to` thread ids; the
+state contains a tag that changes whenever those ids change,
+so a slot that is released and reused in the mean time is
+never adopted by the wrong thread.
+A handoff slot is released once the handing thread is done
+(closed) and its list has been adopted. If the target thread
+is done, or does not adopt the segments within `MI_HANDOFF_EXPIRE`
+milliseconds, the list is sealed and its segments (and any
+that are abandoned later) go to the global abandoned list.
+----------------------------------------------------------- */
+
+#define MI_HANDOFF_MAX      (64)
+#define MI_HANDOFF_EXPIRE   (1000)  // milli-seconds
+
+#define MI_HANDOFF_FREE     (0)
+#define MI_HANDOFF_CLAIMED  (1)   // being initialized, retargeted, adopted, or released
+#define MI_HANDOFF_OPEN     (2)   // the handing thread may still push segments
+#define MI_HANDOFF_CLOSED   (3)   // the handing thread is done
+
+#define MI_HANDOFF_PHASE(s) ((s) & 3)
+#define MI_HANDOFF_TAG(s)   ((s) & ~(size_t)3)
+#define MI_HANDOFF_TAG_INC  (4)
+
+#define MI_HANDOFF_SEALED   ((mi_segment_t*)1)   // the list no longer accepts segments
+
+typedef struct mi_handoff_s {
+  _Atomic(size_t)        state;     // phase in the lower 2 bits, and a tag that changes whenever `from` or `to` changes
+  _Atomic(mi_threadid_t) from;      // the handing thread
+  _Atomic(mi_threadid_t) to;        // the adopting thread (or 0 for any thread)
+  _Atomic(mi_msecs_t)    expire;    // after this time other threads abandon the segments as usual
+  _Atomic(mi_segment_t*) segments;  // abandoned segments linked through `abandoned_next` (or `MI_HANDOFF_SEALED`)
+} mi_handoff_t;
+
+static mi_decl_cache_align mi_handoff_t     handoffs[MI_HANDOFF_MAX];
+static mi_decl_cache_align _Atomic(size_t)  handoff_count;  // slots in use
+
+// Claim a slot that is (still) in the given open or closed `state`.
+static bool mi_handoff_claim(mi_handoff_t* h, size_t state) {
+  mi_assert_internal(MI_HANDOFF_PHASE(state) >= MI_HANDOFF_OPEN);
+  size_t expected = state;
+  return mi_atomic_cas_strong_acq_rel(&h->state, &expected, MI_HANDOFF_TAG(state) | MI_HANDOFF_CLAIMED);
+}
+
+// Claim the slot of the current thread; waits while an adopter has it claimed.
+static size_t mi_handoff_claim_own(mi_handoff_t* h) {
+  while (true) {
+    const size_t state = mi_atomic_load_acquire(&h->state);
+    if (MI_HANDOFF_PHASE(state) == MI_HANDOFF_OPEN && mi_handoff_claim(h, state)) return state;
+    mi_atomic_yield();
+  }
+}
+
+// Release a claimed slot.
+static void mi_handoff_release(mi_handoff_t* h, size_t state) {
+  mi_atomic_store_relaxed(&h->from, 0);
+  mi_atomic_store_relaxed(&h->to, 0);
+  mi_atomic_store_ptr_relaxed(mi_segment_t, &h->segments, NULL);
+  mi_atomic_decrement_relaxed(&handoff_count);
+  mi_atomic_store_release(&h->state, MI_HANDOFF_TAG(state) | MI_HANDOFF_FREE);
+}
+
+// Take the list of a slot that is (still) in the given `state`, and seal it if `seal` is true.
+// Returns `NULL` if the slot changed in the mean time.
+static mi_segment_t* mi_handoff_take(mi_handoff_t* h, size_t state, bool seal) {
+  if (!mi_handoff_claim(h, state)) return NULL;
+  // only the handing thread pushes concurrently (and it never seals)
+  mi_segment_t* segments = mi_atomic_load_ptr_acquire(mi_segment_t, &h->segments);
+  if (segments == MI_HANDOFF_SEALED) {
+    segments = NULL;
+  }
+  else {
+    segments = mi_atomic_exchange_ptr_acq_rel(mi_segment_t, &h->segments, (seal ? MI_HANDOFF_SEALED : NULL));
+  }
+  if (MI_HANDOFF_PHASE(state) == MI_HANDOFF_CLOSED) {
+    mi_handoff_release(h, state);  // the list contained all segments of the handing thread
+  }
+  else {
+    mi_atomic_storei64_relaxed(&h->expire, _mi_clock_now() + MI_HANDOFF_EXPIRE);
+    mi_atomic_store_release(&h->state, state);
+  }
+  return segments;
+}
+
+static void mi_handoff_abandon(mi_segment_t* segments, mi_segments_tld_t* tld);
+
+// Start (or retarget) the handoff of all segments that this thread abandons from now on.
+// Returns `false` if all handoff slots are in use.
+bool _mi_segment_handoff_open(mi_threadid_t to, mi_segments_tld_t* tld) {
+  mi_handoff_t* h = tld->handoff;
+  size_t state = 0;
+  if (h == NULL) {
+    for (size_t i = 0; i < MI_HANDOFF_MAX && h == NULL; i++) {
+      state = mi_atomic_load_relaxed(&handoffs[i].state);
+      if (MI_HANDOFF_PHASE(state) == MI_HANDOFF_FREE &&
+          mi_atomic_cas_strong_acq_rel(&handoffs[i].state, &state, MI_HANDOFF_TAG(state) | MI_HANDOFF_CLAIMED)) {
+        h = &handoffs[i];
+      }
+    }
+    if (h == NULL) return false;
+    mi_atomic_store_ptr_relaxed(mi_segment_t, &h->segments, NULL);
+    mi_atomic_store_relaxed(&h->from, _mi_thread_id());
+    mi_atomic_increment_relaxed(&handoff_count);
+    tld->handoff = h;
+  }
+  else {
+    state = mi_handoff_claim_own(h);
+    // a new target gets a new chance
+    if (mi_atomic_load_ptr_relaxed(mi_segment_t, &h->segments) == MI_HANDOFF_SEALED) {
+      mi_atomic_store_ptr_relaxed(mi_segment_t, &h->segments, NULL);
+    }
+  }
+  mi_atomic_store_relaxed(&h->to, to);
+  mi_atomic_storei64_relaxed(&h->expire, _mi_clock_now() + MI_HANDOFF_EXPIRE);
+  mi_atomic_store_release(&h->state, (MI_HANDOFF_TAG(state) + MI_HANDOFF_TAG_INC) | MI_HANDOFF_OPEN);
+  return true;
+}
+
+// Called when the thread is done. The segments that this thread handed off remain for its successor
+// (or the main thread at exit), but the handoffs to this thread are sealed so their segments are abandoned as usual.
+void _mi_segment_handoff_close(mi_segments_tld_t* tld) {
+  mi_handoff_t* h = tld->handoff;
+  if (h != NULL) {
+    tld->handoff = NULL;
+    const size_t state = mi_handoff_claim_own(h);
+    mi_segment_t* segments = mi_atomic_load_ptr_relaxed(mi_segment_t, &h->segments);
+    if (segments == NULL || segments == MI_HANDOFF_SEALED) {
+      mi_handoff_release(h, state);  // nothing left to adopt
+    }
+    else {
+      mi_atomic_store_release(&h->state, MI_HANDOFF_TAG(state) | MI_HANDOFF_CLOSED);
+    }
+  }
+  if (mi_atomic_load_relaxed(&handoff_count) == 0) return;
+  const mi_threadid_t self = _mi_thread_id();
+  for (size_t i = 0; i < MI_HANDOFF_MAX; i++) {
+    h = &handoffs[i];
+    const size_t state = mi_atomic_load_acquire(&h->state);
+    if (MI_HANDOFF_PHASE(state) < MI_HANDOFF_OPEN) continue;
+    if (mi_atomic_load_acquire(&h->to) != self) continue;
+    mi_handoff_abandon(mi_handoff_take(h, state, true), tld);
+  }
+}
+
+// Push a segment on the handoff list; returns `false` if the list is sealed.
+static bool mi_handoff_push(mi_handoff_t* h, mi_segment_t* segment) {
+  mi_segment_t* next = mi_atomic_load_ptr_relaxed(mi_segment_t, &h->segments);
+  do {
+    if (next == MI_HANDOFF_SEALED) return false;
+    mi_atomic_store_ptr_release(mi_segment_t, &segment->abandoned_next, next);
+  } while (!mi_atomic_cas_ptr_weak_release(mi_segment_t, &h->segments, &next, segment));
+  return true;
+}
+
+
 /* -----------------------------------------------------------
    Abandon segment/page
 ----------------------------------------------------------- */
@@ -1187,6 +1419,7 @@ static void mi_segment_abandon(mi_segment_t* segment, mi_segments_tld_t* tld) {
   mi_assert_internal(mi_atomic_load_ptr_relaxed(mi_segment_t, &segment->abandoned_next) == NULL);
   mi_assert_internal(segment->abandoned_visits == 0);
   mi_assert_expensive(mi_segment_is_valid(segment,tld));
+  _mi_event_record(MI_EVENT_SEGMENT_ABANDON, segment, mi_segment_size(segment));
   
   // remove the free pages from the free page queues
   mi_slice_t* slice = &segment->slices[0];
@@ -1201,15 +1434,16 @@ static void mi_segment_abandon(mi_segment_t* segment, mi_segments_tld_t* tld) {
     slice = slice + slice->slice_count;
   }
 
-  // perform delayed decommits
-  mi_segment_delayed_decommit(segment, mi_option_is_enabled(mi_option_abandoned_page_decommit) /* force? */, tld->stats);    
-  
-  // all pages in the segment are abandoned; add it to the abandoned list
+  // all pages in the segment are abandoned; add it to the handoff or abandoned list
   _mi_stat_increase(&tld->stats->segments_abandoned, 1);
   mi_segments_track_size(-((long)mi_segment_size(segment)), tld);
   segment->thread_id = 0;
   mi_atomic_store_ptr_release(mi_segment_t, &segment->abandoned_next, NULL);
   segment->abandoned_visits = 1;   // from 0 to 1 to signify it is abandoned
+  // keep the pages hot if handed off to a successor
+  if (tld->handoff != NULL && mi_handoff_push(tld->handoff, segment)) return;
+  // otherwise perform delayed decommits 
+  mi_segment_delayed_decommit(segment, mi_option_is_enabled(mi_option_abandoned_page_decommit) /* force? */, tld->stats);    
   mi_abandoned_push(segment);
 }
 
@@ -1294,6 +1528,7 @@ static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap,
   mi_assert_internal(mi_atomic_load_ptr_relaxed(mi_segment_t, &segment->abandoned_next) == NULL);
   mi_assert_expensive(mi_segment_is_valid(segment, tld));
   if (right_page_reclaimed != NULL) { *right_page_reclaimed = false; }
+  _mi_event_record(MI_EVENT_SEGMENT_RECLAIM, segment, mi_segment_size(segment));
 
   segment->thread_id = _mi_thread_id();
   segment->abandoned_visits = 0;
@@ -1353,20 +1588,84 @@ static mi_segment_t* mi_segment_reclaim(mi_segment_t* segment, mi_heap_t* heap,
 }
 
 
+static size_t mi_handoff_adopt_all(mi_heap_t* heap, mi_threadid_t from, bool to_any, mi_segments_tld_t* tld);
+
 void _mi_abandoned_reclaim_all(mi_heap_t* heap, mi_segments_tld_t* tld) {
   mi_segment_t* segment;
   while ((segment = mi_abandoned_pop()) != NULL) {
     mi_segment_reclaim(segment, heap, 0, NULL, tld);
   }
+  mi_handoff_adopt_all(heap, 0, true, tld);
 }
 
-static mi_segment_t* mi_segment_try_reclaim(mi_heap_t* heap, size_t needed_slices, size_t block_size, bool* reclaimed, mi_segments_tld_t* tld)
+// Reclaim a list of handed off segments into `heap`.
+static size_t mi_handoff_reclaim(mi_segment_t* segment, mi_heap_t* heap, mi_segments_tld_t* tld) {
+  size_t count = 0;
+  while (segment != NULL) {
+    mi_segment_t* next = mi_atomic_load_ptr_relaxed(mi_segment_t, &segment->abandoned_next);
+    mi_atomic_store_ptr_release(mi_segment_t, &segment->abandoned_next, NULL);
+    mi_segment_reclaim(segment, heap, 0, NULL, tld);
+    count++;
+    segment = next;
+  }
+  return count;
+}
+
+// Put a list of handed off segments that are not adopted on the abandoned list.
+static void mi_handoff_abandon(mi_segment_t* segment, mi_segments_tld_t* tld) {
+  while (segment != NULL) {
+    mi_segment_t* next = mi_atomic_load_ptr_relaxed(mi_segment_t, &segment->abandoned_next);
+    mi_atomic_store_ptr_release(mi_segment_t, &segment->abandoned_next, NULL);
+    mi_segment_delayed_decommit(segment, mi_option_is_enabled(mi_option_abandoned_page_decommit) /* force? */, tld->stats);
+    mi_abandoned_push(segment);
+    segment = next;
+  }
+}
+
+// Adopt the segments handed off by thread `from` (or any thread if `from == 0`) that are handed to
+// the current thread (or to any thread). If `to_any` is true, also adopt the ones handed to other threads.
+// Handoffs to other threads that are not adopted in time are abandoned as usual.
+static size_t mi_handoff_adopt_all(mi_heap_t* heap, mi_threadid_t from, bool to_any, mi_segments_tld_t* tld) {
+  if (mi_atomic_load_relaxed(&handoff_count) == 0) return 0;
+  const mi_threadid_t self = _mi_thread_id();
+  const mi_msecs_t now = _mi_clock_now();
+  size_t count = 0;
+  for (size_t i = 0; i < MI_HANDOFF_MAX; i++) {
+    mi_handoff_t* h = &handoffs[i];
+    if (h == tld->handoff) continue;  // never adopt our own
+    const size_t state = mi_atomic_load_acquire(&h->state);
+    if (MI_HANDOFF_PHASE(state) < MI_HANDOFF_OPEN) continue;
+    // these are validated by the claim on `state` in `mi_handoff_take`
+    const mi_threadid_t h_from = mi_atomic_load_acquire(&h->from);
+    const mi_threadid_t h_to   = mi_atomic_load_acquire(&h->to);
+    bool adopt;
+    if (to_any)         adopt = (from == 0 || h_from == from);
+    else if (from == 0) adopt = (h_to == self);                                 // implicitly we only adopt the segments handed to us
+    else                adopt = (h_from == from && (h_to == 0 || h_to == self)); // and explicitly also the ones handed to any thread
+    if (adopt) {
+      count += mi_handoff_reclaim(mi_handoff_take(h, state, false), heap, tld);
+    }
+    else if (now >= mi_atomic_loadi64_relaxed(&h->expire)) {
+      mi_handoff_abandon(mi_handoff_take(h, state, true), tld);
+    }
+  }
+  return count;
+}
+
+size_t _mi_segment_handoff_adopt(mi_heap_t* heap, mi_threadid_t from, mi_segments_tld_t* tld) {
+  return mi_handoff_adopt_all(heap, from, false, tld);
+}
+
+static mi_segment_t* mi_segment_try_reclaimx(mi_heap_t* heap, size_t needed_slices, size_t block_size, bool* reclaimed, mi_segments_tld_t* tld)
 {
   *reclaimed = false;
   mi_segment_t* segment;
   long max_tries = mi_option_get_clamp(mi_option_max_segment_reclaim, 8, 1024);     // limit the work to bound allocation times  
   while ((max_tries-- > 0) && ((segment = mi_abandoned_pop()) != NULL)) {
     segment->abandoned_visits++;
+    // todo: an arena exclusive heap will potentially visit many abandoned unsuitable segments
+    // and push them into the visited list and use many tries. Perhaps we can skip non-suitable ones in a better way?
+    bool is_suitable = _mi_arena_memid_is_suitable(segment->memid, heap->arena_id);
     bool has_page = mi_segment_check_free(segment,needed_slices,block_size,tld); // try to free up pages (due to concurrent frees)
     if (segment->used == 0) {
       // free the segment (by forced reclaim) to make it available to other threads.
@@ -1376,13 +1675,13 @@ static mi_segment_t* mi_segment_try_reclaim(mi_heap_t* heap, size_t needed_slice
       // freeing but that would violate some invariants temporarily)
       mi_segment_reclaim(segment, heap, 0, NULL, tld);
     }
-    else if (has_page) {
+    else if (has_page && is_suitable) {
       // found a large enough free span, or a page of the right block_size with free space 
       // we return the result of reclaim (which is usually `segment`) as it might free
       // the segment due to concurrent frees (in which case `NULL` is returned).
       return mi_segment_reclaim(segment, heap, block_size, reclaimed, tld);
     }
-    else if (segment->abandoned_visits > 3) {  
+    else if (segment->abandoned_visits > 3 && is_suitable) {  
       // always reclaim on 3rd visit to limit the abandoned queue length.
       mi_segment_reclaim(segment, heap, 0, NULL, tld);
     }
@@ -1395,6 +1694,16 @@ static mi_segment_t* mi_segment_try_reclaim(mi_heap_t* heap, size_t needed_slice
   return NULL;
 }
 
+static mi_segment_t* mi_segment_try_reclaim(mi_heap_t* heap, size_t needed_slices, size_t block_size, bool* reclaimed, mi_segments_tld_t* tld)
+{
+  const mi_usecs_t start = mi_usdt_start(segment_reclaim);
+  const uint64_t cycles = mi_latency_start();
+  mi_segment_t* segment = mi_segment_try_reclaimx(heap, needed_slices, block_size, reclaimed, tld);
+  mi_latency_stop(tld->stats, MI_LATENCY_SEGMENT_RECLAIM, cycles);
+  mi_usdt_probe4(segment_reclaim, heap, block_size, segment, mi_usdt_elapsed(start));
+  return segment;
+}
+
 
 void _mi_abandoned_collect(mi_heap_t* heap, bool force, mi_segments_tld_t* tld)
 {
@@ -1442,7 +1751,7 @@ static mi_segment_t* mi_segment_reclaim_or_alloc(mi_heap_t* heap, size_t needed_
     return segment;
   }
   // 2. otherwise allocate a fresh segment
-  return mi_segment_alloc(0, tld, os_tld, NULL);  
+  return mi_segment_alloc(0, heap->arena_id, tld, os_tld, NULL);  
 }
 
 
@@ -1458,7 +1767,13 @@ static mi_page_t* mi_segments_page_alloc(mi_heap_t* heap, mi_page_kind_t page_ki
   size_t page_size = _mi_align_up(required, (required > MI_MEDIUM_PAGE_SIZE ? MI_MEDIUM_PAGE_SIZE : MI_SEGMENT_SLICE_SIZE));
   size_t slices_needed = page_size / MI_SEGMENT_SLICE_SIZE;
   mi_assert_internal(slices_needed * MI_SEGMENT_SLICE_SIZE == page_size);
-  mi_page_t* page = mi_segments_page_find_and_allocate(slices_needed, tld); //(required <= MI_SMALL_SIZE_MAX ? 0 : slices_needed), tld);
+  mi_page_t* page = mi_segments_page_find_and_allocate(slices_needed, heap->arena_id, tld); //(required <= MI_SMALL_SIZE_MAX ? 0 : slices_needed), tld);
+  if (page==NULL && mi_unlikely(mi_atomic_load_relaxed(&handoff_count) > 0) && !heap->no_reclaim) {
+    // adopt the segments that a predecessor thread handed to us (into our backing heap) and try again
+    if (mi_handoff_adopt_all(heap->tld->heap_backing, 0, false, tld) > 0) {
+      page = mi_segments_page_find_and_allocate(slices_needed, heap->arena_id, tld);
+    }
+  }
   if (page==NULL) {
     // no free page, allocate a new segment and try again
     if (mi_segment_reclaim_or_alloc(heap, slices_needed, block_size, tld, os_tld) == NULL) {
@@ -1482,10 +1797,10 @@ static mi_page_t* mi_segments_page_alloc(mi_heap_t* heap, mi_page_kind_t page_ki
    Huge page allocation
 ----------------------------------------------------------- */
 
-static mi_page_t* mi_segment_huge_page_alloc(size_t size, mi_segments_tld_t* tld, mi_os_tld_t* os_tld)
+static mi_page_t* mi_segment_huge_page_alloc(size_t size, mi_arena_id_t req_arena_id, mi_segments_tld_t* tld, mi_os_tld_t* os_tld)
 {
   mi_page_t* page = NULL;
-  mi_segment_t* segment = mi_segment_alloc(size,tld,os_tld,&page);
+  mi_segment_t* segment = mi_segment_alloc(size,req_arena_id,tld,os_tld,&page);
   if (segment == NULL || page==NULL) return NULL;
   mi_assert_internal(segment->used==1);
   mi_assert_internal(mi_page_block_size(page) >= size);  
@@ -1520,22 +1835,215 @@ void _mi_segment_huge_page_free(mi_segment_t* segment, mi_page_t* page, mi_block
 #endif
 }
 
+/* -----------------------------------------------------------
+   Heap snapshots: adopt segments that were mapped back in
+   at their original address (see `snapshot.c`)
+----------------------------------------------------------- */
+
+// check that a free list stays within the page area (and is not cyclic)
+static bool mi_snapshot_free_list_is_valid(const mi_page_t* page, mi_block_t* list, const uint8_t* start, size_t psize) {
+  size_t count = 0;
+  for (mi_block_t* block = list; block != NULL; block = mi_block_next(page, block)) {
+    if ((uint8_t*)block < start || (uint8_t*)block >= start + psize) return false;
+    if (++count > page->capacity) return false;
+  }
+  return true;
+}
+
+// cheap structural checks on a segment read back from disk; unlike `mi_segment_is_valid`
+// these are also performed in release mode and return `false` instead of asserting.
+static bool mi_segment_snapshot_is_valid(mi_segment_t* segment, size_t max_size) {
+  if (segment->kind != MI_SEGMENT_NORMAL && segment->kind != MI_SEGMENT_HUGE) return false;
+  if (segment->kind == MI_SEGMENT_NORMAL && segment->segment_slices != MI_SLICES_PER_SEGMENT) return false;
+  if (segment->segment_info_slices == 0 || segment->segment_info_slices >= segment->segment_slices) return false;
+  if (segment->slice_entries == 0 || segment->slice_entries > MI_SLICES_PER_SEGMENT || segment->slice_entries > segment->segment_slices) return false;
+  if (mi_segment_size(segment) > max_size) return false;
+  const mi_slice_t* slice = &segment->slices[0];
+  const mi_slice_t* end = mi_segment_slices_end(segment);
+  size_t used_count = 0;
+  while (slice < end) {
+    if (slice->slice_count == 0 || slice->slice_offset != 0) return false;
+    if (mi_slice_is_used(slice)) {
+      used_count++;
+      if (slice > segment->slices) {
+        const mi_page_t* page = mi_slice_to_page((mi_slice_t*)slice);
+        if (page->capacity > page->reserved || page->used > page->capacity) return false;
+        size_t psize;
+        const uint8_t* start = _mi_segment_page_start_from_slice(segment, slice, page->xblock_size, &psize);
+        if (page->xblock_size < MI_HUGE_BLOCK_SIZE && (size_t)page->reserved * page->xblock_size > psize) return false;
+        if (!mi_snapshot_free_list_is_valid(page, page->free, start, psize)) return false;
+        if (!mi_snapshot_free_list_is_valid(page, page->local_free, start, psize)) return false;
+      }
+    }
+    if (segment->kind == MI_SEGMENT_NORMAL && slice->slice_count > (size_t)(end - slice)) return false;
+    slice = slice + slice->slice_count;
+  }
+  return (used_count == segment->used + 1);
+}
+
+// Adopt a segment from a restored snapshot into `heap`: fix up the process specific
+// fields (memid, cookie, queue links), and reclaim it like an abandoned segment.
+// Huge segments stay abandoned as usual.
+bool _mi_segment_snapshot_adopt(mi_segment_t* segment, size_t memid, size_t max_size, mi_heap_t* heap, bool validate, mi_segments_tld_t* tld) {
+  if (validate && !mi_segment_snapshot_is_valid(segment, max_size)) {
+    _mi_error_message(EINVAL, "invalid segment in heap snapshot at %p\n", segment);
+    return false;
+  }
+  segment->memid = memid;
+  segment->cookie = _mi_ptr_cookie(segment);
+  segment->next = NULL;
+  mi_atomic_store_ptr_release(mi_segment_t, &segment->abandoned_next, NULL);
+  segment->abandoned_visits = 0;
+  _mi_segment_map_allocated_at(segment, mi_segment_size(segment));
+  _mi_stat_increase(&tld->stats->page_committed, mi_segment_info_size(segment));
+
+  // reset the pages to the state they have after `_mi_segment_page_abandon`
+  segment->abandoned = 0;
+  const mi_slice_t* end;
+  mi_slice_t* slice = mi_slices_start_iterate(segment, &end);
+  while (slice < end) {
+    mi_page_t* page = mi_slice_to_page(slice);
+    page->next = NULL;
+    page->prev = NULL;
+    if (mi_slice_is_used(slice)) {
+      mi_page_set_heap(page, NULL);
+      mi_page_set_in_full(page, false);
+      mi_atomic_store_release(&page->xthread_free, mi_tf_make(mi_page_thread_free(page), MI_NEVER_DELAYED_FREE));
+      _mi_stat_increase(&tld->stats->pages, 1);
+      _mi_stat_increase(&tld->stats->page_committed, page->capacity * mi_page_block_size(page));
+      #if (MI_STAT)
+      const size_t bsize = mi_page_block_size(page);
+      if (bsize <= MI_LARGE_OBJ_SIZE_MAX) {
+        mi_heap_stat_increase(heap, normal, bsize * page->used);
+      }
+      mi_heap_stat_increase(heap, malloc, bsize * page->used);
+      #endif
+      segment->abandoned++;
+    }
+    slice = slice + slice->slice_count;
+  }
+  mi_assert_internal(segment->abandoned == segment->used);
+
+  if (segment->kind == MI_SEGMENT_HUGE) {
+    // huge segments are always abandoned (and not in any heap queue)
+    mi_segments_track_size((long)mi_segment_size(segment), tld);
+    segment->abandoned = 0;
+    segment->thread_id = 0;
+    return true;
+  }
+  segment->thread_id = 0;
+  _mi_stat_increase(&tld->stats->segments_abandoned, 1);
+  _mi_stat_increase(&tld->stats->pages_abandoned, segment->abandoned);
+  mi_segment_reclaim(segment, heap, 0, NULL, tld);
+  return true;
+}
+
+// Visit the used spans of a segment (including the segment info) in address order.
+bool _mi_segment_snapshot_visit_spans(mi_segment_t* segment, mi_segment_span_visit_fun* visit, void* arg) {
+  if (segment->kind == MI_SEGMENT_HUGE) {
+    return visit(segment, mi_segment_size(segment), arg);
+  }
+  const mi_slice_t* slice = &segment->slices[0];
+  const mi_slice_t* end = mi_segment_slices_end(segment);
+  while (slice < end) {
+    if (mi_slice_is_used(slice)) {
+      uint8_t* start = (uint8_t*)segment + (mi_slice_index(slice) * MI_SEGMENT_SLICE_SIZE);
+      if (!visit(start, slice->slice_count * MI_SEGMENT_SLICE_SIZE, arg)) return false;
+    }
+    slice = slice + slice->slice_count;
+  }
+  return true;
+}
+
+
+/* -----------------------------------------------------------
+   Fragmentation report: print a map of the slices of a segment
+----------------------------------------------------------- */
+
+#define MI_SEGMENT_MAP_GROUP  (8)   // slices per character in the map
+#define MI_SEGMENT_MAP_LINE   (128) // characters per line of the map
+
+static bool mi_commit_mask_is_set(const mi_commit_mask_t* cm, size_t bitidx) {
+  mi_assert_internal(bitidx < MI_COMMIT_MASK_BITS);
+  return ((cm->mask[bitidx / MI_COMMIT_MASK_FIELD_BITS] >> (bitidx % MI_COMMIT_MASK_FIELD_BITS)) & 1) != 0;
+}
+
+// Print the slice usage of a segment owned by the current thread and return the bytes in free but committed slices.
+size_t _mi_segment_fragmentation_print(const mi_segment_t* segment, mi_output_fun* out, void* arg) {
+  if (segment->kind == MI_SEGMENT_HUGE) {
+    _mi_fprintf(out, arg, "segment %p: huge, %zu bytes\n", segment, mi_segment_size((mi_segment_t*)segment));
+    return 0;
+  }
+  mi_assert_internal(segment->slice_entries <= MI_COMMIT_MASK_BITS);
+  // one character for each group of slices:
+  // '#' all used, '+' partly used, 'o' free and committed, ':' free and partly committed, '.' free and decommitted
+  char map[MI_SLICES_PER_SEGMENT/MI_SEGMENT_MAP_GROUP + 1];
+  size_t used = 0;
+  size_t free_committed = 0;
+  size_t free_decommitted = 0;
+  size_t group_used = 0;
+  size_t group_committed = 0;
+  size_t n = 0;
+  const mi_slice_t* slice = &segment->slices[0];
+  const mi_slice_t* end = mi_segment_slices_end(segment);
+  while (slice < end) {
+    const bool is_used = mi_slice_is_used(slice);
+    const size_t idx = mi_slice_index(slice);
+    for (size_t i = idx; i < idx + slice->slice_count && i < segment->slice_entries; i++) {
+      if (is_used) {
+        used++;
+        group_used++;
+      }
+      else if (mi_commit_mask_is_set(&segment->commit_mask, i)) {
+        free_committed++;
+        group_committed++;
+      }
+      else {
+        free_decommitted++;
+      }
+      if ((i + 1) % MI_SEGMENT_MAP_GROUP == 0 || i + 1 == segment->slice_entries) {
+        const size_t group = (i % MI_SEGMENT_MAP_GROUP) + 1;
+        const size_t group_free = group - group_used;
+        map[n++] = (group_used == group ? '#' : (group_used > 0 ? '+' :
+                   (group_committed == group_free ? 'o' : (group_committed > 0 ? ':' : '.'))));
+        group_used = 0;
+        group_committed = 0;
+      }
+    }
+    slice = slice + slice->slice_count;
+  }
+  map[n] = 0;
+  _mi_fprintf(out, arg, "segment %p: %zu slices used, %zu free and committed (%zu bytes), %zu free and decommitted\n",
+              segment, used, free_committed, free_committed * MI_SEGMENT_SLICE_SIZE, free_decommitted);
+  // print the map in lines of at most MI_SEGMENT_MAP_LINE characters (one line for 1024 slices)
+  for (size_t i = 0; i < n; i += MI_SEGMENT_MAP_LINE) {
+    _mi_fprintf(out, arg, "  %.*s\n", (int)MI_SEGMENT_MAP_LINE, map + i);
+  }
+  return (free_committed * MI_SEGMENT_SLICE_SIZE);
+}
+
+
 /* -----------------------------------------------------------
    Page allocation and free
 ----------------------------------------------------------- */
-mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, mi_segments_tld_t* tld, mi_os_tld_t* os_tld) {
+// Allocate a page for blocks of `block_size`. For small and medium blocks, `page_size` is
+// the requested page size (at most `MI_MEDIUM_PAGE_SIZE`), or 0 for the default. For large
+// blocks it is the size of a page with several blocks, or 0 for a page with just one block.
+mi_page_t* _mi_segment_page_alloc(mi_heap_t* heap, size_t block_size, size_t page_size, mi_segments_tld_t* tld, mi_os_tld_t* os_tld) {
+  mi_assert_internal(page_size <= MI_MEDIUM_PAGE_SIZE || (block_size <= MI_LARGE_BIN_OBJ_SIZE_MAX && block_size > MI_MEDIUM_OBJ_SIZE_MAX));
   mi_page_t* page;
   if (block_size <= MI_SMALL_OBJ_SIZE_MAX) {
-    page = mi_segments_page_alloc(heap,MI_PAGE_SMALL,block_size,block_size,tld,os_tld);
+    page = mi_segments_page_alloc(heap,MI_PAGE_SMALL,(page_size > block_size ? page_size : block_size),block_size,tld,os_tld);
   }
   else if (block_size <= MI_MEDIUM_OBJ_SIZE_MAX) {
-    page = mi_segments_page_alloc(heap,MI_PAGE_MEDIUM,MI_MEDIUM_PAGE_SIZE,block_size,tld, os_tld);
+    page = mi_segments_page_alloc(heap,MI_PAGE_MEDIUM,(page_size > block_size ? page_size : MI_MEDIUM_PAGE_SIZE),block_size,tld, os_tld);
   }
   else if (block_size <= MI_LARGE_OBJ_SIZE_MAX) {
-    page = mi_segments_page_alloc(heap,MI_PAGE_LARGE,block_size,block_size,tld, os_tld);
+    page = mi_segments_page_alloc(heap,MI_PAGE_LARGE,(page_size > block_size ? page_size : block_size),block_size,tld, os_tld);
+    if (page != NULL && page_size > block_size) { mi_segment_page_set_back_offsets(page); }
   }
   else {
-    page = mi_segment_huge_page_alloc(block_size,tld,os_tld);
+    page = mi_segment_huge_page_alloc(block_size,heap->arena_id,tld,os_tld);
   }
   mi_assert_expensive(page == NULL || mi_segment_is_valid(_mi_page_segment(page),tld));
   return page;
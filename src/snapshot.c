@@ -0,0 +1,402 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+  Heap snapshots: a heap that lives in an exclusive arena backed by a file.
+
+  The arena is mapped (copy-on-write) from the file at a fixed address. Saving
+  writes all used spans of the segments in the arena (segment info, page meta
+  data, free lists, and blocks) back to the file together with a header that
+  contains the in-use bitmap of the arena. Restoring maps the file again at the
+  same address and adopts all segments into a fresh heap; memory is faulted in
+  lazily from the file so a restore takes time proportional to the number of
+  segments and not to the size of the heap.
+
+  File layout:
+    [0, MI_SNAPSHOT_HEADER_SIZE)  header + in-use bitmap fields
+    [MI_SNAPSHOT_HEADER_SIZE, ..) the arena memory
+-----------------------------------------------------------------------------*/
+#include "mimalloc.h"
+#include "mimalloc-internal.h"
+#include "mimalloc-atomic.h"
+
+#include <errno.h>
+
+#if !defined(_WIN32) && !defined(__wasi__) && (MI_SECURE==0)
+#define MI_SNAPSHOT_SUPPORTED  1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define MI_SNAPSHOT_MAGIC        (0x70616e73696d696dULL)   // "mimisnap"
+#define MI_SNAPSHOT_VERSION      (1)
+#define MI_SNAPSHOT_HEADER_SIZE  (64*MI_KiB)
+#define MI_SNAPSHOT_MAX          (8)                        // maximal number of live snapshot heaps
+
+typedef struct mi_snapshot_header_s {
+  uint64_t  magic;
+  uint64_t  version;
+  uint64_t  layout;       // hash of the data layout; a snapshot can only be restored by the same build configuration
+  uint64_t  clean;        // `1` if the snapshot was completely written
+  uint64_t  start;        // start address of the arena
+  uint64_t  size;         // size of the arena in bytes
+  uint64_t  root;         // user root pointer
+  uint64_t  field_count;  // in-use bitmap fields that follow the header
+} mi_snapshot_header_t;
+
+#define MI_SNAPSHOT_MAX_FIELDS   ((MI_SNAPSHOT_HEADER_SIZE - sizeof(mi_snapshot_header_t)) / sizeof(size_t))
+
+#if !defined(MI_SNAPSHOT_SUPPORTED)
+
+mi_heap_t* mi_heap_new_snapshot(const char* fname, void* addr, size_t size) mi_attr_noexcept {
+  MI_UNUSED(fname); MI_UNUSED(addr); MI_UNUSED(size);
+  _mi_warning_message("heap snapshots are not supported on this platform or configuration\n");
+  errno = ENOSYS;
+  return NULL;
+}
+
+int mi_heap_snapshot_save(mi_heap_t* heap, void* root) mi_attr_noexcept {
+  MI_UNUSED(heap); MI_UNUSED(root);
+  return ENOSYS;
+}
+
+mi_heap_t* mi_heap_snapshot_restore(const char* fname, bool validate, void** root) mi_attr_noexcept {
+  MI_UNUSED(fname); MI_UNUSED(validate); MI_UNUSED(root);
+  _mi_warning_message("heap snapshots are not supported on this platform or configuration\n");
+  errno = ENOSYS;
+  return NULL;
+}
+
+#else
+
+/* -----------------------------------------------------------
+  Registered snapshot arenas and their backing file
+----------------------------------------------------------- */
+
+typedef struct mi_snapshot_s {
+  _Atomic(mi_arena_id_t) arena_id;  // 0 if the entry is free
+  int                    fd;
+} mi_snapshot_t;
+
+static mi_snapshot_t mi_snapshots[MI_SNAPSHOT_MAX];
+
+static bool mi_snapshot_register(mi_arena_id_t arena_id, int fd) {
+  for (size_t i = 0; i < MI_SNAPSHOT_MAX; i++) {
+    mi_arena_id_t expected = 0;
+    if (mi_atomic_load_relaxed(&mi_snapshots[i].arena_id) == 0 &&
+        mi_atomic_cas_strong_acq_rel(&mi_snapshots[i].arena_id, &expected, -1)) {
+      mi_snapshots[i].fd = fd;
+      mi_atomic_store_release(&mi_snapshots[i].arena_id, arena_id);
+      return true;
+    }
+  }
+  return false;
+}
+
+static int mi_snapshot_fd(mi_arena_id_t arena_id) {
+  if (arena_id == _mi_arena_id_none()) return -1;
+  for (size_t i = 0; i < MI_SNAPSHOT_MAX; i++) {
+    if (mi_atomic_load_acquire(&mi_snapshots[i].arena_id) == arena_id) return mi_snapshots[i].fd;
+  }
+  return -1;
+}
+
+static uint64_t mi_snapshot_layout(void) {
+  uint64_t h = MI_SNAPSHOT_VERSION;
+  h = (h*31) + MI_SEGMENT_SIZE;
+  h = (h*31) + MI_SEGMENT_SLICE_SIZE;
+  h = (h*31) + sizeof(mi_page_t);
+  h = (h*31) + sizeof(mi_segment_t);
+  h = (h*31) + MI_INTPTR_SIZE;
+  h = (h*31) + MI_PADDING_SIZE;
+  for (size_t bin = 1; bin < MI_BIN_HUGE; bin++) {
+    h = (h*31) + _mi_bin_size((uint8_t)bin);  // pages must be in the same size classes
+  }
+  #if defined(MI_ENCODE_FREELIST)
+  h = (h*31) + 1;
+  #endif
+  return h;
+}
+
+
+/* -----------------------------------------------------------
+  File helpers
+----------------------------------------------------------- */
+
+static bool mi_snapshot_pwrite(int fd, const void* buf, size_t size, size_t offset) {
+  const uint8_t* p = (const uint8_t*)buf;
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, (off_t)offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += n; offset += (size_t)n; size -= (size_t)n;
+  }
+  return true;
+}
+
+static bool mi_snapshot_pread(int fd, void* buf, size_t size, size_t offset) {
+  uint8_t* p = (uint8_t*)buf;
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, (off_t)offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) { errno = EIO; return false; }  // unexpected end of file
+    p += n; offset += (size_t)n; size -= (size_t)n;
+  }
+  return true;
+}
+
+// Map the arena part of the file copy-on-write at exactly `addr`.
+static void* mi_snapshot_map(int fd, void* addr, size_t size) {
+  int flags = MAP_PRIVATE;
+  #if defined(MAP_FIXED_NOREPLACE)
+  flags |= MAP_FIXED_NOREPLACE;
+  #endif
+  void* p = mmap(addr, size, PROT_READ | PROT_WRITE, flags, fd, MI_SNAPSHOT_HEADER_SIZE);
+  if (p == MAP_FAILED) return NULL;
+  if (p != addr) {
+    // the address range is (partially) in use already
+    munmap(p, size);
+    errno = EEXIST;
+    return NULL;
+  }
+  return p;
+}
+
+// Iterate through the segments in the arena using the in-use bitmap.
+typedef bool (mi_snapshot_segment_fun)(mi_segment_t* segment, size_t max_size, void* arg);
+
+static bool mi_snapshot_visit_segments(uint8_t* start, size_t size, const size_t* fields, size_t field_count, mi_snapshot_segment_fun* fun, void* arg) {
+  const size_t block_count = size / MI_SEGMENT_SIZE;
+  size_t i = 0;
+  while (i < block_count) {
+    const size_t field = i / MI_INTPTR_BITS;
+    if (field >= field_count) break;
+    if ((fields[field] & ((size_t)1 << (i % MI_INTPTR_BITS))) == 0) { i++; continue; }
+    mi_segment_t* segment = (mi_segment_t*)(start + (i * MI_SEGMENT_SIZE));
+    const size_t max_size = size - (i * MI_SEGMENT_SIZE);
+    if (!fun(segment, max_size, arg)) return false;
+    const size_t segment_size = mi_segment_size(segment);
+    i += (segment_size == 0 ? 1 : _mi_divide_up(segment_size, MI_SEGMENT_SIZE));
+  }
+  return true;
+}
+
+
+/* -----------------------------------------------------------
+  Create a new snapshot heap
+----------------------------------------------------------- */
+
+mi_heap_t* mi_heap_new_snapshot(const char* fname, void* addr, size_t size) mi_attr_noexcept {
+  if (fname == NULL || addr == NULL || size == 0 || ((uintptr_t)addr % MI_SEGMENT_ALIGN) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  size = _mi_align_up(size, MI_SEGMENT_SIZE);
+  if (_mi_divide_up(size / MI_SEGMENT_SIZE, MI_INTPTR_BITS) > MI_SNAPSHOT_MAX_FIELDS) {
+    errno = EINVAL;
+    return NULL;
+  }
+  void* p = NULL;
+  mi_arena_id_t arena_id = _mi_arena_id_none();
+  int err = 0;
+  int fd = open(fname, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    _mi_warning_message("unable to create heap snapshot file \"%s\" (error: %d)\n", fname, errno);
+    return NULL;
+  }
+  // the file is sparse; the header stays zero (and thus not restorable) until the first save
+  if (ftruncate(fd, (off_t)(MI_SNAPSHOT_HEADER_SIZE + size)) != 0) goto err;
+  p = mi_snapshot_map(fd, addr, size);
+  if (p == NULL) {
+    _mi_warning_message("unable to map heap snapshot at %p (error: %d)\n", addr, errno);
+    goto err;
+  }
+  if (!mi_manage_os_memory_ex(p, size, true /* committed */, false /* large */, true /* zero */, -1, true /* exclusive */, &arena_id)) {
+    munmap(p, size);
+    errno = ENOMEM;
+    goto err;
+  }
+  if (!mi_snapshot_register(arena_id, fd)) {
+    _mi_warning_message("too many heap snapshots (at most %d)\n", MI_SNAPSHOT_MAX);
+    errno = ENOMEM;
+    return NULL;  // the arena cannot be removed again
+  }
+  _mi_verbose_message("created heap snapshot \"%s\" at %p (%zu MiB)\n", fname, p, size / MI_MiB);
+  return mi_heap_new_in_arena(arena_id);
+
+err:
+  err = errno;
+  close(fd);
+  errno = err;
+  return NULL;
+}
+
+
+/* -----------------------------------------------------------
+  Save a snapshot
+----------------------------------------------------------- */
+
+typedef struct mi_snapshot_save_s {
+  int      fd;
+  uint8_t* start;
+} mi_snapshot_save_t;
+
+static bool mi_snapshot_save_span(void* p, size_t size, void* arg) {
+  mi_snapshot_save_t* save = (mi_snapshot_save_t*)arg;
+  return mi_snapshot_pwrite(save->fd, p, size, MI_SNAPSHOT_HEADER_SIZE + ((uint8_t*)p - save->start));
+}
+
+static bool mi_snapshot_save_segment(mi_segment_t* segment, size_t max_size, void* arg) {
+  MI_UNUSED(max_size);
+  return _mi_segment_snapshot_visit_spans(segment, &mi_snapshot_save_span, arg);
+}
+
+// Save the heap to its backing file. The heap should not be used concurrently by other threads
+// (including frees) during the save.
+int mi_heap_snapshot_save(mi_heap_t* heap, void* root) mi_attr_noexcept {
+  if (heap == NULL || !mi_heap_is_initialized(heap)) return EINVAL;
+  const int fd = mi_snapshot_fd(heap->arena_id);
+  if (fd < 0) return EINVAL;
+  size_t size;
+  size_t field_count;
+  uint8_t* start = (uint8_t*)_mi_arena_area(heap->arena_id, &size, &field_count);
+  if (start == NULL || field_count > MI_SNAPSHOT_MAX_FIELDS) return EINVAL;
+
+  // make sure all delayed frees are in the page free lists
+  _mi_heap_delayed_free(heap);
+
+  mi_snapshot_header_t* header = (mi_snapshot_header_t*)_mi_os_alloc(MI_SNAPSHOT_HEADER_SIZE, &_mi_stats_main);
+  if (header == NULL) return ENOMEM;
+  size_t* fields = (size_t*)(header + 1);
+  _mi_arena_copy_inuse(heap->arena_id, fields, field_count);
+  header->magic = MI_SNAPSHOT_MAGIC;
+  header->version = MI_SNAPSHOT_VERSION;
+  header->layout = mi_snapshot_layout();
+  header->clean = 0;
+  header->start = (uintptr_t)start;
+  header->size = size;
+  header->root = (uintptr_t)root;
+  header->field_count = field_count;
+
+  // first mark the file as unclean, then write all segments, and finally the clean header
+  int err = 0;
+  mi_snapshot_save_t save = { fd, start };
+  if (!mi_snapshot_pwrite(fd, header, sizeof(mi_snapshot_header_t), 0) ||
+      !mi_snapshot_visit_segments(start, size, fields, field_count, &mi_snapshot_save_segment, &save) ||
+      fdatasync(fd) != 0) {
+    err = errno;
+  }
+  else {
+    header->clean = 1;
+    if (!mi_snapshot_pwrite(fd, header, MI_SNAPSHOT_HEADER_SIZE, 0) || fdatasync(fd) != 0) {
+      err = errno;
+    }
+  }
+  _mi_os_free(header, MI_SNAPSHOT_HEADER_SIZE, &_mi_stats_main);
+  if (err != 0) {
+    _mi_warning_message("unable to save heap snapshot (error: %d)\n", err);
+  }
+  return err;
+}
+
+
+/* -----------------------------------------------------------
+  Restore a snapshot
+----------------------------------------------------------- */
+
+typedef struct mi_snapshot_restore_s {
+  mi_arena_id_t arena_id;
+  mi_heap_t*    heap;
+  bool          validate;
+} mi_snapshot_restore_t;
+
+static bool mi_snapshot_restore_segment(mi_segment_t* segment, size_t max_size, void* arg) {
+  mi_snapshot_restore_t* restore = (mi_snapshot_restore_t*)arg;
+  const size_t memid = _mi_arena_memid_of(restore->arena_id, segment);
+  return _mi_segment_snapshot_adopt(segment, memid, max_size, restore->heap, restore->validate, &restore->heap->tld->segments);
+}
+
+// Restore a heap from a snapshot file at its original address. If `validate` is set, the segments
+// and pages are checked for consistency (which touches all segment meta data).
+mi_heap_t* mi_heap_snapshot_restore(const char* fname, bool validate, void** root) mi_attr_noexcept {
+  if (root != NULL) *root = NULL;
+  if (fname == NULL) { errno = EINVAL; return NULL; }
+  int fd = open(fname, O_RDWR | O_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  mi_snapshot_header_t* header = (mi_snapshot_header_t*)_mi_os_alloc(MI_SNAPSHOT_HEADER_SIZE, &_mi_stats_main);
+  if (header == NULL) { close(fd); errno = ENOMEM; return NULL; }
+  const size_t* fields = (const size_t*)(header + 1);
+  mi_heap_t* heap = NULL;
+  void* p = NULL;
+  mi_arena_id_t arena_id = _mi_arena_id_none();
+  mi_snapshot_restore_t restore;
+  int err = 0;
+  if (!mi_snapshot_pread(fd, header, MI_SNAPSHOT_HEADER_SIZE, 0)) goto err;
+  if (header->magic != MI_SNAPSHOT_MAGIC || header->version != MI_SNAPSHOT_VERSION || header->layout != mi_snapshot_layout() ||
+      header->field_count > MI_SNAPSHOT_MAX_FIELDS || header->size == 0 || (header->size % MI_SEGMENT_SIZE) != 0 ||
+      (header->start % MI_SEGMENT_ALIGN) != 0) {
+    _mi_warning_message("invalid heap snapshot \"%s\"\n", fname);
+    errno = EINVAL;
+    goto err;
+  }
+  if (header->clean != 1) {
+    _mi_warning_message("heap snapshot \"%s\" was not completely saved\n", fname);
+    errno = EINVAL;
+    goto err;
+  }
+
+  p = mi_snapshot_map(fd, (void*)(uintptr_t)header->start, header->size);
+  if (p == NULL) {
+    _mi_warning_message("unable to map heap snapshot at %p (error: %d)\n", (void*)(uintptr_t)header->start, errno);
+    goto err;
+  }
+  if (!mi_manage_os_memory_ex(p, header->size, true /* committed */, false /* large */, false /* zero */, -1, true /* exclusive */, &arena_id)) {
+    munmap(p, header->size);
+    errno = ENOMEM;
+    goto err;
+  }
+  if (!_mi_arena_restore_inuse(arena_id, fields, header->field_count) || !mi_snapshot_register(arena_id, fd)) {
+    errno = EINVAL;
+    goto err_arena;
+  }
+  heap = mi_heap_new_in_arena(arena_id);
+  if (heap == NULL) goto err_arena;
+  restore.arena_id = arena_id;
+  restore.heap = heap;
+  restore.validate = validate;
+  if (!mi_snapshot_visit_segments((uint8_t*)p, header->size, fields, header->field_count, &mi_snapshot_restore_segment, &restore)) {
+    // the segments that were adopted stay in use
+    errno = EINVAL;
+    heap = NULL;
+    goto err_arena;
+  }
+  if (root != NULL) *root = (void*)(uintptr_t)header->root;
+  _mi_verbose_message("restored heap snapshot \"%s\" at %p (%zu MiB)\n", fname, p, (size_t)(header->size / MI_MiB));
+  _mi_os_free(header, MI_SNAPSHOT_HEADER_SIZE, &_mi_stats_main);
+  return heap;
+
+err_arena:
+  // the arena cannot be removed again; keep the file open as it backs the mapping
+  _mi_os_free(header, MI_SNAPSHOT_HEADER_SIZE, &_mi_stats_main);
+  return NULL;
+
+err:
+  err = errno;
+  _mi_os_free(header, MI_SNAPSHOT_HEADER_SIZE, &_mi_stats_main);
+  close(fd);
+  errno = err;
+  return NULL;
+}
+
+#endif
@@ -37,3 +37,8 @@ terms of the MIT license. A copy of the license can be found in the file
 #endif
 #include "init.c"
 #include "options.c"
+#include "snapshot.c"
+#include "profile.c"
+#include "event.c"
+#include "epoch.c"
+#include "trace.c"
@@ -62,6 +62,48 @@ void _mi_stat_counter_increase(mi_stat_counter_t* stat, size_t amount) {
   }
 }
 
+#if MI_LATENCY
+// Bucket of a cycle count: counts below 8 are exact, and above that
+// we use 8 sub-buckets for each power of 2.
+static size_t mi_latency_bucket(uint64_t cycles) {
+  const uint64_t max = ((uint64_t)1 << (MI_LATENCY_MAX_BITS + 1)) - 1;
+  if (cycles > max) cycles = max;
+  if (cycles < ((uint64_t)1 << MI_LATENCY_SUB_BITS)) return (size_t)cycles;
+  size_t e = MI_LATENCY_SUB_BITS;
+  while ((cycles >> (e + 1)) != 0) { e++; }   // note: cannot use `mi_bsr` as `uintptr_t` may be 32-bit
+  const size_t sub = (size_t)(cycles >> (e - MI_LATENCY_SUB_BITS)) & ((1 << MI_LATENCY_SUB_BITS) - 1);
+  return ((e - MI_LATENCY_SUB_BITS + 1) << MI_LATENCY_SUB_BITS) + sub;
+}
+
+// The largest cycle count in a bucket
+static uint64_t mi_latency_bucket_max(size_t bucket) {
+  if (bucket < ((size_t)1 << MI_LATENCY_SUB_BITS)) return bucket;
+  const size_t e = (bucket >> MI_LATENCY_SUB_BITS) + MI_LATENCY_SUB_BITS - 1;
+  const size_t sub = bucket & ((1 << MI_LATENCY_SUB_BITS) - 1);
+  return ((((uint64_t)1 << MI_LATENCY_SUB_BITS) + sub + 1) << (e - MI_LATENCY_SUB_BITS)) - 1;
+}
+#endif
+
+void _mi_stat_latency_add(mi_stat_latency_t* stat, uint64_t cycles) {
+  #if MI_LATENCY
+  const size_t bucket = mi_latency_bucket(cycles);
+  if (mi_is_in_main(stat)) {
+    mi_atomic_addi64_relaxed(&stat->count, 1);
+    mi_atomic_addi64_relaxed(&stat->total, (int64_t)cycles);
+    mi_atomic_maxi64_relaxed(&stat->max, (int64_t)cycles);
+    mi_atomic_addi64_relaxed(&stat->buckets[bucket], 1);
+  }
+  else {
+    stat->count++;
+    stat->total += (int64_t)cycles;
+    if ((int64_t)cycles > stat->max) { stat->max = (int64_t)cycles; }
+    stat->buckets[bucket]++;
+  }
+  #else
+  MI_UNUSED(stat); MI_UNUSED(cycles);
+  #endif
+}
+
 void _mi_stat_increase(mi_stat_count_t* stat, size_t amount) {
   mi_stat_update(stat, (int64_t)amount);
 }
@@ -87,6 +129,18 @@ static void mi_stat_counter_add(mi_stat_counter_t* stat, const mi_stat_counter_t
   mi_atomic_addi64_relaxed( &stat->count, src->count * unit);
 }
 
+#if MI_LATENCY
+static void mi_stat_latency_add(mi_stat_latency_t* stat, const mi_stat_latency_t* src) {
+  if (stat==src || src->count==0) return;
+  mi_atomic_addi64_relaxed( &stat->count, src->count);
+  mi_atomic_addi64_relaxed( &stat->total, src->total);
+  mi_atomic_maxi64_relaxed( &stat->max, src->max);
+  for (size_t i = 0; i < MI_LATENCY_BUCKETS; i++) {
+    if (src->buckets[i] != 0) { mi_atomic_addi64_relaxed( &stat->buckets[i], src->buckets[i]); }
+  }
+}
+#endif
+
 // must be thread safe as it is called from stats_merge
 static void mi_stats_add(mi_stats_t* stats, const mi_stats_t* src) {
   if (stats==src) return;
@@ -123,6 +177,11 @@ static void mi_stats_add(mi_stats_t* stats, const mi_stats_t* src) {
     }
   }
 #endif
+#if MI_LATENCY
+  for (size_t i = 0; i < MI_LATENCY_COUNT; i++) {
+    mi_stat_latency_add(&stats->latency[i], &src->latency[i]);
+  }
+#endif
 }
 
 /* -----------------------------------------------------------
@@ -228,6 +287,43 @@ static void mi_print_header(mi_output_fun* out, void* arg ) {
   _mi_fprintf(out, arg, "%10s: %10s %10s %10s %10s %10s %10s\n", "heap stats", "peak   ", "total   ", "freed   ", "current   ", "unit   ", "count   ");
 }
 
+#if MI_LATENCY
+// The smallest cycle count such that at least `permille` of the samples are at or below it
+static int64_t mi_latency_percentile(const mi_stat_latency_t* stat, int64_t permille) {
+  const int64_t target = (stat->count * permille + 999) / 1000;
+  int64_t seen = 0;
+  for (size_t i = 0; i < MI_LATENCY_BUCKETS; i++) {
+    seen += stat->buckets[i];
+    if (seen >= target && seen > 0) {
+      const int64_t max = (int64_t)mi_latency_bucket_max(i);
+      return (max < stat->max ? max : stat->max);
+    }
+  }
+  return stat->max;
+}
+
+static const char* mi_latency_names[MI_LATENCY_COUNT] = {
+  "malloc", "free", "deferred", "seg alloc", "reclaim", "os alloc", "os free", "commit", "decommit", "reset"
+};
+
+static void mi_stats_print_latency(const mi_stat_latency_t* latency, mi_output_fun* out, void* arg) {
+  _mi_fprintf(out, arg, "\n%10s: %10s %10s %10s %10s %10s %10s\n", "cycles", "count   ", "mean   ", "p50   ", "p99   ", "p999   ", "max   ");
+  for (size_t i = 0; i < MI_LATENCY_COUNT; i++) {
+    const mi_stat_latency_t* stat = &latency[i];
+    if (stat->count == 0) continue;
+    _mi_fprintf(out, arg, "%10s:", mi_latency_names[i]);
+    mi_print_amount(stat->count, 0, out, arg);
+    mi_print_amount(stat->total / stat->count, 0, out, arg);
+    mi_print_amount(mi_latency_percentile(stat, 500), 0, out, arg);
+    mi_print_amount(mi_latency_percentile(stat, 990), 0, out, arg);
+    mi_print_amount(mi_latency_percentile(stat, 999), 0, out, arg);
+    mi_print_amount(stat->max, 0, out, arg);
+    _mi_fprintf(out, arg, "\n");
+  }
+  _mi_fprintf(out, arg, "\n");
+}
+#endif
+
 #if MI_STAT>1
 static void mi_stats_print_bins(const mi_stat_count_t* bins, size_t max, const char* fmt, mi_output_fun* out, void* arg) {
   bool found = false;
@@ -328,6 +424,9 @@ static void _mi_stats_print(mi_stats_t* stats, mi_output_fun* out0, void* arg0)
   mi_stat_print(&stats->threads, "threads", -1, out, arg);
   mi_stat_counter_print_avg(&stats->searches, "searches", out, arg);
   _mi_fprintf(out, arg, "%10s: %7zu\n", "numa nodes", _mi_os_numa_node_count());
+  #if MI_LATENCY
+  mi_stats_print_latency(stats->latency, out, arg);
+  #endif
   
   mi_msecs_t elapsed;
   mi_msecs_t user_time;
@@ -393,8 +492,377 @@ void mi_thread_stats_print_out(mi_output_fun* out, void* arg) mi_attr_noexcept {
 }
 
 
+/* -----------------------------------------------------------
+  Statistics snapshot
+
+  `mi_stats_get` copies the main statistics together with those of the
+  current thread (without merging them, so it can be called repeatedly).
+  Like `mi_stats_print`, the statistics of other threads are only included
+  once they are merged (at thread exit or with `mi_stats_merge`).
+  It does not allocate, and neither does `mi_stats_print_json`.
+----------------------------------------------------------- */
+
+static void mi_stat_count_get(mi_stats_count_t* dst, const mi_stat_count_t* src) {
+  dst->allocated = src->allocated;
+  dst->freed = src->freed;
+  dst->peak = src->peak;
+  dst->current = src->current;
+}
+
+static void mi_stat_counter_get(mi_stats_counter_t* dst, const mi_stat_counter_t* src) {
+  dst->total = src->total;
+  dst->count = src->count;
+}
+
+// the snapshot has a bin for each page queue bin (see `mimalloc.h`)
+#if (MI_STATS_BINS != MI_BIN_HUGE+1)
+#error "MI_STATS_BINS must be MI_BIN_HUGE+1"
+#endif
+
+bool mi_stats_get(mi_stats_snapshot_t* snapshot, size_t version) mi_attr_noexcept {
+  if (snapshot == NULL || version == 0 || version > MI_STATS_VERSION) return false;
+  mi_stats_t stats;
+  memcpy(&stats, &_mi_stats_main, sizeof(mi_stats_t));
+  // don't initialize the thread (as `mi_stats_get_default` does) so we can be called from any thread
+  mi_heap_t* heap = mi_get_default_heap();
+  if (mi_heap_is_initialized(heap)) { mi_stats_add(&stats, &heap->tld->stats); }
+
+  memset(snapshot, 0, sizeof(mi_stats_snapshot_t));
+  snapshot->version = MI_STATS_VERSION;
+  snapshot->size = sizeof(mi_stats_snapshot_t);
+  snapshot->detailed = (MI_STAT > 1);
+  mi_stat_count_get(&snapshot->segments, &stats.segments);
+  mi_stat_count_get(&snapshot->pages, &stats.pages);
+  mi_stat_count_get(&snapshot->reserved, &stats.reserved);
+  mi_stat_count_get(&snapshot->committed, &stats.committed);
+  mi_stat_count_get(&snapshot->reset, &stats.reset);
+  mi_stat_count_get(&snapshot->page_committed, &stats.page_committed);
+  mi_stat_count_get(&snapshot->segments_abandoned, &stats.segments_abandoned);
+  mi_stat_count_get(&snapshot->pages_abandoned, &stats.pages_abandoned);
+  mi_stat_count_get(&snapshot->threads, &stats.threads);
+  mi_stat_count_get(&snapshot->normal, &stats.normal);
+  mi_stat_count_get(&snapshot->huge, &stats.huge);
+  mi_stat_count_get(&snapshot->large, &stats.large);
+  mi_stat_count_get(&snapshot->malloc, &stats.malloc);
+  mi_stat_count_get(&snapshot->segments_cache, &stats.segments_cache);
+  mi_stat_counter_get(&snapshot->pages_extended, &stats.pages_extended);
+  mi_stat_counter_get(&snapshot->mmap_calls, &stats.mmap_calls);
+  mi_stat_counter_get(&snapshot->commit_calls, &stats.commit_calls);
+  mi_stat_counter_get(&snapshot->page_no_retire, &stats.page_no_retire);
+  mi_stat_counter_get(&snapshot->searches, &stats.searches);
+  mi_stat_counter_get(&snapshot->normal_count, &stats.normal_count);
+  mi_stat_counter_get(&snapshot->huge_count, &stats.huge_count);
+  mi_stat_counter_get(&snapshot->large_count, &stats.large_count);
+  for (size_t i = 1; i < MI_BIN_HUGE; i++) {
+    snapshot->normal_bin_sizes[i] = _mi_bin_size((uint8_t)i);
+    #if MI_STAT>1
+    mi_stat_count_get(&snapshot->normal_bins[i], &stats.normal_bins[i]);
+    #endif
+  }
+  #if MI_STAT>1
+  mi_stat_count_get(&snapshot->normal_bins[MI_BIN_HUGE], &stats.normal_bins[MI_BIN_HUGE]);
+  #endif
+  mi_process_info(&snapshot->elapsed_msecs, &snapshot->user_msecs, &snapshot->system_msecs,
+                  &snapshot->current_rss, &snapshot->peak_rss,
+                  &snapshot->current_commit, &snapshot->peak_commit, &snapshot->page_faults);
+  return true;
+}
+
+static void mi_stat_count_json(const mi_stats_count_t* stat, const char* name, mi_output_fun* out, void* arg) {
+  _mi_fprintf(out, arg, "  \"%s\": { \"allocated\": %lld, \"freed\": %lld, \"peak\": %lld, \"current\": %lld },\n", name,
+              (long long)stat->allocated, (long long)stat->freed, (long long)stat->peak, (long long)stat->current);
+}
+
+static void mi_stat_counter_json(const mi_stats_counter_t* stat, const char* name, mi_output_fun* out, void* arg) {
+  _mi_fprintf(out, arg, "  \"%s\": { \"total\": %lld, \"count\": %lld },\n", name, (long long)stat->total, (long long)stat->count);
+}
+
+void mi_stats_print_json(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  mi_stats_snapshot_t s;
+  if (!mi_stats_get(&s, MI_STATS_VERSION)) return;
+  _mi_fprintf(out, arg, "{\n  \"version\": %zu,\n  \"detailed\": %s,\n", s.version, (s.detailed ? "true" : "false"));
+  _mi_fprintf(out, arg, "  \"process\": { \"elapsed_msecs\": %zu, \"user_msecs\": %zu, \"system_msecs\": %zu, \"current_rss\": %zu, \"peak_rss\": %zu, "
+                        "\"current_commit\": %zu, \"peak_commit\": %zu, \"page_faults\": %zu },\n",
+              s.elapsed_msecs, s.user_msecs, s.system_msecs, s.current_rss, s.peak_rss, s.current_commit, s.peak_commit, s.page_faults);
+  mi_stat_count_json(&s.segments, "segments", out, arg);
+  mi_stat_count_json(&s.pages, "pages", out, arg);
+  mi_stat_count_json(&s.reserved, "reserved", out, arg);
+  mi_stat_count_json(&s.committed, "committed", out, arg);
+  mi_stat_count_json(&s.reset, "reset", out, arg);
+  mi_stat_count_json(&s.page_committed, "page_committed", out, arg);
+  mi_stat_count_json(&s.segments_abandoned, "segments_abandoned", out, arg);
+  mi_stat_count_json(&s.pages_abandoned, "pages_abandoned", out, arg);
+  mi_stat_count_json(&s.threads, "threads", out, arg);
+  mi_stat_count_json(&s.normal, "normal", out, arg);
+  mi_stat_count_json(&s.huge, "huge", out, arg);
+  mi_stat_count_json(&s.large, "large", out, arg);
+  mi_stat_count_json(&s.malloc, "malloc", out, arg);
+  mi_stat_count_json(&s.segments_cache, "segments_cache", out, arg);
+  mi_stat_counter_json(&s.pages_extended, "pages_extended", out, arg);
+  mi_stat_counter_json(&s.mmap_calls, "mmap_calls", out, arg);
+  mi_stat_counter_json(&s.commit_calls, "commit_calls", out, arg);
+  mi_stat_counter_json(&s.page_no_retire, "page_no_retire", out, arg);
+  mi_stat_counter_json(&s.searches, "searches", out, arg);
+  mi_stat_counter_json(&s.normal_count, "normal_count", out, arg);
+  mi_stat_counter_json(&s.huge_count, "huge_count", out, arg);
+  mi_stat_counter_json(&s.large_count, "large_count", out, arg);
+  // only the bins that were used
+  _mi_fprintf(out, arg, "  \"normal_bins\": [");
+  bool first = true;
+  for (size_t i = 0; i < MI_STATS_BINS; i++) {
+    const mi_stats_count_t* bin = &s.normal_bins[i];
+    if (bin->allocated == 0 && bin->freed == 0) continue;
+    _mi_fprintf(out, arg, "%s\n    { \"bin\": %zu, \"block_size\": %zu, \"allocated\": %lld, \"freed\": %lld, \"peak\": %lld, \"current\": %lld }",
+                (first ? "" : ","), i, s.normal_bin_sizes[i],
+                (long long)bin->allocated, (long long)bin->freed, (long long)bin->peak, (long long)bin->current);
+    first = false;
+  }
+  _mi_fprintf(out, arg, "%s]\n}\n", (first ? "" : "\n  "));
+}
+
+
+/* -----------------------------------------------------------
+  OpenMetrics (Prometheus) text format
+
+  The metric names are stable: gauges for current and peak values,
+  and counters (with a `_total` suffix) for monotonic counts.
+  Like `mi_stats_print_json` this does not allocate.
+----------------------------------------------------------- */
+
+static void mi_om_family(const char* name, const char* type, const char* unit, const char* help, mi_output_fun* out, void* arg) {
+  _mi_fprintf(out, arg, "# TYPE mimalloc_%s %s\n", name, type);
+  if (unit != NULL) { _mi_fprintf(out, arg, "# UNIT mimalloc_%s %s\n", name, unit); }
+  _mi_fprintf(out, arg, "# HELP mimalloc_%s %s\n", name, help);
+}
+
+static void mi_om_gauge(const char* name, const char* unit, const char* help, int64_t value, mi_output_fun* out, void* arg) {
+  mi_om_family(name, "gauge", unit, help, out, arg);
+  _mi_fprintf(out, arg, "mimalloc_%s %lld\n", name, (long long)value);
+}
+
+static void mi_om_counter(const char* name, const char* unit, const char* help, int64_t value, mi_output_fun* out, void* arg) {
+  mi_om_family(name, "counter", unit, help, out, arg);
+  _mi_fprintf(out, arg, "mimalloc_%s_total %lld\n", name, (long long)value);
+}
+
+// a count statistic as a current and peak gauge (e.g. `mimalloc_reserved_bytes` and `mimalloc_reserved_peak_bytes`)
+static void mi_om_count(const mi_stats_count_t* stat, const char* name, bool bytes, const char* help, mi_output_fun* out, void* arg) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s%s", name, (bytes ? "_bytes" : ""));
+  mi_om_gauge(buf, (bytes ? "bytes" : NULL), help, stat->current, out, arg);
+  snprintf(buf, sizeof(buf), "%s_peak%s", name, (bytes ? "_bytes" : ""));
+  mi_om_gauge(buf, (bytes ? "bytes" : NULL), "Peak value (within a thread, summed over threads)", stat->peak, out, arg);
+}
+
+void mi_stats_print_openmetrics(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  mi_stats_snapshot_t s;
+  if (!mi_stats_get(&s, MI_STATS_VERSION)) return;
+  mi_om_count(&s.reserved, "reserved", true, "Reserved virtual memory", out, arg);
+  mi_om_count(&s.committed, "committed", true, "Committed memory", out, arg);
+  mi_om_count(&s.reset, "reset", true, "Reset (or decommitted) memory", out, arg);
+  mi_om_count(&s.page_committed, "touched", true, "Memory touched by pages", out, arg);
+  mi_om_count(&s.normal, "normal", true, "Memory in use by small and medium blocks", out, arg);
+  mi_om_count(&s.large, "large", true, "Memory in use by large blocks", out, arg);
+  mi_om_count(&s.huge, "huge", true, "Memory in use by huge blocks", out, arg);
+  mi_om_count(&s.segments, "segments", false, "Segments in use", out, arg);
+  mi_om_count(&s.segments_abandoned, "segments_abandoned", false, "Segments abandoned by terminated threads", out, arg);
+  mi_om_count(&s.segments_cache, "segments_cached", false, "Segments in the segment cache", out, arg);
+  mi_om_count(&s.pages, "pages", false, "Pages in use", out, arg);
+  mi_om_count(&s.pages_abandoned, "pages_abandoned", false, "Pages abandoned by terminated threads", out, arg);
+  mi_om_count(&s.threads, "threads", false, "Threads using mimalloc", out, arg);
+  mi_om_counter("pages_extended", NULL, "Page free list extensions", s.pages_extended.total, out, arg);
+  mi_om_counter("page_no_retire", NULL, "Pages that were not retired when they became free", s.page_no_retire.total, out, arg);
+  mi_om_counter("mmap_calls", NULL, "Calls to allocate memory from the OS", s.mmap_calls.total, out, arg);
+  mi_om_counter("commit_calls", NULL, "Calls to commit memory", s.commit_calls.total, out, arg);
+  mi_om_counter("page_searches", NULL, "Searches for a page with free blocks", s.searches.count, out, arg);
+  mi_om_counter("page_search_steps", NULL, "Pages visited while searching for a page with free blocks", s.searches.total, out, arg);
+  mi_om_counter("normal_allocs", NULL, "Allocations of small and medium blocks", s.normal_count.count, out, arg);
+  mi_om_counter("large_allocs", NULL, "Allocations of large blocks", s.large_count.count, out, arg);
+  mi_om_counter("huge_allocs", NULL, "Allocations of huge blocks", s.huge_count.count, out, arg);
+  if (s.detailed) {
+    mi_om_count(&s.malloc, "requested", true, "Requested bytes in use", out, arg);
+    // per size class
+    mi_om_family("bin_blocks", "gauge", NULL, "Blocks in use per size class", out, arg);
+    for (size_t i = 0; i < MI_STATS_BINS; i++) {
+      if (s.normal_bins[i].allocated == 0) continue;
+      _mi_fprintf(out, arg, "mimalloc_bin_blocks{bin=\"%zu\",block_size=\"%zu\"} %lld\n", i, s.normal_bin_sizes[i], (long long)s.normal_bins[i].current);
+    }
+    mi_om_family("bin_allocs", "counter", NULL, "Allocated blocks per size class", out, arg);
+    for (size_t i = 0; i < MI_STATS_BINS; i++) {
+      if (s.normal_bins[i].allocated == 0) continue;
+      _mi_fprintf(out, arg, "mimalloc_bin_allocs_total{bin=\"%zu\",block_size=\"%zu\"} %lld\n", i, s.normal_bin_sizes[i], (long long)s.normal_bins[i].allocated);
+    }
+  }
+  mi_om_gauge("process_rss_bytes", "bytes", "Resident set size of the process", (int64_t)s.current_rss, out, arg);
+  mi_om_gauge("process_rss_peak_bytes", "bytes", "Peak resident set size of the process", (int64_t)s.peak_rss, out, arg);
+  mi_om_gauge("process_commit_bytes", "bytes", "Committed memory of the process", (int64_t)s.current_commit, out, arg);
+  mi_om_gauge("process_commit_peak_bytes", "bytes", "Peak committed memory of the process", (int64_t)s.peak_commit, out, arg);
+  mi_om_counter("process_page_faults", NULL, "Page faults of the process", (int64_t)s.page_faults, out, arg);
+  _mi_fprintf(out, arg, "# EOF\n");
+}
+
+
+/* -----------------------------------------------------------
+  Size histogram
+
+  With detailed statistics (`MI_STAT>1`) and the `size_histogram` option
+  enabled, we count the requested size (in words) of each normal allocation
+  next to the `normal_bins` statistics. The histogram is only allocated when
+  it is enabled as it has an entry for each word size up to
+  `MI_MEDIUM_OBJ_SIZE_MAX`. From this histogram we can suggest size classes
+  (for `MIMALLOC_SIZE_CLASSES`) with the fewest classes such that each
+  requested size wastes at most `size_class_waste` percent of its block.
+----------------------------------------------------------- */
+
+#if MI_STAT>1
+bool _mi_size_histogram_enabled; // = false
+static _Atomic(size_t)* mi_size_histogram;  // MI_MEDIUM_OBJ_WSIZE_MAX+1 entries
+
+void _mi_size_histogram_increase(size_t size) {
+  const size_t wsize = _mi_wsize_from_size(size);
+  if (wsize <= MI_MEDIUM_OBJ_WSIZE_MAX) {
+    mi_atomic_increment_relaxed(&mi_size_histogram[wsize]);
+  }
+}
+#endif
+
+void _mi_size_histogram_init(void) {
+  if (!mi_option_is_enabled(mi_option_size_histogram)) return;
+  #if MI_STAT>1
+  mi_size_histogram = (_Atomic(size_t)*)_mi_os_alloc((MI_MEDIUM_OBJ_WSIZE_MAX+1) * sizeof(size_t), &_mi_stats_main);
+  if (mi_size_histogram == NULL) {
+    _mi_warning_message("unable to allocate the size histogram\n");
+    return;
+  }
+  _mi_size_histogram_enabled = true;
+  #else
+  _mi_warning_message("the size histogram is only recorded with detailed statistics (MI_STAT>1)\n");
+  #endif
+}
+
+#if MI_STAT>1
+// Insert a size class without requests (if it is not present yet)
+static size_t mi_size_classes_insert(size_t* classes, size_t* counts, size_t n, size_t size) {
+  size_t i = 0;
+  while (i < n && classes[i] < size) { i++; }
+  if (i < n && classes[i] == size) return n;
+  for (size_t j = n; j > i; j--) {
+    classes[j] = classes[j-1];
+    counts[j] = counts[j-1];
+  }
+  classes[i] = size;
+  counts[i] = 0;
+  return n + 1;
+}
+
+// Suggest size classes for the current histogram; returns the number of classes
+static size_t mi_size_classes_suggest(size_t waste, size_t* classes, size_t* counts) {
+  size_t n = 0;
+  size_t wsize = 0;
+  while (wsize <= MI_MEDIUM_OBJ_WSIZE_MAX) {
+    size_t count = mi_atomic_load_relaxed(&mi_size_histogram[wsize]);
+    if (count == 0) { wsize++; continue; }
+    // start a class at the smallest size that is not covered yet, and extend it
+    // over the following sizes as long as that smallest size wastes at most `waste` percent
+    const size_t lo = (wsize == 0 ? 1 : wsize) * MI_INTPTR_SIZE;
+    const size_t limit = (lo * 100) / (100 - waste);
+    size_t size = lo;
+    for (wsize++; wsize <= MI_MEDIUM_OBJ_WSIZE_MAX; wsize++) {
+      const size_t c = mi_atomic_load_relaxed(&mi_size_histogram[wsize]);
+      if (c == 0) continue;
+      const size_t next = wsize * MI_INTPTR_SIZE;
+      if (next > size && (next > limit || (size <= MI_SMALL_SIZE_MAX && next > MI_SMALL_SIZE_MAX))) break;
+      size = next;
+      count += c;
+    }
+    classes[n] = size;
+    counts[n] = count;
+    n++;
+  }
+  // always include the small size boundary, and use the default size classes beyond the observed sizes
+  n = mi_size_classes_insert(classes, counts, n, MI_SMALL_SIZE_MAX);
+  const size_t last = classes[n-1];
+  for (size_t bin = 1; bin < MI_BIN_HUGE; bin++) {
+    const size_t bsize = _mi_heap_empty.pages[bin].block_size;
+    if (bsize > last && bsize <= MI_MEDIUM_OBJ_SIZE_MAX) {
+      n = mi_size_classes_insert(classes, counts, n, bsize);
+    }
+  }
+  n = mi_size_classes_insert(classes, counts, n, MI_MEDIUM_OBJ_SIZE_MAX);
+  // and merge the classes that cause the least extra waste into the next class until they fit in the bins
+  while (n > _mi_size_classes_max()) {
+    size_t best = 0;
+    size_t best_cost = SIZE_MAX;
+    for (size_t i = 0; i + 1 < n; i++) {
+      if (classes[i] == MI_SMALL_SIZE_MAX) continue;
+      const size_t cost = counts[i] * (classes[i+1] - classes[i]);
+      if (cost < best_cost) { best = i; best_cost = cost; }
+    }
+    counts[best+1] += counts[best];
+    for (size_t j = best; j + 1 < n; j++) {
+      classes[j] = classes[j+1];
+      counts[j] = counts[j+1];
+    }
+    n--;
+  }
+  return n;
+}
+#endif
+
+// Print suggested size classes for the recorded size histogram
+void mi_size_classes_print(mi_output_fun* out, void* arg) mi_attr_noexcept {
+  #if MI_STAT>1
+  if (!_mi_size_histogram_enabled) {
+    _mi_fprintf(out, arg, "# no size histogram is recorded (enable with MIMALLOC_SIZE_HISTOGRAM=1)\n");
+    return;
+  }
+  const size_t waste = (size_t)mi_option_get_clamp(mi_option_size_class_waste, 1, 50);
+  const size_t capacity = MI_MEDIUM_OBJ_WSIZE_MAX + MI_BIN_HUGE + 2;
+  size_t* classes = (size_t*)_mi_os_alloc(2 * capacity * sizeof(size_t), &_mi_stats_main);
+  if (classes == NULL) return;
+  size_t* counts = classes + capacity;
+  const size_t n = mi_size_classes_suggest(waste, classes, counts);
+
+  // compare the internal waste of the current and the suggested size classes
+  size_t total = 0;
+  size_t requested = 0;
+  size_t current = 0;
+  size_t suggested = 0;
+  size_t i = 0;
+  for (size_t wsize = 0; wsize <= MI_MEDIUM_OBJ_WSIZE_MAX; wsize++) {
+    const size_t count = mi_atomic_load_relaxed(&mi_size_histogram[wsize]);
+    if (count == 0) continue;
+    const size_t size = wsize * MI_INTPTR_SIZE;
+    while (classes[i] < size) { i++; }
+    total += count;
+    requested += count * size;
+    current += count * mi_good_size(size);
+    suggested += count * classes[i];
+  }
+  if (total == 0) {
+    _mi_fprintf(out, arg, "# no allocations are recorded in the size histogram\n");
+  }
+  else {
+    const size_t current_waste = (current == 0 ? 0 : ((current - requested) * 1000) / current);
+    const size_t suggested_waste = (suggested == 0 ? 0 : ((suggested - requested) * 1000) / suggested);
+    _mi_fprintf(out, arg, "# size classes for %zu allocations with at most %zu%% waste: %zu classes, %zu.%zu%% internal waste (currently %zu.%zu%%)\n",
+                total, waste, n, suggested_waste / 10, suggested_waste % 10, current_waste / 10, current_waste % 10);
+    _mi_fprintf(out, arg, "MIMALLOC_SIZE_CLASSES=");
+    for (i = 0; i < n; i++) {
+      _mi_fprintf(out, arg, "%s%zu", (i == 0 ? "" : ","), classes[i]);
+    }
+    _mi_fprintf(out, arg, "\n");
+  }
+  _mi_os_free(classes, 2 * capacity * sizeof(size_t), &_mi_stats_main);
+  #else
+  _mi_fprintf(out, arg, "# no size histogram is available (this needs detailed statistics (MI_STAT>1))\n");
+  #endif
+}
+
+
 // ----------------------------------------------------------------
 // Basic timer for convenience; use milli-seconds to avoid doubles
+// (and micro-seconds for short intervals)
 // ----------------------------------------------------------------
 #ifdef _WIN32
 #include <windows.h>
@@ -414,6 +882,19 @@ mi_msecs_t _mi_clock_now(void) {
   QueryPerformanceCounter(&t);
   return mi_to_msecs(t);
 }
+
+mi_usecs_t _mi_clock_usecs(void) {
+  static LARGE_INTEGER ufreq; // = 0
+  if (ufreq.QuadPart == 0LL) {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    ufreq.QuadPart = f.QuadPart/1000000LL;
+    if (ufreq.QuadPart == 0) ufreq.QuadPart = 1;
+  }
+  LARGE_INTEGER t;
+  QueryPerformanceCounter(&t);
+  return (mi_usecs_t)(t.QuadPart / ufreq.QuadPart);
+}
 #else
 #include <time.h>
 #if defined(CLOCK_REALTIME) || defined(CLOCK_MONOTONIC)
@@ -426,11 +907,25 @@ mi_msecs_t _mi_clock_now(void) {
   #endif
   return ((mi_msecs_t)t.tv_sec * 1000) + ((mi_msecs_t)t.tv_nsec / 1000000);
 }
+
+mi_usecs_t _mi_clock_usecs(void) {
+  struct timespec t;
+  #ifdef CLOCK_MONOTONIC
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  #else
+  clock_gettime(CLOCK_REALTIME, &t);
+  #endif
+  return ((mi_usecs_t)t.tv_sec * 1000000) + ((mi_usecs_t)t.tv_nsec / 1000);
+}
 #else
 // low resolution timer
 mi_msecs_t _mi_clock_now(void) {
   return ((mi_msecs_t)clock() / ((mi_msecs_t)CLOCKS_PER_SEC / 1000));
 }
+
+mi_usecs_t _mi_clock_usecs(void) {
+  return ((mi_usecs_t)_mi_clock_now() * 1000);
+}
 #endif
 #endif
 
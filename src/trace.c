@@ -0,0 +1,235 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+An allocation trace recorder (enabled with `MI_TRACE=1` and `MIMALLOC_TRACE=<prefix>`).
+
+Every malloc, free, realloc and aligned allocation is appended to a buffer of
+the calling thread which is written to the file `<prefix>.<n>` whenever it is
+full, when the thread terminates, and at process exit. The format is described
+in `mimalloc-trace.h`; `test/replay.c` (`mimalloc-replay`) replays a trace.
+
+Allocations are recorded in `_mi_page_malloc` (which every allocation passes
+through), and frees in `mi_free` and `mi_free_size`. Realloc and aligned
+allocations increase the thread-local `mi_trace_depth` so the allocations and
+frees they perform internally are not recorded separately.
+
+The buffers are allocated from the OS and the files are written with `write`
+so the recorder never allocates itself.
+-----------------------------------------------------------------------------*/
+#include "mimalloc.h"
+#include "mimalloc-internal.h"
+#include "mimalloc-atomic.h"
+#include "mimalloc-trace.h"
+
+#include <string.h>  // memcpy, strlen
+
+#if MI_TRACE && !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>   // snprintf
+#include <unistd.h>
+
+#define MI_TRACE_BUFFER_SIZE  (1*MI_MiB)
+#define MI_TRACE_ENTRIES      ((MI_TRACE_BUFFER_SIZE - sizeof(mi_trace_buffer_t)) / sizeof(mi_trace_entry_t))
+#define MI_TRACE_PREFIX_MAX   (240)
+
+typedef struct mi_trace_buffer_s {
+  struct mi_trace_buffer_s* next;   // all open buffers (protected by `mi_trace_lock`)
+  struct mi_trace_buffer_s* prev;
+  int               fd;
+  size_t            count;          // entries in the buffer
+  mi_trace_entry_t  entries[1];
+} mi_trace_buffer_t;
+
+bool _mi_trace_enabled;  // = false
+
+static char               mi_trace_prefix[MI_TRACE_PREFIX_MAX];
+static _Atomic(size_t)    mi_trace_thread_count;
+static _Atomic(uintptr_t) mi_trace_lock;
+static mi_trace_buffer_t* mi_trace_buffers;
+
+#define MI_TRACE_DONE  ((mi_trace_buffer_t*)1)   // sentinel after the thread terminated
+
+static mi_decl_thread mi_trace_buffer_t* mi_trace_buffer;  // the buffer of this thread (or NULL if not yet opened)
+static mi_decl_thread size_t mi_trace_depth;               // inside a realloc or aligned allocation?
+
+static void mi_trace_lock_acquire(void) {
+  uintptr_t expected = 0;
+  while (!mi_atomic_cas_weak_acq_rel(&mi_trace_lock, &expected, 1)) {
+    expected = 0;
+    mi_atomic_yield();
+  }
+}
+
+static void mi_trace_lock_release(void) {
+  mi_atomic_store_release(&mi_trace_lock, 0);
+}
+
+void _mi_trace_init(void) {
+  char buf[MI_TRACE_PREFIX_MAX];
+  if (!_mi_getenv("mimalloc_trace", buf, sizeof(buf)) || buf[0] == 0) return;
+  memcpy(mi_trace_prefix, buf, sizeof(buf));
+  _mi_trace_enabled = true;
+  _mi_verbose_message("record allocation trace to \"%s.<n>\"\n", mi_trace_prefix);
+}
+
+
+/* -----------------------------------------------------------
+  Buffers
+----------------------------------------------------------- */
+
+static bool mi_trace_write(int fd, const void* p, size_t size) {
+  const uint8_t* src = (const uint8_t*)p;
+  while (size > 0) {
+    const ssize_t n = write(fd, src, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    src += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+static void mi_trace_flush(mi_trace_buffer_t* buf) {
+  if (buf->count == 0) return;
+  if (!mi_trace_write(buf->fd, buf->entries, buf->count * sizeof(mi_trace_entry_t))) {
+    _mi_warning_message("unable to write the allocation trace (error: %d)\n", errno);
+  }
+  buf->count = 0;
+}
+
+static mi_trace_buffer_t* mi_trace_open(void) {
+  const size_t thread = mi_atomic_increment_relaxed(&mi_trace_thread_count);
+  char fname[MI_TRACE_PREFIX_MAX + 32];
+  snprintf(fname, sizeof(fname), "%s.%zu", mi_trace_prefix, thread);
+  const int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    _mi_warning_message("unable to create the allocation trace \"%s\" (error: %d)\n", fname, errno);
+    return NULL;
+  }
+  mi_trace_buffer_t* buf = (mi_trace_buffer_t*)_mi_os_alloc(MI_TRACE_BUFFER_SIZE, &_mi_stats_main);
+  if (buf == NULL) {
+    close(fd);
+    return NULL;
+  }
+  buf->fd = fd;
+  mi_trace_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MI_TRACE_MAGIC, sizeof(header.magic));
+  header.thread = thread;
+  header.thread_id = _mi_thread_id();
+  mi_trace_write(fd, &header, sizeof(header));
+  mi_trace_lock_acquire();
+  buf->next = mi_trace_buffers;
+  if (buf->next != NULL) { buf->next->prev = buf; }
+  mi_trace_buffers = buf;
+  mi_trace_lock_release();
+  return buf;
+}
+
+static void mi_trace_close(mi_trace_buffer_t* buf) {
+  mi_trace_flush(buf);
+  close(buf->fd);
+  _mi_os_free(buf, MI_TRACE_BUFFER_SIZE, &_mi_stats_main);
+}
+
+// Called when a thread terminates
+void _mi_trace_thread_done(void) {
+  mi_trace_buffer_t* buf = mi_trace_buffer;
+  mi_trace_buffer = MI_TRACE_DONE;
+  if (buf == NULL || buf == MI_TRACE_DONE) return;
+  mi_trace_lock_acquire();
+  if (buf->prev != NULL) { buf->prev->next = buf->next; }
+                    else { mi_trace_buffers = buf->next; }
+  if (buf->next != NULL) { buf->next->prev = buf->prev; }
+  mi_trace_lock_release();
+  mi_trace_close(buf);
+}
+
+// Called at process exit: write the buffers of all threads that are still running.
+// (these may still be recording concurrently which can lose their last entries)
+void _mi_trace_process_done(void) {
+  if (!_mi_trace_enabled) return;
+  _mi_trace_enabled = false;
+  mi_trace_buffer = MI_TRACE_DONE;
+  mi_trace_lock_acquire();
+  for (mi_trace_buffer_t* buf = mi_trace_buffers; buf != NULL; buf = buf->next) {
+    mi_trace_flush(buf);
+  }
+  mi_trace_lock_release();
+}
+
+
+/* -----------------------------------------------------------
+  Recording
+----------------------------------------------------------- */
+
+static void mi_trace_record(mi_trace_op_t op, const void* p, uint64_t arg, size_t size) {
+  mi_trace_buffer_t* buf = mi_trace_buffer;
+  if (mi_unlikely(buf == NULL)) {
+    mi_trace_depth++;  // opening does not allocate but be safe
+    buf = mi_trace_open();
+    mi_trace_depth--;
+    mi_trace_buffer = (buf == NULL ? MI_TRACE_DONE : buf);
+    if (buf == NULL) return;
+  }
+  else if (buf == MI_TRACE_DONE) {
+    return;
+  }
+  if (buf->count >= MI_TRACE_ENTRIES) { mi_trace_flush(buf); }
+  mi_trace_entry_t* entry = &buf->entries[buf->count++];
+  entry->time = _mi_cycles();
+  entry->ptr = (uintptr_t)p;
+  entry->arg = arg;
+  entry->size_op = ((uint64_t)size << 8) | (uint64_t)op;
+}
+
+void _mi_trace_malloc(const void* p, size_t size) {
+  if (mi_trace_depth == 0) { mi_trace_record(MI_TRACE_MALLOC, p, 0, size); }
+}
+
+void _mi_trace_free(const void* p) {
+  if (mi_trace_depth == 0) { mi_trace_record(MI_TRACE_FREE, p, 0, 0); }
+}
+
+void _mi_trace_enter(void) {
+  mi_trace_depth++;
+}
+
+void _mi_trace_realloc(const void* p, const void* newp, size_t newsize) {
+  mi_assert_internal(mi_trace_depth > 0);
+  if (--mi_trace_depth == 0 && newp != NULL) { mi_trace_record(MI_TRACE_REALLOC, newp, (uintptr_t)p, newsize); }
+}
+
+void _mi_trace_aligned(const void* p, size_t size, size_t alignment) {
+  mi_assert_internal(mi_trace_depth > 0);
+  if (--mi_trace_depth == 0 && p != NULL) { mi_trace_record(MI_TRACE_ALIGNED, p, alignment, size); }
+}
+
+#else
+
+bool _mi_trace_enabled;  // = false
+
+void _mi_trace_init(void) {
+  #if MI_TRACE
+  char buf[32];
+  if (_mi_getenv("mimalloc_trace", buf, sizeof(buf)) && buf[0] != 0) {
+    _mi_warning_message("allocation traces are not supported on this platform\n");
+  }
+  #endif
+}
+
+void _mi_trace_thread_done(void) { }
+void _mi_trace_process_done(void) { }
+void _mi_trace_malloc(const void* p, size_t size) { MI_UNUSED(p); MI_UNUSED(size); }
+void _mi_trace_free(const void* p) { MI_UNUSED(p); }
+void _mi_trace_enter(void) { }
+void _mi_trace_realloc(const void* p, const void* newp, size_t newsize) { MI_UNUSED(p); MI_UNUSED(newp); MI_UNUSED(newsize); }
+void _mi_trace_aligned(const void* p, size_t size, size_t alignment) { MI_UNUSED(p); MI_UNUSED(size); MI_UNUSED(alignment); }
+
+#endif
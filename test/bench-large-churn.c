@@ -0,0 +1,82 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Measure the latency of medium and large object churn: a working set of live
+objects between 16KiB and 16MiB (log-uniformly distributed) is randomly
+replaced, which fragments the segments into many free spans of various sizes.
+Each allocation of such an object searches the span queues of the thread for
+a fitting span.
+
+Usage: mimalloc-bench-large-churn [iterations] [live objects]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "mimalloc.h"
+
+static double now_ns(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return ((double)t.tv_sec * 1e9) + (double)t.tv_nsec;
+}
+
+static uint64_t rnd_state = 0x853c49e6748fea9bULL;
+
+static uint64_t rnd(void) {
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+  return rnd_state;
+}
+
+// log-uniform sizes from `2^min_shift` up to `2^max_shift`
+static size_t rnd_size(size_t min_shift, size_t max_shift) {
+  const size_t shift = min_shift + (size_t)(rnd() % (max_shift - min_shift));
+  const size_t base = (size_t)1 << shift;
+  return base + (size_t)(rnd() % base);
+}
+
+static void bench(const char* name, void** live, size_t count, size_t iters, size_t min_shift, size_t max_shift) {
+  for (size_t i = 0; i < count; i++) {
+    live[i] = mi_malloc(rnd_size(min_shift, max_shift));
+  }
+  const double start = now_ns();
+  for (size_t i = 0; i < iters; i++) {
+    const size_t j = (size_t)(rnd() % count);
+    mi_free(live[j]);
+    live[j] = mi_malloc(rnd_size(min_shift, max_shift));
+    ((uint8_t*)live[j])[0] = (uint8_t)i;   // touch
+  }
+  const double elapsed = now_ns() - start;
+  for (size_t i = 0; i < count; i++) {
+    mi_free(live[i]);
+    live[i] = NULL;
+  }
+  size_t peak_commit = 0;
+  mi_process_info(NULL, NULL, NULL, NULL, NULL, NULL, &peak_commit, NULL);
+  printf("%-12s %8.1f ns/op   (peak commit %zu MiB)\n", name, elapsed / (double)iters, peak_commit / (1024*1024));
+}
+
+int main(int argc, char** argv) {
+  size_t iters = 200000;
+  size_t count = 128;
+  if (argc > 1) iters = (size_t)strtoul(argv[1], NULL, 10);
+  if (argc > 2) count = (size_t)strtoul(argv[2], NULL, 10);
+  if (count == 0) count = 1;
+
+  void** live = (void**)mi_calloc(count, sizeof(void*));
+  bench("medium", live, count, iters, 14, 17);   // 16KiB - 128KiB
+  bench("large", live, count, iters, 17, 21);    // 128KiB - 2MiB
+  bench("mixed", live, count, iters, 14, 24);    // 16KiB - 16MiB
+  mi_free(live);
+  return 0;
+}
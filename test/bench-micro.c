@@ -0,0 +1,377 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Micro benchmarks of the allocator hot paths for tracking regressions across commits:
+malloc/free pairs per size class, `mi_zalloc`/`mi_calloc`, aligned allocation,
+realloc growth, `mi_heap_new`/`mi_heap_destroy`, `mi_usable_size`, and freeing
+blocks that were allocated by another thread.
+
+Each benchmark runs a fixed number of operations (times the scale) once as a
+warmup and then `runs` times; we report the fastest run in nano seconds and
+cycles per operation (cycles are time-stamp counter ticks on x64 and the virtual
+counter on arm64, or 0 if not available). Output is a table, or CSV or JSON.
+
+Usage: mimalloc-bench-micro [--csv|--json] [--scale=<n>] [--runs=<n>] [<filter>]
+
+where `<filter>` only runs benchmarks whose name contains it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "mimalloc.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+static uint64_t cycles(void) { return __rdtsc(); }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+static uint64_t cycles(void) { return __rdtsc(); }
+#elif defined(__GNUC__) && defined(__aarch64__)
+static uint64_t cycles(void) { uint64_t c; __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(c)); return c; }
+#else
+static uint64_t cycles(void) { return 0; }
+#endif
+
+static double now_ns(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return ((double)t.tv_sec * 1e9) + (double)t.tv_nsec;
+}
+
+#define BATCH  (256)
+
+static void* ptrs[BATCH];
+static volatile uintptr_t sink;   // keep the compiler from optimizing allocations away
+
+// A benchmark performs `n` operations (with `param` as the size or alignment)
+typedef void (bench_fun_t)(size_t n, size_t param);
+
+
+/* -----------------------------------------------------------
+  Benchmarks
+----------------------------------------------------------- */
+
+// malloc immediately followed by free (always the same block)
+static void bench_malloc_free(size_t n, size_t size) {
+  for (size_t i = 0; i < n; i++) {
+    void* p = mi_malloc(size);
+    sink = (uintptr_t)p;
+    mi_free(p);
+  }
+}
+
+// a batch of mallocs followed by freeing them all
+static void bench_malloc_batch(size_t n, size_t size) {
+  for (size_t i = 0; i < n; i += BATCH) {
+    for (size_t j = 0; j < BATCH; j++) { ptrs[j] = mi_malloc(size); }
+    for (size_t j = 0; j < BATCH; j++) { mi_free(ptrs[j]); }
+  }
+}
+
+static void bench_zalloc(size_t n, size_t size) {
+  for (size_t i = 0; i < n; i += BATCH) {
+    for (size_t j = 0; j < BATCH; j++) { ptrs[j] = mi_zalloc(size); }
+    for (size_t j = 0; j < BATCH; j++) { mi_free(ptrs[j]); }
+  }
+}
+
+static void bench_calloc(size_t n, size_t size) {
+  for (size_t i = 0; i < n; i += BATCH) {
+    for (size_t j = 0; j < BATCH; j++) { ptrs[j] = mi_calloc(1, size); }
+    for (size_t j = 0; j < BATCH; j++) { mi_free(ptrs[j]); }
+  }
+}
+
+// 64 byte blocks with the given alignment
+static void bench_aligned(size_t n, size_t alignment) {
+  for (size_t i = 0; i < n; i += BATCH) {
+    for (size_t j = 0; j < BATCH; j++) { ptrs[j] = mi_malloc_aligned(64, alignment); }
+    for (size_t j = 0; j < BATCH; j++) { mi_free(ptrs[j]); }
+  }
+}
+
+// grow a block by 16 bytes at a time up to `limit` (like appending to a string)
+static void bench_realloc_linear(size_t n, size_t limit) {
+  size_t ops = 0;
+  while (ops < n) {
+    void* p = NULL;
+    for (size_t size = 16; size <= limit && ops < n; size += 16, ops++) { p = mi_realloc(p, size); }
+    mi_free(p);
+  }
+}
+
+// grow a block by 1.5x up to `limit` (like a growing vector)
+static void bench_realloc_geometric(size_t n, size_t limit) {
+  size_t ops = 0;
+  while (ops < n) {
+    void* p = NULL;
+    for (size_t size = 16; size <= limit && ops < n; size += size/2, ops++) { p = mi_realloc(p, size); }
+    mi_free(p);
+  }
+}
+
+// create a heap, allocate `count` blocks in it, and destroy it
+static void bench_heap_destroy(size_t n, size_t count) {
+  for (size_t i = 0; i < n; i++) {
+    mi_heap_t* heap = mi_heap_new();
+    for (size_t j = 0; j < count; j++) { sink = (uintptr_t)mi_heap_malloc(heap, 16 + 16*(j%8)); }
+    mi_heap_destroy(heap);
+  }
+}
+
+static void bench_usable_size(size_t n, size_t size) {
+  for (size_t j = 0; j < BATCH; j++) { ptrs[j] = mi_malloc(size + 8*(j%4)); }
+  size_t total = 0;
+  for (size_t i = 0; i < n; i += BATCH) {
+    for (size_t j = 0; j < BATCH; j++) { total += mi_usable_size(ptrs[j]); }
+  }
+  sink = total;
+  for (size_t j = 0; j < BATCH; j++) { mi_free(ptrs[j]); }
+}
+
+
+/* -----------------------------------------------------------
+  Cross-thread free: the benchmark thread allocates batches
+  that a second thread frees (using two mailboxes so both
+  threads can run concurrently). We report the time per block
+  as seen by the allocating thread.
+----------------------------------------------------------- */
+
+static void* atomic_exchange_ptr(volatile void** p, void* newval);
+static void  run_os_thread(void (*fun)(void));
+static void  join_os_thread(void);
+static void  yield_os_thread(void);
+
+static void* batches[2][BATCH];
+static volatile void* full[2];     // set to the batch when it is ready to be freed (or to `&stop`)
+static volatile void* empty[2];    // set to the batch when it has been freed
+static int stop;
+
+static void cross_free_thread(void) {
+  for (size_t k = 0; ; k = 1 - k) {
+    void* batch;
+    while ((batch = atomic_exchange_ptr(&full[k], NULL)) == NULL) { yield_os_thread(); }
+    if (batch == &stop) return;
+    void** blocks = (void**)batch;
+    for (size_t j = 0; j < BATCH; j++) { mi_free(blocks[j]); }
+    atomic_exchange_ptr(&empty[k], batch);
+  }
+}
+
+static void bench_cross_free(size_t n, size_t size) {
+  empty[0] = batches[0];
+  empty[1] = batches[1];
+  run_os_thread(&cross_free_thread);
+  size_t k = 0;
+  for (size_t i = 0; i < n; i += BATCH, k = 1 - k) {
+    void* batch;
+    while ((batch = atomic_exchange_ptr(&empty[k], NULL)) == NULL) { yield_os_thread(); }
+    void** blocks = (void**)batch;
+    for (size_t j = 0; j < BATCH; j++) { blocks[j] = mi_malloc(size); }
+    atomic_exchange_ptr(&full[k], batch);
+  }
+  while (atomic_exchange_ptr(&empty[k], NULL) == NULL) { yield_os_thread(); }  // wait until the thread is at mailbox `k`
+  atomic_exchange_ptr(&full[k], &stop);
+  join_os_thread();
+  atomic_exchange_ptr(&empty[1-k], NULL);
+}
+
+
+/* -----------------------------------------------------------
+  Driver
+----------------------------------------------------------- */
+
+typedef struct bench_s {
+  const char*  name;
+  bench_fun_t* fun;
+  size_t       param;
+  size_t       iterations;   // operations per run at scale 1
+} bench_t;
+
+static const bench_t benches[] = {
+  { "malloc-free",        &bench_malloc_free,       8,       10000000 },
+  { "malloc-free",        &bench_malloc_free,       64,      10000000 },
+  { "malloc-free",        &bench_malloc_free,       1024,    10000000 },
+  { "malloc-free",        &bench_malloc_free,       65536,   1000000 },
+  { "malloc-batch",       &bench_malloc_batch,      8,       10000000 },
+  { "malloc-batch",       &bench_malloc_batch,      16,      10000000 },
+  { "malloc-batch",       &bench_malloc_batch,      32,      10000000 },
+  { "malloc-batch",       &bench_malloc_batch,      48,      10000000 },
+  { "malloc-batch",       &bench_malloc_batch,      64,      10000000 },
+  { "malloc-batch",       &bench_malloc_batch,      128,     10000000 },
+  { "malloc-batch",       &bench_malloc_batch,      256,     5000000 },
+  { "malloc-batch",       &bench_malloc_batch,      512,     5000000 },
+  { "malloc-batch",       &bench_malloc_batch,      1024,    2000000 },
+  { "malloc-batch",       &bench_malloc_batch,      4096,    1000000 },
+  { "malloc-batch",       &bench_malloc_batch,      16384,   500000 },
+  { "malloc-batch",       &bench_malloc_batch,      65536,   200000 },
+  { "malloc-batch",       &bench_malloc_batch,      262144,  50000 },
+  { "zalloc",             &bench_zalloc,            64,      5000000 },
+  { "zalloc",             &bench_zalloc,            4096,    500000 },
+  { "calloc",             &bench_calloc,            64,      5000000 },
+  { "calloc",             &bench_calloc,            4096,    500000 },
+  { "aligned",            &bench_aligned,           16,      5000000 },
+  { "aligned",            &bench_aligned,           64,      5000000 },
+  { "aligned",            &bench_aligned,           256,     5000000 },
+  { "aligned",            &bench_aligned,           4096,    1000000 },
+  { "realloc-linear",     &bench_realloc_linear,    4096,    2000000 },
+  { "realloc-geometric",  &bench_realloc_geometric, 1048576, 500000 },
+  { "heap-new-destroy",   &bench_heap_destroy,      16,      200000 },
+  { "heap-new-destroy",   &bench_heap_destroy,      1024,    20000 },
+  { "usable-size",        &bench_usable_size,       64,      20000000 },
+  { "cross-thread-free",  &bench_cross_free,        64,      5000000 },
+  { "cross-thread-free",  &bench_cross_free,        1024,    2000000 },
+};
+
+typedef enum format_e { FORMAT_TABLE, FORMAT_CSV, FORMAT_JSON } format_t;
+
+int main(int argc, char** argv) {
+  format_t format = FORMAT_TABLE;
+  size_t scale_num = 1, scale_den = 1;
+  size_t runs = 5;
+  const char* filter = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--csv") == 0) format = FORMAT_CSV;
+    else if (strcmp(argv[i], "--json") == 0) format = FORMAT_JSON;
+    else if (strncmp(argv[i], "--scale=", 8) == 0) {
+      // a scale like `0.1` runs fewer iterations
+      const double s = strtod(argv[i] + 8, NULL);
+      if (s > 0) { scale_num = (size_t)(s * 1000); scale_den = 1000; }
+    }
+    else if (strncmp(argv[i], "--runs=", 7) == 0) {
+      const long n = strtol(argv[i] + 7, NULL, 10);
+      if (n > 0) runs = (size_t)n;
+    }
+    else if (argv[i][0] != '-') filter = argv[i];
+    else {
+      fprintf(stderr, "usage: %s [--csv|--json] [--scale=<n>] [--runs=<n>] [<filter>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (format == FORMAT_TABLE) printf("%-20s %8s %10s %10s %10s\n", "benchmark", "param", "ops", "ns/op", "cycles/op");
+  else if (format == FORMAT_CSV) printf("name,param,ops,ns_per_op,cycles_per_op\n");
+  else printf("{ \"mimalloc_version\": %d, \"runs\": %zu, \"benchmarks\": [\n", mi_version(), runs);
+
+  bool first = true;
+  for (size_t b = 0; b < sizeof(benches)/sizeof(benches[0]); b++) {
+    const bench_t* bench = &benches[b];
+    if (filter != NULL && strstr(bench->name, filter) == NULL) continue;
+    size_t n = (bench->iterations * scale_num) / scale_den;
+    n = ((n + BATCH - 1) / BATCH) * BATCH;   // a multiple of the batch size
+    bench->fun(n / 10 + BATCH, bench->param);  // warmup
+    double best_ns = 0;
+    uint64_t best_cycles = 0;
+    for (size_t r = 0; r < runs; r++) {
+      const double start_ns = now_ns();
+      const uint64_t start_cycles = cycles();
+      bench->fun(n, bench->param);
+      const uint64_t elapsed_cycles = cycles() - start_cycles;
+      const double elapsed_ns = now_ns() - start_ns;
+      if (r == 0 || elapsed_ns < best_ns) {
+        best_ns = elapsed_ns;
+        best_cycles = elapsed_cycles;
+      }
+    }
+    const double ns_per_op = best_ns / (double)n;
+    const double cycles_per_op = (double)best_cycles / (double)n;
+    if (format == FORMAT_TABLE) {
+      printf("%-20s %8zu %10zu %10.2f %10.1f\n", bench->name, bench->param, n, ns_per_op, cycles_per_op);
+    }
+    else if (format == FORMAT_CSV) {
+      printf("%s,%zu,%zu,%.3f,%.2f\n", bench->name, bench->param, n, ns_per_op, cycles_per_op);
+    }
+    else {
+      printf("%s  { \"name\": \"%s\", \"param\": %zu, \"ops\": %zu, \"ns_per_op\": %.3f, \"cycles_per_op\": %.2f }",
+             (first ? "" : ",\n"), bench->name, bench->param, n, ns_per_op, cycles_per_op);
+    }
+    fflush(stdout);
+    first = false;
+  }
+  if (format == FORMAT_JSON) printf("\n] }\n");
+  return 0;
+}
+
+
+/* -----------------------------------------------------------
+  Threads
+----------------------------------------------------------- */
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+static void (*thread_fun)(void);
+static HANDLE thread_handle;
+
+static DWORD WINAPI thread_entry(LPVOID param) {
+  (void)param;
+  thread_fun();
+  return 0;
+}
+
+static void run_os_thread(void (*fun)(void)) {
+  thread_fun = fun;
+  thread_handle = CreateThread(0, 0, &thread_entry, NULL, 0, NULL);
+}
+
+static void join_os_thread(void) {
+  WaitForSingleObject(thread_handle, INFINITE);
+  CloseHandle(thread_handle);
+}
+
+static void yield_os_thread(void) {
+  SwitchToThread();
+}
+
+static void* atomic_exchange_ptr(volatile void** p, void* newval) {
+#if (INTPTR_MAX == INT32_MAX)
+  return (void*)InterlockedExchange((volatile LONG*)p, (LONG)newval);
+#else
+  return (void*)InterlockedExchange64((volatile LONG64*)p, (LONG64)newval);
+#endif
+}
+
+#else
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+static void (*thread_fun)(void);
+static pthread_t thread;
+
+static void* thread_entry(void* param) {
+  (void)param;
+  thread_fun();
+  return NULL;
+}
+
+static void run_os_thread(void (*fun)(void)) {
+  thread_fun = fun;
+  pthread_create(&thread, NULL, &thread_entry, NULL);
+}
+
+static void join_os_thread(void) {
+  pthread_join(thread, NULL);
+}
+
+static void yield_os_thread(void) {
+  sched_yield();
+}
+
+static void* atomic_exchange_ptr(volatile void** p, void* newval) {
+  return atomic_exchange((volatile _Atomic(void*)*)p, newval);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Micro benchmark of `new`/`delete` pairs comparing sized versus unsized delete
+(and `mi_free_size` versus `mi_free`). Each round allocates a batch of objects
+and then deletes them all again. The "mixed" variants first allocate a few aligned
+blocks of the same size class so the pages contain aligned blocks as well.
+
+Usage: mimalloc-bench-new-delete [rounds]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <new>
+
+#include <mimalloc.h>
+#include <mimalloc-new-delete.h>
+
+static const size_t batch = 1000;
+
+template<size_t N>
+struct object_t {
+  uint8_t data[N];
+};
+
+static volatile uintptr_t sink;
+
+template<size_t N>
+static void bench(const char* name, size_t rounds, bool sized, bool mixed) {
+  typedef object_t<N> T;
+  static T* objs[batch];
+  // allocate blocks in the same size class that need alignment adjustment so the pages get the `has_aligned` flag
+  static void* aligned[8];
+  for (size_t i = 0; i < 8; i++) { aligned[i] = (mixed && N > 32 ? mi_malloc_aligned(N - 31, 32) : NULL); }
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < batch; i++) {
+      objs[i] = static_cast<T*>(::operator new(sizeof(T)));
+      objs[i]->data[0] = (uint8_t)i;
+    }
+    for (size_t i = 0; i < batch; i++) {
+      sink += objs[i]->data[0];
+      if (sized) { ::operator delete(objs[i], sizeof(T)); }
+            else { ::operator delete(objs[i]); }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < 8; i++) { mi_free(aligned[i]); }
+  const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  std::printf("%-10s %6zu bytes %-8s %7.2f ns/pair\n", name, N, (sized ? "sized" : "unsized"), ns / (double)(rounds * batch));
+}
+
+template<size_t N>
+static void bench_size(size_t rounds) {
+  bench<N>("plain", rounds, false, false);
+  bench<N>("plain", rounds, true, false);
+  bench<N>("mixed", rounds, false, true);
+  bench<N>("mixed", rounds, true, true);
+}
+
+int main(int argc, char** argv) {
+  size_t rounds = 10000;
+  if (argc > 1) rounds = (size_t)std::strtoul(argv[1], NULL, 10);
+  bench_size<16>(rounds);
+  bench_size<64>(rounds);
+  bench_size<256>(rounds);
+  bench_size<2048>(rounds);
+  return 0;
+}
@@ -0,0 +1,81 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Measure the latency of segment map lookups through `mi_is_in_heap_region`:
+pointers at the start of a segment, interior pointers in huge objects, and
+pointers that are not in the heap (both low and high addresses).
+
+Usage: mimalloc-bench-segment-map [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "mimalloc.h"
+
+#define PTR_COUNT  (1024)
+
+static double now_ns(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return ((double)t.tv_sec * 1e9) + (double)t.tv_nsec;
+}
+
+static void bench(const char* name, void** ptrs, size_t iters, bool expected) {
+  size_t found = 0;
+  const double start = now_ns();
+  for (size_t i = 0; i < iters; i++) {
+    for (size_t j = 0; j < PTR_COUNT; j++) {
+      if (mi_is_in_heap_region(ptrs[j])) found++;
+    }
+  }
+  const double elapsed = now_ns() - start;
+  const size_t total = iters * PTR_COUNT;
+  const bool ok = (expected ? found == total : found == 0);
+  printf("%-12s %8.2f ns/lookup%s\n", name, elapsed / (double)total, (ok ? "" : "  (unexpected result!)"));
+}
+
+int main(int argc, char** argv) {
+  size_t iters = 10000;
+  if (argc > 1) iters = (size_t)strtoul(argv[1], NULL, 10);
+
+  void** ptrs = (void**)mi_malloc(PTR_COUNT * sizeof(void*));
+  void** blocks = (void**)mi_malloc(PTR_COUNT * sizeof(void*));
+  for (size_t i = 0; i < PTR_COUNT; i++) {
+    blocks[i] = mi_malloc(8 + (i % 64) * 16);
+    ptrs[i] = blocks[i];
+  }
+  bench("small", ptrs, iters, true);
+
+  uint8_t* huge = (uint8_t*)mi_malloc(512 * 1024 * 1024);
+  for (size_t i = 0; i < PTR_COUNT; i++) {
+    ptrs[i] = huge + ((i * 511 * 1024) % (512 * 1024 * 1024));
+  }
+  bench("huge-inner", ptrs, iters, true);
+
+  for (size_t i = 0; i < PTR_COUNT; i++) {
+    ptrs[i] = (void*)((uintptr_t)&iters + (i * 4096));
+  }
+  bench("miss-stack", ptrs, iters, false);
+
+  #if (UINTPTR_MAX > 0xFFFFFFFFUL)
+  for (size_t i = 0; i < PTR_COUNT; i++) {
+    ptrs[i] = (void*)(((uintptr_t)1 << 55) + ((uintptr_t)i << 36));
+  }
+  bench("miss-high", ptrs, iters, false);
+  #endif
+
+  mi_free(huge);
+  for (size_t i = 0; i < PTR_COUNT; i++) { mi_free(blocks[i]); }
+  mi_free(blocks);
+  mi_free(ptrs);
+  return 0;
+}
@@ -0,0 +1,272 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Resident set and fragmentation soak benchmark. Simulates a cache where objects
+have skewed lifetimes (most live briefly, a few for many minutes) and where the
+size distribution shifts between phases (small, medium, large, and mixed sizes).
+Every interval it writes a CSV row with the live data, the resident set size, and
+the mimalloc `committed`, `reserved`, segment and page counts, so RSS creep and
+fragmentation after phase changes show up as a time series.
+
+Time is simulated in milli-second ticks. By default the simulation runs in real
+time; with `--accelerate=<n>` it runs `n` times faster (as far as the CPU allows)
+and the `decommit_delay` and `segment_decommit_delay` options are divided by `n`
+as well, so different decommit and retire policies (set through the usual
+`MIMALLOC_` environment variables) can be compared over hours of simulated time
+in a few minutes.
+
+Usage: mimalloc-bench-soak [--duration=<secs>] [--interval=<secs>] [--phase=<secs>]
+                           [--rate=<objects/sec>] [--accelerate=<n>] [--out=<file.csv>]
+
+All durations are in simulated seconds (defaults: 3600, 10, 600, 10000, and 1).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "mimalloc.h"
+
+static uint64_t rnd_state = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t rnd(void) {   // xorshift
+  uint64_t x = rnd_state;
+  x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+  return (rnd_state = x);
+}
+
+// uniform in `[lo,hi)`
+static inline size_t rnd_range(size_t lo, size_t hi) {
+  return lo + (size_t)(rnd() % (hi - lo));
+}
+
+
+/* -----------------------------------------------------------
+  Phases: each has a size distribution and a rate
+  (relative to `--rate`) such that the live data stays
+  within the same order of magnitude.
+----------------------------------------------------------- */
+
+typedef struct phase_s {
+  const char* name;
+  size_t      min_size;
+  size_t      max_size;
+  size_t      rate_div;   // divide the allocation rate by this
+} phase_t;
+
+static const phase_t phases[] = {
+  { "small",  16,   256,        1 },
+  { "medium", 256,  8*1024,     8 },
+  { "large",  8*1024, 64*1024,  64 },
+  { "mixed",  16,   64*1024,    16 },
+};
+#define PHASE_COUNT  (sizeof(phases)/sizeof(phases[0]))
+
+// skewed lifetimes in ticks (milli-seconds): 80% around 0.1s, 15% around 10s, and 5% around 10 minutes
+static uint64_t pick_lifetime(void) {
+  const uint64_t x = rnd() % 100;
+  const uint64_t mean = (x < 80 ? 100 : (x < 95 ? 10*1000 : 600*1000));
+  return 1 + (rnd() % (2*mean));   // uniform in `[1,2*mean]`
+}
+
+static size_t pick_size(const phase_t* phase) {
+  // skew towards the smaller sizes by picking the minimum of two samples
+  const size_t a = rnd_range(phase->min_size, phase->max_size);
+  const size_t b = rnd_range(phase->min_size, phase->max_size);
+  return (a < b ? a : b);
+}
+
+
+/* -----------------------------------------------------------
+  Live objects in a binary min-heap on their expiration tick
+----------------------------------------------------------- */
+
+typedef struct object_s {
+  uint64_t expire;
+  void*    p;
+  size_t   size;
+} object_t;
+
+static object_t* objects;
+static size_t    object_count;
+static size_t    object_capacity;
+static size_t    live_bytes;
+
+static void objects_push(uint64_t expire, void* p, size_t size) {
+  if (object_count >= object_capacity) {
+    object_capacity = (object_capacity == 0 ? 4096 : 2*object_capacity);
+    objects = (object_t*)realloc(objects, object_capacity * sizeof(object_t));
+    if (objects == NULL) { fprintf(stderr, "out of memory\n"); exit(1); }
+  }
+  size_t i = object_count++;
+  while (i > 0 && objects[(i-1)/2].expire > expire) {
+    objects[i] = objects[(i-1)/2];
+    i = (i-1)/2;
+  }
+  objects[i].expire = expire;
+  objects[i].p = p;
+  objects[i].size = size;
+  live_bytes += size;
+}
+
+static void objects_pop(void) {
+  live_bytes -= objects[0].size;
+  const object_t last = objects[--object_count];
+  size_t i = 0;
+  while (true) {
+    size_t child = 2*i + 1;
+    if (child >= object_count) break;
+    if (child + 1 < object_count && objects[child+1].expire < objects[child].expire) child++;
+    if (objects[child].expire >= last.expire) break;
+    objects[i] = objects[child];
+    i = child;
+  }
+  if (object_count > 0) objects[i] = last;
+}
+
+
+/* -----------------------------------------------------------
+  Sampling
+----------------------------------------------------------- */
+
+static double now_secs(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return (double)t.tv_sec + ((double)t.tv_nsec * 1e-9);
+}
+
+static void sleep_secs(double secs) {
+  #if defined(_WIN32)
+  Sleep((DWORD)(secs * 1000.0));
+  #else
+  usleep((useconds_t)(secs * 1e6));
+  #endif
+}
+
+// the actual resident set size (as `mi_process_info` estimates it from the mimalloc commit on Linux)
+static size_t current_rss(void) {
+  size_t rss = 0;
+  #if defined(__linux__)
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    unsigned long size, resident;
+    if (fscanf(f, "%lu %lu", &size, &resident) == 2) rss = (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+    fclose(f);
+    return rss;
+  }
+  #endif
+  mi_process_info(NULL, NULL, NULL, &rss, NULL, NULL, NULL, NULL);
+  return rss;
+}
+
+static void sample(FILE* out, uint64_t tick, double real_secs, const phase_t* phase) {
+  mi_stats_snapshot_t stats;
+  if (!mi_stats_get(&stats, MI_STATS_VERSION)) memset(&stats, 0, sizeof(stats));
+  fprintf(out, "%.1f,%.2f,%s,%zu,%zu,%zu,%zu,%lld,%lld,%lld,%lld,%zu\n",
+          (double)tick / 1000.0, real_secs, phase->name, object_count, live_bytes,
+          current_rss(), stats.peak_rss,
+          (long long)stats.committed.current, (long long)stats.reserved.current,
+          (long long)stats.segments.current, (long long)stats.pages.current, stats.page_faults);
+  fflush(out);
+}
+
+// divide a time option by the acceleration factor (but keep it non-zero if it was)
+static void accelerate_option(mi_option_t option, size_t factor) {
+  const long value = mi_option_get(option);
+  if (value <= 0) return;
+  const long scaled = value / (long)factor;
+  mi_option_set(option, (scaled > 0 ? scaled : 1));
+}
+
+
+/* -----------------------------------------------------------
+  Main
+----------------------------------------------------------- */
+
+int main(int argc, char** argv) {
+  size_t duration = 3600;
+  size_t interval = 10;
+  size_t phase_secs = 600;
+  size_t rate = 10000;
+  size_t accelerate = 1;
+  const char* fname = NULL;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* eq = strchr(arg, '=');
+    const long n = (eq == NULL ? 0 : strtol(eq + 1, NULL, 10));
+    if (strncmp(arg, "--duration=", 11) == 0 && n > 0) duration = (size_t)n;
+    else if (strncmp(arg, "--interval=", 11) == 0 && n > 0) interval = (size_t)n;
+    else if (strncmp(arg, "--phase=", 8) == 0 && n > 0) phase_secs = (size_t)n;
+    else if (strncmp(arg, "--rate=", 7) == 0 && n > 0) rate = (size_t)n;
+    else if (strncmp(arg, "--accelerate=", 13) == 0 && n > 0) accelerate = (size_t)n;
+    else if (strncmp(arg, "--out=", 6) == 0) fname = arg + 6;
+    else {
+      fprintf(stderr, "usage: %s [--duration=<secs>] [--interval=<secs>] [--phase=<secs>] [--rate=<objects/sec>] [--accelerate=<n>] [--out=<file.csv>]\n", argv[0]);
+      return 1;
+    }
+  }
+  FILE* out = stdout;
+  if (fname != NULL) {
+    out = fopen(fname, "w");
+    if (out == NULL) { fprintf(stderr, "unable to open: %s\n", fname); return 1; }
+  }
+  if (accelerate > 1) {
+    accelerate_option(mi_option_decommit_delay, accelerate);
+    accelerate_option(mi_option_segment_decommit_delay, accelerate);
+  }
+  fprintf(stderr, "soak: %zus simulated (%zux accelerated), sample every %zus, phases of %zus, %zu objects/s, decommit delay %ldms, segment decommit delay %ldms\n",
+          duration, accelerate, interval, phase_secs, rate,
+          mi_option_get(mi_option_decommit_delay), mi_option_get(mi_option_segment_decommit_delay));
+
+  fprintf(out, "sim_secs,real_secs,phase,live_objects,live_bytes,rss,peak_rss,committed,reserved,segments,pages,page_faults\n");
+  const double start = now_secs();
+  const uint64_t end_tick = (uint64_t)duration * 1000;
+  const uint64_t interval_ticks = (uint64_t)interval * 1000;
+  size_t credit = 0;   // allocations per tick in thousandths
+  for (uint64_t tick = 0; tick <= end_tick; tick++) {
+    const phase_t* phase = &phases[(tick / ((uint64_t)phase_secs * 1000)) % PHASE_COUNT];
+    // expire objects
+    while (object_count > 0 && objects[0].expire <= tick) {
+      mi_free(objects[0].p);
+      objects_pop();
+    }
+    // allocate new ones
+    credit += rate / phase->rate_div;
+    for (; credit >= 1000; credit -= 1000) {
+      const size_t size = pick_size(phase);
+      uint8_t* p = (uint8_t*)mi_malloc(size);
+      if (p == NULL) { fprintf(stderr, "out of memory\n"); return 1; }
+      memset(p, 0, (size < 64 ? size : 64));   // touch
+      objects_push(tick + pick_lifetime(), p, size);
+    }
+    if (tick % interval_ticks == 0) {
+      sample(out, tick, now_secs() - start, phase);
+    }
+    // keep (accelerated) real time
+    if (tick % 16 == 0) {
+      const double ahead = ((double)tick / 1000.0 / (double)accelerate) - (now_secs() - start);
+      if (ahead > 0.001) sleep_secs(ahead);
+    }
+  }
+
+  while (object_count > 0) {
+    mi_free(objects[0].p);
+    objects_pop();
+  }
+  free(objects);
+  if (out != stdout) fclose(out);
+  return 0;
+}
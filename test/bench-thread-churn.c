@@ -0,0 +1,117 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Measure the cost of creating and exiting threads that allocate, as in servers
+that spawn a thread per connection. Each spawner repeatedly creates a thread
+that allocates `allocs` blocks and frees half of them, joins it, and frees the
+other half (which then belong to an exited thread). We report threads per
+second, the time per thread (create, allocate, exit, and join), and how much
+memory was reserved from the OS while running (which should stay flat once the
+thread metadata and segments are reused).
+
+Usage: mimalloc-bench-thread-churn [--spawners=<n>] [--allocs=<n>] [--duration=<msecs>]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mimalloc.h"
+
+static size_t          allocs = 100;
+static atomic_bool     running;
+static _Atomic(size_t) total_threads;
+
+static double now_secs(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return (double)t.tv_sec + ((double)t.tv_nsec * 1e-9);
+}
+
+static void* worker(void* arg) {
+  void** blocks = (void**)arg;
+  uint64_t r = (uint64_t)(uintptr_t)blocks;
+  for (size_t i = 0; i < allocs; i++) {
+    r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+    uint8_t* p = (uint8_t*)mi_malloc(16 + (size_t)(r % 16) * 16);
+    p[0] = 1;
+    blocks[i] = p;
+  }
+  for (size_t i = 0; i < allocs; i += 2) { mi_free(blocks[i]); }
+  return NULL;
+}
+
+static void* spawner(void* arg) {
+  (void)arg;
+  void** blocks = (void**)mi_calloc(allocs, sizeof(void*));
+  size_t threads = 0;
+  while (atomic_load_explicit(&running, memory_order_relaxed)) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, &worker, blocks) != 0) {
+      fprintf(stderr, "unable to create a thread\n");
+      break;
+    }
+    pthread_join(t, NULL);
+    for (size_t i = 1; i < allocs; i += 2) { mi_free(blocks[i]); }
+    threads++;
+  }
+  mi_free(blocks);
+  atomic_fetch_add(&total_threads, threads);
+  return NULL;
+}
+
+static void run(size_t spawners, size_t duration_msecs, const char* label) {
+  mi_stats_snapshot_t before, after;
+  mi_stats_get(&before, MI_STATS_VERSION);
+  atomic_store(&total_threads, 0);
+  atomic_store(&running, true);
+  pthread_t* ts = (pthread_t*)calloc(spawners, sizeof(pthread_t));
+  const double start = now_secs();
+  for (size_t i = 0; i < spawners; i++) { pthread_create(&ts[i], NULL, &spawner, NULL); }
+  usleep((useconds_t)(duration_msecs * 1000));
+  atomic_store(&running, false);
+  for (size_t i = 0; i < spawners; i++) { pthread_join(ts[i], NULL); }
+  const double elapsed = now_secs() - start;
+  free(ts);
+  mi_stats_merge();
+  mi_stats_get(&after, MI_STATS_VERSION);
+
+  const size_t threads = atomic_load(&total_threads);
+  printf("%-8s %zu spawners: %zu threads, %.0f threads/s, %.2f us/thread, os reserved: %lld KiB",
+         label, spawners, threads, (double)threads / elapsed, (elapsed * 1e6 * (double)spawners) / (double)(threads == 0 ? 1 : threads),
+         (long long)(after.reserved.allocated - before.reserved.allocated) / 1024);
+  if (after.detailed) {
+    printf(", mmap calls: %lld", (long long)(after.mmap_calls.total - before.mmap_calls.total));
+  }
+  printf("\n");
+}
+
+int main(int argc, char** argv) {
+  size_t spawners = 1;
+  size_t duration = 1000;
+  for (int i = 1; i < argc; i++) {
+    const char* eq = strchr(argv[i], '=');
+    const long n = (eq == NULL ? 0 : strtol(eq + 1, NULL, 10));
+    if (strncmp(argv[i], "--spawners=", 11) == 0 && n > 0) spawners = (size_t)n;
+    else if (strncmp(argv[i], "--allocs=", 9) == 0 && n > 0) allocs = (size_t)n;
+    else if (strncmp(argv[i], "--duration=", 11) == 0 && n > 0) duration = (size_t)n;
+    else {
+      fprintf(stderr, "usage: %s [--spawners=<n>] [--allocs=<n>] [--duration=<msecs>]\n", argv[0]);
+      return 1;
+    }
+  }
+  run(spawners, duration / 4, "warmup");
+  run(spawners, duration, "measure");
+  return 0;
+}
@@ -0,0 +1,395 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Thread scaling benchmark: run allocation patterns for a fixed duration over
+a range of thread counts and report the throughput, the peak resident set
+size, and some mimalloc statistics as JSON.
+
+Patterns:
+- `local`:    each thread replaces random blocks in its own working set.
+- `prodcons`: each thread allocates blocks that the next thread frees.
+- `shared`:   threads read a shared array of blocks and occasionally replace one
+              (which frees blocks that other threads allocated).
+- `churn`:    each thread repeatedly starts a short lived thread that allocates
+              blocks and hands half of them back to be freed after it exits
+              (like `test-stress.c`).
+
+The `searches` and `page_no_retire` counters are only recorded in a build with
+statistics (`MI_STAT>0`, as in debug builds). With `--libc` each run is repeated
+with the C library allocator (`__libc_malloc` on glibc) for comparison.
+
+Usage: mimalloc-bench-threads [--threads=<n>,<m>,...] [--max-threads=<n>] [--duration=<msecs>] [--libc] [<pattern>]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "mimalloc.h"
+
+// An allocator to benchmark
+typedef struct allocator_s {
+  const char* name;
+  void* (*malloc)(size_t size);
+  void  (*free)(void* p);
+} allocator_t;
+
+static void* mimalloc_malloc(size_t size) { return mi_malloc(size); }
+static void  mimalloc_free(void* p)       { mi_free(p); }
+
+static const allocator_t mimalloc = { "mimalloc", &mimalloc_malloc, &mimalloc_free };
+
+#if defined(__GLIBC__)
+// when mimalloc overrides `malloc` we can still call the glibc allocator directly
+extern void* __libc_malloc(size_t size);
+extern void  __libc_free(void* p);
+static const allocator_t libc = { "glibc", &__libc_malloc, &__libc_free };
+#define HAS_LIBC  1
+#else
+static const allocator_t libc = { "libc", &malloc, &free };
+#define HAS_LIBC  0   // `malloc` may be overridden by mimalloc
+#endif
+
+static const allocator_t* alloc;     // the current allocator
+static atomic_bool        running;   // cleared when the duration has passed
+static size_t             nthreads;  // the current thread count
+static volatile size_t    sink;      // keep the compiler from optimizing reads away
+
+static inline uint64_t rnd(uint64_t* r) {   // xorshift
+  uint64_t x = *r;
+  x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+  return (*r = x);
+}
+
+// mostly small sizes, sometimes up to 8KiB
+static inline size_t pick_size(uint64_t* r) {
+  const uint64_t x = rnd(r);
+  if ((x % 100) < 90) return 16 + (size_t)((x >> 8) % 16) * 8;
+  return 16 + (size_t)((x >> 8) % 8192);
+}
+
+static inline void* bench_alloc(size_t size) {
+  uint8_t* p = (uint8_t*)alloc->malloc(size);
+  p[0] = (uint8_t)size;   // touch
+  return p;
+}
+
+
+/* -----------------------------------------------------------
+  local
+----------------------------------------------------------- */
+
+#define LOCAL_SLOTS  (1024)
+
+static size_t run_local(size_t tid) {
+  uint64_t r = 0x9E3779B97F4A7C15ULL * (tid + 1);
+  void** slots = (void**)calloc(LOCAL_SLOTS, sizeof(void*));
+  size_t ops = 0;
+  while (atomic_load_explicit(&running, memory_order_relaxed)) {
+    for (size_t i = 0; i < 64; i++) {
+      const size_t idx = (size_t)(rnd(&r) % LOCAL_SLOTS);
+      if (slots[idx] != NULL) alloc->free(slots[idx]);
+      slots[idx] = bench_alloc(pick_size(&r));
+    }
+    ops += 64;
+  }
+  for (size_t i = 0; i < LOCAL_SLOTS; i++) { if (slots[i] != NULL) alloc->free(slots[i]); }
+  free(slots);
+  return ops;
+}
+
+
+/* -----------------------------------------------------------
+  prodcons: thread `t` pushes into the ring of thread `t+1`
+  (single producer, single consumer)
+----------------------------------------------------------- */
+
+#define RING_SIZE  (1024)
+
+typedef struct ring_s {
+  _Atomic(size_t) head;        // written by the producer
+  uint8_t         pad1[64 - sizeof(size_t)];
+  _Atomic(size_t) tail;        // written by the consumer
+  uint8_t         pad2[64 - sizeof(size_t)];
+  void*           slots[RING_SIZE];
+} ring_t;
+
+static ring_t* rings;
+
+static bool ring_push(ring_t* ring, void* p) {
+  const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= RING_SIZE) return false;
+  ring->slots[head % RING_SIZE] = p;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return true;
+}
+
+static void* ring_pop(ring_t* ring) {
+  const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) return NULL;
+  void* p = ring->slots[tail % RING_SIZE];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return p;
+}
+
+static size_t run_prodcons(size_t tid) {
+  uint64_t r = 0x9E3779B97F4A7C15ULL * (tid + 1);
+  ring_t* out = &rings[(tid + 1) % nthreads];
+  ring_t* in  = &rings[tid];
+  size_t ops = 0;
+  while (atomic_load_explicit(&running, memory_order_relaxed)) {
+    for (size_t i = 0; i < 64; i++) {
+      void* p = bench_alloc(pick_size(&r));
+      if (!ring_push(out, p)) alloc->free(p);  // the consumer is behind
+    }
+    ops += 64;
+    void* p;
+    while ((p = ring_pop(in)) != NULL) { alloc->free(p); }
+  }
+  return ops;
+}
+
+
+/* -----------------------------------------------------------
+  shared: a reader announces itself on the slot so a writer
+  only frees a replaced block once there are no more readers.
+----------------------------------------------------------- */
+
+#define SHARED_SLOTS  (4096)
+
+static _Atomic(void*)  shared[SHARED_SLOTS];
+static _Atomic(size_t) readers[SHARED_SLOTS];
+
+static size_t run_shared(size_t tid) {
+  uint64_t r = 0x9E3779B97F4A7C15ULL * (tid + 1);
+  size_t ops = 0;
+  size_t sum = 0;
+  while (atomic_load_explicit(&running, memory_order_relaxed)) {
+    for (size_t i = 0; i < 64; i++) {
+      const uint64_t x = rnd(&r);
+      const size_t idx = (size_t)((x >> 8) % SHARED_SLOTS);
+      if ((x % 100) == 0) {
+        // replace the block
+        void* old = atomic_exchange(&shared[idx], bench_alloc(pick_size(&r)));
+        while (atomic_load(&readers[idx]) != 0) { sched_yield(); }
+        alloc->free(old);
+      }
+      else {
+        atomic_fetch_add(&readers[idx], 1);
+        const uint8_t* p = (const uint8_t*)atomic_load(&shared[idx]);
+        sum += p[0];
+        atomic_fetch_sub(&readers[idx], 1);
+      }
+    }
+    ops += 64;
+  }
+  sink = sum;
+  return ops;
+}
+
+static void shared_init(void) {
+  uint64_t r = 42;
+  for (size_t i = 0; i < SHARED_SLOTS; i++) { atomic_store(&shared[i], bench_alloc(pick_size(&r))); }
+}
+
+static void shared_done(void) {
+  for (size_t i = 0; i < SHARED_SLOTS; i++) { alloc->free(atomic_exchange(&shared[i], NULL)); }
+}
+
+
+/* -----------------------------------------------------------
+  churn
+----------------------------------------------------------- */
+
+#define CHURN_ALLOCS  (256)
+
+static void* churn_thread(void* arg) {
+  void** blocks = (void**)arg;
+  uint64_t r = (uint64_t)(uintptr_t)blocks | 1;
+  for (size_t i = 0; i < CHURN_ALLOCS; i++) { blocks[i] = bench_alloc(pick_size(&r)); }
+  for (size_t i = 0; i < CHURN_ALLOCS; i += 2) { alloc->free(blocks[i]); blocks[i] = NULL; }
+  return NULL;
+}
+
+static size_t run_churn(size_t tid) {
+  (void)tid;
+  void* blocks[CHURN_ALLOCS];
+  size_t ops = 0;
+  while (atomic_load_explicit(&running, memory_order_relaxed)) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, &churn_thread, blocks) != 0) break;
+    pthread_join(t, NULL);
+    for (size_t i = 1; i < CHURN_ALLOCS; i += 2) { alloc->free(blocks[i]); }
+    ops += CHURN_ALLOCS;
+  }
+  return ops;
+}
+
+
+/* -----------------------------------------------------------
+  Driver
+----------------------------------------------------------- */
+
+typedef struct pattern_s {
+  const char* name;
+  size_t (*run)(size_t tid);
+} pattern_t;
+
+static const pattern_t patterns[] = {
+  { "local",    &run_local },
+  { "prodcons", &run_prodcons },
+  { "shared",   &run_shared },
+  { "churn",    &run_churn },
+};
+
+static const pattern_t*  pattern;
+static _Atomic(size_t)   total_ops;
+static atomic_bool       go;
+
+static void* bench_thread(void* arg) {
+  const size_t tid = (size_t)(uintptr_t)arg;
+  while (!atomic_load_explicit(&go, memory_order_acquire)) { sched_yield(); }
+  atomic_fetch_add(&total_ops, pattern->run(tid));
+  return NULL;
+}
+
+static double now_secs(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return (double)t.tv_sec + ((double)t.tv_nsec * 1e-9);
+}
+
+// the actual resident set size (as `mi_process_info` estimates it from the mimalloc commit on Linux)
+static size_t current_rss(void) {
+  size_t rss = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    unsigned long size, resident;
+    if (fscanf(f, "%lu %lu", &size, &resident) == 2) rss = (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+    fclose(f);
+  }
+  else {
+    mi_process_info(NULL, NULL, NULL, &rss, NULL, NULL, NULL, NULL);
+  }
+  return rss;
+}
+
+static void run(const allocator_t* a, const pattern_t* p, size_t threads, size_t duration_msecs, bool first) {
+  alloc = a;
+  pattern = p;
+  nthreads = threads;
+  atomic_store(&total_ops, 0);
+  atomic_store(&go, false);
+  atomic_store(&running, true);
+  if (p->run == &run_prodcons) rings = (ring_t*)calloc(threads, sizeof(ring_t));
+  if (p->run == &run_shared) shared_init();
+  mi_stats_reset();
+
+  pthread_t* ts = (pthread_t*)calloc(threads, sizeof(pthread_t));
+  for (size_t i = 0; i < threads; i++) {
+    pthread_create(&ts[i], NULL, &bench_thread, (void*)(uintptr_t)i);
+  }
+  const double start = now_secs();
+  atomic_store_explicit(&go, true, memory_order_release);
+  // sample the resident set size until the duration has passed
+  size_t peak_rss = 0;
+  double elapsed;
+  while ((elapsed = now_secs() - start) * 1000.0 < (double)duration_msecs) {
+    const size_t rss = current_rss();
+    if (rss > peak_rss) peak_rss = rss;
+    usleep(10000);
+  }
+  atomic_store(&running, false);
+  for (size_t i = 0; i < threads; i++) { pthread_join(ts[i], NULL); }
+  elapsed = now_secs() - start;
+  free(ts);
+
+  mi_stats_merge();
+  mi_stats_snapshot_t stats;
+  const bool has_stats = (a == &mimalloc && mi_stats_get(&stats, MI_STATS_VERSION));
+  if (p->run == &run_prodcons) {
+    for (size_t i = 0; i < threads; i++) {
+      void* q;
+      while ((q = ring_pop(&rings[i])) != NULL) { a->free(q); }
+    }
+    free(rings);
+    rings = NULL;
+  }
+  if (p->run == &run_shared) shared_done();
+
+  const size_t ops = atomic_load(&total_ops);
+  printf("%s    { \"allocator\": \"%s\", \"pattern\": \"%s\", \"threads\": %zu, \"ops\": %zu, \"ops_per_sec\": %.0f, \"peak_rss\": %zu",
+         (first ? "" : ",\n"), a->name, p->name, threads, ops, (double)ops / elapsed, peak_rss);
+  if (has_stats) {
+    printf(", \"searches\": %lld, \"page_no_retire\": %lld, \"segments_abandoned\": %lld }",
+           (long long)stats.searches.total, (long long)stats.page_no_retire.total, (long long)stats.segments_abandoned.allocated);
+  }
+  else {
+    printf(", \"searches\": null, \"page_no_retire\": null, \"segments_abandoned\": null }");
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  size_t thread_counts[64];
+  size_t thread_count_len = 0;
+  size_t max_threads = 128;
+  size_t duration = 1000;
+  bool with_libc = false;
+  const char* filter = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--threads=", 10) == 0) {
+      char* s = argv[i] + 10;
+      while (*s != 0 && thread_count_len < 64) {
+        const long n = strtol(s, &s, 10);
+        if (n > 0) thread_counts[thread_count_len++] = (size_t)n;
+        if (*s == ',') s++; else break;
+      }
+    }
+    else if (strncmp(argv[i], "--max-threads=", 14) == 0) {
+      const long n = strtol(argv[i] + 14, NULL, 10);
+      if (n > 0) max_threads = (size_t)n;
+    }
+    else if (strncmp(argv[i], "--duration=", 11) == 0) {
+      const long n = strtol(argv[i] + 11, NULL, 10);
+      if (n > 0) duration = (size_t)n;
+    }
+    else if (strcmp(argv[i], "--libc") == 0) with_libc = true;
+    else if (argv[i][0] != '-') filter = argv[i];
+    else {
+      fprintf(stderr, "usage: %s [--threads=<n>,<m>,...] [--max-threads=<n>] [--duration=<msecs>] [--libc] [<pattern>]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (thread_count_len == 0) {
+    for (size_t n = 1; n <= max_threads; n *= 2) { thread_counts[thread_count_len++] = n; }
+  }
+  if (with_libc && !HAS_LIBC) {
+    fprintf(stderr, "warning: cannot call the C library allocator directly on this platform; using `malloc`\n");
+  }
+
+  printf("{ \"mimalloc_version\": %d, \"duration_msecs\": %zu, \"cpus\": %ld,\n  \"results\": [\n", mi_version(), duration, sysconf(_SC_NPROCESSORS_ONLN));
+  bool first = true;
+  for (size_t p = 0; p < sizeof(patterns)/sizeof(patterns[0]); p++) {
+    if (filter != NULL && strcmp(filter, patterns[p].name) != 0) continue;
+    for (size_t t = 0; t < thread_count_len; t++) {
+      run(&mimalloc, &patterns[p], thread_counts[t], duration, first);
+      first = false;
+      if (with_libc) run(&libc, &patterns[p], thread_counts[t], duration, false);
+    }
+  }
+  printf("\n  ]\n}\n");
+  return 0;
+}
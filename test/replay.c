@@ -0,0 +1,320 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Replay an allocation trace recorded with `MIMALLOC_TRACE=<prefix>` (in a build
+with `MI_TRACE=ON`, see `mimalloc-trace.h`) and report the elapsed time, the
+resident set size, and the mimalloc statistics.
+
+Usage: mimalloc-replay <prefix>
+
+All files `<prefix>.0`, `<prefix>.1`, ... are loaded and each is replayed by
+its own thread. The entries of all threads are first put in a global order
+by their timestamp such that each allocated object gets a unique id. When a
+thread frees (or reallocates) an object that another thread allocated, it
+waits until that thread has published the pointer. Since an object is always
+allocated before it is freed this cannot deadlock.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mimalloc.h"
+#include "mimalloc-trace.h"
+
+#define NO_ID  (SIZE_MAX)
+
+typedef struct event_s {
+  uint8_t  op;
+  size_t   size;
+  size_t   arg;       // the alignment of an aligned allocation
+  size_t   id;        // object id of the result of a malloc, realloc, or aligned allocation
+  size_t   src;       // object id of the argument of a free or realloc (or NO_ID)
+} event_t;
+
+typedef struct thread_trace_s {
+  mi_trace_entry_t* entries;
+  size_t            count;
+  event_t*          events;     // the entries translated to object ids
+  size_t            next;       // next entry to merge into the global order
+  pthread_t         thread;
+} thread_trace_t;
+
+static thread_trace_t*        traces;
+static size_t                 trace_count;
+static size_t                 object_count;
+static _Atomic(void*)*        objects;       // published pointers indexed by object id
+static size_t                 unmatched;     // frees of unknown pointers (skipped)
+static atomic_bool            go;
+
+
+/* -----------------------------------------------------------
+  Loading
+----------------------------------------------------------- */
+
+static bool load_trace(const char* prefix, size_t n, thread_trace_t* trace) {
+  char fname[1024];
+  snprintf(fname, sizeof(fname), "%s.%zu", prefix, n);
+  FILE* f = fopen(fname, "rb");
+  if (f == NULL) return false;
+  mi_trace_header_t header;
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, MI_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "%s: not an allocation trace\n", fname);
+    exit(1);
+  }
+  size_t capacity = 1024;
+  trace->entries = (mi_trace_entry_t*)malloc(capacity * sizeof(mi_trace_entry_t));
+  trace->count = 0;
+  size_t read;
+  while ((read = fread(trace->entries + trace->count, sizeof(mi_trace_entry_t), capacity - trace->count, f)) > 0) {
+    trace->count += read;
+    if (trace->count == capacity) {
+      capacity *= 2;
+      trace->entries = (mi_trace_entry_t*)realloc(trace->entries, capacity * sizeof(mi_trace_entry_t));
+    }
+  }
+  fclose(f);
+  // timestamps of a single thread should be monotonic but a migration to another core may have a skewed counter
+  for (size_t i = 1; i < trace->count; i++) {
+    if (trace->entries[i].time < trace->entries[i-1].time) { trace->entries[i].time = trace->entries[i-1].time; }
+  }
+  trace->events = (event_t*)calloc(trace->count + 1, sizeof(event_t));
+  trace->next = 0;
+  return true;
+}
+
+
+/* -----------------------------------------------------------
+  Map live addresses to object ids
+  (open addressing with linear probing and backward shift deletion)
+----------------------------------------------------------- */
+
+typedef struct map_entry_s {
+  uint64_t addr;   // 0 if empty
+  size_t   id;
+} map_entry_t;
+
+static map_entry_t* map;
+static size_t       map_size;    // power of two
+static size_t       map_count;
+
+static size_t map_hash(uint64_t addr) {
+  return (size_t)((addr >> 3) * 0x9E3779B97F4A7C15ULL) & (map_size - 1);
+}
+
+static void map_insert(uint64_t addr, size_t id);
+
+static void map_grow(void) {
+  map_entry_t* old = map;
+  const size_t old_size = map_size;
+  map_size = (map_size == 0 ? 1024 : 2 * map_size);
+  map = (map_entry_t*)calloc(map_size, sizeof(map_entry_t));
+  map_count = 0;
+  for (size_t i = 0; i < old_size; i++) {
+    if (old[i].addr != 0) map_insert(old[i].addr, old[i].id);
+  }
+  free(old);
+}
+
+static void map_insert(uint64_t addr, size_t id) {
+  if (2*(map_count + 1) > map_size) map_grow();
+  size_t i = map_hash(addr);
+  while (map[i].addr != 0 && map[i].addr != addr) { i = (i + 1) & (map_size - 1); }
+  if (map[i].addr == 0) map_count++;
+  map[i].addr = addr;   // overwrites a (missed) earlier allocation at the same address
+  map[i].id = id;
+}
+
+static size_t map_remove(uint64_t addr) {
+  if (map_size == 0) return NO_ID;
+  size_t i = map_hash(addr);
+  while (map[i].addr != addr) {
+    if (map[i].addr == 0) return NO_ID;
+    i = (i + 1) & (map_size - 1);
+  }
+  const size_t id = map[i].id;
+  map[i].addr = 0;
+  map_count--;
+  // shift back following entries that are displaced from their home slot
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & (map_size - 1);
+    if (map[j].addr == 0) break;
+    const size_t home = map_hash(map[j].addr);
+    if (((j - home) & (map_size - 1)) >= ((j - i) & (map_size - 1))) {
+      map[i] = map[j];
+      map[j].addr = 0;
+      i = j;
+    }
+  }
+  return id;
+}
+
+
+/* -----------------------------------------------------------
+  Translate all entries in global order to object ids
+----------------------------------------------------------- */
+
+static void translate(void) {
+  while (true) {
+    // find the thread with the earliest next entry (ties by thread)
+    thread_trace_t* min = NULL;
+    for (size_t t = 0; t < trace_count; t++) {
+      thread_trace_t* trace = &traces[t];
+      if (trace->next < trace->count && (min == NULL || trace->entries[trace->next].time < min->entries[min->next].time)) {
+        min = trace;
+      }
+    }
+    if (min == NULL) break;
+    const mi_trace_entry_t* entry = &min->entries[min->next];
+    event_t* ev = &min->events[min->next];
+    min->next++;
+    ev->op = (uint8_t)(entry->size_op & 0xFF);
+    ev->size = (size_t)(entry->size_op >> 8);
+    ev->arg = (size_t)entry->arg;
+    ev->id = NO_ID;
+    ev->src = NO_ID;
+    switch (ev->op) {
+      case MI_TRACE_FREE:
+        ev->src = map_remove(entry->ptr);
+        if (ev->src == NO_ID) unmatched++;
+        break;
+      case MI_TRACE_REALLOC:
+        if (entry->arg != 0) {
+          ev->src = map_remove(entry->arg);
+          if (ev->src == NO_ID) unmatched++;
+        }
+        ev->arg = 0;
+        ev->id = object_count++;
+        map_insert(entry->ptr, ev->id);
+        break;
+      case MI_TRACE_MALLOC:
+      case MI_TRACE_ALIGNED:
+        ev->id = object_count++;
+        map_insert(entry->ptr, ev->id);
+        break;
+      default:
+        fprintf(stderr, "invalid trace entry (op %u)\n", (unsigned)ev->op);
+        exit(1);
+    }
+  }
+}
+
+
+/* -----------------------------------------------------------
+  Replay
+----------------------------------------------------------- */
+
+static void* wait_object(size_t id) {
+  void* p;
+  size_t spins = 0;
+  while ((p = atomic_load_explicit(&objects[id], memory_order_acquire)) == NULL) {
+    if (++spins > 100) sched_yield();
+  }
+  return p;
+}
+
+static void publish_object(size_t id, void* p) {
+  if (p == NULL) {
+    fprintf(stderr, "out of memory during replay\n");
+    exit(1);
+  }
+  atomic_store_explicit(&objects[id], p, memory_order_release);
+}
+
+static void* replay_thread(void* arg) {
+  const thread_trace_t* trace = (const thread_trace_t*)arg;
+  while (!atomic_load_explicit(&go, memory_order_acquire)) { sched_yield(); }
+  for (size_t i = 0; i < trace->count; i++) {
+    const event_t* ev = &trace->events[i];
+    switch (ev->op) {
+      case MI_TRACE_MALLOC:
+        publish_object(ev->id, mi_malloc(ev->size));
+        break;
+      case MI_TRACE_ALIGNED:
+        publish_object(ev->id, mi_malloc_aligned(ev->size, ev->arg));
+        break;
+      case MI_TRACE_REALLOC: {
+        void* p = (ev->src == NO_ID ? NULL : wait_object(ev->src));
+        publish_object(ev->id, mi_realloc(p, ev->size));
+        break;
+      }
+      case MI_TRACE_FREE:
+        if (ev->src != NO_ID) mi_free(wait_object(ev->src));
+        break;
+    }
+  }
+  return NULL;
+}
+
+static double now_secs(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return (double)t.tv_sec + ((double)t.tv_nsec * 1e-9);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <prefix>\n", argv[0]);
+    return 1;
+  }
+  const char* prefix = argv[1];
+  size_t capacity = 16;
+  traces = (thread_trace_t*)calloc(capacity, sizeof(thread_trace_t));
+  while (load_trace(prefix, trace_count, &traces[trace_count])) {
+    trace_count++;
+    if (trace_count == capacity) {
+      capacity *= 2;
+      traces = (thread_trace_t*)realloc(traces, capacity * sizeof(thread_trace_t));
+    }
+  }
+  if (trace_count == 0) {
+    fprintf(stderr, "no allocation trace found at \"%s.0\"\n", prefix);
+    return 1;
+  }
+  size_t event_count = 0;
+  for (size_t t = 0; t < trace_count; t++) { event_count += traces[t].count; }
+  translate();
+  free(map);
+  objects = (_Atomic(void*)*)calloc(object_count + 1, sizeof(_Atomic(void*)));
+
+  mi_stats_reset();
+  for (size_t t = 0; t < trace_count; t++) {
+    pthread_create(&traces[t].thread, NULL, &replay_thread, &traces[t]);
+  }
+  const double start = now_secs();
+  atomic_store_explicit(&go, true, memory_order_release);
+  for (size_t t = 0; t < trace_count; t++) {
+    pthread_join(traces[t].thread, NULL);
+  }
+  const double elapsed = now_secs() - start;
+
+  size_t current_rss, peak_rss, current_commit, peak_commit;
+  mi_process_info(NULL, NULL, NULL, &current_rss, &peak_rss, &current_commit, &peak_commit, NULL);
+  printf("replayed %zu events (%zu objects) in %zu threads\n", event_count, object_count, trace_count);
+  if (unmatched > 0) { printf("skipped %zu frees of unknown pointers\n", unmatched); }
+  printf("elapsed: %.3fs, rss: %.1f MiB (peak %.1f MiB), commit: %.1f MiB (peak %.1f MiB)\n", elapsed,
+         (double)current_rss / (1024.0*1024.0), (double)peak_rss / (1024.0*1024.0),
+         (double)current_commit / (1024.0*1024.0), (double)peak_commit / (1024.0*1024.0));
+  fflush(stdout);
+  mi_stats_print_out(NULL, NULL);
+
+  for (size_t t = 0; t < trace_count; t++) {
+    free(traces[t].entries);
+    free(traces[t].events);
+  }
+  free(traces);
+  free((void*)objects);
+  return 0;
+}
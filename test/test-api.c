@@ -27,6 +27,10 @@ we therefore test the API over various inputs. Please add more tests :-)
 #include <stdbool.h>
 #include <stdint.h>
 #include <errno.h>
+#include <string.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 #ifdef __cplusplus
 #include <vector>
@@ -46,6 +50,45 @@ bool test_heap2(void);
 bool test_stl_allocator1(void);
 bool test_stl_allocator2(void);
 
+static char   stats_buf[64*1024];
+static size_t stats_len = 0;
+
+static void stats_out(const char* msg, void* arg) {
+  (void)(arg);
+  const size_t n = strlen(msg);
+  if (stats_len + n >= sizeof(stats_buf)) return;
+  memcpy(stats_buf + stats_len, msg, n + 1);
+  stats_len += n;
+}
+
+static bool visit_page_reserved(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(block);
+  size_t* sizes = (size_t*)arg;
+  if (block_size < 16*1024) { if (area->reserved > sizes[0]) { sizes[0] = area->reserved; } }  // largest page of small blocks
+  else { sizes[1] = area->reserved; }   // (last) page of larger blocks
+  return true;
+}
+
+static bool visit_page_count(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(area); (void)(block); (void)(block_size);
+  *((size_t*)arg) += 1;
+  return true;
+}
+
+static size_t heap_page_count(mi_heap_t* heap) {
+  size_t count = 0;
+  mi_heap_visit_blocks(heap, false, &visit_page_count, &count);
+  return count;
+}
+
+#if !defined(_WIN32)
+static void* free_blocks_thread(void* arg) {
+  void** ps = (void**)arg;
+  for (size_t i = 0; ps[i] != NULL; i++) { mi_free(ps[i]); }
+  return NULL;
+}
+#endif
+
 // ---------------------------------------------------------------------------
 // Main testing
 // ---------------------------------------------------------------------------
@@ -164,6 +207,28 @@ int main(void) {
   CHECK_BODY("malloc-aligned-at2", {
     void* p = mi_malloc_aligned_at(50,32,8); result = (p != NULL && ((uintptr_t)(p) + 8) % 32 == 0); mi_free(p);
   });  
+  CHECK_BODY("free-size", {
+    // sized free of plain blocks in a page that also contains aligned blocks
+    void* a = mi_malloc_aligned(33, 32);
+    void* ps[64];
+    for (int i = 0; i < 64; i++) { ps[i] = mi_malloc(64); }
+    for (int i = 0; i < 64; i++) { mi_free_size(ps[i], 64); }
+    mi_free_size_aligned(a, 33, 32);
+    void* p = mi_malloc(64);
+    result = (p != NULL && mi_usable_size(p) >= 64);
+    mi_free_size(p, 64);
+  });
+  CHECK_BODY("free-size-aligned-block", {
+    // sized free of aligned (interior) pointers
+    void* ps[64];
+    for (int i = 0; i < 64; i++) { ps[i] = mi_malloc_aligned(40 + (size_t)i, 64); }
+    for (int i = 0; i < 64; i++) { mi_free_size(ps[i], 40 + (size_t)i); }
+    for (int i = 0; i < 64; i++) {
+      ps[i] = mi_malloc(100);
+      result = result && (ps[i] != NULL) && (mi_usable_size(ps[i]) >= 100);
+    }
+    for (int i = 0; i < 64; i++) { mi_free_size(ps[i], 100); }
+  });
   CHECK_BODY("memalign1", {
     void* p;
     bool ok = true;
@@ -179,6 +244,73 @@ int main(void) {
   // ---------------------------------------------------
   CHECK("heap_destroy", test_heap1());
   CHECK("heap_delete", test_heap2());
+  CHECK_BODY("heap-collect-step", {
+    // blocks of many size classes so there are many pages, where the pages of every other size class become free
+    mi_heap_t* heap = mi_heap_new();
+    void* ps[1000];
+    for (int i = 0; i < 1000; i++) { ps[i] = mi_heap_malloc(heap, 8 + (size_t)(i % 50) * 40); }
+    for (int i = 0; i < 1000; i++) { if ((i % 50) % 2 == 0) mi_free(ps[i]); }
+    const size_t pages = heap_page_count(heap);
+    size_t steps = 1;
+    while (mi_heap_collect_step(heap, 4) && steps < 1000) { steps++; }
+    result = (steps > 1 && steps < 1000);
+    result = result && (heap_page_count(heap) < pages);      // the free pages are freed
+    result = result && !mi_heap_collect_step(heap, 1000);   // a full cycle in one step
+    for (int i = 0; i < 1000; i++) { if ((i % 50) % 2 == 1) result = result && mi_heap_contains_block(heap, ps[i]); }
+    mi_heap_destroy(heap);
+  });
+  #if !defined(_WIN32)
+  CHECK_BODY("heap-collect-step-xthread", {
+    // blocks (in full pages) that are freed by another thread are collected step by step
+    mi_heap_t* heap = mi_heap_new();
+    static void* ps[10001];
+    for (int i = 0; i < 10000; i++) { ps[i] = mi_heap_malloc(heap, 64); }
+    ps[10000] = NULL;
+    void* q = mi_heap_malloc(heap, 1024);
+    const size_t pages = heap_page_count(heap);
+    pthread_t thread;
+    pthread_create(&thread, NULL, &free_blocks_thread, ps);
+    pthread_join(thread, NULL);
+    size_t steps = 1;
+    while (mi_heap_collect_step(heap, 1) && steps < 10000) { steps++; }
+    result = (steps < 10000);
+    result = result && (pages > 2 && heap_page_count(heap) <= 2);  // only the page of `q` (and maybe one retired page) is left
+    result = result && mi_heap_contains_block(heap, q);
+    mi_heap_destroy(heap);
+  });
+  #endif
+  CHECK_BODY("heap-page-size-adaptive", {
+    // a hot size class gets larger pages, and a cold one a small page
+    mi_heap_t* heap = mi_heap_new();
+    for (int i = 0; i < 100000; i++) { result = result && (mi_heap_malloc(heap, 48) != NULL); }
+    void* p = mi_heap_malloc(heap, 16*1024);
+    size_t sizes[2];   // largest page of 48 byte blocks, page of the 16KiB block
+    sizes[0] = 0; sizes[1] = 0;
+    mi_heap_visit_blocks(heap, true, &visit_page_reserved, sizes);
+    result = result && (sizes[0] > MI_SMALL_PAGE_SIZE) && (sizes[1] > 0 && sizes[1] < MI_MEDIUM_PAGE_SIZE);
+    mi_free(p);
+    mi_heap_destroy(heap);
+  });
+  CHECK_BODY("heap-large-bin", {
+    // large blocks share a page with a few others, and each finds its page
+    mi_heap_t* heap = mi_heap_new();
+    const size_t size = MI_LARGE_BIN_OBJ_SIZE_MAX - 1000;
+    void* ps[8];
+    for (int i = 0; i < 8; i++) {
+      ps[i] = mi_heap_malloc(heap, size);
+      result = result && (ps[i] != NULL) && (mi_usable_size(ps[i]) >= size) && mi_heap_contains_block(heap, ps[i]);
+    }
+    size_t sizes[2];
+    sizes[0] = 0; sizes[1] = 0;
+    mi_heap_visit_blocks(heap, true, &visit_page_reserved, sizes);
+    result = result && (sizes[1] >= 4*size);
+    for (int i = 0; i < 8; i += 2) { mi_free(ps[i]); }
+    for (int i = 0; i < 8; i += 2) {
+      ps[i] = mi_heap_malloc(heap, size);
+      result = result && (ps[i] != NULL) && (mi_usable_size(ps[i]) >= size) && mi_heap_contains_block(heap, ps[i]);
+    }
+    mi_heap_destroy(heap);
+  });
 
   //mi_stats_print(NULL);
 
@@ -190,6 +322,83 @@ int main(void) {
     // printf("realpath: %s\n",s);
     mi_free(s);
   });
+  CHECK_BODY("heap-region", {
+    uint8_t* p = (uint8_t*)mi_malloc(32);
+    uint8_t* q = (uint8_t*)mi_malloc(200*1024*1024);  // huge object spanning multiple segments
+    result = (mi_is_in_heap_region(p) && mi_is_in_heap_region(q) && mi_is_in_heap_region(q + 150*1024*1024));
+    result = result && !mi_is_in_heap_region(&result) && !mi_is_in_heap_region(NULL);
+    #if (MI_INTPTR_SIZE==8)
+    result = result && !mi_is_in_heap_region((void*)((uintptr_t)1 << 50)) && !mi_is_in_heap_region((void*)((uintptr_t)1 << 60));
+    #endif
+    mi_free(q);
+    mi_free(p);
+  });
+
+  CHECK_BODY("stats-get", {
+    mi_stats_snapshot_t s0;
+    mi_stats_snapshot_t s1;
+    result = mi_stats_get(&s0, MI_STATS_VERSION);
+    void* p = mi_malloc(1000);
+    result = result && mi_stats_get(&s1, MI_STATS_VERSION);
+    result = result && (s1.version == MI_STATS_VERSION && s1.size == sizeof(mi_stats_snapshot_t));
+    #if (MI_STAT>0)
+    result = result && (s1.normal.allocated >= s0.normal.allocated + 1000 && s1.normal_count.count > s0.normal_count.count);
+    #endif
+    result = result && (s1.normal_bin_sizes[1] == sizeof(void*)) && (s1.elapsed_msecs >= s0.elapsed_msecs);
+    result = result && !mi_stats_get(&s1, MI_STATS_VERSION + 1) && !mi_stats_get(NULL, MI_STATS_VERSION);
+    mi_free(p);
+  });
+  CHECK_BODY("stats-json", {
+    stats_len = 0;
+    mi_stats_print_json(&stats_out, NULL);
+    result = (strncmp(stats_buf, "{\n  \"version\": 1,", 17) == 0 && strstr(stats_buf, "\"normal_bins\": [") != NULL);
+    result = result && (stats_len > 2 && strcmp(stats_buf + stats_len - 2, "}\n") == 0);
+  });
+  CHECK_BODY("stats-openmetrics", {
+    stats_len = 0;
+    mi_stats_print_openmetrics(&stats_out, NULL);
+    result = (strncmp(stats_buf, "# TYPE mimalloc_reserved_bytes gauge\n", 37) == 0 && strstr(stats_buf, "\nmimalloc_mmap_calls_total ") != NULL);
+    result = result && (stats_len > 6 && strcmp(stats_buf + stats_len - 6, "# EOF\n") == 0);
+  });
+  CHECK_BODY("fragmentation-report", {
+    // free every other block so the pages are about half used
+    mi_heap_t* heap = mi_heap_new();
+    void* ps[1000];
+    for (int i = 0; i < 1000; i++) { ps[i] = mi_heap_malloc(heap, 200); }
+    for (int i = 0; i < 1000; i += 2) { mi_free(ps[i]); }
+    stats_len = 0;
+    mi_heap_fragmentation_report(heap, &stats_out, NULL);
+    result = (strstr(stats_buf, "fragmentation of heap") == stats_buf);
+    // the 200 byte blocks are in the 208 byte size class (or 224 bytes on 32-bit)
+    result = result && (strstr(stats_buf, "  208 ") != NULL || strstr(stats_buf, "  224 ") != NULL);
+    result = result && (strstr(stats_buf, "\nsegment ") != NULL);
+    mi_heap_destroy(heap);
+    stats_len = 0;
+    mi_fragmentation_report(&stats_out, NULL);
+    result = result && (strstr(stats_buf, "fragmentation of all heaps") == stats_buf && strstr(stats_buf, "\nsegments: ") != NULL);
+  });
+  #if MI_LATENCY
+  CHECK_BODY("stats-latency", {
+    void* p = mi_malloc(1024*1024);
+    mi_free(p);
+    stats_len = 0;
+    mi_stats_print_out(&stats_out, NULL);
+    result = (strstr(stats_buf, "    cycles: ") != NULL && strstr(stats_buf, "    malloc: ") != NULL);
+    result = result && (strstr(stats_buf, "  os alloc:") != NULL);
+  });
+  #endif
+  CHECK_BODY("event-dump", {
+    mi_option_enable(mi_option_event_log);
+    // the first block of a new heap needs a fresh page
+    mi_heap_t* heap = mi_heap_new();
+    void* p = mi_heap_malloc(heap, 1024*1024);
+    mi_free(p);
+    mi_heap_delete(heap);
+    stats_len = 0;
+    mi_event_dump(&stats_out, NULL);
+    result = (strstr(stats_buf, "slow path events") == stats_buf && strstr(stats_buf, "\nthread 0x") != NULL);
+    result = result && (strstr(stats_buf, "  page-fresh ") != NULL);
+  });
 
   CHECK("stl_allocator1", test_stl_allocator1());
   CHECK("stl_allocator2", test_stl_allocator2());
@@ -0,0 +1,141 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Test epoch based deferred free: blocks passed to `mi_free_deferred` are not
+freed while another thread is inside a critical section that started before,
+and are freed once it left. Also runs a lock-free (Treiber) stack where the
+popped nodes are freed with `mi_free_deferred` while other threads may still
+read them.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "mimalloc.h"
+#include "testhelper.h"
+
+// ---------------------------------------------------------------------------
+// Deferred blocks stay alive while a reader is in a critical section
+// ---------------------------------------------------------------------------
+
+#define BLOCK_COUNT  (1000)
+
+static atomic_bool reader_inside;
+static atomic_bool reader_may_exit;
+
+static void* reader(void* arg) {
+  (void)(arg);
+  mi_epoch_enter();
+  atomic_store(&reader_inside, true);
+  while (!atomic_load(&reader_may_exit)) { sched_yield(); }
+  mi_epoch_exit();
+  return NULL;
+}
+
+static bool count_block(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(area); (void)(block_size);
+  if (block != NULL) { *((size_t*)arg) += 1; }
+  return true;
+}
+
+static size_t live_blocks(mi_heap_t* heap) {
+  size_t count = 0;
+  mi_heap_visit_blocks(heap, true, &count_block, &count);
+  return count;
+}
+
+static void test_deferred(void) {
+  mi_heap_t* heap = mi_heap_new();
+  pthread_t t;
+  pthread_create(&t, NULL, &reader, NULL);
+  while (!atomic_load(&reader_inside)) { sched_yield(); }
+
+  for (size_t i = 0; i < BLOCK_COUNT; i++) {
+    mi_free_deferred(mi_heap_malloc(heap, 32 + (i % 16) * 8));
+  }
+  for (int i = 0; i < 4; i++) { mi_collect(true); }
+  CHECK("epoch-deferred-alive", live_blocks(heap) == BLOCK_COUNT);
+
+  atomic_store(&reader_may_exit, true);
+  pthread_join(t, NULL);
+  for (int i = 0; i < 4; i++) { mi_collect(true); }
+  CHECK("epoch-deferred-freed", live_blocks(heap) == 0);
+  mi_heap_delete(heap);
+}
+
+// ---------------------------------------------------------------------------
+// A lock-free stack
+// ---------------------------------------------------------------------------
+
+#define THREADS     (4)
+#define ITERATIONS  (20000)
+
+typedef struct node_s {
+  struct node_s* next;
+  size_t         value;
+} node_t;
+
+static _Atomic(node_t*) top;
+static atomic_size_t    pushed;
+static atomic_size_t    popped;
+
+static void push(size_t value) {
+  node_t* node = mi_malloc_tp(node_t);
+  node->value = value;
+  node_t* next = atomic_load(&top);
+  do {
+    node->next = next;
+  } while (!atomic_compare_exchange_weak(&top, &next, node));
+}
+
+static bool pop(size_t* value) {
+  mi_epoch_enter();
+  node_t* node = atomic_load(&top);
+  while (node != NULL && !atomic_compare_exchange_weak(&top, &node, node->next)) { }  // reads `node->next` of a possibly popped node
+  mi_epoch_exit();
+  if (node == NULL) return false;
+  *value = node->value;
+  mi_free_deferred(node);
+  return true;
+}
+
+static void* stack_worker(void* arg) {
+  const size_t id = (size_t)(uintptr_t)arg;
+  size_t value;
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    push(id*ITERATIONS + i);
+    atomic_fetch_add(&pushed, 1);
+    if (i % 3 != 0 && pop(&value)) {
+      if (value >= THREADS*ITERATIONS) break;   // corrupted
+      atomic_fetch_add(&popped, 1);
+    }
+    if (i % 1000 == 0) sched_yield();
+  }
+  return NULL;
+}
+
+static void test_stack(void) {
+  pthread_t ts[THREADS];
+  for (size_t i = 0; i < THREADS; i++) { pthread_create(&ts[i], NULL, &stack_worker, (void*)(uintptr_t)i); }
+  for (size_t i = 0; i < THREADS; i++) { pthread_join(ts[i], NULL); }
+  size_t value;
+  while (pop(&value)) { atomic_fetch_add(&popped, 1); }
+  CHECK("epoch-stack", atomic_load(&pushed) == THREADS*ITERATIONS && atomic_load(&popped) == THREADS*ITERATIONS);
+  mi_collect(true);
+}
+
+int main(void) {
+  mi_option_disable(mi_option_verbose);
+  test_deferred();
+  test_stack();
+  return print_test_summary();
+}
@@ -0,0 +1,154 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Test the sampling heap profiler (only built with `MI_PROFILE=ON`).
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "mimalloc.h"
+#include "testhelper.h"
+
+#define N  (10000)
+
+#if defined(_MSC_VER)
+#define mi_test_noinline  __declspec(noinline)
+#else
+#define mi_test_noinline  __attribute__((noinline))
+#endif
+
+static char   out_buf[64*1024];
+static size_t out_len = 0;
+
+// capture the output (we only need the start)
+static void out_capture(const char* msg, void* arg) {
+  (void)(arg);
+  const size_t n = strlen(msg);
+  if (out_len + n >= sizeof(out_buf)) return;
+  memcpy(out_buf + out_len, msg, n + 1);
+  out_len += n;
+}
+
+// dump the profile and return the total in-use bytes from the header
+static bool profile_in_use(size_t* in_use) {
+  out_len = 0;
+  out_buf[0] = 0;
+  mi_profile_dump(&out_capture, NULL);
+  size_t count, size, acount, asize, interval;
+  if (sscanf(out_buf, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu", &count, &size, &acount, &asize, &interval) != 5) {
+    fprintf(stderr, "\n  unexpected profile header: %.80s", out_buf);
+    return false;
+  }
+  *in_use = size;
+  return (interval == 4096);
+}
+
+// dump the lifetime profile and return the total and cross-thread sampled frees
+static bool profile_frees(size_t* total, size_t* cross) {
+  out_len = 0;
+  out_buf[0] = 0;
+  mi_profile_lifetime_print(&out_capture, NULL);
+  if (sscanf(out_buf, "sampled frees: %zu, cross-thread: %zu", total, cross) != 2) {
+    fprintf(stderr, "\n  unexpected lifetime profile: %.80s", out_buf);
+    return false;
+  }
+  return true;
+}
+
+// free blocks in another thread
+static void* free_blocks(void* arg) {
+  void** ps = (void**)arg;
+  for (size_t i = 0; i < N; i++) { mi_free(ps[i]); }
+  return NULL;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI free_blocks_win(LPVOID arg) {
+  free_blocks(arg);
+  return 0;
+}
+
+static void free_in_thread(void** ps) {
+  HANDLE thread = CreateThread(NULL, 0, &free_blocks_win, ps, 0, NULL);
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+#else
+static void free_in_thread(void** ps) {
+  pthread_t thread;
+  pthread_create(&thread, NULL, &free_blocks, ps);
+  pthread_join(thread, NULL);
+}
+#endif
+
+// allocate from a separate function so the samples have a distinct backtrace
+static mi_test_noinline void* profile_alloc(mi_heap_t* heap, size_t size) {
+  return (heap == NULL ? mi_malloc(size) : mi_heap_malloc(heap, size));
+}
+
+int main(void) {
+  mi_option_disable(mi_option_verbose);
+  mi_option_set(mi_option_profile_interval, 4096);
+  mi_option_enable(mi_option_profile_lifetime);
+  static void* ps[N];
+  // other allocations (like stdio buffers) may be sampled too so we only compare against this baseline
+  size_t base = 0;
+
+  CHECK_BODY("profile-sample", {
+    result = profile_in_use(&base);
+    for (size_t i = 0; i < N; i++) { ps[i] = profile_alloc(NULL, 1000); }
+    size_t in_use = 0;
+    result = result && profile_in_use(&in_use) && (in_use >= base);
+    // on average we sample every 4 blocks; each sampled block counts 1000 bytes
+    in_use -= base;
+    result = result && (in_use >= 1000*(N/16) && in_use <= 1000*N && in_use % 1000 == 0);
+    result = result && (strstr(out_buf, " @ 0x") != NULL || strstr(out_buf, "] @\n") != NULL);
+  });
+  CHECK_BODY("profile-free", {
+    for (size_t i = 0; i < N; i++) { mi_free(ps[i]); }
+    size_t in_use = 1;
+    result = profile_in_use(&in_use) && (in_use == base);
+  });
+  CHECK_BODY("profile-heap-destroy", {
+    mi_heap_t* heap = mi_heap_new();
+    for (size_t i = 0; i < N; i++) { profile_alloc(heap, 1000); }
+    size_t in_use = 0;
+    result = profile_in_use(&in_use) && (in_use > base);
+    mi_heap_destroy(heap);
+    result = result && profile_in_use(&in_use) && (in_use == base);
+  });
+  CHECK_BODY("profile-lifetime", {
+    // all frees so far were in the main thread
+    size_t total = 0;
+    size_t cross = 1;
+    result = profile_frees(&total, &cross) && (total >= N/16 && cross == 0);
+    result = result && (strstr(out_buf, "lifetimes of sampled blocks:") != NULL);
+  });
+  CHECK_BODY("profile-cross-thread", {
+    size_t total0 = 0;
+    size_t cross0 = 0;
+    result = profile_frees(&total0, &cross0);
+    for (size_t i = 0; i < N; i++) { ps[i] = profile_alloc(NULL, 1000); }
+    free_in_thread(ps);
+    size_t total = 0;
+    size_t cross = 0;
+    result = result && profile_frees(&total, &cross);
+    result = result && (cross - cross0 >= N/16 && cross - cross0 == total - total0);
+    result = result && (strstr(out_buf, "t1  : thread 0x") != NULL);
+  });
+  return print_test_summary();
+}
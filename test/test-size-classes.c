@@ -0,0 +1,131 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Test custom size classes: this runs with `MIMALLOC_SIZE_CLASSES` set to the
+table below (either directly or as a file name) and `MIMALLOC_SIZE_HISTOGRAM=1`.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mimalloc.h"
+#include "mimalloc-types.h" // for MI_MEDIUM_OBJ_SIZE_MAX and MI_LARGE_BIN_OBJ_SIZE_MAX
+#include "testhelper.h"
+
+// MIMALLOC_SIZE_CLASSES=16,32,48,64,72,96,136,208,320,512,1024,4096
+// (sizes are whole words, and MI_MEDIUM_OBJ_SIZE_MAX (128KiB) is always added)
+
+static bool check_good_size(size_t size, size_t expected) {
+  const size_t good = mi_good_size(size);
+  if (good != expected) {
+    fprintf(stderr, "\n  mi_good_size(%zu) = %zu, expected %zu", size, good, expected);
+    return false;
+  }
+  return true;
+}
+
+static bool visit_area_blocks(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(block); (void)(block_size);
+  if (block == NULL) { *((size_t*)arg) = area->reserved / area->block_size; }
+  return true;
+}
+
+static char out_buf[4096];
+static size_t out_len = 0;
+
+static void out_capture(const char* msg, void* arg) {
+  (void)(arg);
+  const size_t n = strlen(msg);
+  if (out_len + n >= sizeof(out_buf)) return;
+  memcpy(out_buf + out_len, msg, n + 1);
+  out_len += n;
+}
+
+int main(void) {
+  mi_option_disable(mi_option_verbose);
+
+  CHECK_BODY("good-size", {
+    result = check_good_size(0, 16) && check_good_size(1, 16) && check_good_size(8, 16) && check_good_size(17, 32)
+          && check_good_size(65, 72) && check_good_size(72, 72) && check_good_size(73, 96)
+          && check_good_size(100, 136) && check_good_size(136, 136) && check_good_size(200, 208)
+          && check_good_size(1000, 1024) && check_good_size(1025, 4096) && check_good_size(5000, MI_MEDIUM_OBJ_SIZE_MAX)
+          && check_good_size(MI_MEDIUM_OBJ_SIZE_MAX, MI_MEDIUM_OBJ_SIZE_MAX);
+  });
+  CHECK_BODY("usable-size", {
+    for (size_t size = 1; size <= 2048 && result; size++) {
+      void* p = mi_malloc(size);
+      const size_t usable = mi_usable_size(p);
+      result = (p != NULL && usable >= size && usable <= mi_good_size(size) && (uintptr_t)p % sizeof(void*) == 0);
+      mi_free(p);
+    }
+  });
+  CHECK_BODY("small-many", {
+    // many 136 byte blocks should all fit in 136 byte blocks
+    void* ps[1000];
+    for (int i = 0; i < 1000; i++) {
+      ps[i] = mi_malloc(136);
+      memset(ps[i], i & 0xFF, 136);
+      result = result && (mi_usable_size(ps[i]) <= 136);
+    }
+    for (int i = 0; i < 1000; i++) { mi_free(ps[i]); }
+  });
+  CHECK_BODY("heap-destroy", {
+    mi_heap_t* heap = mi_heap_new();
+    for (size_t i = 0; i < 10000; i++) {
+      const size_t size = (i * 7919) % 9000;
+      void* p = mi_heap_malloc(heap, size);
+      result = result && (p != NULL && mi_usable_size(p) >= size);
+    }
+    mi_heap_destroy(heap);
+    void* q = mi_malloc(72);
+    result = result && (mi_usable_size(q) <= 72);
+    mi_free(q);
+  });
+  CHECK_BODY("large-bin", {
+    // sizes beyond the custom classes still use the default large size classes (up to 2MiB)
+    const size_t size = 1024*1024 + 1;
+    if (size <= MI_LARGE_BIN_OBJ_SIZE_MAX) {
+      mi_heap_t* heap = mi_heap_new();
+      void* p = mi_heap_malloc(heap, size);
+      void* q = mi_heap_malloc(heap, size);
+      size_t blocks = 0;
+      mi_heap_visit_blocks(heap, false, &visit_area_blocks, &blocks);
+      result = (p != NULL && q != NULL && mi_good_size(size) == 1280*1024 && mi_usable_size(p) >= size && mi_usable_size(p) <= 1280*1024
+                && blocks >= 2);
+      mi_heap_destroy(heap);
+    }
+  });
+  CHECK_BODY("size-classes-print", {
+    mi_size_classes_print(&out_capture, NULL);
+    const char* table = strstr(out_buf, "MIMALLOC_SIZE_CLASSES=");
+    if (table == NULL) {
+      // no histogram without detailed statistics
+      result = (strstr(out_buf, "# no size histogram is available") == out_buf);
+    }
+    else {
+      // the many 136 byte blocks should get a class within the 10% waste limit
+      const char* s = table + strlen("MIMALLOC_SIZE_CLASSES=");
+      size_t count = 0;
+      size_t last = 0;
+      bool found = false;
+      while (*s >= '0' && *s <= '9') {
+        char* end;
+        const size_t size = (size_t)strtoul(s, &end, 10);
+        result = result && (size > last);
+        if (last < 136 && size >= 136 && size <= 149) found = true;
+        last = size;
+        count++;
+        s = (*end == ',' ? end + 1 : end);
+      }
+      result = result && found && (last == MI_MEDIUM_OBJ_SIZE_MAX) && (count <= 72);
+    }
+  });
+  return print_test_summary();
+}
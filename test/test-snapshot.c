@@ -0,0 +1,169 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Test heap snapshots: run first as `mimalloc-test-snapshot save <file>` to build
+a linked structure in a snapshot heap and save it, and then (in a fresh process)
+as `mimalloc-test-snapshot restore <file>` to restore the heap and check that
+the structure is intact and that the heap can be used as usual.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mimalloc.h"
+#include "testhelper.h"
+
+#define SNAPSHOT_ADDR   ((void*)((uintptr_t)1 << 40))   // 1 TiB
+#define SNAPSHOT_SIZE   (256*1024*1024)
+#define NODE_COUNT      (10000)
+
+typedef struct node_s {
+  struct node_s* next;
+  size_t         value;
+  char*          data;     // a string of `value % 100` characters
+} node_t;
+
+static size_t data_len(size_t value) {
+  return (value % 100) + 1;
+}
+
+static char* data_new(mi_heap_t* heap, size_t value) {
+  const size_t len = data_len(value);
+  char* s = (char*)mi_heap_malloc(heap, len + 1);
+  memset(s, 'a' + (int)(value % 26), len);
+  s[len] = 0;
+  return s;
+}
+
+static bool data_check(const node_t* node) {
+  const size_t len = data_len(node->value);
+  if (strlen(node->data) != len) return false;
+  for (size_t i = 0; i < len; i++) {
+    if (node->data[i] != 'a' + (int)(node->value % 26)) return false;
+  }
+  return true;
+}
+
+static bool count_block(const mi_heap_t* heap, const mi_heap_area_t* area, void* block, size_t block_size, void* arg) {
+  (void)(heap); (void)(area); (void)(block_size);
+  if (block != NULL) { *((size_t*)arg) += 1; }
+  return true;
+}
+
+static int test_save(const char* fname) {
+  mi_heap_t* heap = mi_heap_new_snapshot(fname, SNAPSHOT_ADDR, SNAPSHOT_SIZE);
+  CHECK("snapshot-new", heap != NULL);
+  if (heap == NULL) return print_test_summary();
+
+  // build a list, and free every other node again to have non-trivial free lists
+  node_t* root = NULL;
+  for (size_t i = 0; i < 2*NODE_COUNT; i++) {
+    node_t* node = mi_heap_malloc_tp(heap, node_t);
+    node->value = i;
+    node->data = data_new(heap, i);
+    node->next = root;
+    root = node;
+  }
+  node_t* prev = NULL;
+  for (node_t* node = root; node != NULL; ) {
+    node_t* next = node->next;
+    if (node->value % 2 == 1) {
+      if (prev == NULL) { root = next; } else { prev->next = next; }
+      mi_free(node->data);
+      mi_free(node);
+    }
+    else {
+      prev = node;
+    }
+    node = next;
+  }
+  CHECK_BODY("snapshot-in-arena", {
+    for (node_t* node = root; node != NULL; node = node->next) {
+      if (!mi_heap_check_owned(heap, node) || !mi_heap_check_owned(heap, node->data)) { result = false; break; }
+    }
+    result = result && ((void*)root >= SNAPSHOT_ADDR && (uint8_t*)root < (uint8_t*)SNAPSHOT_ADDR + SNAPSHOT_SIZE);
+  });
+  CHECK("snapshot-save", mi_heap_snapshot_save(heap, root) == 0);
+  return print_test_summary();
+}
+
+static int test_restore(const char* fname) {
+  void* p = NULL;
+  mi_heap_t* heap = mi_heap_snapshot_restore(fname, true, &p);
+  CHECK("snapshot-restore", heap != NULL && p != NULL);
+  if (heap == NULL) return print_test_summary();
+  node_t* root = (node_t*)p;
+
+  CHECK_BODY("snapshot-list", {
+    size_t count = 0;
+    size_t expected = 2*NODE_COUNT;
+    for (node_t* node = root; node != NULL; node = node->next) {
+      expected -= 2;
+      if (node->value != expected || !data_check(node)) { result = false; break; }
+      count++;
+    }
+    result = result && (count == NODE_COUNT);
+  });
+  CHECK_BODY("snapshot-visit", {
+    size_t count = 0;
+    mi_heap_visit_blocks(heap, true, &count_block, &count);
+    result = (count == 2*NODE_COUNT);
+  });
+  CHECK_BODY("snapshot-owned", {
+    for (node_t* node = root; node != NULL; node = node->next) {
+      if (!mi_heap_contains_block(heap, node) || !mi_heap_contains_block(heap, node->data)) { result = false; break; }
+    }
+  });
+  CHECK_BODY("snapshot-use", {
+    // replace all data strings, and add new nodes
+    for (node_t* node = root; node != NULL; node = node->next) {
+      mi_free(node->data);
+      node->value++;
+      node->data = data_new(heap, node->value);
+    }
+    for (size_t i = 0; i < NODE_COUNT; i++) {
+      node_t* node = mi_heap_malloc_tp(heap, node_t);
+      node->value = i;
+      node->data = data_new(heap, i);
+      node->next = root;
+      root = node;
+    }
+    size_t count = 0;
+    for (node_t* node = root; node != NULL; node = node->next) {
+      if (!data_check(node) || !mi_heap_contains_block(heap, node)) { result = false; break; }
+      count++;
+    }
+    result = result && (count == 2*NODE_COUNT);
+  });
+  CHECK_BODY("snapshot-default-heap", {
+    // the default heap never allocates in the exclusive snapshot arena
+    void* q = mi_malloc(64);
+    result = (q != NULL && !mi_heap_check_owned(heap, q));
+    mi_free(q);
+  });
+  CHECK_BODY("snapshot-free", {
+    while (root != NULL) {
+      node_t* next = root->next;
+      mi_free(root->data);
+      mi_free(root);
+      root = next;
+    }
+    size_t count = 0;
+    mi_heap_visit_blocks(heap, true, &count_block, &count);
+    result = (count == 0);
+  });
+  return print_test_summary();
+}
+
+int main(int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "save") == 0) return test_save(argv[2]);
+  if (argc == 3 && strcmp(argv[1], "restore") == 0) return test_restore(argv[2]);
+  fprintf(stderr, "usage: %s (save|restore) <file>\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,178 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2022, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the MIT license. A copy of the license can be found in the file
+"LICENSE" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/*
+Test heap transfer: a thread allocates blocks, hands its heap to a successor
+with `mi_heap_transfer`, and exits. The successor adopts the pages either
+explicitly (`mi_thread_adopt_abandoned_from`) or implicitly when it needs a
+fresh segment, and then owns and frees all the blocks. If the target thread is
+done, or never adopts them, the segments are abandoned as usual and any thread
+can reclaim them.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "mimalloc.h"
+#include "testhelper.h"
+
+#define BLOCK_COUNT  (10000)
+
+static void*  blocks[BLOCK_COUNT];
+static size_t predecessor_id;
+static size_t successor_id;
+static bool   transferred;
+static atomic_bool successor_ready;
+static atomic_bool predecessor_done;
+static atomic_bool target_done;
+static atomic_bool handed_off;
+
+static size_t block_size(size_t i) {
+  return 16 + (i % 64) * 16;
+}
+
+// allocate blocks in the thread's heap and free every other one
+static void alloc_blocks(void) {
+  for (size_t i = 0; i < 2*BLOCK_COUNT; i++) {
+    uint8_t* p = (uint8_t*)mi_malloc(block_size(i/2));
+    memset(p, (int)(i % 256), block_size(i/2));
+    if (i % 2 == 0) { blocks[i/2] = p; } else { mi_free(p); }
+  }
+}
+
+// allocate blocks and hand the heap off
+static void* predecessor(void* arg) {
+  const size_t target = (size_t)(uintptr_t)arg;
+  alloc_blocks();
+  predecessor_id = mi_thread_id();
+  transferred = mi_heap_transfer(mi_heap_get_backing(), target);
+  return NULL;
+}
+
+// hand the heap off, and allocate blocks (that are abandoned at exit) once the target thread is done
+static void* late_predecessor(void* arg) {
+  const size_t target = (size_t)(uintptr_t)arg;
+  predecessor_id = mi_thread_id();
+  transferred = mi_heap_transfer(mi_heap_get_backing(), target);
+  atomic_store(&handed_off, true);
+  while (!atomic_load(&target_done)) { sched_yield(); }
+  alloc_blocks();
+  return NULL;
+}
+
+static bool check_blocks(mi_heap_t* heap) {
+  for (size_t i = 0; i < BLOCK_COUNT; i++) {
+    const uint8_t* p = (const uint8_t*)blocks[i];
+    if (!mi_heap_contains_block(heap, p)) return false;
+    for (size_t j = 0; j < block_size(i); j++) {
+      if (p[j] != (uint8_t)((2*i) % 256)) return false;
+    }
+  }
+  return true;
+}
+
+static void free_blocks(void) {
+  for (size_t i = 0; i < BLOCK_COUNT; i++) { mi_free(blocks[i]); blocks[i] = NULL; }
+}
+
+static void* explicit_successor(void* arg) {
+  (void)(arg);
+  CHECK("transfer-explicit-adopt", mi_thread_adopt_abandoned_from(predecessor_id) > 0);
+  CHECK("transfer-explicit-owned", check_blocks(mi_heap_get_backing()));
+  free_blocks();
+  return NULL;
+}
+
+static void* implicit_successor(void* arg) {
+  (void)(arg);
+  successor_id = mi_thread_id();
+  atomic_store(&successor_ready, true);
+  while (!atomic_load(&predecessor_done)) { sched_yield(); }
+  // allocate until we need a fresh segment; the handed off segments are adopted first
+  void* large[64];
+  for (size_t i = 0; i < 64; i++) { large[i] = mi_malloc(1024*1024); }
+  CHECK("transfer-implicit-owned", check_blocks(mi_heap_get_backing()));
+  for (size_t i = 0; i < 64; i++) { mi_free(large[i]); }
+  free_blocks();
+  return NULL;
+}
+
+static void* target(void* arg) {
+  (void)(arg);
+  mi_free(mi_malloc(8));  // initialize the heap
+  successor_id = mi_thread_id();
+  atomic_store(&successor_ready, true);
+  while (!atomic_load(&predecessor_done)) { sched_yield(); }
+  return NULL;
+}
+
+// reclaim the abandoned segments (of a handoff that was not adopted) when we need a fresh segment
+static void* reclaiming_successor(void* arg) {
+  void* large[64];
+  for (size_t i = 0; i < 64; i++) { large[i] = mi_malloc(1024*1024); }
+  CHECK((const char*)arg, check_blocks(mi_heap_get_backing()));
+  for (size_t i = 0; i < 64; i++) { mi_free(large[i]); }
+  free_blocks();
+  return NULL;
+}
+
+int main(void) {
+  mi_option_disable(mi_option_verbose);
+  pthread_t t1, t2;
+
+  // hand off to any thread, and adopt explicitly after the predecessor is done
+  pthread_create(&t1, NULL, &predecessor, NULL);
+  pthread_join(t1, NULL);
+  CHECK("transfer-explicit", transferred);
+  pthread_create(&t2, NULL, &explicit_successor, NULL);
+  pthread_join(t2, NULL);
+
+  // hand off to a running thread that adopts implicitly
+  atomic_store(&successor_ready, false);
+  atomic_store(&predecessor_done, false);
+  pthread_create(&t2, NULL, &implicit_successor, NULL);
+  while (!atomic_load(&successor_ready)) { sched_yield(); }
+  pthread_create(&t1, NULL, &predecessor, (void*)(uintptr_t)successor_id);
+  pthread_join(t1, NULL);
+  CHECK("transfer-implicit", transferred);
+  atomic_store(&predecessor_done, true);
+  pthread_join(t2, NULL);
+
+  // nothing is left on the abandoned list from these threads
+  CHECK("transfer-adopt-none", mi_thread_adopt_abandoned_from(predecessor_id) == 0);
+
+  // hand off to a thread that exits before the last segments are abandoned
+  atomic_store(&successor_ready, false);
+  atomic_store(&predecessor_done, false);
+  atomic_store(&target_done, false);
+  pthread_create(&t2, NULL, &target, NULL);
+  while (!atomic_load(&successor_ready)) { sched_yield(); }
+  pthread_create(&t1, NULL, &late_predecessor, (void*)(uintptr_t)successor_id);
+  while (!atomic_load(&handed_off)) { sched_yield(); }
+  atomic_store(&predecessor_done, true);
+  pthread_join(t2, NULL);
+  atomic_store(&target_done, true);
+  pthread_join(t1, NULL);
+  CHECK("transfer-target-done", transferred);
+  pthread_create(&t2, NULL, &reclaiming_successor, (void*)"transfer-target-done-reclaimed");
+  pthread_join(t2, NULL);
+
+  // hand off to a thread that never adopts; the handoff expires after a second
+  transferred = false;
+  pthread_create(&t1, NULL, &predecessor, (void*)(uintptr_t)(~(size_t)0));
+  pthread_join(t1, NULL);
+  CHECK("transfer-unknown", transferred);
+  usleep(1500*1000);
+  pthread_create(&t2, NULL, &reclaiming_successor, (void*)"transfer-unknown-reclaimed");
+  pthread_join(t2, NULL);
+  return print_test_summary();
+}
@@ -0,0 +1,28 @@
+# -----------------------------------------------------------------------------
+# Test that the USDT probes are present in the shared library (only with `MI_USDT=ON`).
+# usage: cmake -DREADELF=<readelf> -DLIBRARY=<libmimalloc.so> -P test-usdt.cmake
+# -----------------------------------------------------------------------------
+
+set(mi_usdt_probes
+    malloc_generic page_fresh segment_alloc segment_reclaim
+    segment_cache_pop segment_cache_push os_commit os_reset thread_done)
+
+execute_process(COMMAND ${READELF} -n ${LIBRARY}
+                OUTPUT_VARIABLE mi_notes
+                RESULT_VARIABLE mi_result)
+if (NOT mi_result EQUAL 0)
+  message(FATAL_ERROR "unable to read the notes of ${LIBRARY}")
+endif()
+
+set(mi_missing "")
+foreach(probe ${mi_usdt_probes})
+  if (mi_notes MATCHES "Provider: mimalloc[\r\n\t ]+Name: ${probe}[\r\n]")
+    message(STATUS "probe mimalloc:${probe}")
+  else()
+    list(APPEND mi_missing ${probe})
+  endif()
+endforeach()
+
+if (mi_missing)
+  message(FATAL_ERROR "missing USDT probes: ${mi_missing}")
+endif()